@@ -131,6 +131,10 @@ void pass_through_process(void *st, int16_t in[], int16_t out[], size_t L_in, si
 typedef void (effect_progress_h)(int progress, void *arg);
 int apply_effect_to_wav(const char* wavIn, const char* wavOut, enum audio_effect effect_type, bool reduce_noise, effect_progress_h* progress_h, void *arg);
 int apply_effect_to_pcm(const char* pcmIn, const char* pcmOut, int fs_hz, enum audio_effect effect_type, bool reduce_noise, effect_progress_h* progress_h, void *arg);
+/* Threads used for effects that can be rendered in chunks,
+ * 0 for one per CPU (the default) and 1 to always run serially.
+ */
+int apply_effect_set_max_threads(int nthreads);
     
 #ifdef __cplusplus
 }
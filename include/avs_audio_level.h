@@ -45,6 +45,9 @@ uint8_t audio_level_smoothen_withk(uint8_t level, uint8_t new_level, float k);
 int audio_level_json(struct list *levell,
 		     const char *userid_self, const char *clientid_self,
 		     char **jsonp, char **anon_p);
+int audio_level_delta_json(struct list *lastl, const struct list *levell,
+			   const char *userid_self, const char *clientid_self,
+			   char **jsonp, char **anon_p);
 int audio_level_json_print(struct re_printf *pf, const struct audio_level *a);
 int audio_level_list_debug(struct re_printf *pf, const struct list *levell);
 
@@ -45,6 +45,11 @@ struct icall *ccall_get_icall(struct ccall* ccall);
 
 int ccall_set_config(struct ccall *ccall, struct config *cfg);
 
+/* Cipher suite (enum frame_cipher_suite) for the frames this call sends,
+ * once every client in the call announced that it decrypts it
+ */
+int ccall_set_cipher_suite(struct ccall *ccall, int suite);
+
 int  ccall_add_turnserver(struct icall *icall, struct zapi_ice_server *srv);
 
 int  ccall_add_sft(struct icall *icall, const char *sft_url);
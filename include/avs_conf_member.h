@@ -21,6 +21,7 @@ extern "C" {
 #endif
 
 struct iflow;
+struct conf_member_index;
 
 struct conf_member {
 	char *userid;
@@ -43,13 +44,19 @@ struct conf_member {
 	struct iflow *flow;
 
 	struct le le;
+	struct conf_member_index *idx;
 
 	uint8_t audio_level;
 	uint8_t audio_level_smooth;
 
+	/* Updated atomically, see conf_member_inc_frames() */
 	uint32_t audio_frames;
 	uint32_t video_frames;
 
+	/* Updated atomically, see conf_member_add_latency() */
+	struct stats_latency audio_latency;
+	struct stats_latency video_latency;
+
 	uint64_t last_ts;
 };
 
@@ -82,6 +89,30 @@ struct conf_member *conf_member_find_by_ssrcv(struct list *membl,
 
 void conf_member_set_audio_level(struct conf_member *cm, int level);
 
+void conf_member_deactivate(struct conf_member *cm);
+
+uint32_t conf_member_inc_frames(struct conf_member *cm, bool video,
+				uint32_t frames);
+void conf_member_get_frames(const struct conf_member *cm,
+			    uint32_t *audio_frames, uint32_t *video_frames);
+void conf_member_add_latency(struct conf_member *cm, bool video,
+			     const struct stats_latency *sl);
+void conf_member_get_latency(const struct conf_member *cm, bool video,
+			     struct stats_latency *sl);
+
+
+/*
+ * SSRC -> active member index. Mutations must be serialised by the
+ * owner (write lock); lookups may run concurrently with each other.
+ */
+int conf_member_index_alloc(struct conf_member_index **idxp);
+int conf_member_index_add(struct conf_member_index *idx,
+			  struct conf_member *cm);
+void conf_member_index_remove(struct conf_member_index *idx,
+			      struct conf_member *cm);
+struct conf_member *conf_member_index_find(const struct conf_member_index *idx,
+					   uint32_t ssrc, bool video);
+
 #ifdef __cplusplus
 }
 #endif
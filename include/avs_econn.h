@@ -212,6 +212,12 @@ struct econn_message {
 
 		struct confkey {
 			struct list keyl; /* list of struct econn_key_info */
+			/* Bitmask of frame cipher suites: in a request the
+			 * suites the sender decrypts, in a response the
+			 * suites every client in the call decrypts. 0 from
+			 * clients that do not know about it.
+			 */
+			uint32_t ciphers;
 		} confkey;
 
 		struct confstreams {
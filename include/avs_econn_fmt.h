@@ -18,9 +18,37 @@
 
 
 struct econn_message;
+struct econn_props;
 
 
 int econn_message_encode(char **strp, const struct econn_message *msg);
 int econn_message_decode(struct econn_message **msgp,
 			 uint64_t curr_time, uint64_t msg_time,
 			 const char *str, size_t len);
+
+
+/*
+ * Compact binary format for the data channel between AVS peers.
+ * It is only used when the peer announces ECONN_PROP_BIN with our
+ * ECONN_BIN_VERSION, JSON is the fallback.
+ */
+#define ECONN_BIN_MAGIC       0xEC
+#define ECONN_BIN_VERSION     1
+#define ECONN_BIN_VERSION_STR "1"
+#define ECONN_PROP_BIN        "econnbin"
+
+bool econn_message_is_bin(const uint8_t *buf, size_t len);
+int econn_message_encode_bin(struct mbuf **mbp,
+			     const struct econn_message *msg);
+int econn_message_decode_bin(struct econn_message **msgp,
+			     uint64_t curr_time, uint64_t msg_time,
+			     const uint8_t *buf, size_t len);
+
+/* Encode a message for the data channel to a peer with props_remote,
+ * in the binary format if the peer announced our version of it and
+ * as JSON otherwise.
+ */
+bool econn_props_has_bin(const struct econn_props *props_remote);
+int econn_message_encode_dce(struct mbuf **mbp,
+			     const struct econn_message *msg,
+			     const struct econn_props *props_remote);
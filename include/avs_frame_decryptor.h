@@ -31,6 +31,10 @@ int frame_decryptor_set_keystore(struct frame_decryptor *dec,
 int frame_decryptor_set_uid(struct frame_decryptor *dec,
 			    const char *userid_hash);
 
+int frame_decryptor_set_uid_for_csrc(struct frame_decryptor *dec,
+				     uint32_t csrc,
+				     const char *userid_hash);
+
 int frame_decryptor_decrypt(struct frame_decryptor *dec,
 			    uint32_t csrc,
 			    const uint8_t *src,
@@ -41,3 +45,14 @@ int frame_decryptor_decrypt(struct frame_decryptor *dec,
 size_t frame_decryptor_max_size(struct frame_decryptor *dec,
 				size_t srcsz);
 
+void frame_decryptor_get_cache_stats(struct frame_decryptor *dec,
+				     uint32_t *hits,
+				     uint32_t *misses,
+				     uint32_t *evictions);
+
+/* Latency of the frames from a sender (0 for the set_uid sender)
+ * not yet passed on to the peerflow
+ */
+int frame_decryptor_get_latency(struct frame_decryptor *dec,
+				uint32_t csrc,
+				struct stats_latency *sl);
@@ -23,6 +23,25 @@ enum frame_media_type {
 
 const char *frame_type_name(enum frame_media_type mtype);
 
+/* Cipher suite of a frame, signalled in the frame header.
+ * Senders use the one set in the keystore, receivers the one of
+ * each frame.
+ */
+enum frame_cipher_suite {
+	FRAME_CIPHER_AES_256_GCM        = 0,
+	FRAME_CIPHER_CHACHA20_POLY1305  = 1,
+};
+
+/* Suites as bits, as announced between clients */
+#define FRAME_CIPHER_BIT(suite) (1u << (suite))
+
+const char *frame_cipher_suite_name(enum frame_cipher_suite suite);
+
+/* AES-256-GCM when the CPU has AES instructions, ChaCha20-Poly1305
+ * otherwise
+ */
+enum frame_cipher_suite frame_cipher_suite_preferred(void);
+
 struct frame_encryptor;
 
 int frame_encryptor_alloc(struct frame_encryptor **penc,
@@ -32,6 +51,15 @@ int frame_encryptor_alloc(struct frame_encryptor **penc,
 int frame_encryptor_set_keystore(struct frame_encryptor *enc,
 				 struct keystore *keystore);
 
+/* Add a timestamp and sequence number to the header of each frame,
+ * so that receivers can measure the latency. Off by default.
+ */
+void frame_encryptor_set_latency_probe(struct frame_encryptor *enc,
+				       bool enable);
+
+/* Wall clock in ms, truncated to 32 bits, for the latency probe */
+uint32_t frame_latency_clock_ms(void);
+
 int frame_encryptor_encrypt(struct frame_encryptor *enc,
 			    uint32_t ssrc,
 			    const uint8_t *src,
@@ -39,6 +67,25 @@ int frame_encryptor_encrypt(struct frame_encryptor *enc,
 			    uint8_t *dst,
 			    size_t *dstsz);
 
+/* One frame of a batch. The encrypted frame is written to the
+ * batch arena and dst/dstsz are set on return.
+ */
+struct frame_batch {
+	const uint8_t *src;
+	size_t srcsz;
+	uint32_t ssrc;
+
+	uint8_t *dst;
+	size_t dstsz;
+};
+
+int frame_encryptor_encrypt_batch(struct frame_encryptor *enc,
+				  struct frame_batch *frames,
+				  size_t count,
+				  uint8_t *arena,
+				  size_t arenasz,
+				  size_t *used);
+
 size_t frame_encryptor_max_size(struct frame_encryptor *enc,
 				size_t srcsz);
 
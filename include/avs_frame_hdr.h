@@ -22,6 +22,18 @@
 
 #define FRAME_HDR_MINSZ  2
 
+#define FRAME_HDR_EXT_CSRC   0x01
+#define FRAME_HDR_EXT_SUITE  0x02
+#define FRAME_HDR_EXT_TS     0x03
+
+/* Optional header extensions, written only if set */
+struct frame_hdr_ext {
+	uint8_t  suite;
+	bool     has_ts;
+	uint32_t ts;    /* sender wall clock in ms, wraps */
+	uint16_t seq;   /* per sender, wraps */
+};
+
 size_t frame_hdr_max_size(void);
 
 size_t frame_hdr_write(uint8_t  *buf,
@@ -37,5 +49,36 @@ int frame_hdr_read(const uint8_t *buf,
 		   uint32_t      *csrc,
 		   size_t        *rlen);
 
+/* As above, with the cipher suite extension, written only if non-zero */
+size_t frame_hdr_write_suite(uint8_t  *buf,
+			     size_t   bsz,
+			     uint64_t frame,
+			     uint64_t key,
+			     uint32_t csrc,
+			     uint8_t  suite);
+
+int frame_hdr_read_suite(const uint8_t *buf,
+			 size_t         bsz,
+			 uint64_t      *frame,
+			 uint64_t      *key,
+			 uint32_t      *csrc,
+			 uint8_t       *suite,
+			 size_t        *rlen);
+
+size_t frame_hdr_write_ext(uint8_t  *buf,
+			   size_t   bsz,
+			   uint64_t frame,
+			   uint64_t key,
+			   uint32_t csrc,
+			   const struct frame_hdr_ext *ext);
+
+int frame_hdr_read_ext(const uint8_t *buf,
+		       size_t         bsz,
+		       uint64_t      *frame,
+		       uint64_t      *key,
+		       uint32_t      *csrc,
+		       struct frame_hdr_ext *ext,
+		       size_t        *rlen);
+
 #endif  // FRAME_HDR_H_
 
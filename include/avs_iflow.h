@@ -73,6 +73,9 @@ typedef void (iflow_close)(struct iflow *flow);
 typedef int (iflow_dce_send)(struct iflow *flow,
 			     const uint8_t *data,
 			     size_t len);
+typedef int (iflow_dce_send_batch)(struct iflow *flow,
+				   struct mbuf * const *mbv,
+				   size_t mbc);
 
 typedef int  (iflow_get_stats)(struct iflow *flow,
 			       struct stats_report *stats);
@@ -144,6 +147,13 @@ typedef int (iflow_render_frame_h)(struct avs_vidframe *frame,
 				   const char *userid,
 				   const char *clientid,
 				   void *arg);
+typedef void (iflow_render_stream_h)(uint32_t handle,
+				    const char *userid,
+				    const char *clientid,
+				    void *arg);
+typedef int (iflow_render_stream_frame_h)(struct avs_vidframe *frame,
+					  uint32_t handle,
+					  void *arg);
 
 struct iflow {
 	iflow_set_video_state		*set_video_state;
@@ -165,6 +175,7 @@ struct iflow {
 	iflow_sync_decoders	        *sync_decoders;
 	iflow_set_keystore		*set_keystore;
 	iflow_dce_send			*dce_send;
+	iflow_dce_send_batch		*dce_send_batch;
 	iflow_stop_media		*stop_media;
 	iflow_close			*close;
 	iflow_get_stats			*get_stats;
@@ -214,6 +225,7 @@ void iflow_set_functions(struct iflow *iflow,
 			 iflow_sync_decoders	        *sync_decoders,
 			 iflow_set_keystore		*set_keystore,
 			 iflow_dce_send			*dce_send,
+			 iflow_dce_send_batch		*dce_send_batch,
 			 iflow_stop_media		*stop_media,
 			 iflow_close			*close,
 			 iflow_get_stats		*get_stats,
@@ -252,6 +264,9 @@ int iflow_alloc(struct iflow		**flowp,
 
 void iflow_destroy(void);
 
+int iflow_dce_send_batch(struct iflow *flow,
+			 struct mbuf * const *mbv, size_t mbc);
+
 void iflow_set_mute(bool mute);
 bool iflow_get_mute(void);
 
@@ -267,3 +282,13 @@ int iflow_render_frameh(struct avs_vidframe *frame,
 			const char *userid,
 			const char *clientid);
 
+void iflow_set_render_stream_handlers(iflow_render_stream_h *streamh,
+				      iflow_render_stream_frame_h *frameh,
+				      void *arg);
+bool iflow_render_stream_enabled(void);
+void iflow_render_streamh(uint32_t handle,
+			  const char *userid,
+			  const char *clientid);
+int iflow_render_stream_frameh(struct avs_vidframe *frame,
+			       uint32_t handle);
+
@@ -64,6 +64,15 @@ int jzon_decode(struct json_object **jobjp, const char *buf, size_t len);
 struct json_object *jzon_apply(struct json_object *jobj,
 			       jzon_apply_h *ah, void *arg);
 
+struct json_object *jzon_array_first(struct json_object *jarr);
+struct json_object *jzon_array_next(struct json_object *jitem);
+int jzon_array_vector(struct json_object ***vecp, size_t *countp,
+		      struct json_object *jarr);
+
+#define JZON_ARRAY_FOREACH(jarr, jitem)				\
+	for ((jitem) = jzon_array_first((jarr)); (jitem);	\
+	     (jitem) = jzon_array_next((jitem)))
+
 int jzon_add_str(struct json_object *jobj, const char *key,
 		 const char *fmt, ...);
 int jzon_add_int(struct json_object *jobj, const char *key, int32_t val);
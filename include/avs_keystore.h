@@ -98,3 +98,24 @@ int  keystore_add_listener(struct keystore *ks,
 int  keystore_remove_listener(struct keystore *ks,
 			      void *arg);
 
+/* Lookahead: hash forward this many keys in the background after each
+ * new session key or rotation, so that rotations do not derive keys
+ * on the media threads. Only for hash forward keystores, 0 disables.
+ */
+struct keystore_stats {
+	uint64_t lookahead_hits;
+	uint64_t lookahead_misses;
+	uint64_t derived;
+	uint64_t derive_us;
+	uint64_t derive_max_us;
+};
+
+int keystore_set_lookahead(struct keystore *ks, uint32_t nkeys);
+void keystore_get_stats(struct keystore *ks, struct keystore_stats *stats);
+
+/* Cipher suite (enum frame_cipher_suite) used by the frame encryptors
+ * of this keystore. Decryptors use the suite of each frame.
+ */
+int keystore_set_cipher_suite(struct keystore *ks, int suite);
+int keystore_get_cipher_suite(struct keystore *ks);
+
@@ -52,6 +52,28 @@ void info(const char *fmt, ...);
 void warning(const char *fmt, ...);
 void error(const char *fmt, ...);
 
+
+/*
+ * Asynchronous logging. Callers queue messages on a per-thread ring and
+ * a log thread does the formatting, IP masking and handler dispatch.
+ * When a ring is full, debug and info messages are dropped; warnings and
+ * errors wait briefly for space before being dropped.
+ */
+struct log_async_stats {
+	uint64_t queued;
+	uint64_t dispatched;
+	uint64_t deferred;   /* formatted on the log thread */
+	uint64_t oversized;  /* too long for a ring slot */
+	uint64_t dropped[LOG_LEVEL_ERROR + 1];
+	uint32_t max_delay;  /* ms from queueing to dispatch */
+};
+
+int  log_async_start(size_t ringsz);
+void log_async_stop(void);
+void log_async_flush(void);
+bool log_async_active(void);
+void log_async_get_stats(struct log_async_stats *stats);
+
 /* anonymous IDs */
 #define ANON_ID_LEN     16
 #define ANON_CLIENT_LEN  5
@@ -41,6 +41,10 @@ typedef void (msystem_mute_h)(bool muted, void *arg);
 void msystem_set_env(int env);
 int msystem_get_env(void);
 
+/* Latency probe in the frame header of new senders */
+void msystem_set_latency_probe(bool enable);
+bool msystem_get_latency_probe(void);
+
 int msystem_get(struct msystem **msysp, const char *msysname,
 		struct msystem_config *config,
 		msystem_mute_h *muteh,
@@ -31,3 +31,21 @@ typedef void (dns_lookup_h)(int err, const struct sa *srv, void *arg);
 int  dns_init(void *arg);
 void dns_close(void);
 int  dns_lookup(const char *url, dns_lookup_h *lookuph, void *arg);
+
+/* Results are cached, so resolving a host ahead of use
+ * (e.g. from the call config) makes the later lookup immediate.
+ */
+struct dns_stats {
+	uint32_t hits;        /* answered from the cache */
+	uint32_t neg_hits;    /* failures answered from the cache */
+	uint32_t misses;      /* needed a platform lookup */
+	uint32_t coalesced;   /* joined a running lookup */
+	uint32_t prefetches;  /* platform lookups started by prefetch */
+	uint32_t lookups;     /* platform lookups completed */
+};
+
+/* Resolve host into the cache ahead of a dns_lookup() for it */
+int  dns_prefetch(const char *host);
+void dns_cache_flush(void);
+int  dns_get_stats(struct dns_stats *stats);
+
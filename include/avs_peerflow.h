@@ -27,6 +27,26 @@ int peerflow_alloc(struct iflow		**flowp,
 		   void			*extarg);
 
 void capture_source_handle_frame(struct avs_vidframe *frame);
+void capture_source_stats(uint64_t *frames, uint64_t *allocs);
+
+/* Pass a frame captured at ts_us, in the tmr_jiffies() clock, and
+ * feed back the encode time, for testing admission control without
+ * waiting for a real camera and encoder.
+ */
+void capture_source_handle_frame_at(struct avs_vidframe *frame,
+				    uint64_t ts_us);
+void capture_source_set_encode_time(uint32_t encode_us);
+
+/* Receive the frames passed on to the encoders, as a sink that wants
+ * rotation applied. A NULL handler removes it.
+ */
+typedef void (capture_source_frame_h)(const struct avs_vidframe *frame,
+				      void *arg);
+int capture_source_set_frame_handler(capture_source_frame_h *frameh,
+				     void *arg);
+
+void *video_renderer_frame_retain(const struct avs_vidframe *frame);
+void video_renderer_frame_release(void *ref);
 
 int peerflow_get_userid_for_ssrc(struct peerflow* pf,
 				 uint32_t csrc,
@@ -40,6 +60,11 @@ int peerflow_inc_frame_count(struct peerflow* pf,
 			     bool video,
 			     uint32_t frames);
 
+int peerflow_add_latency(struct peerflow* pf,
+			 uint32_t csrc,
+			 bool video,
+			 const struct stats_latency *sl);
+
 #ifdef __cplusplus
 }
 #endif
@@ -55,6 +55,41 @@ struct stats_packet_counts {
 	struct stats_rx_tx lost;
 };
 
+// frames offered by the video capture source
+struct stats_capture {
+	uint64_t admitted;
+	uint64_t dropped;
+	uint64_t scaled;
+};
+
+/* Sender to receiver frame latency, from the timestamp in the frame
+ * header. Bucket i of the histograms counts values below
+ * stats_latency_bound(i) ms, the last bucket everything above.
+ * Latency assumes the sender and receiver clocks are in sync, jitter
+ * (the latency change between consecutive frames) does not.
+ */
+#define STATS_LAT_BUCKETS 10
+
+struct stats_latency {
+	uint32_t frames;
+	uint32_t lost;     // gaps in the sequence numbers
+	uint32_t skewed;   // negative latency, clocks out of sync
+	uint32_t max_ms;
+	uint64_t sum_ms;
+	uint32_t latency[STATS_LAT_BUCKETS];
+	uint32_t jitter[STATS_LAT_BUCKETS];
+};
+
+#define STATS_LAT_MAX_SENDERS 16
+#define STATS_LAT_ID_LEN      64
+
+struct stats_sender_latency {
+	char userid[STATS_LAT_ID_LEN];
+	char clientid[STATS_LAT_ID_LEN];
+	struct stats_latency audio;
+	struct stats_latency video;
+};
+
 struct stats_report {
 	enum stats_proto proto;
 	enum stats_cand cand;
@@ -64,6 +99,10 @@ struct stats_report {
 	int audio_level;
 	int audio_level_smooth;
 	struct stats_rx_tx rtt;
+	uint32_t encode_time_us; // mean per video frame
+	struct stats_capture capture;
+	uint32_t nsenders;
+	struct stats_sender_latency senders[STATS_LAT_MAX_SENDERS];
 };
 
 int stats_alloc(struct avs_stats **statsp, void *arg);
@@ -71,6 +110,10 @@ int stats_update(struct avs_stats *stats, const char *report_json);
 int stats_get_report(struct avs_stats *stats, struct stats_report *report);
 char *stats_proto_name(enum stats_proto proto);	
 char *stats_cand_name(enum stats_cand cand);	
+
+uint32_t stats_latency_bound(int bucket);
+void stats_latency_add(struct stats_latency *sl, int32_t latency_ms,
+		       int32_t jitter_ms);
 	
 #ifdef __cplusplus
 }
@@ -22,6 +22,7 @@
  */
 
 struct turn_conn;
+struct turn_tcpbuf;
 
 typedef void (turnconn_estab_h)(struct turn_conn *conn,
 				const struct sa *relay_addr,
@@ -40,7 +41,7 @@ struct turn_conn {
 	struct sa turn_srv;
 	struct tls_conn *tlsc;
 	struct tls *tls;
-	struct mbuf *mb;
+	struct turn_tcpbuf *tcpbuf;
 	struct udp_helper *uh_app;  /* for outgoing UDP->TCP redirect */
 	struct udp_sock *us_app;    // todo: remove?
 	struct udp_sock *us_turn;
@@ -90,6 +91,33 @@ bool turnconn_are_all_failed(const struct list *turnconnl);
 int turnconn_debug(struct re_printf *pf, const struct turn_conn *conn);
 
 
+/*
+ * TURN over TCP/TLS stream reassembly
+ *
+ * Splits a TCP byte stream into STUN and ChannelData frames. Complete
+ * frames are passed in place from the received segment, only a frame
+ * split across segments is staged, in a buffer that is rewound after
+ * each frame and so never grows beyond the largest frame.
+ */
+
+struct turn_tcpbuf_stats {
+	uint64_t frames;
+	uint64_t staged;    /* frames that were split across segments */
+	uint64_t copied;    /* bytes copied into the staging buffer */
+	size_t   size_max;  /* largest staging buffer size */
+};
+
+/* The frame is mb pos..end and only valid during the call */
+typedef int (turn_tcpbuf_frame_h)(struct mbuf *mb, void *arg);
+
+int turn_tcpbuf_alloc(struct turn_tcpbuf **tbp);
+int turn_tcpbuf_recv(struct turn_tcpbuf *tb, struct mbuf *mb,
+		     turn_tcpbuf_frame_h *frameh, void *arg);
+void turn_tcpbuf_reset(struct turn_tcpbuf *tb);
+void turn_tcpbuf_get_stats(const struct turn_tcpbuf *tb,
+			   struct turn_tcpbuf_stats *stats);
+
+
 /*
  * STUN uri
  */
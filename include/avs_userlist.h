@@ -18,6 +18,8 @@
 
 struct userinfo {
 	struct le le;
+	struct le hle;  /* member of userlist hashh */
+	struct le rle;  /* member of userlist realh */
 	char *userid_real;
 	char *userid_hash;
 	char *clientid_real;
@@ -43,6 +45,11 @@ struct userinfo {
 	bool muted;
 	int active_audio;
 	int active_prev;
+
+	/* Frame cipher suites the client announced it decrypts,
+	 * as FRAME_CIPHER_BIT()s
+	 */
+	uint32_t ciphers;
 };
 
 typedef void (userlist_add_user_h)(const struct userinfo *user,
@@ -63,6 +70,8 @@ typedef void (userlist_vstate_h)(const struct userinfo *user,
 
 struct userlist {
 	struct list            users;
+	struct hash            *hashh;  /* users by hashed ids */
+	struct hash            *realh;  /* users by real ids   */
 	struct userinfo        *self;
 	struct userinfo        *keygenerator;
 	userlist_add_user_h    *addh;
@@ -71,6 +80,7 @@ struct userlist {
 	userlist_kg_change_h   *kgchangeh;
 	userlist_vstate_h      *vstateh;
 	void                   *arg;
+	uint32_t               joins;   /* clients that joined the call */
 };
 
 int userlist_alloc(struct userlist **listp,
@@ -142,6 +152,9 @@ void userlist_incall_clear(struct userlist *list,
 
 uint32_t userlist_incall_count(struct userlist *list);
 
+/* Cipher suites that all clients in the call announced */
+uint32_t userlist_get_ciphers(const struct userlist *list);
+
 int userlist_get_key_targets(struct userlist *list,
 			     struct list *targets,
 			     bool send_to_all);
@@ -35,4 +35,6 @@ struct avs_vidframe {
 	int h; /* height */
 	int rotation;
 	uint32_t ts;
+	void *ref; /* rendered frames: buffer reference, see
+		    * wcall_render_frame_retain() */
 };
@@ -270,6 +270,38 @@ typedef int (wcall_render_frame_h)(struct avs_vidframe *frame,
 				   const char *clientid,
 				   void *arg);
 
+/**
+ * Callback used to announce who is behind a render stream
+ *
+ * Called when a remote video stream starts, and again whenever the
+ * participant rendered through it changes. userid and clientid are
+ * NULL when the stream goes away and the handle is no longer used.
+ *
+ * @param handle   Render stream handle, never 0
+ * @param userid   User ID for the participant of the stream
+ * @param clientid Client ID for the participant of the stream
+ * @param arg      The handler argument passed to the callback
+ */
+typedef void (wcall_render_stream_h)(uint32_t handle,
+				     const char *userid,
+				     const char *clientid,
+				     void *arg);
+
+/**
+ * Callback used to render frames of a render stream
+ *
+ * Like wcall_render_frame_h, but the participant is identified by the
+ * stream handle only. To keep the frame after returning, take a
+ * reference with wcall_render_frame_retain().
+ *
+ * @param frame    Pointer to the frame object to render
+ * @param handle   Render stream handle
+ * @param arg      The handler argument passed to the callback
+ */
+typedef int (wcall_render_stream_frame_h)(struct avs_vidframe *frame,
+					  uint32_t handle,
+					  void *arg);
+
 /**
  * Callback used to inform user that call uses CBR (in both directions)
  */
@@ -413,6 +445,20 @@ void wcall_set_video_handlers(wcall_render_frame_h *render_frame_h,
 			      wcall_video_size_h *size_h,
 			      void *arg);
 
+/* Render frames by stream handle instead of user and client ID.
+ * Takes precedence over the render_frame_h of wcall_set_video_handlers.
+ */
+void wcall_set_render_stream_handlers(wcall_render_stream_h *stream_h,
+				      wcall_render_stream_frame_h *frame_h,
+				      void *arg);
+
+/* Keep a rendered frame beyond its render callback. Returns a reference
+ * to pass to wcall_render_frame_release, from any thread, once the
+ * frame's planes are no longer used.
+ */
+void *wcall_render_frame_retain(const struct avs_vidframe *frame);
+void wcall_render_frame_release(void *ref);
+
 void wcall_network_changed(void);
 
 void wcall_set_group_changed_handler(WUSER_HANDLE wuser,
@@ -453,6 +499,12 @@ struct re_printf;
 int  wcall_debug(struct re_printf *pf, WUSER_HANDLE wuser);
 int  wcall_stats(struct re_printf *pf, WUSER_HANDLE wuser);
 
+/**
+ * Add a send timestamp to the frame header of calls started after
+ * this, so that receivers can report the latency in wcall_stats.
+ */
+void wcall_set_latency_probe(int enable);
+
 
 #define WCALL_STATE_NONE         0 /* There is no call */
 #define WCALL_STATE_OUTGOING     1 /* Outgoing call is pending */
@@ -531,6 +583,42 @@ typedef void (wcall_active_speaker_h)(WUSER_HANDLE wuser,
 void wcall_set_active_speaker_handler(WUSER_HANDLE wuser,
 				      wcall_active_speaker_h *activeh);
 
+/**
+ * Delta notifications (conference calls).
+ *
+ * When enabled, the participant changed and active speaker handlers
+ * only get what changed since their previous invocation for the call,
+ * and are not invoked at all if nothing did. Participant JSON carries
+ * "delta":true and each member has a "change" of "joined", "changed"
+ * or "left". Active speaker JSON carries "delta":true, the changed
+ * "audio_levels" and the "removed" clients. The first notification
+ * after enabling reports the full state.
+ */
+void wcall_set_delta_notifications(WUSER_HANDLE wuser, int enabled);
+
+/* The participant delta of members compared to last, which may be NULL.
+ * *mjson is set to NULL if nothing changed.
+ */
+int wcall_members_delta_json(const struct wcall_members *last,
+			     const struct wcall_members *members,
+			     const char *convid,
+			     char **mjson, char **anon_str);
+
+/* Media frame cipher suites */
+#define WCALL_CIPHER_AES_256_GCM        0 /* default */
+#define WCALL_CIPHER_CHACHA20_POLY1305  1
+/* ChaCha20-Poly1305 on CPUs without AES instructions, AES otherwise */
+#define WCALL_CIPHER_AUTO               2
+
+/**
+ * Cipher suite for encrypting media frames (conference calls), used
+ * by the calls started or joined afterwards. Clients announce the
+ * suites they decrypt and the suite is only used while every client
+ * in the call announced it, AES-256-GCM otherwise. Web and older
+ * clients only decrypt AES-256-GCM; MLS calls always use it.
+ */
+int wcall_set_cipher_suite(WUSER_HANDLE wuser, int suite);
+
 #define WCALL_VSTREAMS_LIST 0
 
 /* Request Video quality resolution layers */
@@ -595,6 +683,27 @@ int  wcall_event_process(WUSER_HANDLE wuser,
 			 const char *userid,
 			 const char *clientid,
 			 int conv_type);
+
+/* One stored calling message, as passed to wcall_event_process() */
+struct wcall_event_msg {
+	const uint8_t *buf;
+	size_t len;
+	uint32_t curr_time; /* timestamp in seconds */
+	uint32_t msg_time;  /* timestamp in seconds */
+	const char *convid;
+	const char *userid;
+	const char *clientid;
+	int conv_type;
+};
+
+/* Process a backlog in one go; superseded events in a conversation
+ * are dropped so that only the final one is reported at
+ * wcall_event_end(). Messages that cannot be processed are skipped,
+ * the error of the first of them is returned.
+ */
+int wcall_event_process_batch(WUSER_HANDLE wuser,
+			      const struct wcall_event_msg *msgv,
+			      size_t msgc);
 void wcall_event_end(WUSER_HANDLE wuser);
 				
 				
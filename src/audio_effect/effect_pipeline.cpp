@@ -0,0 +1,738 @@
+/*
+* Wire
+* Copyright (C) 2016 Wire Swiss GmbH
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <deque>
+#include <vector>
+#include <re.h>
+#include "avs_audio_effect.h"
+#include "effect_pipeline.h"
+
+#include "common_audio/resampler/include/push_resampler.h"
+#include "modules/include/module_common_types.h"
+#include "api/environment/environment_factory.h"
+#include "api/audio/builtin_audio_processing_builder.h"
+#include "api/audio/audio_processing.h"
+#include "api/audio/audio_frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "avs_log.h"
+#ifdef __cplusplus
+}
+#endif
+
+#define LOG2_CIRC_BUF_SZ 14
+#define CIRC_BUF_MASK ((1 << LOG2_CIRC_BUF_SZ) -1)
+
+#define FS_PROC 32000
+
+#define BLOCK_FRAMES   100   /* 1 s per write */
+#define QUEUE_BLOCKS   8
+#define CHUNK_FRAMES   1000  /* 10 s per parallel chunk */
+#define PREROLL_FRAMES 100   /* lets effect and APM state settle */
+#define XFADE_FRAMES   5     /* crossfade at the chunk seams */
+#define MAX_THREADS    8
+
+static int g_max_threads = 0;
+
+
+int apply_effect_set_max_threads(int nthreads)
+{
+    if (nthreads < 0)
+        return EINVAL;
+
+    g_max_threads = nthreads;
+
+    return 0;
+}
+
+
+int effect_input_open(struct effect_input *in, FILE *fp, size_t offset,
+                      size_t max_samps)
+{
+    struct stat st;
+    size_t nsamps;
+
+    memset(in, 0, sizeof(*in));
+
+    if (fstat(fileno(fp), &st) != 0)
+        return errno;
+
+    if ((size_t)st.st_size <= offset)
+        return 0;
+
+    nsamps = ((size_t)st.st_size - offset) / sizeof(int16_t);
+    if (max_samps && nsamps > max_samps)
+        nsamps = max_samps;
+
+    in->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+                   fileno(fp), 0);
+    if (in->map == MAP_FAILED) {
+        /* Fall back to reading it all in one go */
+        in->map = NULL;
+        in->buf = (int16_t *)mem_alloc(nsamps * sizeof(int16_t), NULL);
+        if (!in->buf)
+            return ENOMEM;
+
+        if (fseek(fp, offset, SEEK_SET) != 0)
+            return errno;
+
+        nsamps = fread(in->buf, sizeof(int16_t), nsamps, fp);
+        in->samps = in->buf;
+    }
+    else {
+        in->map_sz = st.st_size;
+        madvise(in->map, in->map_sz, MADV_SEQUENTIAL);
+        in->samps = (const int16_t *)((const uint8_t *)in->map + offset);
+    }
+    in->nsamps = nsamps;
+
+    return 0;
+}
+
+
+void effect_input_close(struct effect_input *in)
+{
+    if (in->map)
+        munmap(in->map, in->map_sz);
+    mem_deref(in->buf);
+    memset(in, 0, sizeof(*in));
+}
+
+
+/* One APM -> effect -> resampler chain, fed 10 ms at a time */
+class EffectChain {
+public:
+    EffectChain(const struct effect_params *prm);
+    ~EffectChain();
+
+    int Init();
+    void Process(const int16_t *in, std::vector<int16_t> &out);
+
+private:
+    const struct effect_params *prm_;
+    int L_;
+    int L_proc_;
+    webrtc::scoped_refptr<webrtc::AudioProcessing> apm_;
+    struct aueffect *aue_;
+    webrtc::AudioFrame near_frame_;
+    webrtc::PushResampler<int16_t> input_resampler_;
+    webrtc::PushResampler<int16_t> output_resampler_;
+    std::vector<int16_t> proc_;
+    std::vector<int16_t> circ_buf_;
+    int write_idx_;
+    int read_idx_;
+};
+
+
+EffectChain::EffectChain(const struct effect_params *prm) :
+    prm_(prm),
+    L_(prm->fs_hz/100),
+    L_proc_(FS_PROC/100),
+    aue_(NULL),
+    input_resampler_(L_, L_proc_, 1),
+    output_resampler_(L_proc_, L_, 1),
+    proc_(2 * L_proc_),
+    circ_buf_(1 << LOG2_CIRC_BUF_SZ),
+    write_idx_(0),
+    read_idx_(0)
+{
+    near_frame_.samples_per_channel_ = L_proc_;
+    near_frame_.num_channels_ = 1;
+    near_frame_.sample_rate_hz_ = FS_PROC;
+}
+
+
+EffectChain::~EffectChain()
+{
+    mem_deref(aue_);
+}
+
+
+int EffectChain::Init()
+{
+    webrtc::AudioProcessing::Config apmConfig;
+    int ret;
+
+    ret = aueffect_alloc(&aue_, prm_->effect_type, FS_PROC);
+    if (ret != 0) {
+        error("aueffect_alloc failed \n");
+        return ret;
+    }
+
+    apm_ = webrtc::BuiltinAudioProcessingBuilder().Build(
+        webrtc::CreateEnvironment());
+    if (!apm_)
+        return ENOMEM;
+
+    // Enable High Pass Filter
+    apmConfig.high_pass_filter.enabled = true;
+
+    // Enable Noise Supression
+    if (prm_->reduce_noise) {
+        apmConfig.noise_suppression.enabled = true;
+        if (prm_->effect_type == AUDIO_EFFECT_VOCODER_MED) {
+            apmConfig.noise_suppression.level = webrtc::AudioProcessing::Config::NoiseSuppression::kModerate;
+        } else {
+            apmConfig.noise_suppression.level = webrtc::AudioProcessing::Config::NoiseSuppression::kLow;
+        }
+    }
+
+    apm_->ApplyConfig(apmConfig);
+
+    return 0;
+}
+
+
+void EffectChain::Process(const int16_t *in, std::vector<int16_t> &out)
+{
+    webrtc::MonoView<const int16_t> inv(in, L_);
+    webrtc::MonoView<int16_t> outv(near_frame_.mutable_data(), L_proc_);
+    webrtc::StreamConfig inConfig(near_frame_.sample_rate_hz_, 1);
+    webrtc::StreamConfig outConfig(near_frame_.sample_rate_hz_, 1);
+    size_t L_proc_out;
+    int ret;
+
+    input_resampler_.Resample(inv, outv);
+
+    ret = apm_->ProcessStream(near_frame_.data(),
+                              inConfig,
+                              outConfig,
+                              near_frame_.mutable_data());
+    if (ret < 0) {
+        error("apm->ProcessStream returned %d \n", ret);
+    }
+
+    aueffect_process(aue_, near_frame_.data(), proc_.data(), L_proc_,
+                     &L_proc_out);
+
+    for (size_t j = 0; j < L_proc_out; j++) {
+        circ_buf_[write_idx_] = proc_[j];
+        write_idx_ = (write_idx_ + 1) & CIRC_BUF_MASK;
+    }
+
+    // resampler needs 10 ms chunks
+    int buf_smpls = (write_idx_ - read_idx_) & CIRC_BUF_MASK;
+    while (buf_smpls >= L_proc_) {
+        for (int j = 0; j < L_proc_; j++) {
+            proc_[j] = circ_buf_[read_idx_];
+            read_idx_ = (read_idx_ + 1) & CIRC_BUF_MASK;
+        }
+
+        size_t n = out.size();
+        out.resize(n + L_);
+
+        webrtc::MonoView<const int16_t> pin(proc_.data(), L_proc_);
+        webrtc::MonoView<int16_t> pout(out.data() + n, L_);
+        output_resampler_.Resample(pin, pout);
+
+        buf_smpls = (write_idx_ - read_idx_) & CIRC_BUF_MASK;
+    }
+}
+
+
+static int write_samps(FILE *out, const int16_t *samps, size_t n,
+                       size_t *nout, size_t nout_max)
+{
+    if (nout_max && *nout + n > nout_max)
+        n = nout_max - *nout;
+
+    if (n && fwrite(samps, sizeof(int16_t), n, out) != n) {
+        error("audio_effect: Cannot write file \n");
+        return EIO;
+    }
+    *nout += n;
+
+    return 0;
+}
+
+
+/* Writer thread, so file writes overlap with processing */
+struct writer {
+    pthread_t tid;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    std::deque<std::vector<int16_t> *> q;
+    FILE *out;
+    size_t nout;
+    size_t nout_max;
+    bool done;
+    int err;
+};
+
+
+static void *writer_thread(void *arg)
+{
+    struct writer *w = (struct writer *)arg;
+
+    pthread_mutex_lock(&w->mutex);
+    for (;;) {
+        while (w->q.empty() && !w->done)
+            pthread_cond_wait(&w->cond, &w->mutex);
+
+        if (w->q.empty())
+            break;
+
+        std::vector<int16_t> *blk = w->q.front();
+        w->q.pop_front();
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->mutex);
+
+        int err = write_samps(w->out, blk->data(), blk->size(),
+                              &w->nout, w->nout_max);
+        delete blk;
+
+        pthread_mutex_lock(&w->mutex);
+        if (err && !w->err)
+            w->err = err;
+    }
+    pthread_mutex_unlock(&w->mutex);
+
+    return NULL;
+}
+
+
+static int writer_push(struct writer *w, std::vector<int16_t> *blk)
+{
+    int err;
+
+    pthread_mutex_lock(&w->mutex);
+    while (w->q.size() >= QUEUE_BLOCKS && !w->err)
+        pthread_cond_wait(&w->cond, &w->mutex);
+
+    err = w->err;
+    if (err)
+        delete blk;
+    else
+        w->q.push_back(blk);
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->mutex);
+
+    return err;
+}
+
+
+static int process_serial(const struct effect_params *prm,
+                          const struct effect_input *in,
+                          FILE *out,
+                          size_t nout_max,
+                          size_t *noutp)
+{
+    EffectChain chain(prm);
+    struct writer w;
+    std::vector<int16_t> *blk;
+    size_t L = prm->fs_hz/100;
+    size_t N = in->nsamps / L;
+    size_t nout = 0;
+    int err;
+
+    err = chain.Init();
+    if (err)
+        return err;
+
+    w.out = out;
+    w.nout = 0;
+    w.nout_max = nout_max;
+    w.done = false;
+    w.err = 0;
+    pthread_mutex_init(&w.mutex, NULL);
+    pthread_cond_init(&w.cond, NULL);
+    err = pthread_create(&w.tid, NULL, writer_thread, &w);
+    if (err) {
+        pthread_mutex_destroy(&w.mutex);
+        pthread_cond_destroy(&w.cond);
+        return err;
+    }
+
+    blk = new std::vector<int16_t>;
+    blk->reserve((BLOCK_FRAMES + 2) * L);
+
+    for (size_t i = 0; i < N && !err; i++) {
+        if ((i % 100) == 0) {
+            int progress = (i*100)/N;
+            if (prm->progress_h) {
+                prm->progress_h(progress, prm->arg);
+            }
+        }
+
+        chain.Process(in->samps + i * L, *blk);
+
+        if (nout_max && nout + blk->size() + 2 * L > nout_max)
+            break;
+
+        if (blk->size() >= BLOCK_FRAMES * L) {
+            nout += blk->size();
+            err = writer_push(&w, blk);
+            blk = new std::vector<int16_t>;
+            blk->reserve((BLOCK_FRAMES + 2) * L);
+        }
+    }
+
+    if (!err)
+        err = writer_push(&w, blk);
+    else
+        delete blk;
+
+    pthread_mutex_lock(&w.mutex);
+    w.done = true;
+    pthread_cond_broadcast(&w.cond);
+    pthread_mutex_unlock(&w.mutex);
+
+    pthread_join(w.tid, NULL);
+    pthread_mutex_destroy(&w.mutex);
+    pthread_cond_destroy(&w.cond);
+
+    if (!err)
+        err = w.err;
+    if (noutp)
+        *noutp = w.nout;
+
+    return err;
+}
+
+
+/* Effects whose state only depends on the recent input, so that a
+ * chunk started a pre-roll early ends up where a serial run would.
+ */
+static bool effect_chunkable(enum audio_effect effect_type)
+{
+    switch (effect_type) {
+
+    case AUDIO_EFFECT_REVERB:
+    case AUDIO_EFFECT_REVERB_MIN:
+    case AUDIO_EFFECT_REVERB_MID:
+    case AUDIO_EFFECT_REVERB_MAX:
+    case AUDIO_EFFECT_PITCH_UP_SHIFT:
+    case AUDIO_EFFECT_PITCH_UP_SHIFT_MIN:
+    case AUDIO_EFFECT_PITCH_UP_SHIFT_MED:
+    case AUDIO_EFFECT_PITCH_UP_SHIFT_MAX:
+    case AUDIO_EFFECT_PITCH_UP_SHIFT_INSANE:
+    case AUDIO_EFFECT_PITCH_DOWN_SHIFT:
+    case AUDIO_EFFECT_PITCH_DOWN_SHIFT_MIN:
+    case AUDIO_EFFECT_PITCH_DOWN_SHIFT_MED:
+    case AUDIO_EFFECT_PITCH_DOWN_SHIFT_MAX:
+    case AUDIO_EFFECT_PITCH_DOWN_SHIFT_INSANE:
+    case AUDIO_EFFECT_VOCODER_MIN:
+    case AUDIO_EFFECT_VOCODER_MED:
+    case AUDIO_EFFECT_AUTO_TUNE_MIN:
+    case AUDIO_EFFECT_AUTO_TUNE_MED:
+    case AUDIO_EFFECT_AUTO_TUNE_MAX:
+    case AUDIO_EFFECT_HARMONIZER_MIN:
+    case AUDIO_EFFECT_HARMONIZER_MED:
+    case AUDIO_EFFECT_HARMONIZER_MAX:
+    case AUDIO_EFFECT_NONE:
+        return true;
+
+    default:
+        /* Length changing, LFO or whole-file adaptive effects */
+        return false;
+    }
+}
+
+
+struct chunk {
+    size_t start;  /* first frame */
+    size_t end;    /* frame after the last one */
+    std::vector<int16_t> out;
+    size_t skip;   /* output samples belonging to the pre-roll */
+    bool done;
+};
+
+
+struct chunk_pool {
+    const struct effect_params *prm;
+    const struct effect_input *in;
+    std::vector<struct chunk> chunks;
+    size_t next;    /* next chunk to process */
+    size_t merged;  /* chunks written out */
+    size_t window;  /* max chunks ahead of the writer */
+    int err;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+
+static int process_chunk(struct chunk_pool *p, struct chunk *c)
+{
+    EffectChain chain(p->prm);
+    size_t L = p->prm->fs_hz/100;
+    size_t N = p->in->nsamps / L;
+    size_t s0 = c->start > PREROLL_FRAMES ? c->start - PREROLL_FRAMES : 0;
+    size_t e1 = c->end + XFADE_FRAMES < N ? c->end + XFADE_FRAMES : N;
+    int err;
+
+    err = chain.Init();
+    if (err)
+        return err;
+
+    c->out.reserve((e1 - s0 + 2) * L);
+    for (size_t i = s0; i < e1; i++)
+        chain.Process(p->in->samps + i * L, c->out);
+
+    c->skip = (c->start - s0) * L;
+
+    return 0;
+}
+
+
+static void *chunk_worker(void *arg)
+{
+    struct chunk_pool *p = (struct chunk_pool *)arg;
+    size_t nchunks = p->chunks.size();
+
+    pthread_mutex_lock(&p->mutex);
+    for (;;) {
+        while (p->next < nchunks && !p->err
+               && p->next >= p->merged + p->window) {
+            pthread_cond_wait(&p->cond, &p->mutex);
+        }
+
+        if (p->next >= nchunks || p->err)
+            break;
+
+        struct chunk *c = &p->chunks[p->next++];
+        pthread_mutex_unlock(&p->mutex);
+
+        int err = process_chunk(p, c);
+
+        pthread_mutex_lock(&p->mutex);
+        if (err && !p->err)
+            p->err = err;
+        c->done = true;
+        pthread_cond_broadcast(&p->cond);
+    }
+    pthread_mutex_unlock(&p->mutex);
+
+    return NULL;
+}
+
+
+/* Write a chunk, crossfading its start with the previous chunk's tail */
+static int merge_chunk(struct chunk *c, std::vector<int16_t> &tail,
+                       size_t L, FILE *out, size_t *nout, size_t nout_max)
+{
+    const int16_t *samps = c->out.data() + c->skip;
+    size_t n = c->out.size() > c->skip ? c->out.size() - c->skip : 0;
+    size_t nbody = (c->end - c->start) * L;
+    size_t nx = tail.size() < n ? tail.size() : n;
+    int err;
+
+    if (nbody > n)
+        nbody = n;
+    if (nx > nbody)
+        nx = nbody;
+
+    for (size_t i = 0; i < nx; i++) {
+        int32_t s = ((int32_t)tail[i] * (int32_t)(nx - i)
+                     + (int32_t)samps[i] * (int32_t)i) / (int32_t)nx;
+        tail[i] = (int16_t)s;
+    }
+
+    err = write_samps(out, tail.data(), nx, nout, nout_max);
+    if (err)
+        return err;
+
+    err = write_samps(out, samps + nx, nbody - nx, nout, nout_max);
+    if (err)
+        return err;
+
+    tail.assign(samps + nbody, samps + n);
+
+    return 0;
+}
+
+
+static int process_chunked(const struct effect_params *prm,
+                           const struct effect_input *in,
+                           int nthreads,
+                           FILE *out,
+                           size_t nout_max,
+                           size_t *noutp)
+{
+    struct chunk_pool p;
+    std::vector<pthread_t> tids;
+    std::vector<int16_t> tail;
+    size_t L = prm->fs_hz/100;
+    size_t N = in->nsamps / L;
+    size_t nchunks = (N + CHUNK_FRAMES - 1) / CHUNK_FRAMES;
+    size_t nout = 0;
+    int err = 0;
+
+    info("audio_effect: %zu frames in %zu chunks on %d threads\n",
+         N, nchunks, nthreads);
+
+    p.prm = prm;
+    p.in = in;
+    p.chunks.resize(nchunks);
+    for (size_t k = 0; k < nchunks; k++) {
+        p.chunks[k].start = k * CHUNK_FRAMES;
+        p.chunks[k].end = (k + 1) * CHUNK_FRAMES < N ?
+            (k + 1) * CHUNK_FRAMES : N;
+        p.chunks[k].skip = 0;
+        p.chunks[k].done = false;
+    }
+    p.next = 0;
+    p.merged = 0;
+    p.window = 2 * nthreads;
+    p.err = 0;
+    pthread_mutex_init(&p.mutex, NULL);
+    pthread_cond_init(&p.cond, NULL);
+
+    for (int t = 0; t < nthreads; t++) {
+        pthread_t tid;
+
+        if (pthread_create(&tid, NULL, chunk_worker, &p) != 0)
+            break;
+        tids.push_back(tid);
+    }
+    if (tids.empty()) {
+        err = EAGAIN;
+        goto out;
+    }
+
+    /* The calling thread writes, in order, as chunks complete */
+    for (size_t k = 0; k < nchunks && !err; k++) {
+        struct chunk *c = &p.chunks[k];
+
+        pthread_mutex_lock(&p.mutex);
+        while (!c->done && !p.err)
+            pthread_cond_wait(&p.cond, &p.mutex);
+        err = p.err;
+        pthread_mutex_unlock(&p.mutex);
+        if (err)
+            break;
+
+        err = merge_chunk(c, tail, L, out, &nout, nout_max);
+        std::vector<int16_t>().swap(c->out);
+
+        pthread_mutex_lock(&p.mutex);
+        p.merged++;
+        if (err && !p.err)
+            p.err = err;
+        pthread_cond_broadcast(&p.cond);
+        pthread_mutex_unlock(&p.mutex);
+
+        if (prm->progress_h && k + 1 < nchunks) {
+            prm->progress_h((int)((k + 1) * 100 / nchunks), prm->arg);
+        }
+    }
+
+    for (size_t t = 0; t < tids.size(); t++)
+        pthread_join(tids[t], NULL);
+
+ out:
+    pthread_mutex_destroy(&p.mutex);
+    pthread_cond_destroy(&p.cond);
+
+    if (noutp)
+        *noutp = nout;
+
+    return err;
+}
+
+
+int effect_pipeline_process(const struct effect_params *prm,
+                            const struct effect_input *in,
+                            FILE *out,
+                            size_t nout_max,
+                            size_t *noutp)
+{
+    size_t L = prm->fs_hz/100;
+    size_t N;
+    long ncpu;
+    int nthreads;
+
+    if (!L)
+        return EINVAL;
+
+    N = in->nsamps / L;
+
+    nthreads = g_max_threads;
+    if (!nthreads) {
+        ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = ncpu > 0 ? (int)ncpu : 1;
+    }
+    if (nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS;
+    if ((size_t)nthreads > N / CHUNK_FRAMES)
+        nthreads = (int)(N / CHUNK_FRAMES);
+
+    if (nthreads > 1 && effect_chunkable(prm->effect_type))
+        return process_chunked(prm, in, nthreads, out, nout_max, noutp);
+    else
+        return process_serial(prm, in, out, nout_max, noutp);
+}
+
+
+static int write_zeros(FILE *out, size_t n, size_t *nout)
+{
+    std::vector<int16_t> zeros(n < 4800 ? n : 4800, 0);
+    int err;
+
+    while (n) {
+        size_t m = n < zeros.size() ? n : zeros.size();
+
+        err = write_samps(out, zeros.data(), m, nout, 0);
+        if (err)
+            return err;
+        n -= m;
+    }
+
+    return 0;
+}
+
+
+int effect_pipeline_reverse(const struct effect_input *in,
+                            size_t nsamps,
+                            size_t pad,
+                            FILE *out)
+{
+    std::vector<int16_t> buf(4800);
+    size_t nout = 0;
+    int err;
+
+    if (nsamps > in->nsamps)
+        nsamps = in->nsamps;
+
+    for (size_t n = 0; n < nsamps; ) {
+        size_t m = nsamps - n < buf.size() ? nsamps - n : buf.size();
+
+        for (size_t j = 0; j < m; j++)
+            buf[j] = in->samps[nsamps - 1 - n - j];
+
+        err = write_samps(out, buf.data(), m, &nout, 0);
+        if (err)
+            return err;
+        n += m;
+    }
+
+    err = write_zeros(out, pad, &nout);
+    if (err)
+        return err;
+
+    err = write_samps(out, in->samps, nsamps, &nout, 0);
+    if (err)
+        return err;
+
+    return write_zeros(out, pad, &nout);
+}
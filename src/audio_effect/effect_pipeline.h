@@ -0,0 +1,63 @@
+/*
+* Wire
+* Copyright (C) 2016 Wire Swiss GmbH
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef AVS_SRC_AUDIO_EFFECT_EFFECT_PIPELINE_H
+#define AVS_SRC_AUDIO_EFFECT_EFFECT_PIPELINE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "avs_audio_effect.h"
+
+/* Input samples, memory mapped when possible */
+struct effect_input {
+    void *map;
+    size_t map_sz;
+    int16_t *buf;
+    const int16_t *samps;
+    size_t nsamps;
+};
+
+struct effect_params {
+    enum audio_effect effect_type;
+    bool reduce_noise;
+    int fs_hz;
+    effect_progress_h *progress_h;
+    void *arg;
+};
+
+int effect_input_open(struct effect_input *in, FILE *fp, size_t offset,
+                      size_t max_samps);
+void effect_input_close(struct effect_input *in);
+
+/* Run the APM, resampler and effect chain over the input, writing the
+ * result to out. Stops short of nout_max samples if non-zero.
+ */
+int effect_pipeline_process(const struct effect_params *prm,
+                            const struct effect_input *in,
+                            FILE *out,
+                            size_t nout_max,
+                            size_t *noutp);
+
+/* Write the input reversed followed by the original, each padded
+ * with pad zero samples.
+ */
+int effect_pipeline_reverse(const struct effect_input *in,
+                            size_t nsamps,
+                            size_t pad,
+                            FILE *out);
+
+#endif
@@ -17,5 +17,6 @@ AVS_SRCS += \
 	audio_effect/find_pitch_lags.cpp \
 	audio_effect/time_scale.cpp \
 	audio_effect/biquad.cpp \
+	audio_effect/effect_pipeline.cpp \
 	audio_effect/wav_interface.cpp \
 	audio_effect/pcm_interface.cpp
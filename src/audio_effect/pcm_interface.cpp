@@ -18,13 +18,7 @@
 
 #include <re.h>
 #include "avs_audio_effect.h"
-
-#include "common_audio/resampler/include/push_resampler.h"
-#include "modules/include/module_common_types.h"
-#include "api/environment/environment_factory.h"
-#include "api/audio/builtin_audio_processing_builder.h"
-#include "api/audio/audio_processing.h"
-#include "api/audio/audio_frame.h"
+#include "effect_pipeline.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -34,90 +28,6 @@ extern "C" {
 }
 #endif
 
-#define LOG2_CIRC_BUF_SZ 14
-#define CIRC_BUF_MASK ((1 << LOG2_CIRC_BUF_SZ) -1)
-
-#define FS_PROC 32000
-
-#define abs(a) ((a) < 0) ? (-a) : (a)
-
-
-static int get_number_of_frames(const char* pcmIn, int frame_length)
-{
-    FILE *in_file;
-    in_file = fopen(pcmIn,"rb");
-    if( in_file == NULL ){
-        error("Could not open file for reading \n");
-        return -1;
-    }
-    
-    size_t count;
-    int n_frames = 0;
-    int16_t bufIn[frame_length];
-    while(1){
-        count = fread(bufIn,
-                      sizeof(int16_t),
-                      frame_length,
-                      in_file);
-        
-        if(count < frame_length){
-            break;
-        }
-        n_frames++;
-    }
-    fclose(in_file);
-    
-    return n_frames;
-}
-
-static int reverse_stream(const char* pcmIn,
-                      const char* pcmOut,
-                      int fs_hz)
-{
-    FILE *in_file, *out_file;
-    int L = fs_hz/100;
-    int16_t bufIn[L], bufOut[L];
-    
-    int n_frames = get_number_of_frames(pcmIn, L);
-    
-    in_file = fopen(pcmIn,"rb");
-    if( in_file == NULL ){
-        error("Could not open file for reading \n");
-        return -1;
-    }
-    out_file = fopen(pcmOut,"wb");
-    if( out_file == NULL ){
-        error("Could not open file for writing \n");
-        fclose(in_file);
-        return -1;
-    }
-    size_t count;
-    int num_samples = L * n_frames;
-    fseek(in_file, num_samples*sizeof(int16_t), SEEK_CUR);
-    for( int i = 0; i < n_frames; i++){
-        fseek(in_file, -L*sizeof(int16_t), SEEK_CUR);
-        
-        fread(bufIn, sizeof(int16_t), L, in_file);
-	
-        for( int j = 0; j < L; j++){
-            bufOut[j] = bufIn[L - j - 1];
-        }
-        
-        fwrite(bufOut, sizeof(int16_t), L, out_file);
-        
-        fseek(in_file, -L*sizeof(int16_t), SEEK_CUR);
-    }
-    fseek(in_file, 0, SEEK_SET);
-    for( int i = 0; i < n_frames; i++){
-        fread(bufIn, sizeof(int16_t), L, in_file);
-        fwrite(bufIn, sizeof(int16_t), L, out_file);
-    }
-    
-    fclose(in_file);
-    fclose(out_file);
-    
-    return 0;
-}
 
 int apply_effect_to_pcm(const char* pcmIn,
                         const char* pcmOut,
@@ -127,38 +37,14 @@ int apply_effect_to_pcm(const char* pcmIn,
                         effect_progress_h* progress_h,
                         void *arg)
 {
-    if(effect_type == AUDIO_EFFECT_REVERSE){
-        /* Special handling for reverse effect */
-        int ret = reverse_stream(pcmIn, pcmOut, fs_hz);
-        
-        if(progress_h){
-            progress_h(100, arg);
-        }
-        return ret;
-    }
     FILE *in_file, *out_file;
-    
-    webrtc::scoped_refptr<webrtc::AudioProcessing> apm(
-	webrtc::BuiltinAudioProcessingBuilder().Build(webrtc::CreateEnvironment()));
-    
-    struct aueffect *aue;
-    int ret = aueffect_alloc(&aue, effect_type, FS_PROC);
-    if(ret != 0){
-        error("aueffect_alloc failed \n");
-        fclose(in_file);
-        fclose(out_file);
-        return ret;
-    }
-    
+    struct effect_input input;
     int L = fs_hz/100;
-    int n_frames = get_number_of_frames(pcmIn, L);
-    int L_proc = FS_PROC/100;
-    int progress = 0;
-    int rem = 0;
-    int n_samp_out = 0;
-    
-    info("sample_rate = %d \n", fs_hz);
-    
+    int ret;
+
+    if (L <= 0)
+        return EINVAL;
+
     in_file = fopen(pcmIn,"rb");
     if( in_file == NULL ){
         error("Could not open file for reading \n");
@@ -170,120 +56,42 @@ int apply_effect_to_pcm(const char* pcmIn,
         fclose(in_file);
         return -1;
     }
-    
-    // Setup Audio Buffer used by apm
-    webrtc::AudioFrame near_frame;
-    near_frame.samples_per_channel_ = L_proc;
-    near_frame.num_channels_ = 1;
-    near_frame.sample_rate_hz_ = FS_PROC;
-    
-    // Setup APM
-    webrtc::ChannelLayout inLayout = webrtc::CHANNEL_LAYOUT_MONO;
-    webrtc::ChannelLayout outLayout = webrtc::CHANNEL_LAYOUT_MONO;
-    webrtc::ChannelLayout reverseLayout = webrtc::CHANNEL_LAYOUT_MONO;
-    //apm->Initialize( FS_PROC, FS_PROC, FS_PROC, inLayout, outLayout, reverseLayout );
-    
-    // Enable High Pass Filter
-    //apm->high_pass_filter()->Enable(true);
-    webrtc::AudioProcessing::Config apmConfig;
 
-    apmConfig.high_pass_filter.enabled = true;
-    
-    // Enable Noise Supression
-    if(reduce_noise){
-	apmConfig.noise_suppression.enabled = true;
-        if(effect_type == AUDIO_EFFECT_VOCODER_MED){
-	    apmConfig.noise_suppression.level = webrtc::AudioProcessing::Config::NoiseSuppression::kModerate;
-        } else {
-	    apmConfig.noise_suppression.level = webrtc::AudioProcessing::Config::NoiseSuppression::kLow;
-        }
+    ret = effect_input_open(&input, in_file, 0, 0);
+    if (ret) {
+        error("Could not read input file \n");
+        goto out;
     }
-    
-    apm->ApplyConfig(apmConfig);    
-
-    int16_t circ_buf[(1 << LOG2_CIRC_BUF_SZ)];
-    int write_idx = 0;
-    int read_idx = 0;
-    
-    int16_t bufIn[L], procOut[L_proc];
-    //int16_t procIn[L_proc], procOut[L_proc];
-    size_t count;
 
-    webrtc::PushResampler<int16_t> input_resampler(L, L_proc, 1);
-    webrtc::PushResampler<int16_t> output_resampler(L_proc, L, 1);
-    
-    for(int i = 0; i < n_frames; i++){
-        count = fread(bufIn,
-                      sizeof(int16_t),
-                      L,
-                      in_file);
-        
-        if(count < L){
-            break;
-        }
-        if((i % 100) == 0){
-            int progress = (i*100)/n_frames;
-            if(progress_h){
-                progress_h(progress, arg);
-            }
-        }
+    if(effect_type == AUDIO_EFFECT_REVERSE){
+        /* Special handling for reverse effect */
+        ret = effect_pipeline_reverse(&input, (input.nsamps / L) * L, 0,
+                                      out_file);
+    }
+    else {
+        struct effect_params prm;
 
-	webrtc::MonoView<int16_t> inv(bufIn, L);
-	webrtc::MonoView<int16_t> outv(near_frame.mutable_data(), L_proc);
-	
-        input_resampler.Resample(inv, outv); 
+        info("sample_rate = %d \n", fs_hz);
 
-        webrtc::StreamConfig inConfig(near_frame.sample_rate_hz_, 1);
-        webrtc::StreamConfig outConfig(near_frame.sample_rate_hz_, 1);
-        ret = apm->ProcessStream(near_frame.data(),
-                                 inConfig,
-                                 outConfig,
-                                 near_frame.mutable_data());
-        if( ret < 0 ){
-            error("apm->ProcessStream returned %d \n", ret);
-        }
+        prm.effect_type = effect_type;
+        prm.reduce_noise = reduce_noise;
+        prm.fs_hz = fs_hz;
+        prm.progress_h = progress_h;
+        prm.arg = arg;
 
-        size_t L_proc_out;
-        aueffect_process(aue, near_frame.data(), procOut, L_proc, &L_proc_out);
-        
-        //input_resampler.Resample( bufIn, L, procIn, L_proc);
-        
-        //size_t L_proc_out;
-        //aueffect_process(aue, procIn, procOut, L_proc, &L_proc_out);
-        
-        for(int j = 0; j < L_proc_out; j++){
-            circ_buf[write_idx] = procOut[j];
-            write_idx = (write_idx + 1) & CIRC_BUF_MASK;
-        }
-        // resampler needs 10 ms chunks
-        int buf_smpls = (write_idx - read_idx) & CIRC_BUF_MASK;
-        while(buf_smpls >= L_proc){
-            for(int j = 0; j < L_proc; j++){
-                procOut[j] = circ_buf[read_idx];
-                read_idx = (read_idx + 1) & CIRC_BUF_MASK;
-            }
-	    webrtc::MonoView<int16_t> tin(procOut, L_proc);
-	    webrtc::MonoView<int16_t> tout(bufIn, L);
-	    
-            output_resampler.Resample(tin, tout); 
-            
-            fwrite(bufIn, sizeof(int16_t), L, out_file);
-            n_samp_out+=L;
-            
-            buf_smpls = (write_idx - read_idx) & CIRC_BUF_MASK;
-        }
+        ret = effect_pipeline_process(&prm, &input, out_file, 0, NULL);
     }
-    
+
     if(progress_h){
         progress_h(100, arg);
     }
-    
-    mem_deref(aue);
-    
+
+ out:
+    effect_input_close(&input);
     fclose(in_file);
     fclose(out_file);
-    
-    return 0;
+
+    return ret;
 }
 
 
@@ -18,13 +18,7 @@
 
 #include <re.h>
 #include "avs_audio_effect.h"
-
-#include "common_audio/resampler/include/push_resampler.h"
-#include "modules/include/module_common_types.h"
-#include "api/environment/environment_factory.h"
-#include "api/audio/builtin_audio_processing_builder.h"
-#include "api/audio/audio_processing.h"
-#include "api/audio/audio_frame.h"
+#include "effect_pipeline.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -34,9 +28,6 @@ extern "C" {
 }
 #endif
 
-#define LOG2_CIRC_BUF_SZ 14
-#define CIRC_BUF_MASK ((1 << LOG2_CIRC_BUF_SZ) -1)
-
 struct wav_format {
     uint16_t audio_format;
     uint16_t num_channels;
@@ -246,49 +237,6 @@ static int wav_converter_init(FILE *in_file, FILE *out_file, struct wav_format *
 
 #define FS_PROC 32000
 
-static void reverse_stream(FILE *in_file,
-                      FILE *out_file,
-                      struct wav_format *format)
-{
-    
-    int L = format->sample_rate/100;
-    int L_proc = FS_PROC/100;
-    int N = format->num_samples_in/L;
-    int progress = 0;
-    int rem = format->num_samples_in - N*L;
-    int16_t bufIn[L], bufOut[L];
-    FILE *tmp_file = in_file;
-    
-    size_t count;
-    fseek(in_file, format->num_samples_in*sizeof(int16_t), SEEK_CUR);
-    for( int i = 0; i < N; i++){
-        fseek(in_file, -L*sizeof(int16_t), SEEK_CUR);
-        
-        fread(bufIn, sizeof(int16_t), L, in_file);
-
-        for( int j = 0; j < L; j++){
-            bufOut[j] = bufIn[L - j - 1];
-        }
-        
-        fwrite(bufOut, sizeof(int16_t), L, out_file);
-        
-        fseek(in_file, -L*sizeof(int16_t), SEEK_CUR);
-    }
-    
-    memset(bufIn, 0, rem*sizeof(int16_t));
-
-    fwrite(bufIn, sizeof(int16_t), rem, out_file);
-    
-    for( int i = 0; i < N; i++){
-        fread(bufIn, sizeof(int16_t), L, tmp_file);        
-        fwrite(bufIn, sizeof(int16_t), L, out_file);        
-    }
-    
-    memset(bufIn, 0, rem*sizeof(int16_t));
-    
-    fwrite(bufIn, sizeof(int16_t), rem, out_file);
-}
-
 int apply_effect_to_wav(const char* wavIn,
                         const char* wavOut,
                         enum audio_effect effect_type,
@@ -309,9 +257,6 @@ int apply_effect_to_wav(const char* wavIn,
         return -1;
     }
     
-    webrtc::scoped_refptr<webrtc::AudioProcessing> apm(
-	webrtc::BuiltinAudioProcessingBuilder().Build(webrtc::CreateEnvironment()));
-    
     struct aueffect *aue;
     int ret = aueffect_alloc(&aue, effect_type, FS_PROC);
     if(ret != 0){
@@ -337,148 +282,55 @@ int apply_effect_to_wav(const char* wavIn,
     }
 
     info("wav: %s -> %H\n", wavIn, wav_format_debug, &format);
-    
-    if(effect_type == AUDIO_EFFECT_REVERSE){
-        /* Special handling for reverse effect */
-        reverse_stream(in_file, out_file, &format);
-
-        if(progress_h){
-            progress_h(100, arg);
-        }
-        
-        mem_deref(aue);
-        
-        fclose(in_file);
-        fclose(out_file);
-        
-        return 0;
-    }
-    
-    int L = format.sample_rate/100;
-    int L_proc = FS_PROC/100;
-    int N = format.num_samples_in/L;
-    int progress = 0;
-    int rem = 0;
-    int n_samp_out = 0;
-    
-    // Setup Audio Buffer used by apm
-    webrtc::AudioFrame near_frame;
-    near_frame.samples_per_channel_ = L_proc;
-    near_frame.num_channels_ = 1;
-    near_frame.sample_rate_hz_ = FS_PROC;
-    
-    // Setup APM
-    webrtc::ChannelLayout inLayout = webrtc::CHANNEL_LAYOUT_MONO;
-    webrtc::ChannelLayout outLayout = webrtc::CHANNEL_LAYOUT_MONO;
-    webrtc::ChannelLayout reverseLayout = webrtc::CHANNEL_LAYOUT_MONO;
-    //apm->Initialize( FS_PROC, FS_PROC, FS_PROC, inLayout, outLayout, reverseLayout );
-
-    webrtc::AudioProcessing::Config apmConfig;
-    // Enable High Pass Filter
 
-    //apm->high_pass_filter()->Enable(true);
-    apmConfig.high_pass_filter.enabled = true;
-
-    // Enable Noise Supression
-    if(reduce_noise){
-	    apmConfig.noise_suppression.enabled = true;
-	    if(effect_type == AUDIO_EFFECT_VOCODER_MED){
-		    apmConfig.noise_suppression.level = webrtc::AudioProcessing::Config::NoiseSuppression::kModerate;
-	    } else {
-		    apmConfig.noise_suppression.level = webrtc::AudioProcessing::Config::NoiseSuppression::kLow;
-	    }
+    /* The samples follow the header, map them from here */
+    struct effect_input input;
+    ret = effect_input_open(&input, in_file, ftell(in_file),
+                            format.num_samples_in);
+    if(ret != 0){
+        error("audio_effect: Cannot read file \n");
+        goto out;
     }
 
-    apm->ApplyConfig(apmConfig);
-        
-    int16_t circ_buf[(1 << LOG2_CIRC_BUF_SZ)];
-    int write_idx = 0;
-    int read_idx = 0;
-    
-    int16_t bufIn[L];
-    int16_t procIn[L_proc], procOut[L_proc];
-    size_t count;
-
-    webrtc::PushResampler<int16_t> input_resampler(L, L_proc, 1);
-    webrtc::PushResampler<int16_t> output_resampler(L_proc, L, 1);
-    
-    for(int i = 0; i < N; i++){
-        count = fread(bufIn,
-                      sizeof(int16_t),
-                      L,
-                      in_file);
-        
-        if(count < L){
-            break;
-        }
-        
-        if((i % 100) == 0){
-            int progress = (i*100)/N;
-            if(progress_h){
-                progress_h(progress, arg);
-            }
-        }
-
-	webrtc::MonoView<int16_t> inv(bufIn, L);
-	webrtc::MonoView<int16_t> outv(near_frame.mutable_data(), L_proc);
-        input_resampler.Resample(inv, outv);
-
-        webrtc::StreamConfig inConfig(near_frame.sample_rate_hz_, 1);
-        webrtc::StreamConfig outConfig(near_frame.sample_rate_hz_, 1);
-        ret = apm->ProcessStream(near_frame.data(),
-                                 inConfig,
-                                 outConfig,
-                                 near_frame.mutable_data());
-        if( ret < 0 ){
-            error("apm->ProcessStream returned %d \n", ret);
-        }
-
-        size_t L_proc_out;
-        aueffect_process(aue, near_frame.data(), procOut, L_proc, &L_proc_out);
-        
-        for(int j = 0; j < L_proc_out; j++){
-            circ_buf[write_idx] = procOut[j];
-            write_idx = (write_idx + 1) & CIRC_BUF_MASK;
-        }
-        // resampler needs 10 ms chunks
-        int buf_smpls = (write_idx - read_idx) & CIRC_BUF_MASK;
-        while(buf_smpls >= L_proc){
-            for(int j = 0; j < L_proc; j++){
-                procOut[j] = circ_buf[read_idx];
-                read_idx = (read_idx + 1) & CIRC_BUF_MASK;
-            }
-	    webrtc::MonoView<int16_t> pin(procOut, L_proc);
-	    webrtc::MonoView<int16_t> pout(bufIn, L);
-            output_resampler.Resample(pin, pout);
-            
-            fwrite(bufIn, sizeof(int16_t), L, out_file);
-            n_samp_out+=L;
-            
-            buf_smpls = (write_idx - read_idx) & CIRC_BUF_MASK;
-        }
-        rem = format.num_samples_out - n_samp_out;
-        if(rem < L*2){
-            break;
+    if(effect_type == AUDIO_EFFECT_REVERSE){
+        /* Special handling for reverse effect */
+        int L = format.sample_rate/100;
+        int N = format.num_samples_in/L;
+        int rem = format.num_samples_in - N*L;
+
+        ret = effect_pipeline_reverse(&input, N*L, rem, out_file);
+    }
+    else {
+        struct effect_params prm;
+        size_t n_samp_out = 0;
+
+        prm.effect_type = effect_type;
+        prm.reduce_noise = reduce_noise;
+        prm.fs_hz = format.sample_rate;
+        prm.progress_h = progress_h;
+        prm.arg = arg;
+
+        ret = effect_pipeline_process(&prm, &input, out_file,
+                                      format.num_samples_out, &n_samp_out);
+
+        int rem = format.num_samples_out - (int)n_samp_out;
+        if(ret == 0 && rem > 0){
+            int16_t fillbuf[rem];
+            memset(fillbuf, 0, sizeof(fillbuf));
+            fwrite(fillbuf, sizeof(int16_t), rem, out_file);
         }
     }
-    
-    rem = format.num_samples_out - n_samp_out;
-        
-    if(rem > 0){
-        int16_t fillbuf[rem];
-        memset(fillbuf, 0, sizeof(fillbuf));
-        fwrite(fillbuf, sizeof(int16_t), rem, out_file);
-    }
-    
+
     if(progress_h){
         progress_h(100, arg);
     }
-    
+
+ out:
+    effect_input_close(&input);
     mem_deref(aue);
-    
+
     fclose(in_file);
     fclose(out_file);
-    
-    return 0;
-}
 
+    return ret;
+}
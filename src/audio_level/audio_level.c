@@ -193,6 +193,148 @@ int audio_level_json(struct list *levell,
 }
 
 
+static int level_id_print(struct mbuf *mb,
+			  const char *userid, const char *clientid)
+{
+	return mbuf_printf(mb, "{\"userid\":\"%H\",\"clientid\":\"%H\"",
+			   utf8_encode, userid, utf8_encode, clientid);
+}
+
+
+static struct audio_level *level_take(struct list *lastl,
+				      const char *userid,
+				      const char *clientid)
+{
+	struct audio_level *c;
+	struct le *le;
+
+	/* Levels usually arrive in the same order as last time,
+	 * and matched entries are moved out of lastl, so the
+	 * head is the likely match.
+	 */
+	LIST_FOREACH(lastl, le) {
+		c = le->data;
+
+		if (streq(c->userid, userid) && streq(c->clientid, clientid)) {
+			list_unlink(&c->le);
+			return c;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Write only the levels that changed since the previous call.
+ *
+ * lastl holds the caller's copy of the previously reported levels and
+ * is updated to mirror levell. If nothing changed, *jsonp is set to NULL.
+ */
+int audio_level_delta_json(struct list *lastl, const struct list *levell,
+			   const char *userid_self, const char *clientid_self,
+			   char **jsonp, char **anon_p)
+{
+	struct list seenl = LIST_INIT;
+	struct mbuf *mb;
+	struct le *le;
+	size_t nchanged = 0;
+	size_t nremoved = 0;
+	int err = 0;
+
+	if (!lastl || !levell || !jsonp)
+		return EINVAL;
+
+	mb = mbuf_alloc(256);
+	if (!mb)
+		return ENOMEM;
+
+	err |= mbuf_printf(mb, "{\"delta\":true,\"audio_levels\":[");
+
+	LIST_FOREACH(levell, le) {
+		const struct audio_level *a = le->data;
+		struct audio_level *c;
+		const char *userid = a->userid;
+		const char *clientid = a->clientid;
+
+		if (a->is_self) {
+			if (userid_self)
+				userid = userid_self;
+			if (clientid_self)
+				clientid = clientid_self;
+		}
+
+		c = level_take(lastl, userid, clientid);
+		if (c) {
+			list_append(&seenl, &c->le, c);
+			if (c->aulevel == a->aulevel
+			    && c->aulevel_smooth == a->aulevel_smooth)
+				continue;
+
+			c->aulevel = a->aulevel;
+			c->aulevel_smooth = a->aulevel_smooth;
+		}
+		else {
+			err = audio_level_alloc(&c, &seenl, a->is_self,
+						userid, clientid,
+						a->aulevel, a->aulevel_smooth);
+			if (err)
+				goto out;
+		}
+
+		if (nchanged++)
+			err |= mbuf_write_u8(mb, ',');
+		err |= level_id_print(mb, userid, clientid);
+		err |= mbuf_printf(mb, ",\"audio_level\":%u"
+				   ",\"audio_level_now\":%u}",
+				   a->aulevel_smooth, a->aulevel);
+	}
+
+	err |= mbuf_printf(mb, "],\"removed\":[");
+
+	LIST_FOREACH(lastl, le) {
+		const struct audio_level *c = le->data;
+
+		if (nremoved++)
+			err |= mbuf_write_u8(mb, ',');
+		err |= level_id_print(mb, c->userid, c->clientid);
+		err |= mbuf_write_u8(mb, '}');
+	}
+
+	err |= mbuf_printf(mb, "]}");
+	if (err)
+		goto out;
+
+	if (anon_p) {
+		err = re_sdprintf(anon_p, "%zu levels: %zu changed %zu removed",
+				  list_count(levell), nchanged, nremoved);
+		if (err)
+			goto out;
+	}
+
+	if (nchanged || nremoved) {
+		mb->pos = 0;
+		err = mbuf_strdup(mb, jsonp, mb->end);
+	}
+	else {
+		*jsonp = NULL;
+	}
+
+ out:
+	/* Whatever was not seen this time has left */
+	list_flush(lastl);
+	while (seenl.head) {
+		struct audio_level *c = seenl.head->data;
+
+		list_unlink(&c->le);
+		list_append(lastl, &c->le, c);
+	}
+	mem_deref(mb);
+
+	return err;
+}
+
+
 int audio_level_json_print(struct re_printf *pf, const struct audio_level *a)
 {
 	int err = 0;
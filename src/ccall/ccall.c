@@ -38,6 +38,9 @@
 
 #define SFT_STATUS_NETWORK_ERROR 1000
 
+/* Keys hashed forward in the background, ahead of rotations */
+#define CCALL_KEY_LOOKAHEAD 4
+
 static void ccall_connect_timeout(void *arg);
 static void ccall_stop_ringing_timeout(void *arg);
 static void ccall_ongoing_call_timeout(void *arg);
@@ -197,6 +200,66 @@ int ccall_set_config(struct ccall *ccall, struct config *cfg)
 	return 0;
 }
 
+/* Send with the suite asked for once every client in the call
+ * decrypts it, with AES-256-GCM until then.
+ */
+static void ccall_apply_cipher_suite(struct ccall *ccall)
+{
+	int suite = FRAME_CIPHER_AES_256_GCM;
+
+	if (ccall->ciphers & FRAME_CIPHER_BIT(ccall->cipher_suite))
+		suite = ccall->cipher_suite;
+
+	if (suite == keystore_get_cipher_suite(ccall->keystore))
+		return;
+
+	info("ccall(%p): sending with cipher suite %s (ciphers 0x%x)\n",
+	     ccall, frame_cipher_suite_name(suite), ccall->ciphers);
+	keystore_set_cipher_suite(ccall->keystore, suite);
+}
+
+static void ccall_set_ciphers(struct ccall *ccall, uint32_t ciphers)
+{
+	ccall->ciphers = ciphers & CCALL_CIPHERS;
+	ccall_apply_cipher_suite(ccall);
+}
+
+/* Keygenerator only: recompute the suites every client in the call
+ * announced. Returns true if they changed, the keys were then sent
+ * to everyone with the new set.
+ */
+static bool ccall_update_ciphers(struct ccall *ccall)
+{
+	uint32_t ciphers;
+
+	if (ccall->is_mls_call || !userlist_is_keygenerator_me(ccall->userl))
+		return false;
+
+	ciphers = CCALL_CIPHERS & userlist_get_ciphers(ccall->userl);
+	if (ciphers == ccall->ciphers)
+		return false;
+
+	ccall_set_ciphers(ccall, ciphers);
+	ccall_send_keys(ccall, true);
+
+	return true;
+}
+
+int ccall_set_cipher_suite(struct ccall *ccall, int suite)
+{
+	if (!ccall)
+		return EINVAL;
+
+	if (suite != FRAME_CIPHER_AES_256_GCM &&
+	    suite != FRAME_CIPHER_CHACHA20_POLY1305)
+		return EINVAL;
+
+	ccall->cipher_suite = suite;
+	ccall_apply_cipher_suite(ccall);
+
+	return 0;
+}
+
 const char *ccall_state_name(enum ccall_state state)
 {
 	switch (state) {
@@ -1845,6 +1908,7 @@ static void ecall_confpart_handler(struct ecall *ecall,
 	bool self_changed = false;
 	bool first_confpart = false;
 	bool missing_parts = false;
+	uint32_t joins;
 	int err = 0;
 
 	uint64_t timestamp = msg->u.confpart.timestamp;
@@ -1946,6 +2010,7 @@ static void ecall_confpart_handler(struct ecall *ecall,
 		}
 	}
 
+	joins = ccall->userl->joins;
 	err = userlist_update_from_sftlist(ccall->userl,
 					   partlist,
 					   &list_changed,
@@ -1956,6 +2021,12 @@ static void ecall_confpart_handler(struct ecall *ecall,
 		return;
 	}
 
+	/* Whoever joined has not announced their cipher suites yet,
+	 * go back to AES before the keygenerator tells us.
+	 */
+	if (ccall->userl->joins != joins)
+		ccall_set_ciphers(ccall, 0);
+
 	send_confpart_response(ccall);
 
 	if (self_changed) {
@@ -1969,7 +2040,8 @@ static void ecall_confpart_handler(struct ecall *ecall,
 			&ccall->icall, ccall->icall.arg);	
 
 		if (userlist_is_keygenerator_me(ccall->userl) &&
-		    !ccall->is_mls_call) {
+		    !ccall->is_mls_call &&
+		    !ccall_update_ciphers(ccall)) {
 			err = ccall_send_keys(ccall, false);
 			if (err) {
 				warning("ccall(%p): send_keys failed\n", ccall);
@@ -2162,10 +2234,15 @@ static int alloc_message(struct econn_message **msgp,
 				list_append(&msg->u.confkey.keyl, &key1->le, key1);
 			}
 
-			info("ccall(%p): alloc_message: send CONFKEY resp with %u keys\n",
-			     ccall, list_count(&msg->u.confkey.keyl));
+			msg->u.confkey.ciphers = ccall->ciphers;
+
+			info("ccall(%p): alloc_message: send CONFKEY resp with %u keys "
+			     "ciphers 0x%x\n",
+			     ccall, list_count(&msg->u.confkey.keyl), ccall->ciphers);
 		}
 		else {
+			msg->u.confkey.ciphers = CCALL_CIPHERS;
+
 			info("ccall(%p): alloc_message: send CONFKEY req\n", ccall);
 		}
 	}
@@ -2574,6 +2651,10 @@ static void userlist_kg_change_handler(struct userinfo *keygenerator,
 		return;
 	}
 
+	/* The new keygenerator knows nobody's cipher suites yet */
+	ccall->ciphers_sent = false;
+	ccall_set_ciphers(ccall, 0);
+
 	if (is_me) {
 		info("ccall(%p): track_keygenerator: new keygenerator is me\n",
 		      ccall);
@@ -2695,6 +2776,17 @@ int ccall_alloc(struct ccall **ccallp,
 	if (err)
 		goto out;
 
+	if (!is_mls_call) {
+		/* Without lookahead keys are still derived on rotation */
+		err = keystore_set_lookahead(ccall->keystore,
+					     CCALL_KEY_LOOKAHEAD);
+		if (err) {
+			warning("ccall(%p): alloc set_lookahead err=%m\n",
+				ccall, err);
+			err = 0;
+		}
+	}
+
 	randombytes_buf(&secret, CCALL_SECRET_LEN);
 	info("ccall(%p) set_secret from alloc\n", ccall);
 	ccall_set_secret(ccall, secret, CCALL_SECRET_LEN);
@@ -3708,6 +3800,16 @@ int  ccall_msg_recv(struct icall* icall,
 					return 0;
 				}
 			}
+
+			ccall_set_ciphers(ccall, msg->u.confkey.ciphers);
+
+			/* Asking for the keys once more announces our
+			 * cipher suites to this keygenerator.
+			 */
+			if (!ccall->ciphers_sent) {
+				ccall->ciphers_sent = true;
+				ccall_request_keys(ccall);
+			}
 		}
 		else {
 			struct userinfo *u = NULL;
@@ -3737,8 +3839,10 @@ int  ccall_msg_recv(struct icall* icall,
 					anon_client(clientid_anon, clientid_sender));
 				return 0;
 			}
+			u->ciphers = msg->u.confkey.ciphers;
 			u->needs_key = true;
-			ccall_send_keys(ccall, false);
+			if (!ccall_update_ciphers(ccall))
+				ccall_send_keys(ccall, false);
 		}
 		break;
 
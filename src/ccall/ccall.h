@@ -52,6 +52,16 @@
 /* feature toggle for request video optimization */
 #define USE_VIDEO_REQUEST_LIMITER   0
 
+/* Frame cipher suites this client decrypts, as FRAME_CIPHER_BITs.
+ * The web decrypts with WebCrypto, which only does AES-GCM.
+ */
+#ifdef __EMSCRIPTEN__
+#define CCALL_CIPHERS  (FRAME_CIPHER_BIT(FRAME_CIPHER_AES_256_GCM))
+#else
+#define CCALL_CIPHERS  (FRAME_CIPHER_BIT(FRAME_CIPHER_AES_256_GCM) | \
+			FRAME_CIPHER_BIT(FRAME_CIPHER_CHACHA20_POLY1305))
+#endif
+
 
 struct sftconfig {
 	struct le le;
@@ -108,6 +118,9 @@ struct ccall {
 	bool is_ringing;
 	enum sreason stop_ringing_reason;;
 	struct keystore *keystore;
+	int cipher_suite;   /* suite asked for by the app */
+	uint32_t ciphers;   /* suites every client in the call decrypts */
+	bool ciphers_sent;  /* ours announced to the keygenerator */
 
 	enum icall_call_type call_type;
 	enum icall_vstate vstate;
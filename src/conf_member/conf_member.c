@@ -21,12 +21,31 @@
 #include <avs_audio_level.h>
 
 #define TIMEOUT_UPDATE   1000
+#define INDEX_MIN_SIZE     16
+
+
+struct ssrc_slot {
+	uint32_t ssrc;  /* 0 marks an empty slot */
+	struct conf_member *cm;
+};
+
+struct ssrc_table {
+	struct ssrc_slot *slots;
+	size_t size;    /* power of 2 */
+	size_t count;
+};
+
+struct conf_member_index {
+	struct ssrc_table audio;
+	struct ssrc_table video;
+};
 
 
 static void cm_destructor(void *arg)
 {
 	struct conf_member *cm = (struct conf_member *)arg;
 
+	conf_member_index_remove(cm->idx, cm);
 	list_unlink(&cm->le);
 
 	mem_deref(cm->userid);
@@ -195,3 +214,304 @@ void conf_member_set_audio_level(struct conf_member *cm, int level)
 			cm->audio_level_smooth -= n;
 	}
 }
+
+
+void conf_member_deactivate(struct conf_member *cm)
+{
+	if (!cm)
+		return;
+
+	cm->active = false;
+	conf_member_index_remove(cm->idx, cm);
+}
+
+
+uint32_t conf_member_inc_frames(struct conf_member *cm, bool video,
+				uint32_t frames)
+{
+	uint32_t *cnt;
+
+	if (!cm)
+		return 0;
+
+	cnt = video ? &cm->video_frames : &cm->audio_frames;
+
+	return __atomic_add_fetch(cnt, frames, __ATOMIC_RELAXED);
+}
+
+
+void conf_member_get_frames(const struct conf_member *cm,
+			    uint32_t *audio_frames, uint32_t *video_frames)
+{
+	if (!cm)
+		return;
+
+	if (audio_frames)
+		*audio_frames = __atomic_load_n(&cm->audio_frames,
+						__ATOMIC_RELAXED);
+	if (video_frames)
+		*video_frames = __atomic_load_n(&cm->video_frames,
+						__ATOMIC_RELAXED);
+}
+
+
+void conf_member_add_latency(struct conf_member *cm, bool video,
+			     const struct stats_latency *sl)
+{
+	struct stats_latency *dst;
+	uint32_t max;
+	int i;
+
+	if (!cm || !sl)
+		return;
+
+	dst = video ? &cm->video_latency : &cm->audio_latency;
+
+	__atomic_add_fetch(&dst->frames, sl->frames, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&dst->lost, sl->lost, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&dst->skewed, sl->skewed, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&dst->sum_ms, sl->sum_ms, __ATOMIC_RELAXED);
+	for (i = 0; i < STATS_LAT_BUCKETS; i++) {
+		__atomic_add_fetch(&dst->latency[i], sl->latency[i],
+				   __ATOMIC_RELAXED);
+		__atomic_add_fetch(&dst->jitter[i], sl->jitter[i],
+				   __ATOMIC_RELAXED);
+	}
+
+	max = __atomic_load_n(&dst->max_ms, __ATOMIC_RELAXED);
+	while (sl->max_ms > max &&
+	       !__atomic_compare_exchange_n(&dst->max_ms, &max, sl->max_ms,
+					    true, __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED))
+		;
+}
+
+
+void conf_member_get_latency(const struct conf_member *cm, bool video,
+			     struct stats_latency *sl)
+{
+	const struct stats_latency *src;
+	int i;
+
+	if (!cm || !sl)
+		return;
+
+	src = video ? &cm->video_latency : &cm->audio_latency;
+
+	sl->frames = __atomic_load_n(&src->frames, __ATOMIC_RELAXED);
+	sl->lost = __atomic_load_n(&src->lost, __ATOMIC_RELAXED);
+	sl->skewed = __atomic_load_n(&src->skewed, __ATOMIC_RELAXED);
+	sl->max_ms = __atomic_load_n(&src->max_ms, __ATOMIC_RELAXED);
+	sl->sum_ms = __atomic_load_n(&src->sum_ms, __ATOMIC_RELAXED);
+	for (i = 0; i < STATS_LAT_BUCKETS; i++) {
+		sl->latency[i] = __atomic_load_n(&src->latency[i],
+						 __ATOMIC_RELAXED);
+		sl->jitter[i] = __atomic_load_n(&src->jitter[i],
+						__ATOMIC_RELAXED);
+	}
+}
+
+
+static inline size_t ssrc_hash(uint32_t ssrc, size_t size)
+{
+	return (size_t)((ssrc * 2654435761u) >> 8) & (size - 1);
+}
+
+
+static struct ssrc_slot *table_find(const struct ssrc_table *tbl,
+				    uint32_t ssrc)
+{
+	size_t i, n;
+
+	if (!tbl->slots || !ssrc)
+		return NULL;
+
+	i = ssrc_hash(ssrc, tbl->size);
+	for (n = 0; n < tbl->size; ++n) {
+		struct ssrc_slot *slot = &tbl->slots[i];
+
+		if (slot->ssrc == ssrc)
+			return slot;
+		if (!slot->ssrc)
+			return NULL;
+
+		i = (i + 1) & (tbl->size - 1);
+	}
+
+	return NULL;
+}
+
+
+static void table_put(struct ssrc_table *tbl,
+		      uint32_t ssrc, struct conf_member *cm)
+{
+	size_t i = ssrc_hash(ssrc, tbl->size);
+
+	while (tbl->slots[i].ssrc && tbl->slots[i].ssrc != ssrc)
+		i = (i + 1) & (tbl->size - 1);
+
+	if (!tbl->slots[i].ssrc)
+		++tbl->count;
+
+	tbl->slots[i].ssrc = ssrc;
+	tbl->slots[i].cm = cm;
+}
+
+
+static int table_grow(struct ssrc_table *tbl)
+{
+	struct ssrc_slot *old = tbl->slots;
+	size_t oldsz = tbl->size;
+	size_t i;
+
+	tbl->size = oldsz ? oldsz * 2 : INDEX_MIN_SIZE;
+	tbl->slots = mem_zalloc(tbl->size * sizeof(*tbl->slots), NULL);
+	if (!tbl->slots) {
+		tbl->slots = old;
+		tbl->size = oldsz;
+		return ENOMEM;
+	}
+
+	tbl->count = 0;
+	for (i = 0; i < oldsz; ++i) {
+		if (old[i].ssrc)
+			table_put(tbl, old[i].ssrc, old[i].cm);
+	}
+
+	mem_deref(old);
+
+	return 0;
+}
+
+
+static int table_add(struct ssrc_table *tbl,
+		     uint32_t ssrc, struct conf_member *cm)
+{
+	int err;
+
+	if (!ssrc)
+		return 0;
+
+	/* keep the load factor at or below 1/2 */
+	if ((tbl->count + 1) * 2 > tbl->size) {
+		err = table_grow(tbl);
+		if (err)
+			return err;
+	}
+
+	table_put(tbl, ssrc, cm);
+
+	return 0;
+}
+
+
+/* Backward-shift deletion keeps probe chains intact without tombstones */
+static void table_remove(struct ssrc_table *tbl,
+			 uint32_t ssrc, const struct conf_member *cm)
+{
+	struct ssrc_slot *slot = table_find(tbl, ssrc);
+	size_t mask, i, j;
+
+	if (!slot || slot->cm != cm)
+		return;
+
+	mask = tbl->size - 1;
+	i = slot - tbl->slots;
+	j = i;
+	for (;;) {
+		size_t k;
+
+		j = (j + 1) & mask;
+		if (!tbl->slots[j].ssrc)
+			break;
+
+		k = ssrc_hash(tbl->slots[j].ssrc, tbl->size);
+		if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+
+		tbl->slots[i] = tbl->slots[j];
+		i = j;
+	}
+
+	tbl->slots[i].ssrc = 0;
+	tbl->slots[i].cm = NULL;
+	--tbl->count;
+}
+
+
+static void index_destructor(void *arg)
+{
+	struct conf_member_index *idx = arg;
+
+	mem_deref(idx->audio.slots);
+	mem_deref(idx->video.slots);
+}
+
+
+int conf_member_index_alloc(struct conf_member_index **idxp)
+{
+	struct conf_member_index *idx;
+
+	if (!idxp)
+		return EINVAL;
+
+	idx = mem_zalloc(sizeof(*idx), index_destructor);
+	if (!idx)
+		return ENOMEM;
+
+	*idxp = idx;
+
+	return 0;
+}
+
+
+/* A later member with the same SSRC replaces the earlier one */
+int conf_member_index_add(struct conf_member_index *idx,
+			  struct conf_member *cm)
+{
+	int err;
+
+	if (!idx || !cm)
+		return EINVAL;
+
+	err = table_add(&idx->audio, cm->ssrca, cm);
+	if (err)
+		return err;
+
+	err = table_add(&idx->video, cm->ssrcv, cm);
+	if (err) {
+		table_remove(&idx->audio, cm->ssrca, cm);
+		return err;
+	}
+
+	cm->idx = idx;
+
+	return 0;
+}
+
+
+void conf_member_index_remove(struct conf_member_index *idx,
+			      struct conf_member *cm)
+{
+	if (!idx || !cm)
+		return;
+
+	table_remove(&idx->audio, cm->ssrca, cm);
+	table_remove(&idx->video, cm->ssrcv, cm);
+
+	cm->idx = NULL;
+}
+
+
+struct conf_member *conf_member_index_find(const struct conf_member_index *idx,
+					   uint32_t ssrc, bool video)
+{
+	const struct ssrc_slot *slot;
+
+	if (!idx)
+		return NULL;
+
+	slot = table_find(video ? &idx->video : &idx->audio, ssrc);
+
+	return slot ? slot->cm : NULL;
+}
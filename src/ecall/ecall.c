@@ -955,14 +955,52 @@ int ecall_dce_send(struct ecall *ecall, struct mbuf *mb)
 	return err;
 }
 
+/* Send the messages queued before the data channel was up,
+ * in one batch
+ */
+static void dce_send_pending(struct ecall *ecall)
+{
+	struct mbuf **mbv;
+	struct le *le;
+	size_t mbc = 0;
+	int err;
+
+	mbv = mem_zalloc(list_count(&ecall->dce_pendingl) * sizeof(*mbv),
+			 NULL);
+	if (!mbv) {
+		warning("ecall(%p): dce_send_pending: no memory\n", ecall);
+		goto out;
+	}
+
+	LIST_FOREACH(&ecall->dce_pendingl, le) {
+		struct dce_pending_entry *dpe = le->data;
+
+		mbv[mbc++] = dpe->mb;
+	}
+
+	info("ecall(%p): dce_estab: sending %zu pending dce messages\n",
+	     ecall, mbc);
+
+	err = iflow_dce_send_batch(ecall->flow, mbv, mbc);
+	if (err) {
+		warning("ecall(%p): dce_send_pending: send failed (%m)\n",
+			ecall, err);
+	}
+
+ out:
+	mem_deref(mbv);
+	list_flush(&ecall->dce_pendingl);
+}
+
+
 int ecall_dce_sendmsg(struct ecall *ecall, struct econn_message *msg)
 {
-	char *str = NULL;
+	struct mbuf *mb = NULL;
 	int err;
 
-	err = econn_message_encode(&str, msg);
+	err = econn_message_encode_dce(&mb, msg, ecall->props_remote);
 	if (err) {
-		warning("ecall: dce_sendmsg: econn_message_encode"
+		warning("ecall: dce_sendmsg: econn_message_encode_dce"
 			" failed (%m)\n", err);
 		goto out;
 	}
@@ -974,9 +1012,9 @@ int ecall_dce_sendmsg(struct ecall *ecall, struct econn_message *msg)
 	}
 
 	err = IFLOW_CALLE(ecall->flow, dce_send,
-			  (const uint8_t *)str, str_len(str));
+			  mbuf_buf(mb), mbuf_get_left(mb));
  out:
-	mem_deref(str);
+	mem_deref(mb);
 
 	return err;
 }
@@ -1111,6 +1149,16 @@ int ecall_alloc(struct ecall **ecallp, struct list *ecalls,
 	if (err)
 		goto out;
 
+#ifndef __EMSCRIPTEN__
+	/* The web data channel carries strings, it would mangle
+	 * binary messages.
+	 */
+	err = econn_props_add(ecall->props_local, ECONN_PROP_BIN,
+			      ECONN_BIN_VERSION_STR);
+	if (err)
+		goto out;
+#endif
+
 	err |= str_dup(&ecall->convid, convid);
 	err |= str_dup(&ecall->userid_self, userid_self);
 	err |= str_dup(&ecall->clientid_self, clientid);
@@ -1697,18 +1745,8 @@ static void channel_estab_handler(struct iflow *iflow, void *arg)
 		}
 	}
 
-	while(ecall->dce_pendingl.head) {
-	        struct le *le = ecall->dce_pendingl.head;
-		struct dce_pending_entry *dpe = le->data;
-
-		info("ecall(%p): dce_estab: sending pending dce message: %zubytes\n",
-		     ecall, mbuf_get_left(dpe->mb));
-		
-		err = ecall_dce_send(ecall, dpe->mb);
-
-		list_unlink(&dpe->le);
-		mem_deref(dpe);
-	}
+	if (!list_isempty(&ecall->dce_pendingl))
+		dce_send_pending(ecall);
 
 	ecall->update = false;
 	ecall->num_retries = 0;
@@ -1924,7 +1962,10 @@ static void data_channel_handler(struct iflow *iflow,
 		return;
 	}
 
-	err = econn_message_decode(&msg, 0, 0, (char *)data, len);
+	if (econn_message_is_bin(data, len))
+		err = econn_message_decode_bin(&msg, 0, 0, data, len);
+	else
+		err = econn_message_decode(&msg, 0, 0, (char *)data, len);
 	if (err) {
 		warning("ecall: channel: failed to decode %zu bytes (%m)\n",
 			len, err);
@@ -3032,13 +3073,94 @@ int ecall_stats_struct(const struct ecall *ecall,
 	return 0;
 }
 
+static struct json_object *latency_hist(const uint32_t *hist)
+{
+	struct json_object *jhist;
+	int i;
+
+	jhist = jzon_alloc_array();
+	if (!jhist)
+		return NULL;
+
+	for (i = 0; i < STATS_LAT_BUCKETS; i++)
+		json_object_array_add(jhist, json_object_new_int(hist[i]));
+
+	return jhist;
+}
+
+static struct json_object *latency_json(const struct stats_latency *sl)
+{
+	struct json_object *jlat;
+
+	jlat = jzon_alloc_object();
+	if (!jlat)
+		return NULL;
+
+	jzon_add_int(jlat, "frames", sl->frames);
+	jzon_add_int(jlat, "lost", sl->lost);
+	jzon_add_int(jlat, "skewed", sl->skewed);
+	jzon_add_int(jlat, "meanMs",
+		     sl->frames ? (int32_t)(sl->sum_ms / sl->frames) : 0);
+	jzon_add_int(jlat, "maxMs", sl->max_ms);
+	json_object_object_add(jlat, "latencyHist", latency_hist(sl->latency));
+	json_object_object_add(jlat, "jitterHist", latency_hist(sl->jitter));
+
+	return jlat;
+}
+
+/* Per sender latency from the frame header probe, the histogram
+ * buckets are given in latencyBoundsMs.
+ */
+static void latency_stats(struct json_object *jobj,
+			  const struct stats_report *stats)
+{
+	struct json_object *jsenders, *jbounds;
+	uint32_t i;
+
+	if (!stats->nsenders)
+		return;
+
+	jbounds = jzon_alloc_array();
+	jsenders = jzon_alloc_array();
+	if (!jbounds || !jsenders) {
+		mem_deref(jbounds);
+		mem_deref(jsenders);
+		return;
+	}
+
+	for (i = 0; i < STATS_LAT_BUCKETS - 1; i++) {
+		json_object_array_add(jbounds,
+			json_object_new_int(stats_latency_bound(i)));
+	}
+
+	for (i = 0; i < stats->nsenders && i < STATS_LAT_MAX_SENDERS; i++) {
+		const struct stats_sender_latency *sl = &stats->senders[i];
+		struct json_object *jsender;
+
+		jsender = jzon_alloc_object();
+		if (!jsender)
+			break;
+
+		jzon_add_str(jsender, "userId", "%s", sl->userid);
+		jzon_add_str(jsender, "clientId", "%s", sl->clientid);
+		json_object_object_add(jsender, "audio",
+				       latency_json(&sl->audio));
+		json_object_object_add(jsender, "video",
+				       latency_json(&sl->video));
+		json_object_array_add(jsenders, jsender);
+	}
+
+	json_object_object_add(jobj, "latencyBoundsMs", jbounds);
+	json_object_object_add(jobj, "latency", jsenders);
+}
+
 int ecall_stats(struct re_printf *pf, const struct ecall *ecall)
 {
 	struct stats_report stats;
 	struct json_object *jfstats = NULL;
 	int err = 0;
 
-
+	memset(&stats, 0, sizeof(stats));
 	IFLOW_CALL(ecall->flow, get_stats, &stats);
 
 	
@@ -3049,6 +3171,7 @@ int ecall_stats(struct re_printf *pf, const struct ecall *ecall)
 	jzon_add_int(jfstats, "audioPacketsSent", stats.packets.audio.tx);
 	jzon_add_int(jfstats, "videoPacketsReceived", stats.packets.video.rx);
 	jzon_add_int(jfstats, "videoPacketsSent", stats.packets.video.tx);
+	latency_stats(jfstats, &stats);
 	
 	jzon_print(pf, jfstats);
 
@@ -0,0 +1,1029 @@
+/*
+* Wire
+* Copyright (C) 2026 Wire Swiss GmbH
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Compact binary encoding of econn messages, used on the data channel
+ * between AVS peers that both announce it in their props.
+ *
+ *   magic (u8) | version (u8) | type (u8) | flags (u8) | fields ...
+ *
+ * Integers are unsigned LEB128 varints, signed integers are zigzag
+ * encoded first. Strings are prefixed with their length plus one, so
+ * that a zero prefix means a NULL string. Binary data and lists are
+ * prefixed with their length. The fields of each message type are
+ * the same ones the JSON format carries, in a fixed order. Fields
+ * appended by a later revision of the same version are ignored.
+ */
+
+#include <string.h>
+#include <re.h>
+#include "avs_log.h"
+#include "avs_zapi.h"
+#include "avs_econn.h"
+#include "avs_econn_fmt.h"
+#include "avs_string.h"
+
+
+#define BIN_FLAG_RESP 0x01
+
+
+static int put_varint(struct mbuf *mb, uint64_t v)
+{
+	uint8_t buf[10];
+	size_t n = 0;
+
+	while (v >= 0x80) {
+		buf[n++] = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	buf[n++] = (uint8_t)v;
+
+	return mbuf_write_mem(mb, buf, n);
+}
+
+static int put_sint(struct mbuf *mb, int64_t v)
+{
+	return put_varint(mb, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+static int put_str(struct mbuf *mb, const char *str)
+{
+	size_t len;
+	int err;
+
+	if (!str)
+		return put_varint(mb, 0);
+
+	len = strlen(str);
+	err = put_varint(mb, len + 1);
+	if (err)
+		return err;
+
+	return mbuf_write_mem(mb, (const uint8_t *)str, len);
+}
+
+static int put_data(struct mbuf *mb, const uint8_t *data, size_t len)
+{
+	int err;
+
+	if (!data)
+		len = 0;
+
+	err = put_varint(mb, len);
+	if (err || !len)
+		return err;
+
+	return mbuf_write_mem(mb, data, len);
+}
+
+static int put_props(struct mbuf *mb, const struct econn_props *props)
+{
+	struct le *le;
+	size_t n = 0;
+	int err;
+
+	if (!props || !props->dict)
+		return put_varint(mb, 0);
+
+	/* Props only ever hold strings, anything else is not carried */
+	LIST_FOREACH(&props->dict->lst, le) {
+		const struct odict_entry *e = le->data;
+
+		if (e->type == ODICT_STRING)
+			++n;
+	}
+
+	err = put_varint(mb, n + 1);
+	if (err)
+		return err;
+
+	LIST_FOREACH(&props->dict->lst, le) {
+		const struct odict_entry *e = le->data;
+
+		if (e->type != ODICT_STRING)
+			continue;
+
+		err  = put_str(mb, e->key);
+		err |= put_str(mb, e->u.str);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+static int put_turns(struct mbuf *mb,
+		     const struct zapi_ice_server *turnv, size_t turnc)
+{
+	size_t i;
+	int err;
+
+	if (!turnv)
+		turnc = 0;
+
+	err = put_varint(mb, turnc);
+	for (i = 0; i < turnc && !err; i++) {
+		err  = put_str(mb, turnv[i].url);
+		err |= put_str(mb, turnv[i].username);
+		err |= put_str(mb, turnv[i].credential);
+	}
+
+	return err;
+}
+
+static int put_stringlist(struct mbuf *mb, const struct list *strl)
+{
+	struct le *le;
+	int err;
+
+	err = put_varint(mb, list_count(strl));
+	LIST_FOREACH(strl, le) {
+		const struct stringlist_info *str = le->data;
+
+		if (err)
+			break;
+		err = put_str(mb, str->str);
+	}
+
+	return err;
+}
+
+static int put_parts(struct mbuf *mb, const struct list *partl)
+{
+	struct le *le;
+	int err;
+
+	err = put_varint(mb, list_count(partl));
+	LIST_FOREACH(partl, le) {
+		const struct econn_group_part *part = le->data;
+
+		if (err)
+			break;
+		err  = put_str(mb, part->userid);
+		err |= put_str(mb, part->clientid);
+		err |= mbuf_write_u8(mb, part->authorized);
+		err |= mbuf_write_u8(mb, (uint8_t)part->muted_state);
+		err |= put_varint(mb, part->ssrca);
+		err |= put_varint(mb, part->ssrcv);
+		err |= put_varint(mb, part->ts);
+	}
+
+	return err;
+}
+
+static int put_keys(struct mbuf *mb, const struct list *keyl)
+{
+	struct le *le;
+	int err;
+
+	err = put_varint(mb, list_count(keyl));
+	LIST_FOREACH(keyl, le) {
+		const struct econn_key_info *key = le->data;
+
+		if (err)
+			break;
+		err  = put_varint(mb, key->idx);
+		err |= put_data(mb, key->data, key->dlen);
+	}
+
+	return err;
+}
+
+static int put_streams(struct mbuf *mb, const struct list *streaml)
+{
+	struct le *le;
+	int err;
+
+	err = put_varint(mb, list_count(streaml));
+	LIST_FOREACH(streaml, le) {
+		const struct econn_stream_info *stream = le->data;
+
+		if (err)
+			break;
+		err  = put_str(mb, stream->userid);
+		err |= put_varint(mb, stream->quality);
+		err |= put_varint(mb, stream->ssrcv.hi);
+		err |= put_varint(mb, stream->ssrcv.lo);
+		err |= put_str(mb, stream->ssrcv.clientid);
+	}
+
+	return err;
+}
+
+
+static int get_varint(struct mbuf *mb, uint64_t *vp)
+{
+	uint64_t v = 0;
+	unsigned shift = 0;
+
+	while (mbuf_get_left(mb) && shift < 64) {
+		uint8_t b = mbuf_read_u8(mb);
+
+		v |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			*vp = v;
+			return 0;
+		}
+		shift += 7;
+	}
+
+	return EBADMSG;
+}
+
+static int get_u32(struct mbuf *mb, uint32_t *vp)
+{
+	uint64_t v;
+	int err;
+
+	err = get_varint(mb, &v);
+	if (err)
+		return err;
+	if (v > UINT32_MAX)
+		return EBADMSG;
+
+	*vp = (uint32_t)v;
+
+	return 0;
+}
+
+static int get_sint(struct mbuf *mb, int64_t *vp)
+{
+	uint64_t v;
+	int err;
+
+	err = get_varint(mb, &v);
+	if (err)
+		return err;
+
+	*vp = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+
+	return 0;
+}
+
+static int get_bool(struct mbuf *mb, bool *vp)
+{
+	if (!mbuf_get_left(mb))
+		return EBADMSG;
+
+	*vp = mbuf_read_u8(mb) != 0;
+
+	return 0;
+}
+
+/* Element count of a list, which can never exceed the bytes left */
+static int get_count(struct mbuf *mb, size_t *np)
+{
+	uint64_t v;
+	int err;
+
+	err = get_varint(mb, &v);
+	if (err)
+		return err;
+	if (v > mbuf_get_left(mb))
+		return EBADMSG;
+
+	*np = (size_t)v;
+
+	return 0;
+}
+
+/* The string is left in the buffer, pl is unset for a NULL string */
+static int get_pl(struct mbuf *mb, struct pl *pl)
+{
+	uint64_t v;
+	int err;
+
+	err = get_varint(mb, &v);
+	if (err)
+		return err;
+
+	if (v == 0) {
+		*pl = pl_null;
+		return 0;
+	}
+
+	--v;
+	if (v > mbuf_get_left(mb))
+		return EBADMSG;
+
+	pl->p = (const char *)mbuf_buf(mb);
+	pl->l = (size_t)v;
+	mbuf_advance(mb, (ssize_t)v);
+
+	return 0;
+}
+
+static int get_str(struct mbuf *mb, char **strp)
+{
+	struct pl pl;
+	int err;
+
+	err = get_pl(mb, &pl);
+	if (err)
+		return err;
+
+	*strp = mem_deref(*strp);
+	if (!pl.p)
+		return 0;
+
+	return pl_strdup(strp, &pl);
+}
+
+static int get_strbuf(struct mbuf *mb, char *buf, size_t sz)
+{
+	struct pl pl;
+	int err;
+
+	err = get_pl(mb, &pl);
+	if (err)
+		return err;
+
+	if (!pl.p) {
+		buf[0] = '\0';
+		return 0;
+	}
+
+	return pl_strcpy(&pl, buf, sz);
+}
+
+static int get_data(struct mbuf *mb, uint8_t **datap, uint32_t *lenp)
+{
+	uint8_t *data;
+	size_t len;
+	int err;
+
+	err = get_count(mb, &len);
+	if (err)
+		return err;
+
+	if (!len)
+		return 0;
+
+	data = mem_alloc(len, NULL);
+	if (!data)
+		return ENOMEM;
+
+	(void)mbuf_read_mem(mb, data, len);
+
+	*datap = data;
+	*lenp = (uint32_t)len;
+
+	return 0;
+}
+
+static int get_props(struct mbuf *mb, struct econn_props **propsp)
+{
+	struct econn_props *props = NULL;
+	size_t i, n;
+	int err;
+
+	err = get_count(mb, &n);
+	if (err)
+		return err;
+
+	/* Props not present */
+	if (n == 0)
+		return 0;
+
+	err = econn_props_alloc(&props, NULL);
+	if (err)
+		return err;
+
+	for (i = 0; i < n - 1; i++) {
+		char *key = NULL, *val = NULL;
+
+		err  = get_str(mb, &key);
+		err |= get_str(mb, &val);
+		if (!err && key && val)
+			err = econn_props_add(props, key, val);
+
+		mem_deref(key);
+		mem_deref(val);
+		if (err)
+			goto out;
+	}
+
+ out:
+	if (err)
+		mem_deref(props);
+	else
+		*propsp = props;
+
+	return err;
+}
+
+static int get_turns(struct mbuf *mb,
+		     struct zapi_ice_server **turnvp, size_t *turncp)
+{
+	struct zapi_ice_server *turnv;
+	size_t i, n;
+	int err;
+
+	err = get_count(mb, &n);
+	if (err || !n)
+		return err;
+
+	turnv = mem_zalloc(n * sizeof(*turnv), NULL);
+	if (!turnv)
+		return ENOMEM;
+
+	for (i = 0; i < n; i++) {
+		err  = get_strbuf(mb, turnv[i].url, sizeof(turnv[i].url));
+		err |= get_strbuf(mb, turnv[i].username,
+				  sizeof(turnv[i].username));
+		err |= get_strbuf(mb, turnv[i].credential,
+				  sizeof(turnv[i].credential));
+		if (err) {
+			mem_deref(turnv);
+			return EBADMSG;
+		}
+	}
+
+	*turnvp = turnv;
+	*turncp = n;
+
+	return 0;
+}
+
+static int get_stringlist(struct mbuf *mb, struct list *strl)
+{
+	size_t i, n;
+	int err;
+
+	err = get_count(mb, &n);
+	for (i = 0; i < n && !err; i++) {
+		char *str = NULL;
+
+		err = get_str(mb, &str);
+		if (!err && str)
+			err = stringlist_append(strl, str);
+
+		mem_deref(str);
+	}
+
+	return err;
+}
+
+static int get_parts(struct mbuf *mb, struct list *partl)
+{
+	size_t i, n;
+	int err;
+
+	err = get_count(mb, &n);
+	for (i = 0; i < n && !err; i++) {
+		struct econn_group_part *part;
+		uint8_t muted_state;
+
+		part = econn_part_alloc(NULL, NULL);
+		if (!part)
+			return ENOMEM;
+
+		list_append(partl, &part->le, part);
+
+		err  = get_str(mb, &part->userid);
+		err |= get_str(mb, &part->clientid);
+		err |= get_bool(mb, &part->authorized);
+		if (err || !mbuf_get_left(mb))
+			return EBADMSG;
+
+		muted_state = mbuf_read_u8(mb);
+		switch (muted_state) {
+
+		case MUTED_STATE_MUTED:
+		case MUTED_STATE_UNMUTED:
+			part->muted_state = muted_state;
+			break;
+
+		default:
+			part->muted_state = MUTED_STATE_UNKNOWN;
+			break;
+		}
+
+		err  = get_u32(mb, &part->ssrca);
+		err |= get_u32(mb, &part->ssrcv);
+		err |= get_varint(mb, &part->ts);
+	}
+
+	return err ? EBADMSG : 0;
+}
+
+static int get_keys(struct mbuf *mb, struct list *keyl)
+{
+	size_t i, n;
+	int err;
+
+	err = get_count(mb, &n);
+	for (i = 0; i < n && !err; i++) {
+		struct econn_key_info *key;
+		uint32_t idx;
+		size_t len;
+
+		err = get_u32(mb, &idx);
+		if (!err)
+			err = get_count(mb, &len);
+		if (err)
+			break;
+
+		key = econn_key_info_alloc(len ? len : 1);
+		if (!key)
+			return ENOMEM;
+
+		key->idx = idx;
+		key->dlen = (uint32_t)len;
+		(void)mbuf_read_mem(mb, key->data, len);
+
+		list_append(keyl, &key->le, key);
+	}
+
+	return err;
+}
+
+static int get_streams(struct mbuf *mb, struct list *streaml)
+{
+	size_t i, n;
+	int err;
+
+	err = get_count(mb, &n);
+	for (i = 0; i < n && !err; i++) {
+		struct econn_stream_info *stream;
+
+		stream = econn_stream_info_alloc("", 0);
+		if (!stream)
+			return ENOMEM;
+
+		list_append(streaml, &stream->le, stream);
+
+		err  = get_strbuf(mb, stream->userid, sizeof(stream->userid));
+		err |= get_u32(mb, &stream->quality);
+		err |= get_u32(mb, &stream->ssrcv.hi);
+		err |= get_u32(mb, &stream->ssrcv.lo);
+		err |= get_strbuf(mb, stream->ssrcv.clientid,
+				  sizeof(stream->ssrcv.clientid));
+	}
+
+	return err ? EBADMSG : 0;
+}
+
+
+bool econn_message_is_bin(const uint8_t *buf, size_t len)
+{
+	return buf && len > 0 && buf[0] == ECONN_BIN_MAGIC;
+}
+
+
+bool econn_props_has_bin(const struct econn_props *props_remote)
+{
+	const char *ver;
+
+	ver = econn_props_get(props_remote, ECONN_PROP_BIN);
+
+	return ver && streq(ver, ECONN_BIN_VERSION_STR);
+}
+
+
+int econn_message_encode_dce(struct mbuf **mbp,
+			     const struct econn_message *msg,
+			     const struct econn_props *props_remote)
+{
+	struct mbuf *mb;
+	char *str = NULL;
+	int err;
+
+	if (!mbp || !msg)
+		return EINVAL;
+
+	if (econn_props_has_bin(props_remote))
+		return econn_message_encode_bin(mbp, msg);
+
+	err = econn_message_encode(&str, msg);
+	if (err)
+		return err;
+
+	mb = mbuf_alloc(str_len(str));
+	if (!mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = mbuf_write_str(mb, str);
+	if (err)
+		goto out;
+
+	mb->pos = 0;
+
+ out:
+	if (err)
+		mem_deref(mb);
+	else
+		*mbp = mb;
+	mem_deref(str);
+
+	return err;
+}
+
+
+int econn_message_encode_bin(struct mbuf **mbp,
+			     const struct econn_message *msg)
+{
+	struct mbuf *mb;
+	int err = 0;
+
+	if (!mbp || !msg)
+		return EINVAL;
+
+	mb = mbuf_alloc(256);
+	if (!mb)
+		return ENOMEM;
+
+	err |= mbuf_write_u8(mb, ECONN_BIN_MAGIC);
+	err |= mbuf_write_u8(mb, ECONN_BIN_VERSION);
+	err |= mbuf_write_u8(mb, (uint8_t)msg->msg_type);
+	err |= mbuf_write_u8(mb, msg->resp ? BIN_FLAG_RESP : 0);
+
+	err |= put_str(mb, msg->sessid_sender);
+	err |= put_str(mb, msg->src_userid);
+	err |= put_str(mb, msg->src_clientid);
+	err |= put_str(mb, msg->dest_userid);
+	err |= put_str(mb, msg->dest_clientid);
+	if (err)
+		goto out;
+
+	switch (msg->msg_type) {
+
+	case ECONN_SETUP:
+		err  = put_str(mb, msg->u.setup.sdp_msg);
+		err |= put_props(mb, msg->u.setup.props);
+		err |= put_str(mb, msg->u.setup.url);
+		err |= put_str(mb, msg->u.setup.sft_tuple);
+		break;
+
+	case ECONN_GROUP_SETUP:
+	case ECONN_UPDATE:
+		err  = put_str(mb, msg->u.setup.sdp_msg);
+		err |= put_props(mb, msg->u.setup.props);
+		break;
+
+	case ECONN_CANCEL:
+	case ECONN_HANGUP:
+	case ECONN_REJECT:
+	case ECONN_GROUP_LEAVE:
+	case ECONN_GROUP_CHECK:
+	case ECONN_CONF_END:
+	case ECONN_PING:
+		break;
+
+	case ECONN_PROPSYNC:
+		/* props is mandatory for PROPSYNC */
+		if (!msg->u.propsync.props) {
+			warning("propsync: missing props\n");
+			err = EINVAL;
+			goto out;
+		}
+		err = put_props(mb, msg->u.propsync.props);
+		break;
+
+	case ECONN_GROUP_START:
+		err = put_props(mb, msg->u.groupstart.props);
+		break;
+
+	case ECONN_CONF_CONN:
+		err  = put_turns(mb, msg->u.confconn.turnv,
+				 msg->u.confconn.turnc);
+		err |= mbuf_write_u8(mb, msg->u.confconn.update);
+		err |= put_str(mb, msg->u.confconn.tool);
+		err |= put_str(mb, msg->u.confconn.toolver);
+		err |= put_sint(mb, msg->u.confconn.env);
+		err |= put_varint(mb, msg->u.confconn.status);
+		err |= mbuf_write_u8(mb, msg->u.confconn.selective_audio);
+		err |= mbuf_write_u8(mb, msg->u.confconn.selective_video);
+		err |= put_varint(mb, msg->u.confconn.vstreams);
+		err |= put_str(mb, msg->u.confconn.sft_url);
+		err |= put_str(mb, msg->u.confconn.sft_tuple);
+		err |= put_str(mb, msg->u.confconn.sft_username);
+		err |= put_str(mb, msg->u.confconn.sft_credential);
+		break;
+
+	case ECONN_CONF_START:
+		err  = put_str(mb, msg->u.confstart.sft_url);
+		err |= put_str(mb, msg->u.confstart.sft_tuple);
+		err |= put_data(mb, msg->u.confstart.secret,
+				msg->u.confstart.secretlen);
+		err |= put_varint(mb, msg->u.confstart.timestamp);
+		err |= put_varint(mb, msg->u.confstart.seqno);
+		err |= put_stringlist(mb, &msg->u.confstart.sftl);
+		err |= put_props(mb, msg->u.confstart.props);
+		break;
+
+	case ECONN_CONF_CHECK:
+		err  = put_str(mb, msg->u.confcheck.sft_url);
+		err |= put_str(mb, msg->u.confcheck.sft_tuple);
+		err |= put_data(mb, msg->u.confcheck.secret,
+				msg->u.confcheck.secretlen);
+		err |= put_varint(mb, msg->u.confcheck.timestamp);
+		err |= put_varint(mb, msg->u.confcheck.seqno);
+		err |= put_stringlist(mb, &msg->u.confcheck.sftl);
+		break;
+
+	case ECONN_CONF_PART:
+		err  = mbuf_write_u8(mb, msg->u.confpart.should_start);
+		err |= put_varint(mb, msg->u.confpart.timestamp);
+		err |= put_varint(mb, msg->u.confpart.seqno);
+		err |= put_data(mb, msg->u.confpart.entropy,
+				msg->u.confpart.entropylen);
+		err |= put_parts(mb, &msg->u.confpart.partl);
+		err |= put_stringlist(mb, &msg->u.confpart.sftl);
+		break;
+
+	case ECONN_CONF_KEY:
+		err  = put_keys(mb, &msg->u.confkey.keyl);
+		err |= put_varint(mb, msg->u.confkey.ciphers);
+		break;
+
+	case ECONN_CONF_STREAMS:
+		err  = put_str(mb, msg->u.confstreams.mode);
+		err |= put_streams(mb, &msg->u.confstreams.streaml);
+		break;
+
+	case ECONN_DEVPAIR_PUBLISH:
+		err  = put_turns(mb, msg->u.devpair_publish.turnv,
+				 msg->u.devpair_publish.turnc);
+		err |= put_str(mb, msg->u.devpair_publish.sdp);
+		err |= put_str(mb, msg->u.devpair_publish.username);
+		break;
+
+	case ECONN_DEVPAIR_ACCEPT:
+		err = put_str(mb, msg->u.devpair_accept.sdp);
+		break;
+
+	case ECONN_ALERT:
+		err  = put_varint(mb, msg->u.alert.level);
+		err |= put_str(mb, msg->u.alert.descr);
+		break;
+
+	default:
+		warning("econn: dont know how to encode %d\n", msg->msg_type);
+		err = EBADMSG;
+		break;
+	}
+
+ out:
+	if (err) {
+		mem_deref(mb);
+	}
+	else {
+		mb->pos = 0;
+		*mbp = mb;
+	}
+
+	return err;
+}
+
+
+int econn_message_decode_bin(struct econn_message **msgp,
+			     uint64_t curr_time, uint64_t msg_time,
+			     const uint8_t *buf, size_t len)
+{
+	struct econn_message *msg = NULL;
+	struct mbuf mb;
+	uint8_t ver, type, flags;
+	int64_t env = 0;
+	uint32_t u32;
+	int err = 0;
+
+	if (!msgp || !buf)
+		return EINVAL;
+
+	mb.buf = (uint8_t *)buf;
+	mb.size = len;
+	mb.end = len;
+	mb.pos = 0;
+
+	if (mbuf_get_left(&mb) < 4 || mbuf_read_u8(&mb) != ECONN_BIN_MAGIC) {
+		warning("econn: decode_bin: not a binary message\n");
+		return EBADMSG;
+	}
+
+	ver = mbuf_read_u8(&mb);
+	if (ver != ECONN_BIN_VERSION) {
+		warning("econn: decode_bin: version mismatch (us=%u, msg=%u)\n",
+			ECONN_BIN_VERSION, ver);
+		return EPROTO;
+	}
+
+	type = mbuf_read_u8(&mb);
+	flags = mbuf_read_u8(&mb);
+
+	msg = econn_message_alloc();
+	if (!msg)
+		return ENOMEM;
+
+	err |= get_strbuf(&mb, msg->sessid_sender, sizeof(msg->sessid_sender));
+	err |= get_strbuf(&mb, msg->src_userid, sizeof(msg->src_userid));
+	err |= get_strbuf(&mb, msg->src_clientid, sizeof(msg->src_clientid));
+	err |= get_strbuf(&mb, msg->dest_userid, sizeof(msg->dest_userid));
+	err |= get_strbuf(&mb, msg->dest_clientid, sizeof(msg->dest_clientid));
+	if (err) {
+		err = EBADMSG;
+		goto out;
+	}
+
+	msg->resp = (flags & BIN_FLAG_RESP) != 0;
+	msg->msg_type = (enum econn_msg)type;
+
+	switch (msg->msg_type) {
+
+	case ECONN_SETUP:
+	case ECONN_GROUP_SETUP:
+	case ECONN_UPDATE:
+		err  = get_str(&mb, &msg->u.setup.sdp_msg);
+		err |= get_props(&mb, &msg->u.setup.props);
+		if (!err && msg->msg_type == ECONN_SETUP) {
+			err  = get_str(&mb, &msg->u.setup.url);
+			err |= get_str(&mb, &msg->u.setup.sft_tuple);
+		}
+		if (err)
+			break;
+
+		if (!msg->u.setup.sdp_msg) {
+			warning("econn: missing 'sdp' field\n");
+			err = EBADMSG;
+		}
+		else if (!msg->u.setup.props &&
+			 msg->msg_type != ECONN_UPDATE) {
+			warning("econn: no props\n");
+			err = EBADMSG;
+		}
+		break;
+
+	case ECONN_CANCEL:
+	case ECONN_HANGUP:
+	case ECONN_REJECT:
+	case ECONN_GROUP_LEAVE:
+	case ECONN_GROUP_CHECK:
+	case ECONN_CONF_END:
+	case ECONN_PING:
+		break;
+
+	case ECONN_PROPSYNC:
+		err = get_props(&mb, &msg->u.propsync.props);
+		if (!err && !msg->u.propsync.props) {
+			warning("econn: no props\n");
+			err = EBADMSG;
+		}
+		break;
+
+	case ECONN_GROUP_START:
+		err = get_props(&mb, &msg->u.groupstart.props);
+		break;
+
+	case ECONN_CONF_CONN:
+		err  = get_turns(&mb, &msg->u.confconn.turnv,
+				 &msg->u.confconn.turnc);
+		err |= get_bool(&mb, &msg->u.confconn.update);
+		err |= get_str(&mb, &msg->u.confconn.tool);
+		err |= get_str(&mb, &msg->u.confconn.toolver);
+		err |= get_sint(&mb, &env);
+		err |= get_u32(&mb, &u32);
+		msg->u.confconn.env = (int)env;
+		msg->u.confconn.status = (enum econn_confconn_status)u32;
+		err |= get_bool(&mb, &msg->u.confconn.selective_audio);
+		err |= get_bool(&mb, &msg->u.confconn.selective_video);
+		err |= get_u32(&mb, &msg->u.confconn.vstreams);
+		/* vstreams range 0 to 32 */
+		if (msg->u.confconn.vstreams > 32)
+			msg->u.confconn.vstreams = 32;
+		err |= get_str(&mb, &msg->u.confconn.sft_url);
+		err |= get_str(&mb, &msg->u.confconn.sft_tuple);
+		err |= get_str(&mb, &msg->u.confconn.sft_username);
+		err |= get_str(&mb, &msg->u.confconn.sft_credential);
+		break;
+
+	case ECONN_CONF_START:
+		err  = get_str(&mb, &msg->u.confstart.sft_url);
+		err |= get_str(&mb, &msg->u.confstart.sft_tuple);
+		err |= get_data(&mb, &msg->u.confstart.secret,
+				&msg->u.confstart.secretlen);
+		err |= get_varint(&mb, &msg->u.confstart.timestamp);
+		err |= get_u32(&mb, &msg->u.confstart.seqno);
+		err |= get_stringlist(&mb, &msg->u.confstart.sftl);
+		err |= get_props(&mb, &msg->u.confstart.props);
+		if (!err && !msg->u.confstart.sft_url) {
+			warning("econn: decode CONFSTART: "
+				"couldnt read SFT URL\n");
+			err = EBADMSG;
+		}
+		break;
+
+	case ECONN_CONF_CHECK:
+		err  = get_str(&mb, &msg->u.confcheck.sft_url);
+		err |= get_str(&mb, &msg->u.confcheck.sft_tuple);
+		err |= get_data(&mb, &msg->u.confcheck.secret,
+				&msg->u.confcheck.secretlen);
+		err |= get_varint(&mb, &msg->u.confcheck.timestamp);
+		err |= get_u32(&mb, &msg->u.confcheck.seqno);
+		err |= get_stringlist(&mb, &msg->u.confcheck.sftl);
+		if (!err && !msg->u.confcheck.sft_url) {
+			warning("econn: decode CONFCHECK: "
+				"couldnt read SFT URL\n");
+			err = EBADMSG;
+		}
+		break;
+
+	case ECONN_CONF_PART:
+		err  = get_bool(&mb, &msg->u.confpart.should_start);
+		err |= get_varint(&mb, &msg->u.confpart.timestamp);
+		err |= get_u32(&mb, &msg->u.confpart.seqno);
+		err |= get_data(&mb, &msg->u.confpart.entropy,
+				&msg->u.confpart.entropylen);
+		err |= get_parts(&mb, &msg->u.confpart.partl);
+		err |= get_stringlist(&mb, &msg->u.confpart.sftl);
+		break;
+
+	case ECONN_CONF_KEY:
+		err = get_keys(&mb, &msg->u.confkey.keyl);
+		if (!err)
+			err = get_u32(&mb, &msg->u.confkey.ciphers);
+		break;
+
+	case ECONN_CONF_STREAMS:
+		err  = get_str(&mb, &msg->u.confstreams.mode);
+		err |= get_streams(&mb, &msg->u.confstreams.streaml);
+		if (!err && !msg->u.confstreams.mode) {
+			warning("econn: conf_streams: "
+				"could not find mode in message\n");
+			err = EBADMSG;
+		}
+		break;
+
+	case ECONN_DEVPAIR_PUBLISH:
+		err  = get_turns(&mb, &msg->u.devpair_publish.turnv,
+				 &msg->u.devpair_publish.turnc);
+		err |= get_str(&mb, &msg->u.devpair_publish.sdp);
+		err |= get_str(&mb, &msg->u.devpair_publish.username);
+		if (!err && (!msg->u.devpair_publish.sdp ||
+			     !msg->u.devpair_publish.username)) {
+			warning("econn: devpair_publish: "
+				"missing SDP or username\n");
+			err = EBADMSG;
+		}
+		break;
+
+	case ECONN_DEVPAIR_ACCEPT:
+		err = get_str(&mb, &msg->u.devpair_accept.sdp);
+		if (!err && !msg->u.devpair_accept.sdp) {
+			warning("econn: devpair_accept: "
+				"could not find SDP in message\n");
+			err = EBADMSG;
+		}
+		break;
+
+	case ECONN_ALERT:
+		err  = get_u32(&mb, &msg->u.alert.level);
+		err |= get_str(&mb, &msg->u.alert.descr);
+		if (!err && !msg->u.alert.descr) {
+			warning("econn: alert: "
+				"could not find descr in message\n");
+			err = EBADMSG;
+		}
+		break;
+
+	default:
+		warning("econn: decode_bin: unknown message type %u\n", type);
+		/* nothing was allocated for an unknown type */
+		msg->msg_type = 0;
+		err = EPROTONOSUPPORT;
+		goto out;
+	}
+
+	/* ENOMEM is kept, any other failure is a malformed message */
+	if (err && err != ENOMEM)
+		err = EBADMSG;
+	if (err)
+		goto out;
+
+	msg->time = msg_time;
+	msg->age = (msg_time > curr_time) ? 0 : curr_time - msg_time;
+
+ out:
+	if (err)
+		mem_deref(msg);
+	else
+		*msgp = msg;
+
+	return err;
+}
@@ -4,4 +4,5 @@
 
 
 AVS_SRCS += \
-	econn_fmt/msg.c
+	econn_fmt/msg.c \
+	econn_fmt/bin.c
@@ -130,11 +130,9 @@ struct econn_group_part *econn_part_alloc(const char *userid,
 	return part;
 }
 
-static bool part_decode_handler(const char *key, struct json_object *jobj,
-				void *arg)
+static void part_decode(struct json_object *jobj, struct list *partl)
 {
 	struct econn_group_part *part;
-	struct list *partl = arg;
 	const char *ssrc;
 	int32_t ts;
 	bool muted;
@@ -142,8 +140,8 @@ static bool part_decode_handler(const char *key, struct json_object *jobj,
 
 	part = mem_zalloc(sizeof(*part), part_destructor);
 	if (!part) {
-		warning("econn: part_decode_handler: could not alloc part\n");
-		return false;
+		warning("econn: part_decode: could not alloc part\n");
+		return;
 	}
 
 	err = jzon_strdup(&part->userid, jobj, "userid");
@@ -185,18 +183,17 @@ static bool part_decode_handler(const char *key, struct json_object *jobj,
  out:	
 	if (err) {
 		warning("econn: failed to parse participant entry\n");
-		return false;
+		mem_deref(part);
+		return;
 	}
 
 	list_append(partl, &part->le, part);
-
-	return false;
 }
 
 
 static int econn_parts_decode(struct list *partl, struct json_object *jobj)
 {
-	struct json_object *jparts;
+	struct json_object *jparts, *jpart;
 	int err = 0;
 
 	err = jzon_array(&jparts, jobj, "participants");
@@ -205,7 +202,9 @@ static int econn_parts_decode(struct list *partl, struct json_object *jobj)
 		return err;
 	}
 
-	jzon_apply(jparts, part_decode_handler, partl);
+	JZON_ARRAY_FOREACH(jparts, jpart) {
+		part_decode(jpart, partl);
+	}
 
 	return 0;
 }
@@ -275,12 +274,9 @@ struct econn_key_info *econn_key_info_alloc(size_t keysz)
 	return key;
 }
 
-static bool key_decode_handler(const char *keystr,
-			       struct json_object *jobj,
-			       void *arg)
+static void key_decode(struct json_object *jobj, struct list *keyl)
 {
 	struct econn_key_info *key;
-	struct list *keyl = arg;
 	int32_t i;
 	const char *dstr;
 	uint8_t *d;
@@ -289,44 +285,50 @@ static bool key_decode_handler(const char *keystr,
 
 	key = mem_zalloc(sizeof(*key), key_destructor);
 	if (!key) {
-		warning("econn: key_decode_handler: could not alloc part\n");
-		return false;
+		warning("econn: key_decode: could not alloc key\n");
+		return;
 	}
 
 	err = jzon_int(&i, jobj, "idx");
 	if (err)
-		return false;
+		goto out;
 
 	key->idx = i;
 
 	dstr = jzon_str(jobj, "data");
-	if (!dstr)
-		return false;
+	if (!dstr) {
+		err = ENOENT;
+		goto out;
+	}
 
 	sz = str_len(dstr);
 
 	d = mem_zalloc(sz, NULL);
-	if (!d)
-		return false;
+	if (!d) {
+		err = ENOMEM;
+		goto out;
+	}
 
 	err = base64_decode(dstr, str_len(dstr), d, &sz);
 	if (err) {
 		warning("econn: failed to base64 decode key\n");
 		mem_deref(d);
-		return err;
+		goto out;
 	}
 
 	key->data = d;
 	key->dlen = sz;
 
-	list_append(keyl, &key->le, key);
-
-	return false;
+ out:
+	if (err)
+		mem_deref(key);
+	else
+		list_append(keyl, &key->le, key);
 }
 
 static int econn_keys_decode(struct list *keyl, struct json_object *jobj)
 {
-	struct json_object *jkeys;
+	struct json_object *jkeys, *jkey;
 	int err = 0;
 
 	err = jzon_array(&jkeys, jobj, "keys");
@@ -335,7 +337,9 @@ static int econn_keys_decode(struct list *keyl, struct json_object *jobj)
 		return err;
 	}
 
-	jzon_apply(jkeys, key_decode_handler, keyl);
+	JZON_ARRAY_FOREACH(jkeys, jkey) {
+		key_decode(jkey, keyl);
+	}
 
 	return 0;
 }
@@ -402,12 +406,9 @@ struct econn_stream_info *econn_stream_info_alloc(const char *userid,
 	return stream;
 }
 
-static bool stream_decode_handler(const char *keystr,
-				  struct json_object *jobj,
-				  void *arg)
+static void stream_decode(struct json_object *jobj, struct list *streaml)
 {
 	struct econn_stream_info *stream;
-	struct list *streaml = arg;
 	const char *userid = NULL;
 	const char *clientid = NULL;
 	int32_t quality = 0;
@@ -418,11 +419,11 @@ static bool stream_decode_handler(const char *keystr,
 
 	err = jzon_int(&quality, jobj, "quality");
 	if (err)
-		goto out;
+		return;
 
 	userid = jzon_str(jobj, "userid");
 	if (!userid)
-		goto out;
+		return;
 
 	err = jzon_u32(&ssrcv, jobj, "ssrcv_hi");
 	if (0 == err)
@@ -435,8 +436,8 @@ static bool stream_decode_handler(const char *keystr,
 
 	stream = econn_stream_info_alloc(userid, quality);
 	if (!stream) {
-		warning("econn: stream_decode_handler: could not alloc stream\n");
-		goto out;
+		warning("econn: stream_decode: could not alloc stream\n");
+		return;
 	}
 	if (ssrcv_hi)
 		stream->ssrcv.hi = ssrcv_hi;
@@ -448,14 +449,11 @@ static bool stream_decode_handler(const char *keystr,
 	}
 
 	list_append(streaml, &stream->le, stream);
-
-out:
-	return false;
 }
 
 static int econn_streams_decode(struct list *streaml, struct json_object *jobj)
 {
-	struct json_object *jstreams;
+	struct json_object *jstreams, *jstream;
 	int err = 0;
 
 	err = jzon_array(&jstreams, jobj, "streams");
@@ -464,7 +462,9 @@ static int econn_streams_decode(struct list *streaml, struct json_object *jobj)
 		return err;
 	}
 
-	jzon_apply(jstreams, stream_decode_handler, streaml);
+	JZON_ARRAY_FOREACH(jstreams, jstream) {
+		stream_decode(jstream, streaml);
+	}
 
 	return 0;
 }
@@ -500,11 +500,8 @@ static int econn_stringlist_encode(struct json_object *jobj,
 	return err;
 }
 
-static bool string_decode_handler(const char *keystr,
-				  struct json_object *jobj,
-				  void *arg)
+static void string_decode(struct json_object *jobj, struct list *strl)
 {
-	struct list *strl = arg;
 	const char *val = NULL;
 	int err = 0;
 
@@ -512,18 +509,14 @@ static bool string_decode_handler(const char *keystr,
 	if (val) {
 		err =  stringlist_append(strl, val);
 		if (err) {
-			warning("econn: string_decode_handler: could not decode string\n");
-			goto out;
+			warning("econn: string_decode: could not decode string\n");
 		}
 	}
-
-out:
-	return false;
 }
 
 static int econn_stringlist_decode(struct list *strl, struct json_object *jobj, const char *name)
 {
-	struct json_object *jarray;
+	struct json_object *jarray, *jstr;
 	int err = 0;
 
 	err = jzon_array(&jarray, jobj, name);
@@ -532,7 +525,9 @@ static int econn_stringlist_decode(struct list *strl, struct json_object *jobj,
 		return err;
 	}
 
-	jzon_apply(jarray, string_decode_handler, strl);
+	JZON_ARRAY_FOREACH(jarray, jstr) {
+		string_decode(jstr, strl);
+	}
 
 	return 0;
 }
@@ -736,6 +731,10 @@ int econn_message_encode(char **strp, const struct econn_message *msg)
 
 	case ECONN_CONF_KEY:
 		econn_keys_encode(jobj, &msg->u.confkey.keyl);
+		if (msg->u.confkey.ciphers) {
+			jzon_add_int(jobj, "ciphers",
+				     (int32_t)msg->u.confkey.ciphers);
+		}
 		break;
 
 	case ECONN_CONF_STREAMS:
@@ -1232,6 +1231,10 @@ int econn_message_decode(struct econn_message **msgp,
 		err = econn_keys_decode(&msg->u.confkey.keyl, jobj);
 		if (err)
 			return err;
+
+		/* optional, absent from older clients */
+		if (jzon_u32(&msg->u.confkey.ciphers, jobj, "ciphers"))
+			msg->u.confkey.ciphers = 0;
 	}
 	else if (0 == str_casecmp(type, econn_msg_name(ECONN_CONF_STREAMS))) {
 		msg->msg_type = ECONN_CONF_STREAMS;
@@ -23,35 +23,231 @@
 #include <openssl/evp.h>
 #include <sodium.h>
 #include <assert.h>
+#include <stdlib.h>
 
 static const size_t TAG_SIZE   = 16;
 #define IV_SIZE   12
 
+/* Number of senders (CSRCs) for which the decryption state is kept.
+ * Must be a power of 2.
+ */
+#define CSRC_CACHE_SIZE 16
+#define CSRC_CACHE_MASK (CSRC_CACHE_SIZE - 1)
+
+/* Decryption state for a single sender. The entry with csrc 0 is
+ * used for P2P flows where the sender is set through set_uid.
+ */
+struct csrc_entry
+{
+	uint32_t csrc;
+	char *userid_hash;
+	uint8_t iv[IV_SIZE];
+	bool iv_ready;
+	uint64_t kidx;
+	uint8_t suite;
+	EVP_CIPHER_CTX *ctx;
+	uint8_t key[E2EE_SESSIONKEY_SIZE];
+	bool key_ready;
+	uint32_t frame_count;
+	uint64_t used;
+	bool frame_dec;
+
+	struct stats_latency lat;
+	bool lat_valid;
+	uint16_t lat_seq;
+	int32_t lat_ms;
+};
+
 struct frame_decryptor
 {
 	struct peerflow *pf;
-	uint32_t kidx;
-	EVP_CIPHER_CTX *ctx;
 	struct keystore *keystore;
-	uint8_t iv[IV_SIZE];
 	enum frame_media_type mtype;
 
-	char *userid_hash;
-	uint32_t csrc;
-	uint32_t frame_count;
-	bool frame_recv;
-	bool frame_dec;
+	struct csrc_entry def;
+	struct csrc_entry cache[CSRC_CACHE_SIZE];
+	struct csrc_entry *cur;
+	uint64_t used;
+
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t evictions;
 };
 
+static uint32_t csrc_hash(uint32_t csrc)
+{
+	return (csrc * 0x9e3779b1) >> 16;
+}
+
+static void entry_reset_ctx(struct csrc_entry *ent)
+{
+	if (ent->ctx) {
+		EVP_CIPHER_CTX_free(ent->ctx);
+		ent->ctx = NULL;
+	}
+	sodium_memzero(ent->key, sizeof(ent->key));
+	ent->key_ready = false;
+}
+
+static void entry_flush_frames(struct frame_decryptor *dec,
+			       struct csrc_entry *ent)
+{
+	bool video = dec->mtype == FRAME_MEDIA_VIDEO;
+
+	if (dec->pf && ent->csrc && ent->frame_count) {
+		peerflow_inc_frame_count(dec->pf,
+					 ent->csrc,
+					 video,
+					 ent->frame_count);
+	}
+	ent->frame_count = 0;
+
+	if (dec->pf && ent->csrc && ent->lat.frames) {
+		peerflow_add_latency(dec->pf, ent->csrc, video, &ent->lat);
+		memset(&ent->lat, 0, sizeof(ent->lat));
+	}
+}
+
+/* Account the latency of a frame from the timestamp in its header */
+static void entry_add_latency(struct csrc_entry *ent,
+			      const struct frame_hdr_ext *ext)
+{
+	int32_t lat, jitter = -1;
+	uint16_t gap;
+
+	lat = (int32_t)(frame_latency_clock_ms() - ext->ts);
+
+	/* A backwards step is a reordered frame or a restarted sender,
+	 * neither of which gives a jitter or loss sample.
+	 */
+	if (ent->lat_valid) {
+		gap = ext->seq - ent->lat_seq;
+		if (gap == 1)
+			jitter = abs(lat - ent->lat_ms);
+		else if (gap != 0 && gap < 0x8000)
+			ent->lat.lost += gap - 1;
+	}
+
+	stats_latency_add(&ent->lat, lat, jitter);
+
+	ent->lat_valid = true;
+	ent->lat_seq = ext->seq;
+	ent->lat_ms = lat;
+}
+
+/* Frames counted for the entry are reported before it is cleared */
+static void entry_clear(struct frame_decryptor *dec,
+			struct csrc_entry *ent)
+{
+	entry_flush_frames(dec, ent);
+	entry_reset_ctx(ent);
+	ent->userid_hash = mem_deref(ent->userid_hash);
+	sodium_memzero(ent->iv, sizeof(ent->iv));
+	ent->iv_ready = false;
+	ent->csrc = 0;
+	ent->kidx = 0;
+	ent->suite = FRAME_CIPHER_AES_256_GCM;
+	ent->frame_count = 0;
+	ent->used = 0;
+	ent->frame_dec = false;
+	memset(&ent->lat, 0, sizeof(ent->lat));
+	ent->lat_valid = false;
+}
+
 static void destructor(void *arg)
 {
 	struct frame_decryptor *dec = arg;
+	size_t i;
+
+	entry_clear(dec, &dec->def);
+	for (i = 0; i < CSRC_CACHE_SIZE; i++)
+		entry_clear(dec, &dec->cache[i]);
+
 	dec->keystore = (struct keystore*)mem_deref(dec->keystore);
-	dec->userid_hash = mem_deref(dec->userid_hash);
-	if (dec->ctx) {
-		EVP_CIPHER_CTX_free(dec->ctx);
-		dec->ctx = NULL;
+}
+
+static struct csrc_entry *cache_find(struct frame_decryptor *dec,
+				     uint32_t csrc)
+{
+	uint32_t h = csrc_hash(csrc);
+	size_t i;
+
+	for (i = 0; i < CSRC_CACHE_SIZE; i++) {
+		struct csrc_entry *ent;
+
+		ent = &dec->cache[(h + i) & CSRC_CACHE_MASK];
+		if (ent->csrc == csrc)
+			return ent;
+		if (ent->csrc == 0)
+			return NULL;
 	}
+
+	return NULL;
+}
+
+/* Remove an entry without breaking the probe sequence of the entries
+ * following it.
+ */
+static void cache_remove(struct frame_decryptor *dec,
+			 struct csrc_entry *ent)
+{
+	size_t i = ent - dec->cache;
+	size_t j = i;
+
+	if (dec->cur == ent)
+		dec->cur = NULL;
+
+	entry_clear(dec, ent);
+
+	for (;;) {
+		struct csrc_entry tmp;
+		size_t k;
+
+		j = (j + 1) & CSRC_CACHE_MASK;
+		if (dec->cache[j].csrc == 0)
+			break;
+
+		k = csrc_hash(dec->cache[j].csrc) & CSRC_CACHE_MASK;
+		if ((j > i && (k <= i || k > j)) ||
+		    (j < i && (k <= i && k > j))) {
+			if (dec->cur == &dec->cache[j])
+				dec->cur = &dec->cache[i];
+
+			tmp = dec->cache[i];
+			dec->cache[i] = dec->cache[j];
+			dec->cache[j] = tmp;
+			i = j;
+		}
+	}
+}
+
+static struct csrc_entry *cache_insert(struct frame_decryptor *dec,
+				       uint32_t csrc)
+{
+	struct csrc_entry *lru = NULL;
+	uint32_t h = csrc_hash(csrc);
+	size_t i;
+
+	for (i = 0; i < CSRC_CACHE_SIZE; i++) {
+		struct csrc_entry *ent;
+
+		ent = &dec->cache[(h + i) & CSRC_CACHE_MASK];
+		if (ent->csrc == 0) {
+			ent->csrc = csrc;
+			return ent;
+		}
+	}
+
+	/* Cache full, evict the least recently used sender */
+	for (i = 0; i < CSRC_CACHE_SIZE; i++) {
+		if (!lru || dec->cache[i].used < lru->used)
+			lru = &dec->cache[i];
+	}
+
+	cache_remove(dec, lru);
+	dec->evictions++;
+
+	return cache_insert(dec, csrc);
 }
 
 int frame_decryptor_alloc(struct frame_decryptor **pdec,
@@ -92,9 +288,10 @@ int frame_decryptor_set_uid(struct frame_decryptor *dec,
 	info("frame_dec(%p): set_uid: %s\n",
 	     dec,
 	     userid_hash);
-	dec->userid_hash = mem_deref(dec->userid_hash);
 
-	err = str_dup(&dec->userid_hash, userid_hash);
+	entry_clear(dec, &dec->def);
+
+	err = str_dup(&dec->def.userid_hash, userid_hash);
 	if (err)
 		goto out;
 
@@ -102,6 +299,27 @@ out:
 	return err;
 }
 
+int frame_decryptor_set_uid_for_csrc(struct frame_decryptor *dec,
+				     uint32_t csrc,
+				     const char *userid_hash)
+{
+	struct csrc_entry *ent;
+
+	if (!dec || !csrc || !userid_hash)
+		return EINVAL;
+
+	ent = cache_find(dec, csrc);
+	if (ent)
+		entry_clear(dec, ent);
+	else
+		ent = cache_insert(dec, csrc);
+
+	ent->csrc = csrc;
+	ent->used = ++dec->used;
+
+	return str_dup(&ent->userid_hash, userid_hash);
+}
+
 int frame_decryptor_set_peerflow(struct frame_decryptor *dec,
 				 struct peerflow *pf)
 {
@@ -128,6 +346,222 @@ int frame_decryptor_set_keystore(struct frame_decryptor *dec,
 	return err;
 }
 
+/* Find the decryption state for a sender, resolving the
+ * user and deriving the IV only when the sender is not cached.
+ */
+static int lookup_entry(struct frame_decryptor *dec,
+			uint32_t csrc,
+			struct csrc_entry **pent)
+{
+	struct csrc_entry *ent;
+	bool video = dec->mtype == FRAME_MEDIA_VIDEO;
+	int err = 0;
+
+	if (csrc == 0 || (!dec->pf && !cache_find(dec, csrc))) {
+		ent = &dec->def;
+	}
+	else if (dec->cur && dec->cur->csrc == csrc) {
+		ent = dec->cur;
+	}
+	else {
+		ent = cache_find(dec, csrc);
+		if (ent) {
+			dec->hits++;
+		}
+		else {
+			ent = cache_insert(dec, csrc);
+			dec->misses++;
+		}
+	}
+
+	if (!ent->userid_hash) {
+		if (ent == &dec->def || !dec->pf)
+			return EAGAIN;
+
+		err = peerflow_get_userid_for_ssrc(dec->pf,
+						   csrc,
+						   video,
+						   NULL,
+						   NULL,
+						   &ent->userid_hash);
+		if (err) {
+			cache_remove(dec, ent);
+			return err;
+		}
+	}
+
+	if (!ent->iv_ready) {
+		err = keystore_generate_iv(dec->keystore,
+					   ent->userid_hash,
+					   video ? "video_iv" : "audio_iv",
+					   ent->iv,
+					   IV_SIZE);
+		if (err)
+			return err;
+
+		ent->iv_ready = true;
+		ent->frame_dec = false;
+
+		info("frame_dec(%p): decrypt: first frame received "
+		     "type: %s uid: %s csrc: %u\n",
+		     dec,
+		     frame_type_name(dec->mtype),
+		     ent->userid_hash,
+		     csrc);
+		keystore_set_decrypt_attempted(dec->keystore);
+	}
+
+	ent->used = ++dec->used;
+	dec->cur = ent;
+	*pent = ent;
+
+	return 0;
+}
+
+/* Set up the entry for the key and cipher suite of a frame */
+static int entry_set_key(struct frame_decryptor *dec,
+			 struct csrc_entry *ent,
+			 uint64_t kid,
+			 uint8_t suite)
+{
+	uint8_t key[E2EE_SESSIONKEY_SIZE];
+	int err = 0;
+
+	if (suite != ent->suite)
+		entry_reset_ctx(ent);
+
+	if (kid == ent->kidx && (ent->ctx || ent->key_ready))
+		return 0;
+
+	if (keystore_get_media_key(dec->keystore, kid, key, sizeof(key)) != 0) {
+		//warning("frame_dec(%p): decrypt: cant find key %u\n", dec, kid);
+		err = EAGAIN;
+		goto out;
+	}
+
+	switch (suite) {
+
+	case FRAME_CIPHER_AES_256_GCM:
+		if (!ent->ctx) {
+			ent->ctx = EVP_CIPHER_CTX_new();
+			if (!ent->ctx) {
+				err = ENOMEM;
+				goto out;
+			}
+			if (!EVP_DecryptInit_ex(ent->ctx, EVP_aes_256_gcm(),
+						NULL, key, NULL))
+				warning("frame_dec(%p): decrypt: init 256_gcm failed\n", dec);
+		}
+		else if (!EVP_DecryptInit_ex(ent->ctx, NULL, NULL, key, NULL)) {
+			warning("frame_dec(%p): decrypt: rekey failed\n", dec);
+		}
+		break;
+
+	case FRAME_CIPHER_CHACHA20_POLY1305:
+		memcpy(ent->key, key, sizeof(ent->key));
+		ent->key_ready = true;
+		break;
+
+	default:
+		warning("frame_dec(%p): decrypt: unknown cipher suite %u\n",
+			dec, suite);
+		err = ENOTSUP;
+		goto out;
+	}
+
+	if (suite != ent->suite) {
+		info("frame_dec(%p): decrypt: type: %s csrc: %u using %s\n",
+		     dec,
+		     frame_type_name(dec->mtype),
+		     ent->csrc,
+		     frame_cipher_suite_name((enum frame_cipher_suite)suite));
+	}
+
+	ent->suite = suite;
+	ent->kidx = kid;
+
+out:
+	sodium_memzero(key, E2EE_SESSIONKEY_SIZE);
+	return err;
+}
+
+static int open_aes(struct frame_decryptor *dec,
+		    struct csrc_entry *ent,
+		    const uint8_t *iv,
+		    const uint8_t *hdr,
+		    size_t hsize,
+		    const uint8_t *enc,
+		    int enc_size,
+		    uint8_t *dst,
+		    size_t *dstsz)
+{
+	const uint8_t *tag = enc + enc_size;
+	int dec_len = 0, blk_len = 0;
+
+	if (!EVP_DecryptInit_ex(ent->ctx, NULL, NULL, NULL, iv)) {
+		warning("frame_dec(%p): decrypt: init failed\n", dec);
+		return EIO;
+	}
+
+	if (!EVP_CIPHER_CTX_ctrl(ent->ctx, EVP_CTRL_GCM_SET_TAG, TAG_SIZE, (uint8_t*)tag)) {
+		warning("frame_dec(%p): decrypt: set tag failed\n", dec);
+		return EIO;
+	}
+	
+	if (!EVP_DecryptUpdate(ent->ctx, NULL, &dec_len, hdr, (int)hsize)) {
+		warning("frame_dec(%p): decrypt: add header failed\n", dec);
+		return EIO;
+	}
+	if (!EVP_DecryptUpdate(ent->ctx, dst, &dec_len, enc, enc_size)) {
+		warning("frame_dec(%p): decrypt: update failed\n", dec);
+		return EIO;
+	}
+	
+	if (!EVP_DecryptFinal_ex(ent->ctx, dst + dec_len, &blk_len)) {
+	        warning("frame_dec(%p): decrypt: final failed key-id=%llu\n",
+			dec, ent->kidx);
+		return EIO;
+	}
+
+	*dstsz = dec_len + blk_len;
+
+	return 0;
+}
+
+static int open_chacha(struct frame_decryptor *dec,
+		       struct csrc_entry *ent,
+		       const uint8_t *iv,
+		       const uint8_t *hdr,
+		       size_t hsize,
+		       const uint8_t *enc,
+		       int enc_size,
+		       uint8_t *dst,
+		       size_t *dstsz)
+{
+	const uint8_t *tag = enc + enc_size;
+
+	if (enc_size < 0)
+		return EIO;
+
+	if (crypto_aead_chacha20poly1305_ietf_decrypt_detached(dst,
+							       NULL,
+							       enc,
+							       enc_size,
+							       tag,
+							       hdr,
+							       hsize,
+							       iv,
+							       ent->key)) {
+	        warning("frame_dec(%p): decrypt: chacha failed key-id=%llu\n",
+			dec, ent->kidx);
+		return EIO;
+	}
+
+	*dstsz = enc_size;
+
+	return 0;
+}
+
 int frame_decryptor_decrypt(struct frame_decryptor *dec,
 			    uint32_t csrc,
 			    const uint8_t *src,
@@ -135,17 +569,17 @@ int frame_decryptor_decrypt(struct frame_decryptor *dec,
 			    uint8_t *dst,
 			    size_t *dstsz)
 {
-	uint8_t key[E2EE_SESSIONKEY_SIZE];
+	struct csrc_entry *ent = NULL;
 	uint8_t iv[IV_SIZE];
-	int dec_len = 0, blk_len = 0;
-	const uint8_t *enc, *tag;
+	const uint8_t *enc;
 	int enc_size;
 	uint64_t frameid = 0;
 	uint32_t fid32 = 0;
 	uint64_t kid = 0;
 	uint32_t fcsrc = 0;
+	struct frame_hdr_ext ext;
+	uint8_t suite = 0;
 	size_t hsize = 0;
-	bool new_user = false;
 	uint32_t frm_res = (dec->mtype == FRAME_MEDIA_VIDEO) ? 15 : 50;
 	int err = 0;
 
@@ -158,164 +592,115 @@ int frame_decryptor_decrypt(struct frame_decryptor *dec,
 		goto out;
 	}
 
-	err = frame_hdr_read(src, srcsz, &frameid, &kid, &fcsrc, &hsize);
+	err = frame_hdr_read_ext(src, srcsz, &frameid, &kid, &fcsrc,
+				 &ext, &hsize);
 	if (err)
 		goto out;
 
+	suite = ext.suite;
 	fid32 = (uint32_t)frameid;
 
 	if (fcsrc)
 		csrc = fcsrc;
-	if (csrc != 0 && csrc != dec->csrc && dec->pf) {
-		dec->userid_hash = mem_deref(dec->userid_hash);
-
-		if (dec->frame_count) {
-			err = peerflow_inc_frame_count(dec->pf,
-						       csrc,
-						       dec->mtype == FRAME_MEDIA_VIDEO,
-						       dec->frame_count);
-			if (err)
-				goto out;
-		}
-		err = peerflow_get_userid_for_ssrc(dec->pf,
-						   csrc,
-						   dec->mtype == FRAME_MEDIA_VIDEO,
-						   NULL,
-						   NULL,
-						   &dec->userid_hash);
-		if (err) 
-			goto out;
-
-		new_user = true;
-		dec->csrc = csrc;
-		dec->frame_recv = true;
-		dec->frame_count = 0;
-	}
-	else if (!dec->frame_recv) {
-		new_user = true;
-		dec->frame_recv = true;
-		dec->frame_dec = false;
-	}
 
-	if(new_user) {
-		const char *typename;
-		typename = dec->mtype == FRAME_MEDIA_VIDEO ? "video_iv" : "audio_iv";
-
-		if (!dec->userid_hash) {
+	err = lookup_entry(dec, csrc, &ent);
+	if (err) {
+		ent = NULL;
+		if (err == ENOENT)
 			err = EAGAIN;
-			goto out;
-		}
-		err = keystore_generate_iv(dec->keystore,
-					   dec->userid_hash,
-					   typename,
-					   dec->iv,
-					   IV_SIZE);
-		if (err) 
-			goto out;
-
-		info("frame_dec(%p): decrypt: first frame received "
-		     "type: %s uid: %s fid: %u kid: %llu csrc: %u\n",
-		     dec,
-		     frame_type_name(dec->mtype),
-		     dec->userid_hash,
-		     fid32,
-		     kid,
-		     csrc);
-		dec->frame_dec = false;
-		keystore_set_decrypt_attempted(dec->keystore);
+		goto out;
 	}
 
-	err = frame_encryptor_xor_iv(dec->iv, fid32, kid, iv, IV_SIZE);
+	err = frame_encryptor_xor_iv(ent->iv, fid32, kid, iv, IV_SIZE);
 	if (err) {
 		goto out;
 	}
 
 	enc = src + hsize;
 	enc_size = srcsz - hsize - TAG_SIZE;
-	tag = enc + enc_size;
-
-	if (kid != dec->kidx && dec->ctx) {
-		EVP_CIPHER_CTX_free(dec->ctx);
-		dec->ctx = NULL;
-	}
-
-	if (!dec->ctx) {
-		if (keystore_get_media_key(dec->keystore, kid, key, sizeof(key)) != 0) {
-			//warning("frame_dec(%p): decrypt: cant find key %u\n", dec, kid);
-			err = EAGAIN;
-			goto out;
-		}
-
-		dec->ctx = EVP_CIPHER_CTX_new();
-		if (!EVP_DecryptInit_ex(dec->ctx, EVP_aes_256_gcm(), NULL, key, NULL))
-			warning("frame_dec(%p): decrypt: init 256_gcm failed\n", dec);
-			
-		dec->kidx = kid;
-	}
 
-	if (!EVP_DecryptInit_ex(dec->ctx, NULL, NULL, NULL, iv)) {
-		warning("frame_dec(%p): decrypt: init failed\n", dec);
-		err = EIO;
+	err = entry_set_key(dec, ent, kid, suite);
+	if (err)
 		goto out;
-	}
 
-	if (!EVP_CIPHER_CTX_ctrl(dec->ctx, EVP_CTRL_GCM_SET_TAG, TAG_SIZE, (uint8_t*)tag)) {
-		warning("frame_dec(%p): decrypt: set tag failed\n", dec);
-		err = EIO;
-		goto out;
-	}
-	
-	if (!EVP_DecryptUpdate(dec->ctx, NULL, &dec_len, src, (int)hsize)) {
-		warning("frame_dec(%p): decrypt: add header failed\n", dec);
-		err = EIO;
-		goto out;
+	if (suite == FRAME_CIPHER_CHACHA20_POLY1305) {
+		err = open_chacha(dec, ent, iv, src, hsize,
+				  enc, enc_size, dst, dstsz);
 	}
-	if (!EVP_DecryptUpdate(dec->ctx, dst, &dec_len, enc, enc_size)) {
-		warning("frame_dec(%p): decrypt: update failed\n", dec);
-		err = EIO;
-		goto out;
+	else {
+		err = open_aes(dec, ent, iv, src, hsize,
+			       enc, enc_size, dst, dstsz);
 	}
-	
-	if (!EVP_DecryptFinal_ex(dec->ctx, dst + dec_len, &blk_len)) {
-	        warning("frame_dec(%p): decrypt: final failed key-id=%llu\n", dec, kid);
-		err = EIO;
+	if (err)
 		goto out;
-	}
 
-	*dstsz = dec_len + blk_len;
+	if (ext.has_ts)
+		entry_add_latency(ent, &ext);
+
+	ent->frame_count++;
+	if (ent->frame_count >= frm_res)
+		entry_flush_frames(dec, ent);
 
-	dec->frame_count++;
-	if (dec->pf && dec->frame_count >= frm_res) {
-		err = peerflow_inc_frame_count(dec->pf,
-					       csrc,
-					       dec->mtype == FRAME_MEDIA_VIDEO,
-					       dec->frame_count);
-		dec->frame_count = 0;
-		if (err)
-			goto out;
-	}
 out:
-	sodium_memzero(key, E2EE_SESSIONKEY_SIZE);
-	if (err != 0 && dec->ctx) {
-		EVP_CIPHER_CTX_free(dec->ctx);
-		dec->ctx = NULL;
+	if (err != 0 && ent) {
+		entry_reset_ctx(ent);
+
+		/* The SSRC may have been reassigned to a different user,
+		 * resolve it again on the next frame.
+		 */
+		if (err == EIO && ent != &dec->def)
+			cache_remove(dec, ent);
 	}
 
-	if (!err && !dec->frame_dec) {
+	if (!err && !ent->frame_dec) {
 		info("frame_dec(%p): decrypt: first frame decrypted "
 		     "type: %s uid: %s fid: %u csrc: %u\n",
 		     dec,
 		     frame_type_name(dec->mtype),
-		     dec->userid_hash,
+		     ent->userid_hash,
 		     fid32,
-		     dec->csrc);
-		dec->frame_dec = true;
+		     ent->csrc);
+		ent->frame_dec = true;
 		keystore_set_decrypt_successful(dec->keystore);
 	}
 
 	return err;
 }
 
+void frame_decryptor_get_cache_stats(struct frame_decryptor *dec,
+				     uint32_t *hits,
+				     uint32_t *misses,
+				     uint32_t *evictions)
+{
+	if (!dec)
+		return;
+
+	if (hits)
+		*hits = dec->hits;
+	if (misses)
+		*misses = dec->misses;
+	if (evictions)
+		*evictions = dec->evictions;
+}
+
+int frame_decryptor_get_latency(struct frame_decryptor *dec,
+				uint32_t csrc,
+				struct stats_latency *sl)
+{
+	struct csrc_entry *ent;
+
+	if (!dec || !sl)
+		return EINVAL;
+
+	ent = csrc ? cache_find(dec, csrc) : &dec->def;
+	if (!ent)
+		return ENOENT;
+
+	*sl = ent->lat;
+
+	return 0;
+}
+
 size_t frame_decryptor_max_size(struct frame_decryptor *dec,
 				size_t srcsz)
 {
@@ -22,6 +22,7 @@
 #include <openssl/evp.h>
 #include <sodium.h>
 #include <assert.h>
+#include <time.h>
 
 static const size_t BLOCK_SIZE = 32;
 static const size_t TAG_SIZE   = 16;
@@ -33,10 +34,16 @@ struct frame_encryptor
 	uint64_t kidx;
 	uint64_t frameid;
 	EVP_CIPHER_CTX *ctx;
+	enum frame_cipher_suite suite;
+	uint8_t key[E2EE_SESSIONKEY_SIZE];
+	bool key_ready;
 	struct keystore *keystore;
 	uint8_t iv[IV_SIZE];
 	enum frame_media_type mtype;
 
+	bool probe;
+	uint16_t probe_seq;
+
 	bool frame_recv;
 	bool frame_enc;
 	uint64_t updated_ts;
@@ -51,6 +58,7 @@ static void destructor(void *arg)
 		EVP_CIPHER_CTX_free(enc->ctx);
 		enc->ctx = NULL;
 	}
+	sodium_memzero(enc->key, sizeof(enc->key));
 }
 
 const char *frame_type_name(enum frame_media_type mtype)
@@ -66,6 +74,33 @@ const char *frame_type_name(enum frame_media_type mtype)
 	return "unknown";
 }
 
+const char *frame_cipher_suite_name(enum frame_cipher_suite suite)
+{
+	switch(suite) {
+	case FRAME_CIPHER_AES_256_GCM:
+		return "aes-256-gcm";
+
+	case FRAME_CIPHER_CHACHA20_POLY1305:
+		return "chacha20-poly1305";
+	}
+
+	return "unknown";
+}
+
+enum frame_cipher_suite frame_cipher_suite_preferred(void)
+{
+	if (sodium_init() < 0)
+		return FRAME_CIPHER_AES_256_GCM;
+
+	/* libsodium only offers AES-GCM with hardware support, which makes
+	 * it a good proxy for whether OpenSSL's AES will be fast
+	 */
+	if (crypto_aead_aes256gcm_is_available())
+		return FRAME_CIPHER_AES_256_GCM;
+	else
+		return FRAME_CIPHER_CHACHA20_POLY1305;
+}
+
 int frame_encryptor_xor_iv(const uint8_t *srciv,
 			   uint32_t frameid,
 			   uint32_t keyid,
@@ -153,39 +188,51 @@ int frame_encryptor_set_keystore(struct frame_encryptor *enc,
 	return err;
 }
 
-int frame_encryptor_encrypt(struct frame_encryptor *enc,
-			    uint32_t ssrc,
-			    const uint8_t *src,
-			    size_t srcsz,
-			    uint8_t *dst,
-			    size_t *dstsz)
+static void encryptor_reset(struct frame_encryptor *enc)
 {
-	int32_t enc_len = 0, blk_len = 0;
-	uint8_t iv[IV_SIZE];
-	uint8_t *tag;
+	if (enc->ctx) {
+		EVP_CIPHER_CTX_free(enc->ctx);
+		enc->ctx = NULL;
+	}
+	sodium_memzero(enc->key, sizeof(enc->key));
+	enc->key_ready = false;
+}
+
+void frame_encryptor_set_latency_probe(struct frame_encryptor *enc,
+				       bool enable)
+{
+	if (!enc)
+		return;
+
+	info("frame_enc(%p): set_latency_probe: %d\n", enc, enable);
+	enc->probe = enable;
+}
+
+uint32_t frame_latency_clock_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	return (uint32_t)((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/* Fetch the current key and set up the cipher context for it */
+static int encryptor_prepare(struct frame_encryptor *enc,
+			     uint64_t *pkid)
+{
+	uint8_t key[E2EE_SESSIONKEY_SIZE];
+	enum frame_cipher_suite suite;
 	uint64_t kid = 0;
 	uint64_t updated_ts = 0;
 	uint32_t kid32 = 0;
-	size_t hlen = 0;
-	uint8_t key[E2EE_SESSIONKEY_SIZE];
 	int err = 0;
 
-	enc->frameid = (enc->frameid + 1) & 0xFFFFFFFF;
-
 	if (!enc->keystore) {
 		return EINVAL;
 	}
 
-	if (!enc->frame_recv) {
-		info("frame_enc(%p): encrypt: first frame received "
-		     "type: %s uid: %s fid: %u ssrc: %u\n",
-		     enc,
-		     frame_type_name(enc->mtype),
-		     enc->userid_hash,
-		     enc->frameid,
-		     ssrc);
-		enc->frame_recv = true;
-	}
+	memset(key, 0, sizeof(key));
 
 	err = keystore_get_current(enc->keystore, &kid32, &updated_ts);
 	if (err) {
@@ -196,12 +243,14 @@ int frame_encryptor_encrypt(struct frame_encryptor *enc,
 	}
 	kid = (uint64_t)kid32;
 
-	if (enc->ctx && (kid != enc->kidx || updated_ts != enc->updated_ts)) {
-		EVP_CIPHER_CTX_free(enc->ctx);
-		enc->ctx = NULL;
+	suite = (enum frame_cipher_suite)keystore_get_cipher_suite(enc->keystore);
+
+	if (kid != enc->kidx || updated_ts != enc->updated_ts ||
+	    suite != enc->suite) {
+		encryptor_reset(enc);
 	}
 
-	if (!enc->ctx) {
+	if (!enc->ctx && !enc->key_ready) {
 		err = keystore_get_media_key(enc->keystore, kid, key, sizeof(key));
 		if (err) {
 			err = EAGAIN;
@@ -210,23 +259,76 @@ int frame_encryptor_encrypt(struct frame_encryptor *enc,
 			goto out;
 		}
 		//info("frame_encryptor(%p): encrypting with kid=%llu\n", enc, kid);
-		enc->ctx = EVP_CIPHER_CTX_new();
-		EVP_EncryptInit_ex(enc->ctx, EVP_aes_256_gcm(), NULL, key, NULL);
+		if (suite == FRAME_CIPHER_CHACHA20_POLY1305) {
+			memcpy(enc->key, key, sizeof(enc->key));
+			enc->key_ready = true;
+		}
+		else {
+			enc->ctx = EVP_CIPHER_CTX_new();
+			EVP_EncryptInit_ex(enc->ctx, EVP_aes_256_gcm(),
+					   NULL, key, NULL);
+		}
+		if (suite != enc->suite) {
+			info("frame_enc(%p): type: %s using %s\n",
+			     enc,
+			     frame_type_name(enc->mtype),
+			     frame_cipher_suite_name(suite));
+		}
+		enc->suite = suite;
 		enc->kidx = kid;
 		enc->updated_ts = updated_ts;
 	}
 
-	hlen = frame_hdr_write(dst,
-			       frame_encryptor_max_size(enc, srcsz),
-			       enc->frameid,
-			       kid,
-			       ssrc);
+	*pkid = kid;
+out:
+	sodium_memzero(key, E2EE_SESSIONKEY_SIZE);
+	return err;
+}
 
-	err = frame_encryptor_xor_iv(enc->iv, enc->frameid, kid, iv, IV_SIZE);
-	if (err) {
+static int seal_chacha(struct frame_encryptor *enc,
+		       const uint8_t *iv,
+		       const uint8_t *src,
+		       size_t srcsz,
+		       uint8_t *dst,
+		       size_t hlen,
+		       size_t *dstsz)
+{
+	uint8_t *tag = dst + hlen + srcsz;
+	int err = 0;
+
+	if (crypto_aead_chacha20poly1305_ietf_encrypt_detached(dst + hlen,
+							       tag,
+							       NULL,
+							       src,
+							       srcsz,
+							       dst,
+							       hlen,
+							       NULL,
+							       iv,
+							       enc->key)) {
+		warning("frame_enc(%p): encrypt: chacha failed\n", enc);
+		err = EBADF;
 		goto out;
 	}
 
+	*dstsz = hlen + srcsz + TAG_SIZE;
+
+out:
+	return err;
+}
+
+static int seal_aes(struct frame_encryptor *enc,
+		    const uint8_t *iv,
+		    const uint8_t *src,
+		    size_t srcsz,
+		    uint8_t *dst,
+		    size_t hlen,
+		    size_t *dstsz)
+{
+	int32_t enc_len = 0, blk_len = 0;
+	uint8_t *tag;
+	int err = 0;
+
 	if (!EVP_EncryptInit_ex(enc->ctx, NULL, NULL, NULL, iv)) {
 		warning("frame_enc(%p): encrypt: init failed\n", enc);
 		err = ENOSYS;
@@ -264,7 +366,67 @@ int frame_encryptor_encrypt(struct frame_encryptor *enc,
 
 	*dstsz = hlen + enc_len + TAG_SIZE;
 
-	if (!err && !enc->frame_enc) {
+out:
+	return err;
+}
+
+/* Write the header and ciphertext of the current frame id into dst */
+static int encryptor_seal(struct frame_encryptor *enc,
+			  uint64_t kid,
+			  uint32_t ssrc,
+			  const uint8_t *src,
+			  size_t srcsz,
+			  uint8_t *dst,
+			  size_t dstmax,
+			  size_t *dstsz)
+{
+	struct frame_hdr_ext ext;
+	uint8_t iv[IV_SIZE];
+	size_t hlen = 0;
+	int err = 0;
+
+	memset(&ext, 0, sizeof(ext));
+	ext.suite = (uint8_t)enc->suite;
+	if (enc->probe) {
+		ext.has_ts = true;
+		ext.ts = frame_latency_clock_ms();
+		ext.seq = enc->probe_seq++;
+	}
+
+	hlen = frame_hdr_write_ext(dst,
+				   dstmax,
+				   enc->frameid,
+				   kid,
+				   ssrc,
+				   &ext);
+
+	err = frame_encryptor_xor_iv(enc->iv, enc->frameid, kid, iv, IV_SIZE);
+	if (err) {
+		return err;
+	}
+
+	if (enc->suite == FRAME_CIPHER_CHACHA20_POLY1305)
+		return seal_chacha(enc, iv, src, srcsz, dst, hlen, dstsz);
+	else
+		return seal_aes(enc, iv, src, srcsz, dst, hlen, dstsz);
+}
+
+static void encryptor_log_first(struct frame_encryptor *enc,
+				uint32_t ssrc,
+				bool encrypted)
+{
+	if (!encrypted && !enc->frame_recv) {
+		info("frame_enc(%p): encrypt: first frame received "
+		     "type: %s uid: %s fid: %u ssrc: %u\n",
+		     enc,
+		     frame_type_name(enc->mtype),
+		     enc->userid_hash,
+		     enc->frameid,
+		     ssrc);
+		enc->frame_recv = true;
+	}
+
+	if (encrypted && !enc->frame_enc) {
 		info("frame_enc(%p): encrypt: first frame encrypted "
 		     "type: %s uid: %s fid: %u ssrc: %u\n",
 		     enc,
@@ -274,8 +436,95 @@ int frame_encryptor_encrypt(struct frame_encryptor *enc,
 		     ssrc);
 		enc->frame_enc = true;
 	}
+}
+
+int frame_encryptor_encrypt(struct frame_encryptor *enc,
+			    uint32_t ssrc,
+			    const uint8_t *src,
+			    size_t srcsz,
+			    uint8_t *dst,
+			    size_t *dstsz)
+{
+	uint64_t kid = 0;
+	int err = 0;
+
+	enc->frameid = (enc->frameid + 1) & 0xFFFFFFFF;
+
+	if (!enc->keystore) {
+		return EINVAL;
+	}
+
+	encryptor_log_first(enc, ssrc, false);
+
+	err = encryptor_prepare(enc, &kid);
+	if (err)
+		return err;
+
+	err = encryptor_seal(enc, kid, ssrc, src, srcsz,
+			     dst, frame_encryptor_max_size(enc, srcsz),
+			     dstsz);
+	if (!err)
+		encryptor_log_first(enc, ssrc, true);
+
+	return err;
+}
+
+int frame_encryptor_encrypt_batch(struct frame_encryptor *enc,
+				  struct frame_batch *frames,
+				  size_t count,
+				  uint8_t *arena,
+				  size_t arenasz,
+				  size_t *used)
+{
+	uint64_t kid = 0;
+	size_t pos = 0;
+	size_t i;
+	int err = 0;
+
+	if (!enc || !frames || !arena)
+		return EINVAL;
+
+	if (!enc->keystore)
+		return EINVAL;
+
+	if (count == 0)
+		goto out;
+
+	encryptor_log_first(enc, frames[0].ssrc, false);
+
+	err = encryptor_prepare(enc, &kid);
+	if (err)
+		goto out;
+
+	for (i = 0; i < count; i++) {
+		struct frame_batch *fb = &frames[i];
+		size_t maxsz = frame_encryptor_max_size(enc, fb->srcsz);
+
+		fb->dst = NULL;
+		fb->dstsz = 0;
+
+		if (pos + maxsz > arenasz) {
+			err = ENOMEM;
+			goto out;
+		}
+
+		enc->frameid = (enc->frameid + 1) & 0xFFFFFFFF;
+		err = encryptor_seal(enc, kid, fb->ssrc,
+				     fb->src, fb->srcsz,
+				     arena + pos, maxsz, &fb->dstsz);
+		if (err)
+			goto out;
+
+		fb->dst = arena + pos;
+		pos += fb->dstsz;
+	}
+
+	encryptor_log_first(enc, frames[0].ssrc, true);
+
 out:
-	sodium_memzero(key, E2EE_SESSIONKEY_SIZE);
+	if (used)
+		*used = pos;
+
 	return err;
 }
 
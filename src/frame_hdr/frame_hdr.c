@@ -41,6 +41,10 @@ Extensions
 +-+-+-+-+-+-+-+-+---------------------------+
 |M| ELN |  EID  |   VAL... (length=ELEN)    |
 +-+-+-+-+-+-+-+-+---------------------------+
+
+EID 1: CSRC of the sender (4 bytes)
+EID 2: cipher suite (1 byte), AES-256-GCM when absent
+EID 3: sender timestamp in ms (4 bytes) and sequence number (2 bytes)
 */
 
 #define HDR_VERSION 0
@@ -120,13 +124,54 @@ size_t frame_hdr_write(uint8_t  *buf,
 		       uint64_t frame,
 		       uint64_t key,
 		       uint32_t csrc)
+{
+	return frame_hdr_write_suite(buf, bsz, frame, key, csrc, 0);
+}
+
+size_t frame_hdr_write_suite(uint8_t  *buf,
+			     size_t   bsz,
+			     uint64_t frame,
+			     uint64_t key,
+			     uint32_t csrc,
+			     uint8_t  suite)
+{
+	struct frame_hdr_ext ext;
+
+	memset(&ext, 0, sizeof(ext));
+	ext.suite = suite;
+
+	return frame_hdr_write_ext(buf, bsz, frame, key, csrc, &ext);
+}
+
+/* Write one extension, flagging the previous one as not the last */
+static size_t write_ext(uint8_t *buf, size_t p, size_t *last,
+			uint8_t eid, uint8_t len, uint64_t val)
+{
+	if (*last)
+		buf[*last] |= 0x80;
+	*last = p;
+
+	buf[p] = (len - 1) << 4 | eid;
+
+	return 1 + write_bytes(buf + p + 1, len, val);
+}
+
+size_t frame_hdr_write_ext(uint8_t  *buf,
+			   size_t   bsz,
+			   uint64_t frame,
+			   uint64_t key,
+			   uint32_t csrc,
+			   const struct frame_hdr_ext *hext)
 {
 	uint8_t sig = 0;
 	uint8_t x = 0;
 	uint8_t klen, flen;
 	size_t p = 2;
-	uint8_t ext = csrc ? 1 : 0;
-	size_t xsz = csrc ? 5 : 0;
+	size_t last = 0;
+	uint8_t suite = hext ? hext->suite : 0;
+	bool ts = hext ? hext->has_ts : false;
+	size_t xsz = (csrc ? 5 : 0) + (suite ? 2 : 0) + (ts ? 7 : 0);
+	uint8_t ext = xsz ? 1 : 0;
 	size_t hsz, ksz;
 
 	if (key > 7) {
@@ -152,11 +197,15 @@ size_t frame_hdr_write(uint8_t  *buf,
 	}
 	p += write_bytes(buf + p, flen, frame);
 
-	if (csrc) {
-		buf[p] = 0x31;
-		p++;
-		write_bytes(buf + p, 4, csrc);
-		p += 4;
+	if (csrc)
+		p += write_ext(buf, p, &last, FRAME_HDR_EXT_CSRC, 4, csrc);
+
+	if (suite)
+		p += write_ext(buf, p, &last, FRAME_HDR_EXT_SUITE, 1, suite);
+
+	if (ts) {
+		p += write_ext(buf, p, &last, FRAME_HDR_EXT_TS, 6,
+			       (uint64_t)hext->ts << 16 | hext->seq);
 	}
 
 	return p;
@@ -170,6 +219,39 @@ int frame_hdr_read(const uint8_t *buf,
 		   uint32_t *csrc,
 		   size_t *rlen)
 {
+	struct frame_hdr_ext ext;
+
+	return frame_hdr_read_ext(buf, bsz, frameid, key, csrc,
+				  &ext, rlen);
+}
+
+int frame_hdr_read_suite(const uint8_t *buf,
+			 size_t   bsz,
+			 uint64_t *frameid,
+			 uint64_t *key,
+			 uint32_t *csrc,
+			 uint8_t  *suite,
+			 size_t *rlen)
+{
+	struct frame_hdr_ext ext;
+	int err;
+
+	err = frame_hdr_read_ext(buf, bsz, frameid, key, csrc,
+				 &ext, rlen);
+	*suite = ext.suite;
+
+	return err;
+}
+
+int frame_hdr_read_ext(const uint8_t *buf,
+		       size_t   bsz,
+		       uint64_t *frameid,
+		       uint64_t *key,
+		       uint32_t *csrc,
+		       struct frame_hdr_ext *hext,
+		       size_t *rlen)
+{
+	uint64_t tsval;
 	uint8_t x = 0;
 	uint8_t klen, flen, elen;
 	size_t p = FRAME_HDR_MINSZ;
@@ -177,6 +259,7 @@ int frame_hdr_read(const uint8_t *buf,
 	uint64_t csrc64;
 	uint32_t i = 0;
 
+	memset(hext, 0, sizeof(*hext));
 	ext = buf[0] & 0x10;
 	flen = ((buf[1] >> 4) & 7) + 1;
 	x = (buf[1] >> 3) & 1;
@@ -206,13 +289,22 @@ int frame_hdr_read(const uint8_t *buf,
 
 		eid = b & 0x0f;
 
-		if (eid == 0x01 && elen == 4) {
+		if (eid == FRAME_HDR_EXT_CSRC && elen == 4) {
 			if (bsz < p + 5)
 				return ERANGE;
 			
 			read_bytes(buf + p + 1, 4, &csrc64);
 			*csrc = csrc64;
 		}
+		else if (eid == FRAME_HDR_EXT_SUITE && elen == 1) {
+			hext->suite = buf[p + 1];
+		}
+		else if (eid == FRAME_HDR_EXT_TS && elen == 6) {
+			read_bytes(buf + p + 1, 6, &tsval);
+			hext->has_ts = true;
+			hext->ts = (uint32_t)(tsval >> 16);
+			hext->seq = (uint16_t)tsval;
+		}
 		p += elen + 1;
 		i++;
 	}
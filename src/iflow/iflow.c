@@ -39,6 +39,7 @@ void iflow_set_functions(struct iflow *iflow,
 			 iflow_sync_decoders	        *sync_decoders,
 			 iflow_set_keystore		*set_keystore,
 			 iflow_dce_send			*dce_send,
+			 iflow_dce_send_batch		*dce_send_batch,
 			 iflow_stop_media		*stop_media,
 			 iflow_close			*close,
 			 iflow_get_stats		*get_stats,
@@ -69,6 +70,7 @@ void iflow_set_functions(struct iflow *iflow,
 	iflow->sync_decoders            = sync_decoders;
 	iflow->set_keystore		= set_keystore;
 	iflow->dce_send			= dce_send;
+	iflow->dce_send_batch		= dce_send_batch;
 	iflow->stop_media		= stop_media;
 	iflow->close			= close;
 	iflow->get_stats		= get_stats;
@@ -151,6 +153,56 @@ int iflow_render_frameh(struct avs_vidframe *frame,
 	return EINVAL;
 }
 
+
+/* Render streams identify the remote video by a handle, the user
+ * behind a handle is only announced when it changes.
+ */
+static struct {
+	iflow_render_stream_h *streamh;
+	iflow_render_stream_frame_h *frameh;
+	void *arg;
+} rstream = {
+	NULL,
+	NULL,
+	NULL
+};
+
+
+void iflow_set_render_stream_handlers(iflow_render_stream_h *streamh,
+				      iflow_render_stream_frame_h *frameh,
+				      void *arg)
+{
+	rstream.streamh = streamh;
+	rstream.frameh = frameh;
+	rstream.arg = arg;
+}
+
+
+bool iflow_render_stream_enabled(void)
+{
+	return rstream.frameh != NULL;
+}
+
+
+void iflow_render_streamh(uint32_t handle,
+			  const char *userid,
+			  const char *clientid)
+{
+	if (rstream.streamh) {
+		rstream.streamh(handle, userid, clientid, rstream.arg);
+	}
+}
+
+
+int iflow_render_stream_frameh(struct avs_vidframe *frame,
+			       uint32_t handle)
+{
+	if (rstream.frameh) {
+		return rstream.frameh(frame, handle, rstream.arg);
+	}
+	return EINVAL;
+}
+
 struct {
 	iflow_allocf	*alloc;
 	iflow_destroyf	*destroy;
@@ -236,3 +288,29 @@ int iflow_alloc(struct iflow		**flowp,
 			     extarg);
 }
 
+
+/* Send several messages on the data channel at once. Flows without
+ * a batch function get one dce_send per message.
+ */
+int iflow_dce_send_batch(struct iflow *flow,
+			 struct mbuf * const *mbv, size_t mbc)
+{
+	size_t i;
+	int err = 0;
+
+	if (!flow || (mbc && !mbv))
+		return EINVAL;
+
+	if (flow->dce_send_batch)
+		return flow->dce_send_batch(flow, mbv, mbc);
+
+	if (!flow->dce_send)
+		return ENOSYS;
+
+	for (i = 0; i < mbc && !err; ++i) {
+		err = flow->dce_send(flow, mbuf_buf(mbv[i]),
+				     mbuf_get_left(mbv[i]));
+	}
+
+	return err;
+}
@@ -624,6 +624,7 @@ int jsflow_alloc(struct iflow		**flowp,
 			    jsflow_sync_decoders,
 			    jsflow_set_keystore,
 			    jsflow_dce_send,
+			    NULL, // jsflow_dce_send_batch
 			    jsflow_stop_media,
 			    jsflow_close,
 			    jsflow_get_stats,
@@ -441,6 +441,69 @@ struct json_object *jzon_apply(struct json_object *jobj,
 }
 
 
+/*
+ * Array elements are kept in the odict list in index order, so they
+ * can be walked without formatting and hashing an index key for each.
+ */
+struct json_object *jzon_array_first(struct json_object *jarr)
+{
+	struct le *le;
+
+	if (!jarr || jarr->entry.type != ODICT_ARRAY || !jarr->entry.u.odict)
+		return NULL;
+
+	le = list_head(&jarr->entry.u.odict->lst);
+
+	return le ? le->data : NULL;
+}
+
+
+struct json_object *jzon_array_next(struct json_object *jitem)
+{
+	struct le *le;
+
+	if (!jitem)
+		return NULL;
+
+	le = jitem->entry.le.next;
+
+	return le ? le->data : NULL;
+}
+
+
+/* Contiguous view of the array elements, for random access */
+int jzon_array_vector(struct json_object ***vecp, size_t *countp,
+		      struct json_object *jarr)
+{
+	struct json_object **vec;
+	struct json_object *jitem;
+	size_t n, i = 0;
+
+	if (!vecp || !countp || !jarr)
+		return EINVAL;
+
+	if (jarr->entry.type != ODICT_ARRAY || !jarr->entry.u.odict) {
+		warning("jzon: array_vector: not an array\n");
+		return EINVAL;
+	}
+
+	n = list_count(&jarr->entry.u.odict->lst);
+
+	vec = mem_zalloc((n ? n : 1) * sizeof(*vec), NULL);
+	if (!vec)
+		return ENOMEM;
+
+	JZON_ARRAY_FOREACH(jarr, jitem) {
+		vec[i++] = jitem;
+	}
+
+	*vecp = vec;
+	*countp = n;
+
+	return 0;
+}
+
+
 int jzon_add_str(struct json_object *jobj, const char *key,
 		 const char *fmt, ...)
 {
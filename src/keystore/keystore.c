@@ -30,9 +30,17 @@
 #include "avs_keystore.h"
 
 #include <sodium.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
 
 #define NUM_KEYS 16
 
+/* Number of key slots, allows for the previous and current key plus
+ * NUM_KEYS hashed forward keys, or keys from a new era.
+ */
+#define KEY_SLOTS (2 * NUM_KEYS)
+
 const uint8_t SKEY_INFO[] = "session_key";
 const size_t  SKEY_INFO_LEN = 11;
 const uint8_t MKEY_INFO[] = "media_key";
@@ -49,16 +57,50 @@ struct listener
 
 struct keyinfo
 {
-	struct le le;
 	uint8_t skey[E2EE_SESSIONKEY_SIZE];
 	uint8_t mkey[E2EE_SESSIONKEY_SIZE];
 	uint32_t index;
 	uint64_t update_ts;
+	bool used;
+};
+
+/* Media keys needed by the encrypt and decrypt threads, published
+ * under a sequence counter so they can be read without the lock.
+ */
+struct key_snapshot
+{
+	uint64_t update_ts;
+	uint32_t index[2];
+	uint8_t mkey[2][E2EE_SESSIONKEY_SIZE];
+	bool valid[2];
+};
+
+/* Keys hashed forward ahead of time by a background thread, so that
+ * a rotation on the media threads only copies a key.
+ */
+struct lookahead
+{
+	struct keyinfo keys[NUM_KEYS];
+	uint32_t nkeys;
+	uint32_t gen;
+	struct keystore_stats stats;
+
+	pthread_t tid;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool started;
+	bool pending;
+	bool run;
+};
+
+enum {
+	SNAP_PREV = 0,
+	SNAP_CUR  = 1,
 };
 
 struct keystore
 {
-	struct list keyl;
+	struct keyinfo keys[KEY_SLOTS];
 	struct keyinfo *current;
 	bool init;
 	uint8_t *salt;
@@ -75,6 +117,13 @@ struct keystore
 
 	uint64_t update_ts;
 	struct lock *lock;	
+
+	atomic_uint snap_seq;
+	struct key_snapshot snap;
+
+	struct lookahead ahead;
+
+	atomic_int suite;
 };
 
 static int keystore_hash_to_key(struct keystore *ks, uint32_t index);
@@ -83,9 +132,8 @@ static int keystore_derive_session_key(struct keystore *ks,
 				       struct keyinfo **pnext);
 static int keystore_derive_media_key(struct keystore *ks,
 				     struct keyinfo *kinfo);
-static int keystore_append_key(struct keystore *ks,
-			       struct keyinfo *kinfo);
 static int keystore_organise(struct keystore *ks);
+static void lookahead_kick(struct keystore *ks);
 
 
 static bool is_empty(const uint8_t *buf, size_t sz)
@@ -96,33 +144,276 @@ static bool is_empty(const uint8_t *buf, size_t sz)
 	return (buf[0] == 0) && (memcmp(buf, buf + 1, sz - 1) == 0);
 }
 
-static void keyinfo_destructor(void *data)
+static void keyinfo_clear(struct keyinfo *kinfo)
+{
+	sodium_memzero(kinfo, sizeof(*kinfo));
+}
+
+/* Must be called with the write lock held */
+static void lookahead_invalidate(struct keystore *ks)
+{
+	size_t i;
+
+	for (i = 0; i < NUM_KEYS; i++)
+		keyinfo_clear(&ks->ahead.keys[i]);
+
+	ks->ahead.gen++;
+}
+
+static void keystore_clear_keys(struct keystore *ks)
 {
-	struct keyinfo *info = data;
+	size_t i;
+
+	for (i = 0; i < KEY_SLOTS; i++)
+		keyinfo_clear(&ks->keys[i]);
 
-	list_unlink(&info->le);
-	sodium_memzero(info, sizeof(*info));
+	ks->current = NULL;
+	lookahead_invalidate(ks);
+}
+
+static void lookahead_stop(struct keystore *ks)
+{
+	struct lookahead *la = &ks->ahead;
+
+	if (!la->started)
+		return;
+
+	pthread_mutex_lock(&la->mutex);
+	la->run = false;
+	pthread_cond_signal(&la->cond);
+	pthread_mutex_unlock(&la->mutex);
+
+	pthread_join(la->tid, NULL);
+	pthread_mutex_destroy(&la->mutex);
+	pthread_cond_destroy(&la->cond);
+	la->started = false;
 }
 
 static void keystore_destructor(void *data)
 {
 	struct keystore *ks = data;
 
+	lookahead_stop(ks);
+	if (ks->ahead.nkeys) {
+		info("keystore(%p): lookahead hits: %llu misses: %llu "
+		     "derived: %llu in %llu us (max %llu us)\n",
+		     ks,
+		     (unsigned long long)ks->ahead.stats.lookahead_hits,
+		     (unsigned long long)ks->ahead.stats.lookahead_misses,
+		     (unsigned long long)ks->ahead.stats.derived,
+		     (unsigned long long)ks->ahead.stats.derive_us,
+		     (unsigned long long)ks->ahead.stats.derive_max_us);
+	}
+
 	ks->salt = mem_deref(ks->salt);
 	ks->lock = mem_deref(ks->lock);
-	list_flush(&ks->keyl);
+	list_flush(&ks->listeners);
 	sodium_memzero(ks, sizeof(*ks));
 }
 
+static struct keyinfo *keystore_find(struct keystore *ks, uint32_t index)
+{
+	size_t i;
+
+	for (i = 0; i < KEY_SLOTS; i++) {
+		struct keyinfo *kinfo = &ks->keys[(index + i) % KEY_SLOTS];
+
+		if (kinfo->used && kinfo->index == index)
+			return kinfo;
+	}
+
+	return NULL;
+}
+
+/* Find a free slot for a key. When all slots are used, the oldest key
+ * is evicted, other than the current key and the one given in keep.
+ */
+static struct keyinfo *keystore_new_slot(struct keystore *ks,
+					 uint32_t index,
+					 const struct keyinfo *keep)
+{
+	struct keyinfo *oldest = NULL;
+	size_t i;
+
+	for (i = 0; i < KEY_SLOTS; i++) {
+		struct keyinfo *kinfo = &ks->keys[(index + i) % KEY_SLOTS];
+
+		if (!kinfo->used) {
+			kinfo->index = index;
+			kinfo->used = true;
+			return kinfo;
+		}
+
+		if (kinfo == ks->current || kinfo == keep)
+			continue;
+
+		if (!oldest || kinfo->index < oldest->index)
+			oldest = kinfo;
+	}
+
+	if (!oldest)
+		return NULL;
+
+	info("keystore(%p): evicting key 0x%08x for key 0x%08x\n",
+	     ks, oldest->index, index);
+
+	keyinfo_clear(oldest);
+	oldest->index = index;
+	oldest->used = true;
+
+	return oldest;
+}
+
 static struct keyinfo *keystore_get_latest(struct keystore *ks)
 {
-	struct le *le;
+	struct keyinfo *latest = NULL;
+	size_t i;
+
+	for (i = 0; i < KEY_SLOTS; i++) {
+		struct keyinfo *kinfo = &ks->keys[i];
+
+		if (kinfo->used && (!latest || kinfo->index > latest->index))
+			latest = kinfo;
+	}
+
+	return latest;
+}
+
+/* The closest key before (dir < 0) or after (dir > 0) the given index */
+static struct keyinfo *keystore_get_adjacent(struct keystore *ks,
+					     uint32_t index,
+					     int dir)
+{
+	struct keyinfo *adj = NULL;
+	size_t i;
+
+	for (i = 0; i < KEY_SLOTS; i++) {
+		struct keyinfo *kinfo = &ks->keys[i];
+
+		if (!kinfo->used)
+			continue;
+
+		if (dir > 0 && kinfo->index > index &&
+		    (!adj || kinfo->index < adj->index))
+			adj = kinfo;
+		else if (dir < 0 && kinfo->index < index &&
+			 (!adj || kinfo->index > adj->index))
+			adj = kinfo;
+	}
+
+	return adj;
+}
+
+static uint32_t keystore_count(struct keystore *ks)
+{
+	uint32_t n = 0;
+	size_t i;
+
+	for (i = 0; i < KEY_SLOTS; i++) {
+		if (ks->keys[i].used)
+			n++;
+	}
+
+	return n;
+}
+
+static void snapshot_set(struct key_snapshot *snap,
+			 int pos,
+			 const struct keyinfo *kinfo)
+{
+	if (kinfo) {
+		snap->index[pos] = kinfo->index;
+		memcpy(snap->mkey[pos], kinfo->mkey, E2EE_SESSIONKEY_SIZE);
+		snap->valid[pos] = true;
+	}
+	else {
+		snap->index[pos] = 0;
+		sodium_memzero(snap->mkey[pos], E2EE_SESSIONKEY_SIZE);
+		snap->valid[pos] = false;
+	}
+}
+
+/* Must be called with the write lock held */
+static void snapshot_publish(struct keystore *ks)
+{
+	struct keyinfo *prev = NULL;
+
+	if (ks->current)
+		prev = keystore_get_adjacent(ks, ks->current->index, -1);
+
+	atomic_fetch_add_explicit(&ks->snap_seq, 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	ks->snap.update_ts = ks->update_ts;
+	snapshot_set(&ks->snap, SNAP_PREV, prev);
+	snapshot_set(&ks->snap, SNAP_CUR, ks->current);
+
+	atomic_fetch_add_explicit(&ks->snap_seq, 1, memory_order_release);
+}
+
+/* Lock-free read of a media key from the published snapshot.
+ * Returns false if the key is not in the snapshot, or if using it
+ * would move the current key forward.
+ */
+static bool snapshot_get_media_key(struct keystore *ks,
+				   uint32_t index,
+				   uint8_t *pkey,
+				   size_t sz)
+{
+	unsigned s1, s2;
+	bool found;
+	int pos;
+
+	do {
+		s1 = atomic_load_explicit(&ks->snap_seq, memory_order_acquire);
+		if (s1 & 1)
+			continue;
+
+		found = false;
+		for (pos = SNAP_PREV; pos <= SNAP_CUR; pos++) {
+			if (ks->snap.valid[pos] &&
+			    ks->snap.index[pos] == index) {
+				memcpy(pkey, ks->snap.mkey[pos], sz);
+				found = true;
+				break;
+			}
+		}
 
-	le = ks->keyl.head;
-	while (le && le->next)
-		le = le->next;
+		atomic_thread_fence(memory_order_acquire);
+		s2 = atomic_load_explicit(&ks->snap_seq, memory_order_relaxed);
+	} while ((s1 & 1) || s1 != s2);
+
+	return found;
+}
+
+static bool snapshot_get_current(struct keystore *ks,
+				 uint32_t *pindex,
+				 uint64_t *updated_ts)
+{
+	unsigned s1, s2;
+	uint32_t index;
+	uint64_t ts;
+	bool valid;
+
+	do {
+		s1 = atomic_load_explicit(&ks->snap_seq, memory_order_acquire);
+		if (s1 & 1)
+			continue;
+
+		valid = ks->snap.valid[SNAP_CUR];
+		index = ks->snap.index[SNAP_CUR];
+		ts = ks->snap.update_ts;
+
+		atomic_thread_fence(memory_order_acquire);
+		s2 = atomic_load_explicit(&ks->snap_seq, memory_order_relaxed);
+	} while ((s1 & 1) || s1 != s2);
+
+	if (valid) {
+		*pindex = index;
+		*updated_ts = ts;
+	}
 
-	return le ? le->data : NULL;
+	return valid;
 }
 
 int keystore_alloc(struct keystore **pks, bool hash_forward)
@@ -141,6 +432,8 @@ int keystore_alloc(struct keystore **pks, bool hash_forward)
 	if (err)
 		goto out;
 
+	atomic_init(&ks->snap_seq, 0);
+	atomic_init(&ks->suite, 0);
 	ks->update_ts = tmr_jiffies();
 	ks->hash_md = EVP_sha512();
 	ks->hash_forward = hash_forward;
@@ -160,14 +453,14 @@ int keystore_reset_keys(struct keystore *ks)
 
 	info("keystore(%p): reset_keys\n", ks);
 	lock_write_get(ks->lock);
-	list_flush(&ks->keyl);
-	ks->current = NULL;
+	keystore_clear_keys(ks);
 
 	ks->init = false;
 	ks->has_keys = false;
 	ks->decrypt_attempted = false;
 	ks->decrypt_successful = false;
 	ks->err_reported = false;
+	snapshot_publish(ks);
 
 	lock_rel(ks->lock);
 
@@ -182,14 +475,14 @@ int keystore_reset(struct keystore *ks)
 	info("keystore(%p): reset\n", ks);
 	lock_write_get(ks->lock);
 
-	list_flush(&ks->keyl);
-	ks->current = NULL;
+	keystore_clear_keys(ks);
 	ks->init = false;
 	ks->slen = 0;
 	ks->salt = mem_deref(ks->salt);
 	ks->has_keys = false;
 	ks->decrypt_attempted = false;
 	ks->decrypt_successful = false;
+	snapshot_publish(ks);
 
 	lock_rel(ks->lock);
 
@@ -220,8 +513,12 @@ int keystore_set_salt(struct keystore *ks,
 	ks->salt = tsalt;
 	ks->slen = saltlen;
 	ks->update_ts = tmr_jiffies();
+	lookahead_invalidate(ks);
+	snapshot_publish(ks);
 	lock_rel(ks->lock);
 
+	lookahead_kick(ks);
+
 	return 0;
 }
 
@@ -233,6 +530,7 @@ int keystore_set_session_key(struct keystore *ks,
 	uint32_t sz = 0;
 	struct le *le = NULL;
 	struct keyinfo *kinfo = NULL;
+	bool changed = false;
 	int err = 0;
 
 	if (!ks || ksz == 0) {
@@ -256,46 +554,45 @@ int keystore_set_session_key(struct keystore *ks,
 		goto out;
 	}
 
-	LIST_FOREACH(&ks->keyl, le) {
-		kinfo = le->data;
-		if (index == kinfo->index) {
-			if (memcmp(kinfo->skey, key, sz) == 0) {
-				//info("keystore(%p): set_session_key key 0x%08x already set, "
-				//     "ignoring\n", ks, index);
-				err = EALREADY;
-				goto out;
-			}
-			else {
-				warning("keystore(%p): set_session_key key 0x%08x changed, "
-					"overwriting\n", ks, index);
-				memset(kinfo->skey, 0, E2EE_SESSIONKEY_SIZE);
-				memcpy(kinfo->skey, key, sz);
-				ks->update_ts = tmr_jiffies();
-				err = keystore_derive_media_key(ks, kinfo);
-				goto out;
-			}
+	kinfo = keystore_find(ks, index);
+	if (kinfo) {
+		if (memcmp(kinfo->skey, key, sz) == 0) {
+			//info("keystore(%p): set_session_key key 0x%08x already set, "
+			//     "ignoring\n", ks, index);
+			err = EALREADY;
+			goto out;
+		}
+		else {
+			warning("keystore(%p): set_session_key key 0x%08x changed, "
+				"overwriting\n", ks, index);
+			memset(kinfo->skey, 0, E2EE_SESSIONKEY_SIZE);
+			memcpy(kinfo->skey, key, sz);
+			ks->update_ts = tmr_jiffies();
+			lookahead_invalidate(ks);
+			err = keystore_derive_media_key(ks, kinfo);
+			goto out;
 		}
 	}
 
-	kinfo = mem_zalloc(sizeof(*kinfo), keyinfo_destructor);
+	kinfo = keystore_new_slot(ks, index, NULL);
 	if (!kinfo) {
-		err = ENOMEM;
+		err = ENOSPC;
 		goto out;
 	}
 
 	memset(kinfo->skey, 0, E2EE_SESSIONKEY_SIZE);
 	memcpy(kinfo->skey, key, sz);
-	kinfo->index = index;
 
 	kinfo->update_ts = tmr_jiffies();
 	ks->update_ts = kinfo->update_ts;
 	err = keystore_derive_media_key(ks, kinfo);
-	if (err)
+	if (err) {
+		keyinfo_clear(kinfo);
 		goto out;
+	}
 
-	err = keystore_append_key(ks, kinfo);
-	if (err)
-		goto out;
+	/* A new key starts a new chain to hash forward from */
+	lookahead_invalidate(ks);
 
 	ks->has_keys = true;
 	if (!ks->init) {
@@ -305,18 +602,25 @@ int keystore_set_session_key(struct keystore *ks,
 			goto out;
 
 		ks->init = true;
+		changed = true;
+	}
 
+	info("keystore(%p): set_session_key 0x%08x set\n",
+	     ks, kinfo->index);
+out:
+	snapshot_publish(ks);
+
+	if (changed) {
 		LIST_FOREACH(&ks->listeners, le) {
 			struct listener *l = le->data;
 			l->changedh(ks, l->arg);
 		}
 	}
-
-	info("keystore(%p): set_session_key 0x%08x set\n",
-	     ks, kinfo->index);
-out:
 	lock_rel(ks->lock);
 
+	if (!err)
+		lookahead_kick(ks);
+
 	return err;
 }
 
@@ -391,6 +695,7 @@ int keystore_get_next_session_key(struct keystore *ks,
 				  uint8_t *pkey,
 				  size_t ksz)
 {
+	struct keyinfo *next = NULL;
 	uint32_t sz;
 	int err = 0;
 
@@ -403,11 +708,13 @@ int keystore_get_next_session_key(struct keystore *ks,
 
 	lock_read_get(ks->lock);
 
-	if (!ks->current || !ks->current->le.next) {
+	if (ks->current)
+		next = keystore_get_adjacent(ks, ks->current->index, 1);
+
+	if (!next) {
 		err = ENOENT;
 	}
 	else {
-		struct keyinfo *next = ks->current->le.next->data;
 		memcpy(pkey, next->skey, sz);
 		*pindex = next->index;
 	}
@@ -420,52 +727,64 @@ int keystore_get_next_session_key(struct keystore *ks,
 
 int keystore_rotate(struct keystore *ks)
 {
+	struct keyinfo *next;
 	struct le *le;
+	bool changed = false;
 	int err = 0;
 
 	if (!ks) {
 		return EINVAL;
 	}
 
+	lock_write_get(ks->lock);
+
 	info("keystore(%p): rotate keys: %u current: %u\n",
-	     ks, list_count(&ks->keyl),
+	     ks, keystore_count(ks),
 	     ks->current ? ks->current->index : 0);
 
-	lock_write_get(ks->lock);
-
 	if (!ks->current) {
 		err = ENOENT;
 		goto out;
 	}
 
-	if (!ks->current->le.next) {
+	next = keystore_get_adjacent(ks, ks->current->index, 1);
+	if (!next) {
 		if (ks->hash_forward) {
 			err = keystore_hash_to_key(ks, ks->current->index + 1);
 			if (err) {
 				goto out;
 			}
+			next = keystore_get_adjacent(ks, ks->current->index, 1);
 		}
 		else {
 			err = ENOENT;
 			goto out;
 		}
 	}
-	ks->current = ks->current->le.next->data;
+	ks->current = next;
 	err = keystore_organise(ks);
 	if (err)
 		goto out;
 
-	LIST_FOREACH(&ks->listeners, le) {
-		struct listener *l = le->data;
-		l->changedh(ks, l->arg);
-	}
+	changed = true;
 	info("keystore(%p): rotate new key %08x\n",
 	     ks, ks->current->index);
 
 
 out:
+	snapshot_publish(ks);
+
+	if (changed) {
+		LIST_FOREACH(&ks->listeners, le) {
+			struct listener *l = le->data;
+			l->changedh(ks, l->arg);
+		}
+	}
 	lock_rel(ks->lock);
 
+	if (!err)
+		lookahead_kick(ks);
+
 	return err;
 }
 
@@ -477,11 +796,8 @@ int keystore_get_current(struct keystore *ks,
 		return EINVAL;
 	}
 
-	if (ks->current) {
-		*pindex = ks->current->index;
-		*updated_ts = ks->update_ts;
+	if (snapshot_get_current(ks, pindex, updated_ts))
 		return 0;
-	}
 
 	return ENOENT;
 }
@@ -489,48 +805,44 @@ int keystore_get_current(struct keystore *ks,
 int keystore_set_current(struct keystore *ks,
 			 uint32_t index)
 {
+	struct keyinfo *kinfo;
 	struct le *le;
-	bool set = false;
+	bool changed = false;
 	int err = 0;
 
 	if (!ks) {
 		return EINVAL;
 	}
 
-	info("keystore(%p): set_current to: %zu c: %zu\n",
-	     ks, index, ks->current);
-
 	lock_write_get(ks->lock);
 
-	LIST_FOREACH(&ks->keyl, le) {
-		struct keyinfo *kinfo = le->data;
-
-		if (kinfo->index == index) {
-			ks->current = kinfo;
-			set = true;
-			break;
-		}
-	}
+	info("keystore(%p): set_current to: %u c: %p\n",
+	     ks, index, ks->current);
 
-	if (!set) {
+	kinfo = keystore_find(ks, index);
+	if (!kinfo) {
 		err = ENOENT;
 		goto out;
 	}
 
+	ks->current = kinfo;
 	err = keystore_organise(ks);
 	if (err)
 		goto out;
 
-	LIST_FOREACH(&ks->listeners, le) {
-		struct listener *l = le->data;
-		l->changedh(ks, l->arg);
-	}
-
-
+	changed = true;
 	info("keystore(%p): set_current key %08x\n",
 	     ks, ks->current->index);
 
 out:
+	snapshot_publish(ks);
+
+	if (changed) {
+		LIST_FOREACH(&ks->listeners, le) {
+			struct listener *l = le->data;
+			l->changedh(ks, l->arg);
+		}
+	}
 	lock_rel(ks->lock);
 	return err;
 }
@@ -542,7 +854,7 @@ int keystore_get_media_key(struct keystore *ks,
 {
 	uint32_t sz;
 	bool found = false;
-	struct le *le = NULL;
+	bool hashed = false;
 	struct keyinfo *kinfo = NULL;
 	int err = 0;
 
@@ -553,24 +865,27 @@ int keystore_get_media_key(struct keystore *ks,
 	sz = MIN(ksz, E2EE_SESSIONKEY_SIZE);
 	memset(pkey, 0, ksz);
 
-	lock_read_get(ks->lock);
+	/* Fast path, the current or previous key */
+	if (snapshot_get_media_key(ks, index, pkey, sz))
+		return 0;
 
-	LIST_FOREACH(&ks->keyl, le) {
-		kinfo = le->data;
-		if (kinfo->index == index) {
-			memcpy(pkey, kinfo->mkey, sz);
-			found = true;
-			if (!ks->current || index > ks->current->index) {
-				ks->current = kinfo;
-				err = keystore_organise(ks);
-				if (err)
-					goto out;
-			}
-			break;
+	/* Slow path, may move the current key or hash forward */
+	lock_write_get(ks->lock);
+
+	kinfo = keystore_find(ks, index);
+	if (kinfo) {
+		memcpy(pkey, kinfo->mkey, sz);
+		found = true;
+		if (!ks->current || index > ks->current->index) {
+			ks->current = kinfo;
+			err = keystore_organise(ks);
+			if (err)
+				goto out;
 		}
 	}
 
 	if (!found && ks->hash_forward) {
+		kinfo = keystore_get_latest(ks);
 		if (!kinfo) {
 			if (!ks->err_reported) {
 				warning("keystore(%p): get_media_key nothing to hash forward from\n", ks);
@@ -587,6 +902,7 @@ int keystore_get_media_key(struct keystore *ks,
 			if (err) {
 				goto out;
 			}
+			hashed = true;
 
 			kinfo = keystore_get_latest(ks);
 			if (!kinfo) {
@@ -595,7 +911,7 @@ int keystore_get_media_key(struct keystore *ks,
 
 			memcpy(pkey, kinfo->mkey, sz);
 			found = true;
-			if (kinfo->index > ks->current->index) {
+			if (!ks->current || kinfo->index > ks->current->index) {
 				ks->current = kinfo;
 				err = keystore_organise(ks);
 				if (err)
@@ -605,11 +921,274 @@ int keystore_get_media_key(struct keystore *ks,
 	}
 
 out:
+	snapshot_publish(ks);
 	lock_rel(ks->lock);
 
+	if (hashed)
+		lookahead_kick(ks);
+
 	return found ? err : ENOENT;
 }
 
+/* Move the key hashed ahead of time following prev into a key slot,
+ * must be called with the write lock held.
+ */
+static bool lookahead_take(struct keystore *ks,
+			   const struct keyinfo *prev,
+			   struct keyinfo **pkinfo)
+{
+	struct lookahead *la = &ks->ahead;
+	struct keyinfo *kinfo;
+	uint32_t index = prev->index + 1;
+	size_t i;
+
+	if (!la->nkeys)
+		return false;
+
+	for (i = 0; i < NUM_KEYS; i++) {
+		struct keyinfo *akey = &la->keys[i];
+
+		if (!akey->used || akey->index != index)
+			continue;
+
+		kinfo = keystore_new_slot(ks, index, prev);
+		if (!kinfo)
+			return false;
+
+		memcpy(kinfo->skey, akey->skey, sizeof(kinfo->skey));
+		memcpy(kinfo->mkey, akey->mkey, sizeof(kinfo->mkey));
+		kinfo->update_ts = tmr_jiffies();
+		ks->update_ts = kinfo->update_ts;
+		keyinfo_clear(akey);
+
+		la->stats.lookahead_hits++;
+		*pkinfo = kinfo;
+		return true;
+	}
+
+	la->stats.lookahead_misses++;
+	return false;
+}
+
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Hash forward nkeys keys from the latest one, outside of the lock */
+static void lookahead_derive(struct keystore *ks)
+{
+	struct lookahead *la = &ks->ahead;
+	struct keyinfo keys[NUM_KEYS];
+	struct keyinfo base;
+	struct keyinfo *latest, *prev;
+	uint8_t *salt = NULL;
+	size_t slen = 0;
+	uint32_t gen, nkeys, n;
+	uint64_t t0, t;
+	size_t i;
+	int s = 1;
+
+	lock_read_get(ks->lock);
+
+	latest = keystore_get_latest(ks);
+	nkeys = la->nkeys;
+	gen = la->gen;
+	if (!latest || !nkeys) {
+		lock_rel(ks->lock);
+		return;
+	}
+
+	/* Nothing to do if the furthest key is already there */
+	for (i = 0; i < NUM_KEYS; i++) {
+		if (la->keys[i].used &&
+		    la->keys[i].index == latest->index + nkeys) {
+			lock_rel(ks->lock);
+			return;
+		}
+	}
+
+	base = *latest;
+	if (ks->slen) {
+		salt = mem_alloc(ks->slen, NULL);
+		if (!salt) {
+			lock_rel(ks->lock);
+			goto out;
+		}
+		memcpy(salt, ks->salt, ks->slen);
+		slen = ks->slen;
+	}
+	lock_rel(ks->lock);
+
+	t0 = now_usec();
+	prev = &base;
+	for (n = 0; n < nkeys && s; n++) {
+		struct keyinfo *kinfo = &keys[n];
+
+		kinfo->index = prev->index + 1;
+		s = HKDF(kinfo->skey, sizeof(kinfo->skey), ks->hash_md,
+			 prev->skey, sizeof(prev->skey),
+			 salt, slen,
+			 SKEY_INFO, SKEY_INFO_LEN);
+		if (s) {
+			s = HKDF(kinfo->mkey, sizeof(kinfo->mkey), ks->hash_md,
+				 kinfo->skey, sizeof(kinfo->skey),
+				 salt, slen,
+				 MKEY_INFO, MKEY_INFO_LEN);
+		}
+		prev = kinfo;
+	}
+	t = now_usec() - t0;
+	if (!s) {
+		warning("keystore(%p): lookahead derivation failed\n", ks);
+		goto out;
+	}
+
+	lock_write_get(ks->lock);
+	if (gen == la->gen) {
+		for (i = 0; i < NUM_KEYS; i++) {
+			keyinfo_clear(&la->keys[i]);
+			if (i < n) {
+				la->keys[i] = keys[i];
+				la->keys[i].used = true;
+			}
+		}
+		la->stats.derived += n;
+		la->stats.derive_us += t;
+		if (t > la->stats.derive_max_us)
+			la->stats.derive_max_us = t;
+	}
+	lock_rel(ks->lock);
+
+ out:
+	sodium_memzero(keys, sizeof(keys));
+	sodium_memzero(&base, sizeof(base));
+	if (salt)
+		sodium_memzero(salt, slen);
+	mem_deref(salt);
+}
+
+static void *lookahead_thread(void *arg)
+{
+	struct keystore *ks = arg;
+	struct lookahead *la = &ks->ahead;
+
+	pthread_mutex_lock(&la->mutex);
+	while (la->run) {
+		while (la->run && !la->pending)
+			pthread_cond_wait(&la->cond, &la->mutex);
+
+		if (!la->run)
+			break;
+
+		la->pending = false;
+		pthread_mutex_unlock(&la->mutex);
+
+		lookahead_derive(ks);
+
+		pthread_mutex_lock(&la->mutex);
+	}
+	pthread_mutex_unlock(&la->mutex);
+
+	return NULL;
+}
+
+/* Wake the lookahead thread, must be called without the lock held */
+static void lookahead_kick(struct keystore *ks)
+{
+	struct lookahead *la = &ks->ahead;
+
+	if (!la->started)
+		return;
+
+	pthread_mutex_lock(&la->mutex);
+	la->pending = true;
+	pthread_cond_signal(&la->cond);
+	pthread_mutex_unlock(&la->mutex);
+}
+
+int keystore_set_lookahead(struct keystore *ks, uint32_t nkeys)
+{
+	struct lookahead *la;
+	int err;
+
+	if (!ks)
+		return EINVAL;
+
+	la = &ks->ahead;
+	if (!ks->hash_forward && nkeys)
+		return ENOTSUP;
+
+	nkeys = MIN(nkeys, NUM_KEYS - 1);
+	info("keystore(%p): set_lookahead %u keys\n", ks, nkeys);
+
+	if (nkeys && !la->started) {
+		err = pthread_mutex_init(&la->mutex, NULL);
+		if (err)
+			return err;
+		err = pthread_cond_init(&la->cond, NULL);
+		if (err) {
+			pthread_mutex_destroy(&la->mutex);
+			return err;
+		}
+
+		la->run = true;
+		la->pending = false;
+		err = pthread_create(&la->tid, NULL, lookahead_thread, ks);
+		if (err) {
+			pthread_mutex_destroy(&la->mutex);
+			pthread_cond_destroy(&la->cond);
+			return err;
+		}
+		la->started = true;
+	}
+
+	lock_write_get(ks->lock);
+	la->nkeys = nkeys;
+	lookahead_invalidate(ks);
+	lock_rel(ks->lock);
+
+	if (nkeys)
+		lookahead_kick(ks);
+	else
+		lookahead_stop(ks);
+
+	return 0;
+}
+
+void keystore_get_stats(struct keystore *ks, struct keystore_stats *stats)
+{
+	if (!ks || !stats)
+		return;
+
+	lock_read_get(ks->lock);
+	*stats = ks->ahead.stats;
+	lock_rel(ks->lock);
+}
+
+int keystore_set_cipher_suite(struct keystore *ks, int suite)
+{
+	if (!ks)
+		return EINVAL;
+
+	info("keystore(%p): set_cipher_suite %d\n", ks, suite);
+	atomic_store_explicit(&ks->suite, suite, memory_order_relaxed);
+
+	return 0;
+}
+
+int keystore_get_cipher_suite(struct keystore *ks)
+{
+	if (!ks)
+		return 0;
+
+	return atomic_load_explicit(&ks->suite, memory_order_relaxed);
+}
+
 static int keystore_hash_to_key(struct keystore *ks, uint32_t index)
 {
 	struct keyinfo *kinfo = NULL;
@@ -630,23 +1209,22 @@ static int keystore_hash_to_key(struct keystore *ks, uint32_t index)
 	     ks, index, kinfo->index);
 	while(kinfo->index < index) {
 
+		if (lookahead_take(ks, kinfo, &knext)) {
+			kinfo = knext;
+			continue;
+		}
+
 		err = keystore_derive_session_key(ks,
 						  kinfo,
 						  &knext);
 		if (err) {
 			goto out;
 		}
-		if (!knext) {
-			err = ENOMEM;
-			goto out;
-		}
 		err = keystore_derive_media_key(ks, knext);
 		if (err) {
+			keyinfo_clear(knext);
 			goto out;
 		}
-		err = keystore_append_key(ks, knext);
-		if (err)
-			goto out;
 
 		kinfo = knext;
 	}
@@ -670,22 +1248,25 @@ static int keystore_derive_session_key(struct keystore *ks,
 		return EINVAL;
 	}
 
-	kinfo = mem_zalloc(sizeof(*kinfo), keyinfo_destructor);
+	kinfo = keystore_new_slot(ks, prev->index + 1, prev);
 	if (!kinfo) {
-		return ENOMEM;
+		return ENOSPC;
 	}
 
-	kinfo->index = prev->index + 1;
 	s = HKDF(kinfo->skey, sizeof(kinfo->skey), ks->hash_md,
 		 prev->skey, sizeof(prev->skey),
 		 ks->salt, ks->slen,
 		 SKEY_INFO, SKEY_INFO_LEN);
+	if (!s) {
+		keyinfo_clear(kinfo);
+		return EINVAL;
+	}
 
 	kinfo->update_ts = tmr_jiffies();
 	ks->update_ts = kinfo->update_ts;
 
 	*pnext = kinfo;
-	return s ? 0 : EINVAL;
+	return 0;
 }
 
 static int keystore_derive_media_key(struct keystore *ks,
@@ -705,69 +1286,51 @@ static int keystore_derive_media_key(struct keystore *ks,
 	return s ? 0 : EINVAL;
 }
 
-static bool sort_handler(struct le *le1, struct le *le2, void *arg)
-{
-	struct keyinfo *ki1 = le1 ? le1->data : NULL;
-	struct keyinfo *ki2 = le2 ? le2->data : NULL;
-
-	(void)arg;
-
-	if (!ki1 || !ki2) {
-		return true;
-	}
-
-	return ki1->index <= ki2->index;
-}
-
+/* Drop all keys older than the one preceding the current key */
 static int keystore_organise(struct keystore *ks)
 {
-	struct le *le = NULL;
+	struct keyinfo *prev;
+	size_t i;
+
 	if (!ks) {
 		return EINVAL;
 	}
 
-	list_sort(&ks->keyl, sort_handler, NULL);
-
 	if (!ks->current) {
 		return 0;
 	}
 
-	le = ks->keyl.head;
-	while (le && le->data != ks->current &&
-	       le->next && le->next->data != ks->current) {
-		mem_deref(le->data);
-		le = ks->keyl.head;
+	prev = keystore_get_adjacent(ks, ks->current->index, -1);
+	if (!prev) {
+		return 0;
 	}
 
-	return 0;
-}
-
-static int keystore_append_key(struct keystore *ks,
-			       struct keyinfo *kinfo)
-{
+	for (i = 0; i < KEY_SLOTS; i++) {
+		struct keyinfo *kinfo = &ks->keys[i];
 
-	if (!ks || !kinfo) {
-		return EINVAL;
+		if (kinfo->used && kinfo->index < prev->index)
+			keyinfo_clear(kinfo);
 	}
 
-	list_append(&ks->keyl, &kinfo->le, kinfo);
-	return keystore_organise(ks);
+	return 0;
 }
 
 uint32_t keystore_get_max_key(struct keystore *ks)
 {
 	struct keyinfo *kinfo = NULL;
+	uint32_t index = 0;
 
 	if (!ks) {
 		return 0;
 	}
 	
+	lock_read_get(ks->lock);
 	kinfo = keystore_get_latest(ks);
-	if (!kinfo) {
-		return 0;
-	}
+	if (kinfo)
+		index = kinfo->index;
+	lock_rel(ks->lock);
 
-	return kinfo->index;
+	return index;
 }
 
 int keystore_generate_iv(struct keystore *ks,
@@ -893,6 +1456,8 @@ bool keystore_rotate_by_time(struct keystore *ks,
 {
 	struct le *le = NULL;
 	struct keyinfo *latest = NULL;
+	bool more = false;
+	size_t i;
 	int err = 0;
 
 	if (!ks)
@@ -900,20 +1465,19 @@ bool keystore_rotate_by_time(struct keystore *ks,
 
 	lock_write_get(ks->lock);
 
-	if (ks->current) {
-		le = &ks->current->le;
-	}
-	else {
-		le = ks->keyl.head;
-	}
-
 	info("keystore(%p): rotate_by_time ts: %llu\n", ks, min_ts);
-	while (le) {
-		struct keyinfo *kinfo = le->data;
-		if (kinfo->update_ts <= min_ts) {
+	for (i = 0; i < KEY_SLOTS; i++) {
+		struct keyinfo *kinfo = &ks->keys[i];
+
+		if (!kinfo->used)
+			continue;
+		if (ks->current && kinfo->index < ks->current->index)
+			continue;
+
+		if (kinfo->update_ts <= min_ts &&
+		    (!latest || kinfo->index > latest->index)) {
 			latest = kinfo;
 		}
-		le = le->next;
 	}
 
 	if (latest && latest != ks->current) {
@@ -922,6 +1486,8 @@ bool keystore_rotate_by_time(struct keystore *ks,
 		if (err)
 			goto out;
 
+		snapshot_publish(ks);
+
 		LIST_FOREACH(&ks->listeners, le) {
 			struct listener *l = le->data;
 			l->changedh(ks, l->arg);
@@ -934,8 +1500,9 @@ bool keystore_rotate_by_time(struct keystore *ks,
 	}
 
 out:
+	if (latest)
+		more = keystore_get_adjacent(ks, latest->index, 1) != NULL;
 	lock_rel(ks->lock);
 
-	return (err || !latest || latest->le.next);
+	return (err || !latest || more);
 }
-
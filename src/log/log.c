@@ -20,20 +20,107 @@
 #include "avs_log.h"
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 
 #define ANON_QID_LEN    9
 #define ANON_DOMAIN_LEN 4
 
+#define LOG_RING_DEFAULT  256   /* records per thread, power of 2 */
+#define LOG_REC_DATA      448
+#define LOG_MSG_MAX      4096
+#define LOG_MAX_RINGS     128
+#define LOG_WAIT_SPINS   1000   /* warnings and errors only */
+#define LOG_BATCH_MS        5
+#define LOG_IDLE_MS      1000
+#define LOG_FLUSH_MS     1000
+
+
+/*
+ * One queued message. Messages logged through debug(), info(),
+ * warning() and error() keep the format pointer and their arguments
+ * packed in data, and are formatted on the log thread. Everything else
+ * is formatted by the caller, into data or onto the heap if too long.
+ */
+struct log_rec {
+	uint64_t seq;
+	uint64_t ts;
+	const char *fmt;
+	char *heap;
+	enum log_level level;
+	uint8_t data[LOG_REC_DATA];
+};
+
+/* Single-producer ring owned by one logging thread */
+struct log_ring {
+	struct le le;
+	struct log_rec *recs;
+	uint32_t size;
+	atomic_uint head;
+	atomic_uint tail;
+	atomic_bool dead;
+};
+
+struct log_spec {
+	const char *start;
+	const char *end;
+	size_t flagl;
+	int lenmod;
+	char conv;
+};
+
+enum {
+	LENMOD_NONE = 0,
+	LENMOD_LONG,
+	LENMOD_LONGLONG,
+	LENMOD_SIZE,
+};
+
 static struct {
 	struct list logl;
 	enum log_level min_level;
 	bool stder;
+
+	struct {
+		atomic_bool on;
+		bool running;
+		bool key_ok;
+		pthread_t tid;
+		pthread_key_t key;
+		pthread_mutex_t mutex;
+		pthread_cond_t cond;
+		atomic_bool pending;
+		atomic_uint writers;
+		struct lock *lock;  /* protects ringl */
+		struct list ringl;
+		size_t ringsz;
+		uint32_t gen;
+
+		atomic_uint_fast64_t seq;
+		atomic_uint_fast64_t dispatched;
+		atomic_uint_fast64_t deferred;
+		atomic_uint_fast64_t oversized;
+		atomic_uint_fast64_t dropped[LOG_LEVEL_ERROR + 1];
+		uint64_t dropped_reported;
+		atomic_uint max_delay;
+	} async;
 } lg = {
 	.logl  = LIST_INIT,
 	.min_level = LOG_LEVEL_WARN,
-	.stder = true
+	.stder = true,
+	.async = {
+		.mutex = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.ringl = LIST_INIT,
+		.gen = 1,
+	},
 };
 
+/* Rings are freed on log_async_stop(), the generation tells stale ones */
+static __thread struct log_ring *tls_ring;
+static __thread uint32_t tls_gen;
+
 
 void log_register_handler(struct log *log)
 {
@@ -80,15 +167,9 @@ void vloglv(enum log_level level, const char *fmt, va_list ap)
 }
 
 
-void vlog(enum log_level level, const char *fmt, va_list ap)
+static void log_dispatch(enum log_level level, char *msg)
 {
 	struct le *le;
-	char *msg;
-	int err;
-
-	err = re_vsdprintf(&msg, fmt, ap);
-	if (err)
-		return;
 
 	log_mask_ipaddr(msg);
 
@@ -116,11 +197,742 @@ void vlog(enum log_level level, const char *fmt, va_list ap)
 		if (log->h)
 			log->h(level, msg, log->arg);
 	}
+}
+
+
+static void vlog_sync(enum log_level level, const char *fmt, va_list ap)
+{
+	char *msg;
+	int err;
+
+	err = re_vsdprintf(&msg, fmt, ap);
+	if (err)
+		return;
+
+	log_dispatch(level, msg);
 
 	mem_deref(msg);
 }
 
 
+/* Find the next conversion in fmt, NULL if there are none left */
+static const char *next_spec(const char *p, struct log_spec *spec)
+{
+	const char *q;
+
+	p = strchr(p, '%');
+	if (!p)
+		return NULL;
+
+	spec->start = p;
+	spec->lenmod = LENMOD_NONE;
+
+	q = p + 1;
+	while (*q == '-' || *q == '0')
+		++q;
+	while (*q >= '0' && *q <= '9')
+		++q;
+	if (*q == '.') {
+		++q;
+		while (*q >= '0' && *q <= '9')
+			++q;
+	}
+	spec->flagl = q - p - 1;
+
+	if (*q == 'l') {
+		++q;
+		spec->lenmod = LENMOD_LONG;
+		if (*q == 'l') {
+			++q;
+			spec->lenmod = LENMOD_LONGLONG;
+		}
+	}
+	else if (*q == 'z') {
+		++q;
+		spec->lenmod = LENMOD_SIZE;
+	}
+
+	spec->conv = *q;
+	spec->end = *q ? q + 1 : q;
+
+	return p;
+}
+
+
+static int pack_val(uint8_t **pp, const uint8_t *end,
+		    const void *v, size_t sz)
+{
+	if ((size_t)(end - *pp) < sz)
+		return E2BIG;
+
+	memcpy(*pp, v, sz);
+	*pp += sz;
+
+	return 0;
+}
+
+
+/* Pack the arguments of fmt into rec, so it can be formatted later */
+static int log_pack(struct log_rec *rec, const char *fmt, va_list ap)
+{
+	const uint8_t *end = rec->data + sizeof(rec->data);
+	uint8_t *p = rec->data;
+	struct log_spec spec;
+	const char *s;
+	int err = 0;
+
+	for (s = fmt; !err && next_spec(s, &spec); s = spec.end) {
+		int64_t i64;
+		uint64_t u64;
+		void *ptr;
+		double d;
+		const char *str;
+		uint16_t len;
+
+		switch (spec.conv) {
+
+		case '%':
+			break;
+
+		case 'd':
+		case 'i':
+			if (spec.lenmod == LENMOD_LONGLONG)
+				i64 = va_arg(ap, long long);
+			else if (spec.lenmod == LENMOD_LONG)
+				i64 = va_arg(ap, long);
+			else if (spec.lenmod == LENMOD_SIZE)
+				i64 = (ssize_t)va_arg(ap, size_t);
+			else
+				i64 = va_arg(ap, int);
+			err = pack_val(&p, end, &i64, sizeof(i64));
+			break;
+
+		case 'u':
+		case 'x':
+		case 'X':
+			if (spec.lenmod == LENMOD_LONGLONG)
+				u64 = va_arg(ap, unsigned long long);
+			else if (spec.lenmod == LENMOD_LONG)
+				u64 = va_arg(ap, unsigned long);
+			else if (spec.lenmod == LENMOD_SIZE)
+				u64 = va_arg(ap, size_t);
+			else
+				u64 = va_arg(ap, unsigned int);
+			err = pack_val(&p, end, &u64, sizeof(u64));
+			break;
+
+		case 'c':
+			if (spec.lenmod != LENMOD_NONE)
+				return ENOTSUP;
+			i64 = va_arg(ap, int);
+			err = pack_val(&p, end, &i64, sizeof(i64));
+			break;
+
+		case 'p':
+			if (spec.lenmod != LENMOD_NONE)
+				return ENOTSUP;
+			ptr = va_arg(ap, void *);
+			err = pack_val(&p, end, &ptr, sizeof(ptr));
+			break;
+
+		case 'f':
+			if (spec.lenmod > LENMOD_LONG)
+				return ENOTSUP;
+			d = va_arg(ap, double);
+			err = pack_val(&p, end, &d, sizeof(d));
+			break;
+
+		case 's':
+			if (spec.lenmod != LENMOD_NONE)
+				return ENOTSUP;
+
+			/* strings are copied, they rarely outlive the call */
+			str = va_arg(ap, const char *);
+			if (!str) {
+				len = UINT16_MAX;
+				err = pack_val(&p, end, &len, sizeof(len));
+				break;
+			}
+			if (strlen(str) >= UINT16_MAX)
+				return E2BIG;
+			len = (uint16_t)strlen(str);
+			err = pack_val(&p, end, &len, sizeof(len));
+			if (!err)
+				err = pack_val(&p, end, str, len + 1);
+			break;
+
+		default:
+			/* %H, %j, %r, %m, %w etc. are formatted by the caller */
+			return ENOTSUP;
+		}
+	}
+
+	return err;
+}
+
+
+static const uint8_t *unpack_val(const uint8_t *p, void *v, size_t sz)
+{
+	memcpy(v, p, sz);
+
+	return p + sz;
+}
+
+
+/* Format a record packed by log_pack(); output is truncated to sz */
+static void log_unpack(char *buf, size_t sz, const struct log_rec *rec)
+{
+	const uint8_t *p = rec->data;
+	struct log_spec spec;
+	const char *s = rec->fmt;
+	char specbuf[32];
+	size_t n = 0;
+
+	while (n + 1 < sz) {
+		const char *lit = next_spec(s, &spec);
+		size_t litl = lit ? (size_t)(lit - s) : strlen(s);
+		size_t specl;
+		int64_t i64;
+		uint64_t u64;
+		void *ptr;
+		double d;
+		uint16_t len;
+
+		litl = min(litl, sz - n - 1);
+		memcpy(buf + n, s, litl);
+		n += litl;
+		if (!lit || n + 1 >= sz)
+			break;
+
+		s = spec.end;
+
+		if (spec.conv == '%') {
+			buf[n++] = '%';
+			continue;
+		}
+
+		/* rebuild the conversion, integers always as long long */
+		specl = min(spec.flagl + 1, sizeof(specbuf) - 4);
+		memcpy(specbuf, spec.start, specl);
+		if (strchr("diuxX", spec.conv)) {
+			specbuf[specl++] = 'l';
+			specbuf[specl++] = 'l';
+		}
+		specbuf[specl++] = spec.conv;
+		specbuf[specl] = '\0';
+
+		switch (spec.conv) {
+
+		case 'd':
+		case 'i':
+			p = unpack_val(p, &i64, sizeof(i64));
+			re_snprintf(buf + n, sz - n, specbuf, (long long)i64);
+			break;
+
+		case 'u':
+		case 'x':
+		case 'X':
+			p = unpack_val(p, &u64, sizeof(u64));
+			re_snprintf(buf + n, sz - n, specbuf,
+				    (unsigned long long)u64);
+			break;
+
+		case 'c':
+			p = unpack_val(p, &i64, sizeof(i64));
+			re_snprintf(buf + n, sz - n, specbuf, (int)i64);
+			break;
+
+		case 'p':
+			p = unpack_val(p, &ptr, sizeof(ptr));
+			re_snprintf(buf + n, sz - n, specbuf, ptr);
+			break;
+
+		case 'f':
+			p = unpack_val(p, &d, sizeof(d));
+			re_snprintf(buf + n, sz - n, specbuf, d);
+			break;
+
+		case 's':
+			p = unpack_val(p, &len, sizeof(len));
+			if (len == UINT16_MAX) {
+				re_snprintf(buf + n, sz - n, specbuf, NULL);
+			}
+			else {
+				re_snprintf(buf + n, sz - n, specbuf,
+					    (const char *)p);
+				p += len + 1;
+			}
+			break;
+
+		default:
+			break;
+		}
+
+		n += strlen(buf + n);
+	}
+
+	buf[n] = '\0';
+}
+
+
+static void ring_destructor(void *arg)
+{
+	struct log_ring *ring = arg;
+	uint32_t i;
+
+	list_unlink(&ring->le);
+
+	for (i = 0; i < ring->size; ++i)
+		mem_deref(ring->recs[i].heap);
+
+	mem_deref(ring->recs);
+}
+
+
+/* Called on thread exit, the log thread frees the ring once drained */
+static void ring_release(void *arg)
+{
+	(void)arg;
+
+	atomic_fetch_add(&lg.async.writers, 1);
+	if (atomic_load(&lg.async.on) && tls_gen == lg.async.gen && tls_ring)
+		atomic_store(&tls_ring->dead, true);
+	atomic_fetch_sub(&lg.async.writers, 1);
+
+	tls_ring = NULL;
+}
+
+
+static struct log_ring *ring_get(void)
+{
+	struct log_ring *ring;
+
+	if (tls_ring && tls_gen == lg.async.gen)
+		return tls_ring;
+
+	ring = mem_zalloc(sizeof(*ring), ring_destructor);
+	if (!ring)
+		return NULL;
+
+	ring->size = (uint32_t)lg.async.ringsz;
+	ring->recs = mem_zalloc(ring->size * sizeof(*ring->recs), NULL);
+	if (!ring->recs) {
+		mem_deref(ring);
+		return NULL;
+	}
+
+	/* only used to get ring_release() called on thread exit */
+	if (pthread_setspecific(lg.async.key, ring)) {
+		mem_deref(ring);
+		return NULL;
+	}
+
+	lock_write_get(lg.async.lock);
+	list_append(&lg.async.ringl, &ring->le, ring);
+	lock_rel(lg.async.lock);
+
+	tls_ring = ring;
+	tls_gen = lg.async.gen;
+
+	return ring;
+}
+
+
+static void async_wake(void)
+{
+	if (atomic_exchange(&lg.async.pending, true))
+		return;
+
+	pthread_mutex_lock(&lg.async.mutex);
+	pthread_cond_signal(&lg.async.cond);
+	pthread_mutex_unlock(&lg.async.mutex);
+}
+
+
+/* Queue a message on the calling thread's ring.
+ * Returns false if the caller should log synchronously instead.
+ */
+static bool vlog_async_ring(enum log_level level, const char *fmt,
+			    va_list ap, bool deferred)
+{
+	struct log_ring *ring;
+	struct log_rec *rec;
+	uint32_t head, tail;
+	int spins = 0;
+	va_list aq;
+	int n;
+
+	/* handlers logging from the log thread */
+	if (pthread_equal(pthread_self(), lg.async.tid))
+		return false;
+
+	ring = ring_get();
+	if (!ring)
+		return false;
+
+	tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	for (;;) {
+		head = atomic_load_explicit(&ring->head,
+					    memory_order_acquire);
+		if (tail - head < ring->size)
+			break;
+
+		/* Ring full: debug and info are dropped straight away,
+		 * warnings and errors wait a little for the log thread.
+		 */
+		if (level < LOG_LEVEL_WARN || ++spins > LOG_WAIT_SPINS) {
+			atomic_fetch_add(&lg.async.dropped[level], 1);
+			async_wake();
+			return true;
+		}
+
+		async_wake();
+		sched_yield();
+	}
+
+	rec = &ring->recs[tail & (ring->size - 1)];
+	rec->level = level;
+	rec->ts = tmr_jiffies();
+	rec->fmt = NULL;
+	rec->heap = mem_deref(rec->heap);
+
+	va_copy(aq, ap);
+	if (deferred && 0 == log_pack(rec, fmt, aq)) {
+		rec->fmt = fmt;
+		atomic_fetch_add(&lg.async.deferred, 1);
+	}
+	va_end(aq);
+
+	if (!rec->fmt) {
+		va_copy(aq, ap);
+		n = re_vsnprintf((char *)rec->data, sizeof(rec->data), fmt, aq);
+		va_end(aq);
+
+		if (n < 0 || (size_t)n >= sizeof(rec->data)) {
+			if (re_vsdprintf(&rec->heap, fmt, ap))
+				return true;
+			atomic_fetch_add(&lg.async.oversized, 1);
+		}
+	}
+
+	rec->seq = atomic_fetch_add(&lg.async.seq, 1);
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+	async_wake();
+
+	return true;
+}
+
+
+/* The writer count keeps log_async_stop() from freeing rings in use */
+static bool vlog_async(enum log_level level, const char *fmt, va_list ap,
+		       bool deferred)
+{
+	bool queued = false;
+
+	if (!atomic_load_explicit(&lg.async.on, memory_order_relaxed))
+		return false;
+
+	atomic_fetch_add(&lg.async.writers, 1);
+	if (atomic_load(&lg.async.on))
+		queued = vlog_async_ring(level, fmt, ap, deferred);
+	atomic_fetch_sub(&lg.async.writers, 1);
+
+	return queued;
+}
+
+
+static void dispatch_rec(struct log_rec *rec)
+{
+	static char buf[LOG_MSG_MAX];
+	uint64_t delay = tmr_jiffies() - rec->ts;
+
+	if (delay > atomic_load_explicit(&lg.async.max_delay,
+					 memory_order_relaxed))
+		atomic_store(&lg.async.max_delay, (uint32_t)delay);
+
+	if (rec->heap) {
+		log_dispatch(rec->level, rec->heap);
+		rec->heap = mem_deref(rec->heap);
+	}
+	else if (rec->fmt) {
+		log_unpack(buf, sizeof(buf), rec);
+		log_dispatch(rec->level, buf);
+	}
+	else {
+		log_dispatch(rec->level, (char *)rec->data);
+	}
+}
+
+
+static uint64_t dropped_total(void)
+{
+	uint64_t n = 0;
+	int i;
+
+	for (i = 0; i <= LOG_LEVEL_ERROR; ++i)
+		n += atomic_load(&lg.async.dropped[i]);
+
+	return n;
+}
+
+
+/* Dispatch everything queued, merging the rings in sequence order */
+static size_t async_drain(void)
+{
+	struct log_ring *rings[LOG_MAX_RINGS];
+	uint64_t dropped;
+	size_t ringc = 0, n = 0;
+	struct le *le;
+
+	lock_read_get(lg.async.lock);
+	for (le = lg.async.ringl.head; le && ringc < LOG_MAX_RINGS;
+	     le = le->next) {
+		rings[ringc++] = le->data;
+	}
+	lock_rel(lg.async.lock);
+
+	for (;;) {
+		struct log_ring *best = NULL;
+		struct log_rec *rec = NULL;
+		uint32_t head;
+		size_t i;
+
+		for (i = 0; i < ringc; ++i) {
+			struct log_ring *ring = rings[i];
+			uint32_t tail;
+
+			head = atomic_load_explicit(&ring->head,
+						    memory_order_relaxed);
+			tail = atomic_load_explicit(&ring->tail,
+						    memory_order_acquire);
+			if (head == tail)
+				continue;
+
+			if (!best ||
+			    ring->recs[head & (ring->size - 1)].seq < rec->seq) {
+				best = ring;
+				rec = &ring->recs[head & (ring->size - 1)];
+			}
+		}
+
+		if (!best)
+			break;
+
+		dispatch_rec(rec);
+
+		head = atomic_load_explicit(&best->head, memory_order_relaxed);
+		atomic_store_explicit(&best->head, head + 1,
+				      memory_order_release);
+		atomic_fetch_add(&lg.async.dispatched, 1);
+		++n;
+	}
+
+	dropped = dropped_total();
+	if (dropped != lg.async.dropped_reported) {
+		char msg[64];
+
+		re_snprintf(msg, sizeof(msg),
+			    "log: dropped %llu messages\n",
+			    (unsigned long long)
+			    (dropped - lg.async.dropped_reported));
+		lg.async.dropped_reported = dropped;
+		log_dispatch(LOG_LEVEL_WARN, msg);
+	}
+
+	return n;
+}
+
+
+/* Free rings whose threads have exited and which have been drained */
+static void async_sweep(void)
+{
+	struct le *le;
+
+	lock_write_get(lg.async.lock);
+	le = lg.async.ringl.head;
+	while (le) {
+		struct log_ring *ring = le->data;
+
+		le = le->next;
+
+		if (atomic_load(&ring->dead) &&
+		    atomic_load(&ring->head) == atomic_load(&ring->tail))
+			mem_deref(ring);
+	}
+	lock_rel(lg.async.lock);
+}
+
+
+/*
+ * While messages keep coming the log thread drains in batches every
+ * LOG_BATCH_MS and producers never signal it. Once it finds nothing it
+ * clears the pending flag and sleeps until the next producer wakes it.
+ */
+static void *log_thread(void *arg)
+{
+	(void)arg;
+
+	while (atomic_load(&lg.async.on)) {
+
+		if (async_drain() > 0) {
+			sys_msleep(LOG_BATCH_MS);
+			continue;
+		}
+
+		async_sweep();
+
+		atomic_store(&lg.async.pending, false);
+		if (async_drain() > 0)
+			continue;
+
+		pthread_mutex_lock(&lg.async.mutex);
+		if (atomic_load(&lg.async.on) &&
+		    !atomic_load(&lg.async.pending)) {
+			struct timespec ts;
+
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += LOG_IDLE_MS / 1000;
+			pthread_cond_timedwait(&lg.async.cond,
+					       &lg.async.mutex, &ts);
+		}
+		pthread_mutex_unlock(&lg.async.mutex);
+	}
+
+	async_drain();
+
+	return NULL;
+}
+
+
+int log_async_start(size_t ringsz)
+{
+	int err;
+
+	if (lg.async.running)
+		return EALREADY;
+
+	if (!ringsz)
+		ringsz = LOG_RING_DEFAULT;
+	if (ringsz & (ringsz - 1))
+		return EINVAL;
+
+	if (!lg.async.key_ok) {
+		err = pthread_key_create(&lg.async.key, ring_release);
+		if (err)
+			return err;
+		lg.async.key_ok = true;
+	}
+
+	err = lock_alloc(&lg.async.lock);
+	if (err)
+		return err;
+
+	lg.async.ringsz = ringsz;
+	atomic_store(&lg.async.on, true);
+
+	err = pthread_create(&lg.async.tid, NULL, log_thread, NULL);
+	if (err) {
+		atomic_store(&lg.async.on, false);
+		lg.async.lock = mem_deref(lg.async.lock);
+		return err;
+	}
+
+	lg.async.running = true;
+
+	return 0;
+}
+
+
+void log_async_stop(void)
+{
+	if (!lg.async.running)
+		return;
+
+	pthread_mutex_lock(&lg.async.mutex);
+	atomic_store(&lg.async.on, false);
+	pthread_cond_signal(&lg.async.cond);
+	pthread_mutex_unlock(&lg.async.mutex);
+
+	while (atomic_load(&lg.async.writers))
+		sched_yield();
+
+	pthread_join(lg.async.tid, NULL);
+	memset(&lg.async.tid, 0, sizeof(lg.async.tid));
+	lg.async.running = false;
+
+	lock_write_get(lg.async.lock);
+	list_flush(&lg.async.ringl);
+	++lg.async.gen;
+	lock_rel(lg.async.lock);
+
+	lg.async.lock = mem_deref(lg.async.lock);
+}
+
+
+bool log_async_active(void)
+{
+	return atomic_load(&lg.async.on);
+}
+
+
+/* Wait until everything queued so far has been dispatched */
+void log_async_flush(void)
+{
+	uint64_t target = atomic_load(&lg.async.seq);
+	int ms;
+
+	if (!lg.async.running)
+		return;
+
+	for (ms = 0; ms < LOG_FLUSH_MS; ++ms) {
+		if (atomic_load(&lg.async.dispatched) >= target)
+			break;
+
+		async_wake();
+		sys_msleep(1);
+	}
+}
+
+
+void log_async_get_stats(struct log_async_stats *stats)
+{
+	int i;
+
+	if (!stats)
+		return;
+
+	memset(stats, 0, sizeof(*stats));
+
+	stats->queued = atomic_load(&lg.async.seq);
+	stats->dispatched = atomic_load(&lg.async.dispatched);
+	stats->deferred = atomic_load(&lg.async.deferred);
+	stats->oversized = atomic_load(&lg.async.oversized);
+	for (i = 0; i <= LOG_LEVEL_ERROR; ++i)
+		stats->dropped[i] = atomic_load(&lg.async.dropped[i]);
+	stats->max_delay = atomic_load(&lg.async.max_delay);
+}
+
+
+void vlog(enum log_level level, const char *fmt, va_list ap)
+{
+	if (vlog_async(level, fmt, ap, false))
+		return;
+
+	vlog_sync(level, fmt, ap);
+}
+
+
+/* Formats passed to these are literals, so formatting can be deferred */
+static void vlog_deferred(enum log_level level, const char *fmt, va_list ap)
+{
+	if (vlog_async(level, fmt, ap, true))
+		return;
+
+	vlog_sync(level, fmt, ap);
+}
+
+
 void loglv(enum log_level level, const char *fmt, ...)
 {
 	va_list ap;
@@ -142,7 +954,7 @@ void debug(const char *fmt, ...)
 		return;
 
 	va_start(ap, fmt);
-	vlog(LOG_LEVEL_DEBUG, fmt, ap);
+	vlog_deferred(LOG_LEVEL_DEBUG, fmt, ap);
 	va_end(ap);
 }
 
@@ -155,7 +967,7 @@ void info(const char *fmt, ...)
 		return;
 
 	va_start(ap, fmt);
-	vlog(LOG_LEVEL_INFO, fmt, ap);
+	vlog_deferred(LOG_LEVEL_INFO, fmt, ap);
 	va_end(ap);
 }
 
@@ -168,7 +980,7 @@ void warning(const char *fmt, ...)
 		return;
 
 	va_start(ap, fmt);
-	vlog(LOG_LEVEL_WARN, fmt, ap);
+	vlog_deferred(LOG_LEVEL_WARN, fmt, ap);
 	va_end(ap);
 }
 
@@ -178,7 +990,7 @@ void error(const char *fmt, ...)
 	va_list ap;
 
 	va_start(ap, fmt);
-	vlog(LOG_LEVEL_ERROR, fmt, ap);
+	vlog_deferred(LOG_LEVEL_ERROR, fmt, ap);
 	va_end(ap);
 }
 
@@ -78,6 +78,7 @@ struct mute_elem {
 static struct msystem *g_msys = NULL;
 
 static int msys_env = 0;
+static bool msys_latency_probe = false;
 
 void msystem_set_env(int env)
 {
@@ -89,6 +90,16 @@ int msystem_get_env(void)
 	return msys_env;
 }
 
+void msystem_set_latency_probe(bool enable)
+{
+	msys_latency_probe = enable;
+}
+
+bool msystem_get_latency_probe(void)
+{
+	return msys_latency_probe;
+}
+
 void msystem_set_version(const char *ver)
 {
 	if (!g_msys)
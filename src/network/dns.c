@@ -41,33 +41,163 @@
 #endif
 
 #define DNS_QUERY_TIMEOUT  3000
+#define DNS_WORKERS           4
+#define DNS_HASH_SIZE        16
+#define DNS_CACHE_MAX        64
 
+/* The platform resolvers do not report the record TTL,
+ * so results are kept for a fixed time.
+ */
+#define DNS_TTL_POSITIVE   (300 * 1000)  /* in ms */
+#define DNS_TTL_NEGATIVE    (10 * 1000)  /* in ms */
+
+enum {
+	DNS_MQ_RESOLVED = 0,
+	DNS_MQ_CACHED   = 1,
+};
+
+
+/* Result of a platform lookup, reused until it expires */
+struct dns_cache_entry {
+	struct le le;
+	char *host;
+	struct sa srv;
+	int err;
+	uint64_t expires;
+};
 
 
 static struct {
 	struct lock *lock;
 	struct mqueue *mq;
-	struct list lookupl;
+	struct hash *pendingh;  /* running lookups, by host */
+	struct hash *cacheh;    /* lookup results, by host */
+	uint32_t ncache;
+	struct dns_stats stats;
+
+	/* Worker pool, protected by mutex */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct list queue;
+	pthread_t workerv[DNS_WORKERS];
+	int nworkers;
+	int idle;
+	bool run;
 } dns = {
 	.lock = NULL,
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
 };
 
 
 static int dns_lookup_internal(const char *url,
 			       dns_lookup_h *lookuph, void *arg);
 
+
+static void cache_destructor(void *arg)
+{
+	struct dns_cache_entry *ce = arg;
+
+	hash_unlink(&ce->le);
+
+	mem_deref(ce->host);
+}
+
+
+static bool cache_find_handler(struct le *le, void *arg)
+{
+	struct dns_cache_entry *ce = le->data;
+
+	return strcaseeq(arg, ce->host);
+}
+
+
+static bool cache_oldest_handler(struct le *le, void *arg)
+{
+	struct dns_cache_entry *ce = le->data;
+	struct dns_cache_entry **oldest = arg;
+
+	if (!*oldest || ce->expires < (*oldest)->expires)
+		*oldest = ce;
+
+	return false;
+}
+
+
+/* Must be called with dns.lock held */
+static struct dns_cache_entry *cache_find(const char *host)
+{
+	struct dns_cache_entry *ce;
+	struct le *le;
+
+	le = hash_lookup(dns.cacheh, hash_joaat_str_ci(host),
+			 cache_find_handler, (void *)host);
+	if (!le)
+		return NULL;
+
+	ce = le->data;
+	if (ce->expires <= tmr_jiffies()) {
+		mem_deref(ce);
+		--dns.ncache;
+		return NULL;
+	}
+
+	return ce;
+}
+
+
+/* Must be called with dns.lock held */
+static void cache_store(const char *host, int err, const struct sa *srv)
+{
+	struct dns_cache_entry *ce;
+
+	ce = cache_find(host);
+	if (!ce) {
+		if (dns.ncache >= DNS_CACHE_MAX) {
+			struct dns_cache_entry *oldest = NULL;
+
+			hash_apply(dns.cacheh, cache_oldest_handler, &oldest);
+			if (oldest) {
+				mem_deref(oldest);
+				--dns.ncache;
+			}
+		}
+
+		ce = mem_zalloc(sizeof(*ce), cache_destructor);
+		if (!ce)
+			return;
+
+		if (str_dup(&ce->host, host)) {
+			mem_deref(ce);
+			return;
+		}
+
+		hash_append(dns.cacheh, hash_joaat_str_ci(host), &ce->le, ce);
+		++dns.ncache;
+	}
+
+	ce->err = err;
+	ce->srv = *srv;
+	ce->expires = tmr_jiffies()
+		+ (err ? DNS_TTL_NEGATIVE : DNS_TTL_POSITIVE);
+}
+
+
 static void mqueue_handler(int id, void *data, void *arg)
 {
 	struct dns_lookup_entry *lent = data;
 	struct le *le;
 	
-	(void)id;
 	(void)arg;
 
-	/* The lookup thread is done;
-	 * need to join to release its resources
-	 */
-	pthread_join(lent->tid, NULL);
+	if (id == DNS_MQ_RESOLVED) {
+		/* Later requests for the host are answered by the cache */
+		lock_write_get(dns.lock);
+		hash_unlink(&lent->le);
+		++dns.stats.lookups;
+		cache_store(lent->host, lent->err, &lent->srv);
+		lock_rel(dns.lock);
+	}
 
 	if (lent->lookuph)
 		lent->lookuph(lent->err, &lent->srv, lent->arg);
@@ -106,7 +236,21 @@ int dns_init(void *arg)
 	if (err)
 		goto out;
 
-	list_init(&dns.lookupl);
+	err = hash_alloc(&dns.pendingh, DNS_HASH_SIZE);
+	if (err)
+		goto out;
+
+	err = hash_alloc(&dns.cacheh, DNS_HASH_SIZE);
+	if (err)
+		goto out;
+
+	dns.ncache = 0;
+	memset(&dns.stats, 0, sizeof(dns.stats));
+
+	list_init(&dns.queue);
+	dns.nworkers = 0;
+	dns.idle = 0;
+	dns.run = true;
 
 	err = mqueue_alloc(&dns.mq, mqueue_handler, NULL);
 	if (err)
@@ -119,33 +263,92 @@ int dns_init(void *arg)
 }
 
 
-static struct dns_lookup_entry *find_lookup(struct list *ll, const char *host)
+static bool find_lookup_handler(struct le *le, void *arg)
+{
+	struct dns_lookup_entry *lent = le->data;
+
+	return strcaseeq(arg, lent->host);
+}
+
+
+/* Must be called with dns.lock held */
+static struct dns_lookup_entry *find_lookup(const char *host)
 {
-	struct dns_lookup_entry *lent = NULL;	
-	bool found = false;
 	struct le *le;
 
-	le = list_head(ll);
-	while (!found && le != NULL) {
+	le = hash_lookup(dns.pendingh, hash_joaat_str_ci(host),
+			 find_lookup_handler, (void *)host);
+
+	return le ? le->data : NULL;
+}
+
+
+static void *worker_thread(void *arg)
+{
+	(void)arg;
+
+	pthread_mutex_lock(&dns.mutex);
+	while (dns.run) {
+		struct dns_lookup_entry *lent;
+		struct le *le;
+
+		le = list_head(&dns.queue);
+		if (!le) {
+			++dns.idle;
+			pthread_cond_wait(&dns.cond, &dns.mutex);
+			--dns.idle;
+			continue;
+		}
+
+		list_unlink(le);
 		lent = le->data;
-		found = strcaseeq(host, lent->host);
-		le = le->next;
+		pthread_mutex_unlock(&dns.mutex);
+
+		lent->err = dns_platform_lookup(lent, &lent->srv);
+		mqueue_push(dns.mq, DNS_MQ_RESOLVED, lent);
+
+		pthread_mutex_lock(&dns.mutex);
 	}
+	pthread_mutex_unlock(&dns.mutex);
 
-	return found ? lent : NULL;
+	return NULL;
 }
 
-static void *lookup_thread(void *arg)
+
+/* Hand a lookup to the worker pool, starting another worker
+ * if all of them are busy and the pool is not yet full.
+ */
+static int queue_lookup(struct dns_lookup_entry *lent)
 {
-	struct dns_lookup_entry *lent = arg;
-	int err;
+	int err = 0;
 
-	err = dns_platform_lookup(lent, &lent->srv);
-	lent->err = err;
+	pthread_mutex_lock(&dns.mutex);
 
-	mqueue_push(dns.mq, 0, lent);
+	list_append(&dns.queue, &lent->qle, lent);
 
-	return NULL;
+	if ((int)list_count(&dns.queue) > dns.idle
+	    && dns.nworkers < DNS_WORKERS) {
+
+		err = pthread_create(&dns.workerv[dns.nworkers], NULL,
+				     worker_thread, NULL);
+		if (err) {
+			warning("dns: worker thread failed: %m\n", err);
+
+			/* Busy workers will get to it eventually */
+			if (dns.nworkers > 0)
+				err = 0;
+			else
+				list_unlink(&lent->qle);
+		}
+		else {
+			++dns.nworkers;
+		}
+	}
+
+	pthread_cond_signal(&dns.cond);
+	pthread_mutex_unlock(&dns.mutex);
+
+	return err;
 }
 
 
@@ -154,10 +357,78 @@ static void lent_destructor(void *arg)
 	struct dns_lookup_entry *lent = arg;
 
 	list_unlink(&lent->le);
+	list_flush(&lent->lookupl);
 	
 	mem_deref(lent->host);
 }
 
+
+/* Answer from the cache, join a running lookup or start a new one.
+ * Without a handler, this only makes sure the host gets resolved.
+ */
+static int lookup_start(const char *host, dns_lookup_h *lookuph, void *arg)
+{
+	struct dns_lookup_entry *lent = NULL;
+	struct dns_lookup_entry *pend_lent;
+	struct dns_cache_entry *ce;
+	bool prefetch = lookuph == NULL;
+	int err = 0;
+
+	lock_write_get(dns.lock);
+
+	ce = cache_find(host);
+	pend_lent = ce ? NULL : find_lookup(host);
+	if (prefetch && (ce || pend_lent))
+		goto out;
+
+	lent = mem_zalloc(sizeof(*lent), lent_destructor);
+	if (!lent) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = str_dup(&lent->host, host);
+	if (err)
+		goto out;
+
+	list_init(&lent->lookupl);
+	lent->lookuph = lookuph;
+	lent->arg = arg;
+
+	if (ce) {
+		/* Still reported asynchronously, as for a lookup */
+		lent->err = ce->err;
+		lent->srv = ce->srv;
+		if (ce->err)
+			++dns.stats.neg_hits;
+		else
+			++dns.stats.hits;
+
+		err = mqueue_push(dns.mq, DNS_MQ_CACHED, lent);
+	}
+	else if (pend_lent) {
+		list_append(&pend_lent->lookupl, &lent->le, lent);
+		++dns.stats.coalesced;
+	}
+	else {
+		hash_append(dns.pendingh, hash_joaat_str_ci(host),
+			    &lent->le, lent);
+		if (prefetch)
+			++dns.stats.prefetches;
+		else
+			++dns.stats.misses;
+
+		err = queue_lookup(lent);
+	}
+
+ out:
+	if (err)
+		mem_deref(lent);
+	lock_rel(dns.lock);
+
+	return err;
+}
+
 #ifdef TMOBILE_WORKAROUND
 
 struct dns_query_entry {
@@ -298,53 +569,9 @@ static bool check_if_handler(const char *ifname, const struct sa *sa,
 static int dns_lookup_internal(const char *url,
 			       dns_lookup_h *lookuph, void *arg)
 {
-	struct dns_lookup_entry *lent;
-	struct dns_lookup_entry *pend_lent;
-	struct list *ll;
-	int err = 0;
-
 	info("dns: lookup internal: %s\n", url);
 
-	lent = mem_zalloc(sizeof(*lent), lent_destructor);
-	if (!lent)
-		return ENOMEM;
-
-	lock_write_get(dns.lock);
-	
-	err = str_dup(&lent->host, url);
-	if (err)
-		goto out;
-
-	list_init(&lent->lookupl);
-	lent->lookuph = lookuph;
-	lent->arg = arg;
-
-	pend_lent = find_lookup(&dns.lookupl, url);
-
-	/* The lookup is either appended to an already running lookup,
-	 * or to the list of pending lookups.
-	 */
-	ll = pend_lent ? &pend_lent->lookupl : &dns.lookupl;
-	list_append(ll, &lent->le, lent);
-
-	/* If there were no pending lookup requests, we need to create one */
-	if (pend_lent) {
-		lent->tid = pend_lent->tid;
-	}
-	else {
-		err = pthread_create(&lent->tid, NULL, lookup_thread, lent);
-		if (err) {
-			warning("dns_iosx: lookup thread failed: %m\n", err);
-			goto out;
-		}
-	}
-
- out:
-	if (err)
-		mem_deref(lent);
-	lock_rel(dns.lock);
-
-	return err;
+	return lookup_start(url, lookuph, arg);
 }
 
 int dns_lookup(const char *url, dns_lookup_h *lookuph, void *arg)
@@ -444,26 +671,74 @@ int dns_get_servers(char *domain, size_t dsize, struct sa *nsv, uint32_t *n)
 }
 
 
+int dns_prefetch(const char *host)
+{
+	if (!str_isset(host))
+		return EINVAL;
+
+	if (!dns.lock)
+		return ENOSYS;
+
+	debug("dns: prefetch: %s\n", host);
+
+	return lookup_start(host, NULL, NULL);
+}
+
+
+void dns_cache_flush(void)
+{
+	if (!dns.lock)
+		return;
+
+	lock_write_get(dns.lock);
+	hash_flush(dns.cacheh);
+	dns.ncache = 0;
+	lock_rel(dns.lock);
+}
+
+
+int dns_get_stats(struct dns_stats *stats)
+{
+	if (!stats)
+		return EINVAL;
+
+	if (!dns.lock)
+		return ENOSYS;
+
+	lock_read_get(dns.lock);
+	*stats = dns.stats;
+	lock_rel(dns.lock);
+
+	return 0;
+}
+
+
 void dns_close(void)
 {
-	struct le *le;
+	int i;
 
 	if (!dns.lock)
 		return;
 	
-	/* Wait for all pending lookups to complete */
-	lock_write_get(dns.lock);
-	le = list_head(&dns.lookupl);
-	while(le) {
-		struct dns_lookup_entry *lent = le->data;
+	/* Let the running lookups complete, and drop the queued ones */
+	pthread_mutex_lock(&dns.mutex);
+	dns.run = false;
+	pthread_cond_broadcast(&dns.cond);
+	pthread_mutex_unlock(&dns.mutex);
 
-		lock_rel(dns.lock);
-		pthread_join(lent->tid, NULL);
-		lock_write_get(dns.lock);
-		le = list_head(&dns.lookupl);
-	}	
+	for (i = 0; i < dns.nworkers; ++i)
+		pthread_join(dns.workerv[i], NULL);
+	dns.nworkers = 0;
+
+	lock_write_get(dns.lock);
+	list_clear(&dns.queue);
+	hash_flush(dns.pendingh);
+	hash_flush(dns.cacheh);
+	dns.ncache = 0;
 	lock_rel(dns.lock);
 
+	dns.pendingh = mem_deref(dns.pendingh);
+	dns.cacheh = mem_deref(dns.cacheh);
 	dns.mq = mem_deref(dns.mq);
 	dns.lock = mem_deref(dns.lock);
 
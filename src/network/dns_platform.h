@@ -3,9 +3,9 @@ struct dns_lookup_entry {
 	dns_lookup_h *lookuph;
 	void *arg;
 
-	struct le le;
+	struct le le;     /* pending hash, or lookupl of running lookup */
+	struct le qle;    /* worker queue */
 	struct list lookupl;
-	pthread_t tid;
 	struct sa srv;
 	int err;
 };
@@ -15,4 +15,8 @@ int  dns_platform_init(void *arg);
 void dns_platform_close(void);
 int  dns_platform_lookup(struct dns_lookup_entry *lent, struct sa *srv);
 
+/* Replaces the resolver of the dummy platform, for testing */
+typedef int (dns_platform_stub_h)(const char *host, struct sa *srv);
+void dns_platform_set_stub(dns_platform_stub_h *stubh);
+
 
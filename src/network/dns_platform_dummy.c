@@ -24,6 +24,16 @@
 
 #include <netdb.h>
 
+
+static dns_platform_stub_h *platform_stubh = NULL;
+
+
+void dns_platform_set_stub(dns_platform_stub_h *stubh)
+{
+	platform_stubh = stubh;
+}
+
+
 int dns_platform_init(void *arg)
 {
 	return 0;
@@ -34,6 +44,9 @@ int dns_platform_lookup(struct dns_lookup_entry *lent, struct sa *srv)
 	struct hostent *hent;
 	int err = 0;
 
+	if (platform_stubh)
+		return platform_stubh(lent->host, srv);
+
 	hent = gethostbyname(lent->host);
 	if (!hent) {
 		err = errno;
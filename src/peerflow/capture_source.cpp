@@ -16,6 +16,8 @@
 * along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+
 #include <re.h>
 #include <avs.h>
 
@@ -24,6 +26,7 @@
 #include "third_party/libyuv/include/libyuv.h"
 #include "api/video/i420_buffer.h"
 #include "api/video/video_frame.h"
+#include "common_video/include/video_frame_buffer.h"
 
 #include "capture_source.h"
 
@@ -35,6 +38,11 @@
 #define MAX_FPS 15
 #define MIN_FPS 15
 
+#define POOL_MAX_BUFFERS 8
+
+/* Each load level halves the frame rate and the pixel budget side */
+#define ADMIT_MAX_LOAD 2
+
 
 struct enc_stream {
 	struct le le;
@@ -53,6 +61,47 @@ namespace wire {
 
 CaptureSource * g_cap = NULL;
 
+/* A sink handing the frames that go to the encoders to a C handler */
+class FrameTap : public webrtc::VideoSinkInterface<webrtc::VideoFrame> {
+public:
+	FrameTap(capture_source_frame_h *frameh, void *arg) :
+		frameh_(frameh),
+		arg_(arg)
+	{
+	}
+
+	void OnFrame(const webrtc::VideoFrame& frame) override
+	{
+		webrtc::scoped_refptr<webrtc::I420BufferInterface> i420;
+		struct avs_vidframe avsframe;
+
+		i420 = frame.video_frame_buffer()->ToI420();
+		if (!i420)
+			return;
+
+		memset(&avsframe, 0, sizeof(avsframe));
+		avsframe.type = AVS_VIDFRAME_I420;
+		avsframe.y = (uint8_t *)i420->DataY();
+		avsframe.u = (uint8_t *)i420->DataU();
+		avsframe.v = (uint8_t *)i420->DataV();
+		avsframe.ys = i420->StrideY();
+		avsframe.us = i420->StrideU();
+		avsframe.vs = i420->StrideV();
+		avsframe.w = i420->width();
+		avsframe.h = i420->height();
+		avsframe.rotation = (int)frame.rotation();
+		avsframe.ts = frame.timestamp_us() / 1000;
+
+		frameh_(&avsframe, arg_);
+	}
+
+private:
+	capture_source_frame_h *frameh_;
+	void *arg_;
+};
+
+static FrameTap *g_tap = NULL;
+
 CaptureSource::CaptureSource()
 {
 	_buffer_rotate = false;
@@ -64,6 +113,14 @@ CaptureSource::CaptureSource()
 	_skip_count = 0;
 	_skipped = 1;
 	_max_pixel_count = MAX_PIXEL_W * MAX_PIXEL_H;
+	_black_frames = false;
+	_frames = 0;
+	_allocs = 0;
+	_ts_admit = 0;
+	_load = 0;
+	_admitted = 0;
+	_dropped = 0;
+	_scaled = 0;
 	list_init(&_streaml);
 
 	webrtc::VideoTrackSourceConstraints constraints = {
@@ -177,14 +234,180 @@ void CaptureSource::RemoveSink(webrtc::VideoSinkInterface<webrtc::VideoFrame>* s
 	//FireOnChanged();
 }
 
+/* Get a buffer for a frame, reusing a pooled one of the same size
+ * that nobody else references any more. Pooled buffers are fully
+ * overwritten by the caller, so they are not zero-filled.
+ */
+webrtc::scoped_refptr<webrtc::I420Buffer> CaptureSource::GetBuffer(int w, int h)
+{
+	webrtc::scoped_refptr<PooledI420Buffer> buf;
+	size_t i;
+
+	for (i = 0; i < _pool.size(); ++i) {
+		if (_pool[i]->HasOneRef()
+		    && _pool[i]->width() == w && _pool[i]->height() == h)
+			return _pool[i];
+	}
+
+	/* Make room by dropping an idle buffer of another size */
+	if (_pool.size() >= POOL_MAX_BUFFERS) {
+		for (i = 0; i < _pool.size(); ++i) {
+			if (_pool[i]->HasOneRef()) {
+				_pool.erase(_pool.begin() + i);
+				break;
+			}
+		}
+	}
+
+	buf = webrtc::scoped_refptr<PooledI420Buffer>(new PooledI420Buffer(w, h));
+	++_allocs;
+	if (_pool.size() < POOL_MAX_BUFFERS)
+		_pool.push_back(buf);
+
+	return buf;
+}
+
+/* Frame rate we aim for: what the sinks want, capped at MAX_FPS
+ * and lowered while the encoder is falling behind.
+ */
+uint32_t CaptureSource::TargetFps(int want_fps) const
+{
+	uint32_t fps = MAX_FPS;
+
+	if (want_fps > 0 && (uint32_t)want_fps < fps)
+		fps = want_fps;
+
+	fps >>= _load.load();
+
+	return fps ? fps : 1;
+}
+
+/* Pixel budget, quartered per load level, i.e. one more halving
+ * of width and height.
+ */
+uint32_t CaptureSource::PixelLimit(int want_pixels) const
+{
+	uint32_t pixels = _max_pixel_count;
+
+	if (want_pixels > 0 && (uint32_t)want_pixels < pixels)
+		pixels = want_pixels;
+
+	return pixels >> (2 * _load.load());
+}
+
+/* Decide whether to pass on a frame, before any conversion is done */
+bool CaptureSource::Admit(int64_t ts_us, int want_fps)
+{
+	int64_t interval = 1000000 / TargetFps(want_fps);
+
+	/* Allow some jitter in the capture timing */
+	if (ts_us - _ts_admit < interval * 9 / 10)
+		return false;
+
+	/* Keep the cadence, unless we fell behind */
+	_ts_admit += interval;
+	if (ts_us - _ts_admit > interval)
+		_ts_admit = ts_us;
+
+	return true;
+}
+
+/* Feed back the mean time the encoder spends per frame */
+void CaptureSource::SetEncodeTime(uint32_t encode_us)
+{
+	uint32_t load = _load.load();
+	uint32_t budget;
+
+	/* A zero time means nothing was encoded since the last report,
+	 * the encoder is idle and the load decays like for a fast one.
+	 */
+	budget = 1000000 / TargetFps(0);
+
+	if (encode_us > budget * 3 / 4 && load < ADMIT_MAX_LOAD)
+		++load;
+	else if (encode_us < budget * 3 / 8 && load > 0)
+		--load;
+	else
+		return;
+
+	info("CaptureSource::SetEncodeTime: %u us budget %u us load %u\n",
+	     encode_us, budget, load);
+	_load = load;
+}
+
+void CaptureSource::GetAdmissionStats(struct stats_capture *st) const
+{
+	st->admitted = _admitted.load();
+	st->dropped = _dropped.load();
+	st->scaled = _scaled.load();
+}
+
+void CaptureSource::GetStats(uint64_t *frames, uint64_t *allocs)
+{
+	if (frames)
+		*frames = _frames;
+	if (allocs)
+		*allocs = _allocs;
+}
+
+/* Crop and scale the NV12/NV21 planes to the size of dst before
+ * the conversion, so only the scaled frame is converted and rotated.
+ * The crop is the one CropAndScaleFrom() would make on the rotated
+ * frame.
+ */
+void CaptureSource::ScaleNV12(const struct avs_vidframe *frame,
+			      uint32_t yoff, uint32_t dw, uint32_t dh,
+			      webrtc::scoped_refptr<webrtc::I420Buffer> dst,
+			      int rotation)
+{
+	libyuv::RotationMode mode = (libyuv::RotationMode)rotation;
+	bool swap = mode == libyuv::kRotate90 || mode == libyuv::kRotate270;
+	uint32_t tw = swap ? dst->height() : dst->width();
+	uint32_t th = swap ? dst->width() : dst->height();
+	uint32_t cw, ch, cx, cy, uvs;
+	uint8_t *ty, *tuv;
+	bool nv21 = frame->type == AVS_VIDFRAME_NV21;
+
+	cw = std::min(dw, tw * dh / th);
+	ch = std::min(dh, th * dw / tw);
+	cx = yoff + (((dw - cw) / 2) & ~1);
+	cy = ((dh - ch) / 2) & ~1;
+
+	uvs = (tw + 1) & ~1;
+	_nv12.resize(tw * th + uvs * ((th + 1) / 2));
+	ty = _nv12.data();
+	tuv = ty + tw * th;
+
+	libyuv::NV12Scale(frame->y + cy * frame->ys + cx, frame->ys,
+			  frame->u + (cy / 2) * frame->us + cx, frame->us,
+			  cw, ch,
+			  ty, tw, tuv, uvs, tw, th,
+			  libyuv::kFilterBox);
+
+	/* NV21 is NV12 with U and V swapped */
+	libyuv::NV12ToI420Rotate(ty, tw, tuv, uvs,
+		dst->MutableDataY(), dst->StrideY(),
+		nv21 ? dst->MutableDataV() : dst->MutableDataU(),
+		nv21 ? dst->StrideV() : dst->StrideU(),
+		nv21 ? dst->MutableDataU() : dst->MutableDataV(),
+		nv21 ? dst->StrideU() : dst->StrideV(),
+		tw, th, mode);
+}
+
 void CaptureSource::HandleFrame(struct avs_vidframe *frame)
+{
+	HandleFrame(frame, tmr_jiffies() * 1000);
+}
+
+void CaptureSource::HandleFrame(struct avs_vidframe *frame, int64_t ts_us)
 {
 	webrtc::scoped_refptr<webrtc::I420Buffer> frmbuf;
 	webrtc::VideoRotation rtc_rotation;
-
-	int64_t ts_us = tmr_jiffies() * 1000;
+	libyuv::RotationMode mode = libyuv::kRotate0;
 
 	uint32_t dw, dh, yoff, uvoff;
+	uint32_t sw, sh;
+	int bw, bh;
 
 	_fps_count++;
 	if (_skip_count) {
@@ -209,45 +432,7 @@ void CaptureSource::HandleFrame(struct avs_vidframe *frame)
 #endif
 
 	yoff = ((frame->w - dw) / 2) & ~1;
-
-	frmbuf = webrtc::I420Buffer::Create(dw, dh);
-	frmbuf->InitializeData();
-
-	if (_black_frames) {
-		webrtc::I420Buffer::SetBlack(frmbuf.get());
-	}
-	else {
-		switch(frame->type) {
-		case AVS_VIDFRAME_NV12:
-			libyuv:: NV12ToI420(frame->y + yoff, frame->ys,
-				frame->u + yoff, frame->us,
-				(uint8_t *)frmbuf->DataY(), frmbuf->StrideY(),
-				(uint8_t *)frmbuf->DataU(), frmbuf->StrideU(),
-				(uint8_t *)frmbuf->DataV(), frmbuf->StrideV(),
-				dw, dh);
-			break;
-
-		case AVS_VIDFRAME_NV21:
-			libyuv:: NV21ToI420(frame->y + yoff, frame->ys,
-				frame->u + yoff, frame->us,
-				(uint8_t *)frmbuf->DataY(), frmbuf->StrideY(),
-				(uint8_t *)frmbuf->DataU(), frmbuf->StrideU(),
-				(uint8_t *)frmbuf->DataV(), frmbuf->StrideV(),
-				dw, dh);
-			break;
-
-		case AVS_VIDFRAME_I420:
-			uvoff = yoff / 2;
-			libyuv::I420Copy(frame->y + yoff, frame->ys,
-				frame->u + uvoff, frame->us,
-				frame->v + uvoff, frame->vs,
-				(uint8_t *)frmbuf->DataY(), frmbuf->StrideY(),
-				(uint8_t *)frmbuf->DataU(), frmbuf->StrideU(),
-				(uint8_t *)frmbuf->DataV(), frmbuf->StrideV(),
-				dw, dh);
-			break;
-		}
-	}
+	uvoff = yoff / 2;
 
 	switch (frame->rotation) {
 	case 90:
@@ -269,43 +454,125 @@ void CaptureSource::HandleFrame(struct avs_vidframe *frame)
 	}
 	struct le *le = NULL;
 	bool buffer_rotate = false;
+	int want_fps = 0;
+	int want_pixels = 0;
 
+	/* Serve the most demanding sink */
 	lock_read_get(_lock);
 	LIST_FOREACH(&_streaml, le) {
 		struct enc_stream *stream = (struct enc_stream*)le->data;
 		if (stream) {
 			buffer_rotate |= stream->wants.rotation_applied;
+			want_fps = std::max(want_fps,
+					    stream->wants.max_framerate_fps);
+			want_pixels = std::max(want_pixels,
+					       stream->wants.max_pixel_count);
 		}
 	}
 	lock_rel(_lock);
 
+	if (!Admit(ts_us, want_fps)) {
+		++_dropped;
+		return;
+	}
+	++_admitted;
+
+	/* Rotation is applied while converting, not as a pass of its own */
+	bw = dw;
+	bh = dh;
 	if (buffer_rotate && rtc_rotation != webrtc::kVideoRotation_0) {
-		frmbuf = webrtc::I420Buffer::Rotate(*frmbuf, rtc_rotation);
+		mode = (libyuv::RotationMode)rtc_rotation;
+		if (rtc_rotation != webrtc::kVideoRotation_180) {
+			bw = dh;
+			bh = dw;
+		}
 		rtc_rotation = webrtc::kVideoRotation_0;
 	}
 
-	uint32_t sw, sh;
-
 	sw = MAX_PIXEL_W;
 	sh = MAX_PIXEL_H;
 
-	while((sw > dw || sh > dh || (sw * sh) > _max_pixel_count) &&
+	uint32_t max_pixels = PixelLimit(want_pixels);
+
+	while((sw > dw || sh > dh || (sw * sh) > max_pixels) &&
 		sh > MIN_PIXEL_H) {
 		sw /= 2;
 		sh /= 2;
 	}
 
-	if (dw != sw || dh != sh) {
-		webrtc::scoped_refptr<webrtc::I420Buffer> sbuf;
+	if (dw != sw || dh != sh)
+		++_scaled;
 
-		sbuf = webrtc::I420Buffer::Create(sw, sh);
-		sbuf->InitializeData();
+	if (!_black_frames && frame->type == AVS_VIDFRAME_I420
+	    && mode == libyuv::kRotate0 && (dw != sw || dh != sh)) {
+		webrtc::scoped_refptr<webrtc::I420BufferInterface> src;
 
-		sbuf->CropAndScaleFrom(*frmbuf);
+		/* Crop and scale straight from the capture planes */
+		src = webrtc::WrapI420Buffer(dw, dh,
+			frame->y + yoff, frame->ys,
+			frame->u + uvoff, frame->us,
+			frame->v + uvoff, frame->vs,
+			[] {});
 
-		frmbuf = sbuf;
+		frmbuf = GetBuffer(sw, sh);
+		frmbuf->CropAndScaleFrom(*src);
 	}
-	
+	else if (!_black_frames && frame->type != AVS_VIDFRAME_I420
+		 && (dw != sw || dh != sh)) {
+		frmbuf = GetBuffer(sw, sh);
+		ScaleNV12(frame, yoff, dw, dh, frmbuf, mode);
+	}
+	else {
+		frmbuf = GetBuffer(bw, bh);
+
+		if (_black_frames) {
+			webrtc::I420Buffer::SetBlack(frmbuf.get());
+		}
+		else {
+			switch(frame->type) {
+			case AVS_VIDFRAME_NV12:
+				libyuv::NV12ToI420Rotate(frame->y + yoff, frame->ys,
+					frame->u + yoff, frame->us,
+					frmbuf->MutableDataY(), frmbuf->StrideY(),
+					frmbuf->MutableDataU(), frmbuf->StrideU(),
+					frmbuf->MutableDataV(), frmbuf->StrideV(),
+					dw, dh, mode);
+				break;
+
+			case AVS_VIDFRAME_NV21:
+				/* NV21 is NV12 with U and V swapped */
+				libyuv::NV12ToI420Rotate(frame->y + yoff, frame->ys,
+					frame->u + yoff, frame->us,
+					frmbuf->MutableDataY(), frmbuf->StrideY(),
+					frmbuf->MutableDataV(), frmbuf->StrideV(),
+					frmbuf->MutableDataU(), frmbuf->StrideU(),
+					dw, dh, mode);
+				break;
+
+			case AVS_VIDFRAME_I420:
+				libyuv::I420Rotate(frame->y + yoff, frame->ys,
+					frame->u + uvoff, frame->us,
+					frame->v + uvoff, frame->vs,
+					frmbuf->MutableDataY(), frmbuf->StrideY(),
+					frmbuf->MutableDataU(), frmbuf->StrideU(),
+					frmbuf->MutableDataV(), frmbuf->StrideV(),
+					dw, dh, mode);
+				break;
+			}
+		}
+
+		if (dw != sw || dh != sh) {
+			webrtc::scoped_refptr<webrtc::I420Buffer> sbuf;
+
+			sbuf = GetBuffer(sw, sh);
+			sbuf->CropAndScaleFrom(*frmbuf);
+
+			frmbuf = sbuf;
+		}
+	}
+
+	++_frames;
+
 	uint64_t now = tmr_jiffies();
 
 	_fps_send++;
@@ -360,6 +627,48 @@ void capture_source_handle_frame(struct avs_vidframe *frame)
 	wire::g_cap->HandleFrame(frame);
 }
 
+void capture_source_stats(uint64_t *frames, uint64_t *allocs)
+{
+	if (wire::g_cap)
+		wire::g_cap->GetStats(frames, allocs);
+}
+
+void capture_source_handle_frame_at(struct avs_vidframe *frame,
+				    uint64_t ts_us)
+{
+	wire::g_cap->HandleFrame(frame, (int64_t)ts_us);
+}
+
+void capture_source_set_encode_time(uint32_t encode_us)
+{
+	if (wire::g_cap)
+		wire::g_cap->SetEncodeTime(encode_us);
+}
+
+int capture_source_set_frame_handler(capture_source_frame_h *frameh,
+				     void *arg)
+{
+	webrtc::VideoSinkWants wants;
+
+	if (!wire::g_cap)
+		return ENOSYS;
+
+	if (wire::g_tap) {
+		wire::g_cap->RemoveSink(wire::g_tap);
+		delete wire::g_tap;
+		wire::g_tap = NULL;
+	}
+
+	if (!frameh)
+		return 0;
+
+	wire::g_tap = new wire::FrameTap(frameh, arg);
+	wants.rotation_applied = true;
+	wire::g_cap->AddOrUpdateSink(wire::g_tap, wants);
+
+	return 0;
+}
+
 };
 
 
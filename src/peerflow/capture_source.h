@@ -19,8 +19,15 @@
 #ifndef CAPTURE_SOURCE_H
 #define CAPTURE_SOURCE_H
 
+#include <atomic>
+#include <vector>
+
 #include "api/media_stream_interface.h"
 #include "api/notifier.h"
+#include "api/video/i420_buffer.h"
+#include "rtc_base/ref_counted_object.h"
+
+struct stats_capture;
 
 namespace wire {
 
@@ -36,6 +43,10 @@ public:
 	void RemoveSink(webrtc::VideoSinkInterface<webrtc::VideoFrame>* sink);
 
 	void HandleFrame(struct avs_vidframe *frame);
+	void HandleFrame(struct avs_vidframe *frame, int64_t ts_us);
+	void GetStats(uint64_t *frames, uint64_t *allocs);
+	void GetAdmissionStats(struct stats_capture *st) const;
+	void SetEncodeTime(uint32_t encode_us);
 
 	void AddRef() const;
 	webrtc::RefCountReleaseStatus Release() const;
@@ -62,6 +73,29 @@ public:
 	void UnregisterObserver(webrtc::ObserverInterface* observer) {};
 
 private:
+	typedef webrtc::RefCountedObject<webrtc::I420Buffer> PooledI420Buffer;
+
+	webrtc::scoped_refptr<webrtc::I420Buffer> GetBuffer(int w, int h);
+	uint32_t TargetFps(int want_fps) const;
+	uint32_t PixelLimit(int want_pixels) const;
+	bool Admit(int64_t ts_us, int want_fps);
+	void ScaleNV12(const struct avs_vidframe *frame,
+		       uint32_t yoff, uint32_t dw, uint32_t dh,
+		       webrtc::scoped_refptr<webrtc::I420Buffer> dst,
+		       int rotation);
+
+	std::vector<webrtc::scoped_refptr<PooledI420Buffer>> _pool;
+	std::vector<uint8_t> _nv12; /* scaled NV12 before conversion */
+	uint64_t     _frames;
+	uint64_t     _allocs;
+
+	/* admission control */
+	int64_t      _ts_admit;
+	std::atomic<uint32_t> _load;
+	std::atomic<uint64_t> _admitted;
+	std::atomic<uint64_t> _dropped;
+	std::atomic<uint64_t> _scaled;
+
 	struct list  _streaml;
 	struct lock* _lock;
 	bool         _buffer_rotate;
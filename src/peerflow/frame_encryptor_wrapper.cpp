@@ -33,6 +33,7 @@ FrameEncryptor::FrameEncryptor(const char *userid_hash,
 	frame_encryptor_alloc(&_enc,
 			      userid_hash,
 			      mtype);
+	frame_encryptor_set_latency_probe(_enc, msystem_get_latency_probe());
 }
 
 FrameEncryptor::~FrameEncryptor()
@@ -17,6 +17,9 @@
 */
 
 #include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <new>
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -50,6 +53,7 @@ extern "C" {
 #include "api/field_trials_view.h"
 #include "modules/audio_processing/include/audio_processing.h"
 #include "api/rtc_event_log/rtc_event_log_factory.h"
+#include "rtc_base/copy_on_write_buffer.h"
 #include "rtc_base/crypto_random.h"
 #include "rtc_base/logging.h"
 #include "rtc_base/physical_socket_server.h"
@@ -93,19 +97,75 @@ extern "C" {
 #define VIDEO_BITRATE_HI (1000 * 1024)
 #define VIDEO_BITRATE_LO (250 * 1024)
 
+#define MQ_RING_SIZE           1024  /* must be a power of 2 */
+#define MQ_RING_MASK   (MQ_RING_SIZE - 1)
+#define MQ_DRAIN_BATCH           64
+
+#define PF_SLOTS_MIN              8
+
+struct mq_data;
+struct mq_slot;
+struct peerflow;
+
+/* Events from the WebRTC threads address their flow by a slot and the
+ * slot generation, so a stale event never matches a reused slot.
+ */
+struct pf_slot {
+	struct peerflow *pf;
+	uint32_t gen;
+};
+
 static struct {
 	std::unique_ptr<webrtc::Thread> thread;
 	webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> pc_factory;
 	bool initialized;
 
+	/* Bounded MPSC ring: producers on any thread claim slots
+	 * lock-free, the main thread drains. The lock only serialises
+	 * consumers, and the overflow list.
+	 *
+	 * Control events are never dropped: when the ring is full they
+	 * are allocated on the overflow list, and dispatched in order
+	 * once the ring events queued before them have been drained.
+	 */
 	struct {
 		struct lock *lock;
 		struct mqueue *q;
-		struct list l;
+		struct mq_slot *ring;
+		std::atomic<uint32_t> tail;
+		uint32_t head;
+		std::atomic<bool> wake;
+		struct list overflowl;
+
+		struct mq_data *batch;
+		size_t batchc;
+
+		struct {
+			std::atomic<uint64_t> pushed;
+			std::atomic<uint64_t> dropped;
+			std::atomic<uint64_t> overflowed;
+			uint64_t drained;
+			uint32_t depth_max;
+			uint64_t lat_total_us;
+			uint64_t lat_max_us;
+
+			/* data channel receive path */
+			std::atomic<uint64_t> dc_msgs;
+			std::atomic<uint64_t> dc_bytes;
+			std::atomic<uint64_t> dc_copied;
+
+			/* data channel send path */
+			uint64_t dc_sent;
+			uint64_t dc_posts;
+		} stats;
 	} mq;
 	
-	struct lock *lock;
+	struct lock *lock;  /* protects pfl and slots */
 	struct list pfl;
+	struct {
+		struct pf_slot *v;
+		uint32_t c;
+	} slots;
 
 	class LogSink *logsink;	
 
@@ -125,6 +185,10 @@ static struct {
 	.initialized = false,
 	.lock = NULL,
 	.pfl = LIST_INIT,
+	.slots = {
+		  .v = NULL,
+		  .c = 0,
+	},
 	.audio = {
 		  .muted = false,
 	},
@@ -202,6 +266,7 @@ struct peerflow {
 	/* conf members */
 	struct {
 		struct list list;
+		struct conf_member_index *idx;
 		struct lock *lock;
 	} cml;
 
@@ -209,6 +274,8 @@ struct peerflow {
 	char *clientid_remote;
 
 	struct le le;
+	uint32_t slot;
+	uint32_t gen;
 
 	struct tmr tmr_stats;
 	struct tmr tmr_gather;
@@ -249,9 +316,11 @@ enum {
 
 struct mq_data {
 	struct peerflow *pf;
+	uint32_t slot;
+	uint32_t gen;
 	int id;
-	struct le le;
 	bool handled;
+	uint64_t ts;  /* enqueue time in us */
 
 	union {
 		struct {
@@ -259,36 +328,92 @@ struct mq_data {
 		} close;
 
 		struct {
-			char *sdp;
-			char *type;
+			const char *type;
 		} gather;
 
 		struct {
 			int id;
-			char *label;
 		} dcestab;
 		
+		/* Holds a reference to the WebRTC owned buffer,
+		 * mb is only used if that could not be taken.
+		 */
 		struct {
 			int id;
+			webrtc::CopyOnWriteBuffer *buf;
 			struct mbuf *mb;
 		} dcdata;
 	} u;
 };
 
+struct mq_slot {
+	std::atomic<uint32_t> seq;
+	uint32_t pos;
+	struct mq_data md;
+
+	struct le le;   /* member of overflow list */
+	bool overflow;
+};
+
 
-static bool valid_pf(struct peerflow *pf)
+/* g_pf.lock must be held */
+static bool valid_pf(const struct mq_data *md)
 {
-	bool found = false;
-	struct le *le;
+	const struct pf_slot *ps;
 
-	if (!pf)
+	if (!md->pf || md->slot >= g_pf.slots.c)
 		return false;
-	
-	for(le = g_pf.pfl.head; !found && le; le = le->next) {
-		found = le->data == pf;
+
+	ps = &g_pf.slots.v[md->slot];
+
+	return ps->pf == md->pf && ps->gen == md->gen;
+}
+
+
+/* g_pf.lock must be held for writing */
+static int slot_alloc(struct peerflow *pf)
+{
+	struct pf_slot *v;
+	uint32_t i, c;
+
+	for (i = 0; i < g_pf.slots.c; ++i) {
+		if (!g_pf.slots.v[i].pf)
+			goto out;
 	}
 
-	return found;
+	c = g_pf.slots.c ? 2 * g_pf.slots.c : PF_SLOTS_MIN;
+	v = (struct pf_slot *)mem_realloc(g_pf.slots.v, c * sizeof(*v));
+	if (!v)
+		return ENOMEM;
+
+	memset(&v[g_pf.slots.c], 0, (c - g_pf.slots.c) * sizeof(*v));
+	i = g_pf.slots.c;
+	g_pf.slots.v = v;
+	g_pf.slots.c = c;
+
+ out:
+	g_pf.slots.v[i].pf = pf;
+	pf->slot = i;
+	pf->gen = g_pf.slots.v[i].gen;
+
+	return 0;
+}
+
+
+/* g_pf.lock must be held for writing, see pf_destructor */
+static void slot_release(struct peerflow *pf)
+{
+	struct pf_slot *ps;
+
+	if (pf->slot >= g_pf.slots.c)
+		return;
+
+	ps = &g_pf.slots.v[pf->slot];
+	if (ps->pf != pf)
+		return;
+
+	ps->pf = NULL;
+	++ps->gen;
 }
 
 
@@ -437,57 +562,171 @@ public:
 	}
 };
 
-static void md_destructor(void *arg)
+static uint64_t mq_now_us(void)
 {
-	struct mq_data *md = (struct mq_data *)arg;
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
 
-	switch(md->id) {
-	case MQ_PC_GATHER:
-	case MQ_PC_GATHER_DELAY:
-		mem_deref(md->u.gather.sdp);
-		mem_deref(md->u.gather.type);
-		break;
+	return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
 
-	case MQ_DC_ESTAB:
-	case MQ_DC_OPEN:
-	case MQ_DC_CLOSE:
-		mem_deref(md->u.dcestab.label);
-		break;
-		
+static void mq_data_clear(struct mq_data *md)
+{
+	switch(md->id) {
 	case MQ_DC_DATA:
-		mem_deref(md->u.dcdata.mb);
+		delete md->u.dcdata.buf;
+		md->u.dcdata.buf = NULL;
+		md->u.dcdata.mb = (struct mbuf *)mem_deref(md->u.dcdata.mb);
 		break;
 
 	default:
 		break;
 	}
+}
 
-	list_unlink(&md->le);
+/* Control events must not be lost, data can be dropped under load */
+static bool mq_droppable(int id)
+{
+	return id == MQ_DC_DATA;
 }
 
-static void push_mq(struct mq_data *md)
+/* Claim a ring slot for an event. If the ring is full, data events
+ * are dropped (NULL), control events get an overflow slot.
+ * The caller fills in slot->md and hands it back with push_mq().
+ */
+static struct mq_slot *claim_mq(struct peerflow *pf, int id)
 {
-	lock_write_get(g_pf.mq.lock);
-	list_append(&g_pf.mq.l, &md->le, md);
-		
-	mqueue_push(g_pf.mq.q, md->id, md);
-	lock_rel(g_pf.mq.lock);
+	struct mq_slot *slot;
+	uint32_t pos, seq;
+	int32_t dif;
+
+	if (!g_pf.mq.ring)
+		return NULL;
+
+	pos = g_pf.mq.tail.load(std::memory_order_relaxed);
+	for (;;) {
+		slot = &g_pf.mq.ring[pos & MQ_RING_MASK];
+		seq = slot->seq.load(std::memory_order_acquire);
+		dif = (int32_t)(seq - pos);
+
+		if (dif == 0) {
+			if (g_pf.mq.tail.compare_exchange_weak(pos, pos + 1,
+					std::memory_order_relaxed))
+				break;
+		}
+		else if (dif < 0) {
+			if (mq_droppable(id)) {
+				g_pf.mq.stats.dropped.fetch_add(1,
+					std::memory_order_relaxed);
+				warning("pf(%p): mq full, dropping event: "
+					"0x%02x\n", pf, id);
+				return NULL;
+			}
+
+			slot = new (std::nothrow) mq_slot();
+			if (!slot) {
+				warning("pf(%p): mq full, no memory for "
+					"event: 0x%02x\n", pf, id);
+				return NULL;
+			}
+			slot->overflow = true;
+			g_pf.mq.stats.overflowed.fetch_add(1,
+					std::memory_order_relaxed);
+			break;
+		}
+		else {
+			pos = g_pf.mq.tail.load(std::memory_order_relaxed);
+		}
+	}
+
+	slot->pos = pos;
+	memset(&slot->md, 0, sizeof(slot->md));
+	slot->md.pf = pf;
+	if (pf) {
+		slot->md.slot = pf->slot;
+		slot->md.gen = pf->gen;
+	}
+	slot->md.id = id;
+	slot->md.ts = mq_now_us();
+
+	return slot;
+}
+
+static void push_mq(struct mq_slot *slot)
+{
+	if (slot->overflow) {
+		lock_write_get(g_pf.mq.lock);
+		list_append(&g_pf.mq.overflowl, &slot->le, slot);
+		lock_rel(g_pf.mq.lock);
+	}
+	else {
+		slot->seq.store(slot->pos + 1, std::memory_order_release);
+	}
+	g_pf.mq.stats.pushed.fetch_add(1, std::memory_order_relaxed);
+
+	/* Only wake the main thread if it is not already due to drain */
+	if (!g_pf.mq.wake.exchange(true))
+		mqueue_push(g_pf.mq.q, 0, NULL);
 }
 
 static void send_close(struct peerflow *pf, int err)
 {
-	struct mq_data *md;
+	struct mq_slot *slot;
 	
-	md = (struct mq_data *)mem_zalloc(sizeof(*md), md_destructor);
-	if (!md) {
-		warning("pf(%p): could not alloc md\n");
+	slot = claim_mq(pf, MQ_PC_CLOSE);
+	if (!slot)
 		return;
+
+	slot->md.u.close.err = err;
+
+	push_mq(slot);
+}
+
+int peerflow_inject_dce_data(struct iflow *iflow,
+			     const uint8_t *data, size_t len)
+{
+	struct peerflow *pf = (struct peerflow *)iflow;
+	struct mq_slot *slot;
+	struct mbuf *mb;
+
+	if (!pf || !data)
+		return EINVAL;
+
+	mb = mbuf_alloc(len);
+	if (!mb)
+		return ENOMEM;
+	mbuf_write_mem(mb, data, len);
+
+	slot = claim_mq(pf, MQ_DC_DATA);
+	if (!slot) {
+		mem_deref(mb);
+		return EOVERFLOW;
 	}
-	md->id = MQ_PC_CLOSE;
-	md->pf = pf;
-	md->u.close.err = err;
 
-	push_mq(md);
+	slot->md.u.dcdata.mb = mb;
+	push_mq(slot);
+
+	return 0;
+}
+
+int peerflow_inject_close(struct iflow *iflow, int err)
+{
+	if (!iflow)
+		return EINVAL;
+
+	send_close((struct peerflow *)iflow, err);
+
+	return 0;
+}
+
+void peerflow_mq_stats(uint64_t *pushed, uint64_t *dropped,
+		       uint64_t *overflowed)
+{
+	if (pushed)
+		*pushed = g_pf.mq.stats.pushed.load();
+	if (dropped)
+		*dropped = g_pf.mq.stats.dropped.load();
+	if (overflowed)
+		*overflowed = g_pf.mq.stats.overflowed.load();
 }
 
 static void set_all_mute(bool muted)
@@ -591,10 +830,18 @@ static void handle_mq(struct peerflow *pf, struct mq_data *md, int id)
 			break;
 
 		case MQ_DC_DATA:
-			IFLOW_CALL_CB(pf->iflow, dce_recvh,
-				      md->u.dcdata.mb->buf,
-				      md->u.dcdata.mb->end,
-				      pf->iflow.arg);
+			if (md->u.dcdata.buf) {
+				IFLOW_CALL_CB(pf->iflow, dce_recvh,
+					      md->u.dcdata.buf->cdata(),
+					      md->u.dcdata.buf->size(),
+					      pf->iflow.arg);
+			}
+			else {
+				IFLOW_CALL_CB(pf->iflow, dce_recvh,
+					      md->u.dcdata.mb->buf,
+					      md->u.dcdata.mb->end,
+					      pf->iflow.arg);
+			}
 			break;
 
 		default:
@@ -605,108 +852,165 @@ static void handle_mq(struct peerflow *pf, struct mq_data *md, int id)
 	md->handled = true;
 }
 
-static void run_mq_on_pf(struct peerflow *pf, bool call_func)
+/* Drop pending events for a flow that is going away. Events are
+ * dropped from the ring, the overflow list and from a batch being
+ * dispatched. Slots still being filled in by a producer are skipped,
+ * the dispatcher drops those once the flow is no longer valid.
+ */
+static void discard_mq_on_pf(struct peerflow *pf)
 {
+	uint32_t pos, tail;
 	struct le *le;
-	
-	lock_write_get(g_pf.mq.lock);
-	le = g_pf.mq.l.head;
-	while (le) {
-		struct mq_data *md = (struct mq_data *)le->data;
-
-		md = (struct mq_data *)mem_ref(md);
-		le = le->next;
-		if (pf == md->pf) {
-			if (!call_func) {
-				md->handled = true;
-			}
-			else {
-				if (!md->handled) {
-					lock_rel(g_pf.mq.lock);
-					handle_mq(pf, md, md->id);
-					lock_write_get(g_pf.mq.lock);					
-				}
-				mem_deref(md);
-			}
-		}
-		mem_deref(md);
-	}
-	lock_rel(g_pf.mq.lock);
-}
+	size_t i;
 
-struct mq_entry {
-	struct mq_data *md;
+	if (!g_pf.mq.ring)
+		return;
 
-	struct le le;
-};
+	lock_write_get(g_pf.mq.lock);
+	tail = g_pf.mq.tail.load(std::memory_order_acquire);
+	for (pos = g_pf.mq.head; pos != tail; ++pos) {
+		struct mq_slot *slot = &g_pf.mq.ring[pos & MQ_RING_MASK];
 
-static void mqe_destructor(void *arg)
-{
-	struct mq_entry *mqe = (struct mq_entry *)arg;
+		if (slot->seq.load(std::memory_order_acquire) != pos + 1)
+			continue;
+		if (slot->md.pf == pf)
+			slot->md.handled = true;
+	}
+	LIST_FOREACH(&g_pf.mq.overflowl, le) {
+		struct mq_slot *slot = (struct mq_slot *)le->data;
 
-	list_unlink(&mqe->le);
-	lock_write_get(g_pf.mq.lock);
-	mem_deref(mqe->md);
+		if (slot->md.pf == pf)
+			slot->md.handled = true;
+	}
+	for (i = 0; i < g_pf.mq.batchc; ++i) {
+		if (g_pf.mq.batch[i].pf == pf)
+			g_pf.mq.batch[i].handled = true;
+	}
 	lock_rel(g_pf.mq.lock);
 }
 
-static void run_all_mq(void)
+/* Move up to MQ_DRAIN_BATCH events out of the ring and release
+ * their slots to the producers.
+ */
+static size_t fill_mq_batch(void)
 {
-	struct list mql = LIST_INIT;
-	struct le *le;
-	
+	uint32_t depth;
+	size_t n = 0;
+
 	lock_write_get(g_pf.mq.lock);
-	le = g_pf.mq.l.head;
-	while(le) {
-		struct mq_data *md = (struct mq_data *)le->data;
-		struct mq_entry *mqe;
 
-		le = le->next;
+	depth = g_pf.mq.tail.load(std::memory_order_relaxed) - g_pf.mq.head;
+	if (depth > g_pf.mq.stats.depth_max)
+		g_pf.mq.stats.depth_max = depth;
 
-		mqe = (struct mq_entry *)mem_zalloc(sizeof(*mqe), mqe_destructor);
-		if (!mqe)
-			continue;
+	while (n < MQ_DRAIN_BATCH) {
+		uint32_t pos = g_pf.mq.head;
+		struct mq_slot *slot;
+		struct le *le;
+
+		/* An overflow event is due once the ring events queued
+		 * before it have been drained.
+		 */
+		le = list_head(&g_pf.mq.overflowl);
+		if (le) {
+			slot = (struct mq_slot *)le->data;
+			if ((int32_t)(pos - slot->pos) >= 0) {
+				list_unlink(&slot->le);
+				g_pf.mq.batch[n++] = slot->md;
+				delete slot;
+				continue;
+			}
+		}
 
-		mqe->md = md;
-		list_append(&mql, &mqe->le, mqe);
+		slot = &g_pf.mq.ring[pos & MQ_RING_MASK];
+		if (slot->seq.load(std::memory_order_acquire) != pos + 1)
+			break;
 
-		list_unlink(&md->le);
+		g_pf.mq.batch[n++] = slot->md;
+		slot->seq.store(pos + MQ_RING_SIZE, std::memory_order_release);
+		g_pf.mq.head = pos + 1;
 	}
+	g_pf.mq.batchc = n;
+
 	lock_rel(g_pf.mq.lock);
-		
-	LIST_FOREACH(&mql, le) {
-		struct mq_entry *mqe = (struct mq_entry *)le->data;
-		struct mq_data *md = mqe->md;
-		struct peerflow *pf = md->pf;
 
-		switch(md->id) {
-		case MQ_INTERNAL_SET_MUTE:
-			break;
+	return n;
+}
 
-		default:
+static void mq_account(struct mq_data *md)
+{
+	uint64_t lat = mq_now_us() - md->ts;
+
+	++g_pf.mq.stats.drained;
+	g_pf.mq.stats.lat_total_us += lat;
+	if (lat > g_pf.mq.stats.lat_max_us)
+		g_pf.mq.stats.lat_max_us = lat;
+}
+
+/* Dispatch a batch one flow at a time, so each flow is looked up
+ * and referenced once per batch rather than once per event.
+ */
+static void dispatch_mq_batch(size_t n)
+{
+	size_t i, j;
+
+	for (i = 0; i < n; ++i) {
+		struct peerflow *pf = g_pf.mq.batch[i].pf;
+		bool valid = true;
+
+		if (g_pf.mq.batch[i].handled)
+			continue;
+
+		if (pf) {
 			lock_write_get(g_pf.lock);
-			if (pf && valid_pf(pf)) {
+			valid = valid_pf(&g_pf.mq.batch[i]);
+			if (valid)
 				pf = (struct peerflow *)mem_ref(pf);
-			}
-			else if (pf) {
-				debug("pf(%p): handle_all: spurious event: 0x%02x\n", pf, md->id);
-				lock_rel(g_pf.lock);
-				continue;
-			}
 			lock_rel(g_pf.lock);
-			break;
 		}
-		
-		if (!md->handled) {
+
+		for (j = i; j < n; ++j) {
+			struct mq_data *md = &g_pf.mq.batch[j];
+
+			if (md->pf != pf || md->handled)
+				continue;
+
+			if (!valid) {
+				debug("pf(%p): handle_all: spurious event: "
+				      "0x%02x\n", pf, md->id);
+				md->handled = true;
+				continue;
+			}
+
+			mq_account(md);
 			handle_mq(pf, md, md->id);
 		}
-		if (pf) {
+
+		if (pf && valid) {
 			lock_write_get(g_pf.lock);
 			mem_deref(pf);
 			lock_rel(g_pf.lock);
 		}
 	}
-	list_flush(&mql);
+
+	lock_write_get(g_pf.mq.lock);
+	for (i = 0; i < n; ++i)
+		mq_data_clear(&g_pf.mq.batch[i]);
+	g_pf.mq.batchc = 0;
+	lock_rel(g_pf.mq.lock);
+}
+
+static void run_all_mq(void)
+{
+	size_t n;
+
+	if (!g_pf.mq.ring)
+		return;
+
+	g_pf.mq.wake.store(false);
+
+	while ((n = fill_mq_batch()) > 0)
+		dispatch_mq_batch(n);
 }
 
 static void mq_handler(int id, void *data, void *arg)
@@ -781,7 +1085,7 @@ void peerflow_start_log(void)
 
 static void peerflow_set_mute(bool muted)
 {
-	struct mq_data *md;
+	struct mq_slot *slot;
 	
 	info("pf: set_mute: %d muted=%d\n", muted, g_pf.audio.muted);
 	
@@ -795,13 +1099,12 @@ static void peerflow_set_mute(bool muted)
 		return;
 	}
 
-	md = (struct mq_data *)mem_zalloc(sizeof(*md), md_destructor);
-	if (!md) {
-		warning("pf: set_mute: failed to alloc md\n");
+	slot = claim_mq(NULL, MQ_INTERNAL_SET_MUTE);
+	if (!slot) {
+		warning("pf: set_mute: failed to queue event\n");
 		return;
 	}
-	md->id = MQ_INTERNAL_SET_MUTE;
-	push_mq(md);
+	push_mq(slot);
 }
 
 static bool peerflow_get_mute(void)
@@ -841,7 +1144,16 @@ int peerflow_init(void)
 	if (err)
 		goto out;
 	
-	list_init(&g_pf.mq.l);
+	g_pf.mq.ring = new struct mq_slot[MQ_RING_SIZE];
+	g_pf.mq.batch = new struct mq_data[MQ_DRAIN_BATCH];
+	for (uint32_t i = 0; i < MQ_RING_SIZE; ++i) {
+		g_pf.mq.ring[i].seq.store(i, std::memory_order_relaxed);
+		g_pf.mq.ring[i].overflow = false;
+	}
+	list_init(&g_pf.mq.overflowl);
+	g_pf.mq.tail.store(0);
+	g_pf.mq.head = 0;
+	g_pf.mq.batchc = 0;
 
 	err = lock_alloc(&g_pf.lock);
 	if (err)
@@ -924,11 +1236,52 @@ void peerflow_destroy(void)
 	// This seems to hang forever
 	//g_pf.thread->Stop();
 
+	info("peerflow_destroy: mq pushed=%llu dropped=%llu overflowed=%llu "
+	     "drained=%llu depth_max=%u latency avg=%llu max=%llu us\n",
+	     (unsigned long long)g_pf.mq.stats.pushed.load(),
+	     (unsigned long long)g_pf.mq.stats.dropped.load(),
+	     (unsigned long long)g_pf.mq.stats.overflowed.load(),
+	     (unsigned long long)g_pf.mq.stats.drained,
+	     g_pf.mq.stats.depth_max,
+	     (unsigned long long)(g_pf.mq.stats.drained ?
+		g_pf.mq.stats.lat_total_us / g_pf.mq.stats.drained : 0),
+	     (unsigned long long)g_pf.mq.stats.lat_max_us);
+	info("peerflow_destroy: dc msgs=%llu bytes=%llu copied=%llu "
+	     "sent=%llu posts=%llu\n",
+	     (unsigned long long)g_pf.mq.stats.dc_msgs.load(),
+	     (unsigned long long)g_pf.mq.stats.dc_bytes.load(),
+	     (unsigned long long)g_pf.mq.stats.dc_copied.load(),
+	     (unsigned long long)g_pf.mq.stats.dc_sent,
+	     (unsigned long long)g_pf.mq.stats.dc_posts);
+
 	g_pf.mq.q = (struct mqueue *)mem_deref(g_pf.mq.q);
-	list_flush(&g_pf.mq.l);
+	while (g_pf.mq.ring) {
+		uint32_t pos = g_pf.mq.head;
+		struct mq_slot *slot = &g_pf.mq.ring[pos & MQ_RING_MASK];
+
+		if (slot->seq.load(std::memory_order_acquire) != pos + 1)
+			break;
+		mq_data_clear(&slot->md);
+		slot->seq.store(pos + MQ_RING_SIZE, std::memory_order_release);
+		g_pf.mq.head = pos + 1;
+	}
+	while (!list_isempty(&g_pf.mq.overflowl)) {
+		struct le *le = list_head(&g_pf.mq.overflowl);
+		struct mq_slot *slot = (struct mq_slot *)le->data;
+
+		list_unlink(le);
+		mq_data_clear(&slot->md);
+		delete slot;
+	}
+	delete[] g_pf.mq.ring;
+	delete[] g_pf.mq.batch;
+	g_pf.mq.ring = NULL;
+	g_pf.mq.batch = NULL;
 	g_pf.mq.lock = (struct lock *)mem_deref(g_pf.mq.lock);
 
 	g_pf.lock = (struct lock *)mem_deref(g_pf.lock);
+	g_pf.slots.v = (struct pf_slot *)mem_deref(g_pf.slots.v);
+	g_pf.slots.c = 0;
 
 	g_pf.initialized = false;
 
@@ -983,61 +1336,75 @@ class DataChanObserver : public webrtc::DataChannelObserver {
 	virtual void OnStateChange() {
 
 		webrtc::DataChannelInterface::DataState state;
-		struct mq_data *md;
+		struct mq_slot *slot;
+		int id;
 
 		state = dc_->state();
 
-		md = (struct mq_data *)mem_zalloc(sizeof(*md), md_destructor);
-		md->pf = pf_;
-		md->u.dcestab.id = dc_->id();
-		md->id = MQ_DC_OPEN;
-		str_dup(&md->u.dcestab.label, dc_->label().c_str());
-				
 		switch (state) {
 		case webrtc::DataChannelInterface::kOpen:			
 			if (pf_->dc.ch == nullptr)
 				pf_->dc.ch = dc_;
 
-			md->id = MQ_DC_OPEN;
+			id = MQ_DC_OPEN;
 			break;
 
 		case webrtc::DataChannelInterface::kClosed:
-			md->id = MQ_DC_CLOSE;
+			id = MQ_DC_CLOSE;
 			break;
 
 		default:
-			mem_deref(md);
 			return;
 		}
 
-		push_mq(md);
-		//mqueue_push(g_pf.mq, md->id, md);
+		slot = claim_mq(pf_, id);
+		if (!slot)
+			return;
+
+		slot->md.u.dcestab.id = dc_->id();
+
+		push_mq(slot);
 	}
 	
 	//  A data buffer was successfully received.
 	virtual void OnMessage(const webrtc::DataBuffer& buffer) {
 
-		struct mq_data *md;
+		webrtc::CopyOnWriteBuffer *buf;
+		struct mq_slot *slot;
+		struct mbuf *mb = NULL;
+
+		g_pf.mq.stats.dc_msgs.fetch_add(1, std::memory_order_relaxed);
+		g_pf.mq.stats.dc_bytes.fetch_add(buffer.size(),
+						 std::memory_order_relaxed);
 
-		md = (struct mq_data *)mem_zalloc(sizeof(*md), md_destructor);
-		md->pf = pf_; //(struct peerflow *)mem_ref(pf_);
-		md->u.dcdata.mb = mbuf_alloc(buffer.size());
-		if (!md->u.dcdata.mb) {
-			warning("pf(%p): dce data: no mbuf\n", pf_);
-			mem_deref(md);
+		slot = claim_mq(pf_, MQ_DC_DATA);
+		if (!slot)
 			return;
-		}
 
-		mbuf_write_mem(md->u.dcdata.mb,
-			       (const uint8_t *)buffer.data.cdata(),
-			       buffer.size());
+		/* Copying a CopyOnWriteBuffer only takes a reference,
+		 * the payload is handed to the main thread as is.
+		 */
+		buf = new (std::nothrow) webrtc::CopyOnWriteBuffer(buffer.data);
+		if (!buf) {
+			mb = mbuf_alloc(buffer.size());
+			if (!mb) {
+				warning("pf(%p): dce data: no mbuf\n", pf_);
+				slot->md.handled = true;
+				push_mq(slot);
+				return;
+			}
+			mbuf_write_mem(mb,
+				       (const uint8_t *)buffer.data.cdata(),
+				       buffer.size());
+			g_pf.mq.stats.dc_copied.fetch_add(buffer.size(),
+						std::memory_order_relaxed);
+		}
 
-		md->u.dcdata.id = dc_->id();
-		
-		md->id = MQ_DC_DATA;
+		slot->md.u.dcdata.id = dc_->id();
+		slot->md.u.dcdata.buf = buf;
+		slot->md.u.dcdata.mb = mb;
 
-		push_mq(md);
-		//mqueue_push(g_pf.mq, md->id, md);
+		push_mq(slot);
 	}
 	
 	// The data channel's buffered_amount has changed.
@@ -1086,38 +1453,34 @@ static void invoke_gather(struct peerflow *pf,
 			  const webrtc::SessionDescriptionInterface *isdp)
 {
 	std::string sdp_str;
-	struct mq_data *md;
-	const char *type;
+	struct mq_slot *slot;
 
 	tmr_cancel(&pf->tmr_gather);
 	
-	type = SdpTypeToString(isdp->GetType());
-	
-	md = (struct mq_data *)mem_zalloc(sizeof(*md), md_destructor);
-	md->id = MQ_PC_GATHER;	
-	md->pf = pf;
-	str_dup(&md->u.gather.type, type);
+	slot = claim_mq(pf, MQ_PC_GATHER);
+	if (!slot)
+		return;
+
+	slot->md.u.gather.type = SdpTypeToString(isdp->GetType());
 
-	push_mq(md);
+	push_mq(slot);
 }
 
 static void invoke_gather_delayed(struct peerflow *pf,
 				  const webrtc::SessionDescriptionInterface *isdp)
 {
 	std::string sdp_str;
-	struct mq_data *md;
-	const char *type;
+	struct mq_slot *slot;
 
 	tmr_cancel(&pf->tmr_gather);
 
-	type = SdpTypeToString(isdp->GetType());
+	slot = claim_mq(pf, MQ_PC_GATHER_DELAY);
+	if (!slot)
+		return;
 
-	md = (struct mq_data *)mem_zalloc(sizeof(*md), md_destructor);
-	md->id = MQ_PC_GATHER_DELAY;
-	md->pf = pf;
-	str_dup(&md->u.gather.type, type);
+	slot->md.u.gather.type = SdpTypeToString(isdp->GetType());
 
-	push_mq(md);
+	push_mq(slot);
 }
 
 
@@ -1189,7 +1552,7 @@ public:
 	virtual void OnDataChannel (
 		webrtc::scoped_refptr<webrtc::DataChannelInterface> dc) {
 
-		struct mq_data *md;
+		struct mq_slot *slot;
 
 		info("pf(%p): data channel %d opened\n", pf_, dc->id());
 
@@ -1198,20 +1561,13 @@ public:
 		observer = new DataChanObserver(pf_, dc);
 		dc->RegisterObserver(observer);
 
-		md = (struct mq_data *)mem_zalloc(sizeof(*md), md_destructor);
-		if (!md) {
-			warning("pf(%p): failed to alloc md\n", pf_);
+		slot = claim_mq(pf_, MQ_DC_ESTAB);
+		if (!slot)
 			return;
-		}
 
-		md->pf = pf_;
-		md->u.dcestab.id = dc->id();
-		str_dup(&md->u.dcestab.label, dc->label().c_str());
+		slot->md.u.dcestab.id = dc->id();
 
-		md->id = MQ_DC_ESTAB;
-
-		push_mq(md);
-		//mqueue_push(g_pf.mq, md->id, md);
+		push_mq(slot);
 	}
 
 	// Triggered when renegotiation is needed. For example, an ICE restart
@@ -1222,17 +1578,13 @@ public:
 
 
 	void SendMQMessage(int msgid) {
-		struct mq_data *md;
-		md = (struct mq_data *)mem_zalloc(sizeof(*md),
-						  md_destructor);
-		if (!md) {
-			warning("pf(%p): could not alloc md\n", pf_);
+		struct mq_slot *slot;
+
+		slot = claim_mq(pf_, msgid);
+		if (!slot)
 			return;
-		}
-		md->pf = pf_;
-		md->id = msgid;
 
-		push_mq(md);
+		push_mq(slot);
 	}
 
 	// Called any time the IceConnectionState changes.
@@ -2192,9 +2544,11 @@ static void pf_destructor(void *arg)
 	pf->audio.source = NULL;
 	pf->dc.ch = NULL;
 
-	run_mq_on_pf(pf, false);
-	
+	discard_mq_on_pf(pf);
+
+	/* The last reference is dropped with g_pf.lock held */
 	list_unlink(&pf->le);
+	slot_release(pf);
 
 	delete pf->offerOptions;
 	delete pf->answerOptions;
@@ -2221,6 +2575,7 @@ static void pf_destructor(void *arg)
 	mem_deref(pf->stats);
 
 	list_flush(&pf->cml.list);
+	mem_deref(pf->cml.idx);
 	mem_deref(pf->cml.lock);
 
 	list_flush(&pf->video.renderl);
@@ -2248,7 +2603,7 @@ static void timer_stats(void *arg)
 		lock_write_get(pf->cml.lock);
 		for(webrtc::RtpSource src: sources) {
 			uint32_t ssrc = src.source_id();
-			struct conf_member *cm = conf_member_find_by_ssrca(&pf->cml.list, ssrc);
+			struct conf_member *cm = conf_member_index_find(pf->cml.idx, ssrc, false);
 			uint8_t level = src.audio_level() ? *src.audio_level() : 127;
 			if (cm) {
 				float flevel = powf(10.0f, -level / 30.0f) * 255.0f;
@@ -2260,6 +2615,16 @@ static void timer_stats(void *arg)
 
 	pf->peerConn->GetStats(pf->netStatsCb);
 
+	/* Let capture admission follow the encoder, using the
+	 * previous report as this one is delivered asynchronously.
+	 */
+	if (g_pf.video.src) {
+		struct stats_report report;
+
+		if (0 == stats_get_report(pf->stats, &report))
+			g_pf.video.src->SetEncodeTime(report.encode_time_us);
+	}
+
  out:
 	tmr_start(&pf->tmr_stats, TMR_STATS_INTERVAL, timer_stats, pf);
 }
@@ -2433,6 +2798,7 @@ int peerflow_alloc(struct iflow		**flowp,
 			    peerflow_sync_decoders,
 			    peerflow_set_keystore,
 			    peerflow_dce_send,
+			    peerflow_dce_send_batch,
 			    peerflow_stop_media,
 			    peerflow_close,
 			    peerflow_get_stats,
@@ -2458,6 +2824,10 @@ int peerflow_alloc(struct iflow		**flowp,
 	if (err)
 		goto out;
 
+	err = conf_member_index_alloc(&pf->cml.idx);
+	if (err)
+		goto out;
+
 #if 0
 	pf->dc.ch = pf->pf->CreateDataChannel("calling-3.0", nullptr);
 	if (!pf->dc.ch) {
@@ -2477,8 +2847,12 @@ int peerflow_alloc(struct iflow		**flowp,
 	pf->decoderAnswerObserver = new AnswerObserver(pf);
 	
 	lock_write_get(g_pf.lock);
-	list_append(&g_pf.pfl, &pf->le, pf);
+	err = slot_alloc(pf);
+	if (!err)
+		list_append(&g_pf.pfl, &pf->le, pf);
 	lock_rel(g_pf.lock);
+	if (err)
+		goto out;
 
 	pf->netStatsCb = new wire::NetStatsCallback(pf, pf->stats);
 
@@ -2636,23 +3010,71 @@ int peerflow_dcid(struct peerflow *pf)
 	return pf->dc.ch->id();
 }
 
+/* Hand messages to the data channel on the signaling thread in one
+ * task. Binary econn messages are sent as binary, JSON as text. Calling Send() from here goes through the channel proxy,
+ * which blocks on a signaling thread round trip for every message.
+ */
+static int dc_post(struct peerflow *pf,
+		   std::vector<webrtc::DataBuffer> bufv)
+{
+	webrtc::scoped_refptr<webrtc::DataChannelInterface> ch = pf->dc.ch;
+
+	if (!ch) {
+		warning("peerflow(%p): no data channel\n", pf);
+		return ENOENT;
+	}
+
+	g_pf.mq.stats.dc_sent += bufv.size();
+	++g_pf.mq.stats.dc_posts;
+
+	g_pf.thread->PostTask([ch, bufv = std::move(bufv)]() {
+		for (const webrtc::DataBuffer &buf : bufv)
+			ch->Send(buf);
+	});
+
+	return 0;
+}
+
 int peerflow_dce_send(struct iflow *flow,
 		      const uint8_t *data,
 		      size_t len)
 {
 	struct peerflow *pf = (struct peerflow*)flow;
-	if (!pf)
+	std::vector<webrtc::DataBuffer> bufv;
+
+	if (!pf || (len && !data))
 		return EINVAL;
 
-	if (!pf->dc.ch) {
-		warning("peerflow(%p): no data channel\n", pf);
-		return ENOENT;
+	bufv.emplace_back(webrtc::CopyOnWriteBuffer(data, len),
+			  econn_message_is_bin(data, len));
+
+	return dc_post(pf, std::move(bufv));
+}
+
+int peerflow_dce_send_batch(struct iflow *flow,
+			    struct mbuf * const *mbv,
+			    size_t mbc)
+{
+	struct peerflow *pf = (struct peerflow*)flow;
+	std::vector<webrtc::DataBuffer> bufv;
+	size_t i;
+
+	if (!pf || (mbc && !mbv))
+		return EINVAL;
+
+	if (!mbc)
+		return 0;
+
+	bufv.reserve(mbc);
+	for (i = 0; i < mbc; ++i) {
+		const uint8_t *data = mbuf_buf(mbv[i]);
+		size_t len = mbuf_get_left(mbv[i]);
+
+		bufv.emplace_back(webrtc::CopyOnWriteBuffer(data, len),
+				  econn_message_is_bin(data, len));
 	}
-	
-	std::string txt((const char *)data, len);
-	pf->dc.ch->Send(webrtc::DataBuffer(txt));
 
-	return 0;
+	return dc_post(pf, std::move(bufv));
 }
 
 
@@ -2970,7 +3392,7 @@ int peerflow_add_decoders_for_user(struct iflow *iflow,
 	}
 
 	if (memb)
-		memb->active = false;
+		conf_member_deactivate(memb);
 
 	uuid_v4(&label);
 	
@@ -2980,6 +3402,12 @@ int peerflow_add_decoders_for_user(struct iflow *iflow,
 	if (err)
 		goto out;
 
+	err = conf_member_index_add(pf->cml.idx, memb);
+	if (err) {
+		mem_deref(memb);
+		goto out;
+	}
+
  out:
 	lock_rel(pf->cml.lock);
 	mem_deref(label);
@@ -3008,7 +3436,7 @@ int peerflow_remove_decoders_for_user(struct iflow *iflow,
 	lock_write_get(pf->cml.lock);
 	memb = conf_member_find_active_by_userclient(&pf->cml.list, userid, clientid);
 	if (memb)
-		memb->active = false;
+		conf_member_deactivate(memb);
 	lock_rel(pf->cml.lock);
 
 	return 0;
@@ -3178,7 +3606,7 @@ void peerflow_close(struct iflow *iflow)
 	 * BEFORE we return. This ensures that all entries in the mqueue,
 	 * associated with this peerflow will finish execution
 	 */
-	run_mq_on_pf(pf, false);
+	discard_mq_on_pf(pf);
 
 	lock_write_get(g_pf.lock);
 	mem_deref(pf);
@@ -3245,12 +3673,8 @@ int peerflow_get_userid_for_ssrc(struct peerflow* pf,
 	if (!pf)
 		return EINVAL;
 
-	lock_write_get(pf->cml.lock);
-	if (video)
-		cm = conf_member_find_by_ssrcv(&pf->cml.list, csrc);
-	else
-		cm = conf_member_find_by_ssrca(&pf->cml.list, csrc);
-
+	lock_read_get(pf->cml.lock);
+	cm = conf_member_index_find(pf->cml.idx, csrc, video);
 	if (!cm) {
 		err = ENOENT;
 		goto out;
@@ -3278,38 +3702,93 @@ int peerflow_inc_frame_count(struct peerflow* pf,
 	char userid_anon[ANON_ID_LEN];
 	char clientid_anon[ANON_CLIENT_LEN];
 	struct conf_member *cm;
+	uint32_t aframes, vframes;
 	int err = 0;
 
 	if (!pf)
 		return EINVAL;
 
-	lock_write_get(pf->cml.lock);
-	if (video)
-		cm = conf_member_find_by_ssrcv(&pf->cml.list, csrc);
-	else
-		cm = conf_member_find_by_ssrca(&pf->cml.list, csrc);
-
+	/* Counters are atomic, so decoders only need the shared lock
+	 * to keep the member alive while they update it.
+	 */
+	lock_read_get(pf->cml.lock);
+	cm = conf_member_index_find(pf->cml.idx, csrc, video);
 	if (!cm) {
 		err = ENOENT;
 		goto out;
 	}
 
-	if (video)
-		cm->video_frames += frames;
-	else
-		cm->audio_frames += frames;
+	conf_member_inc_frames(cm, video, frames);
+	conf_member_get_frames(cm, &aframes, &vframes);
 
 	debug("FRAME(%p): %s.%s a: %u v: %u\n",
 	      pf,
 	      anon_id(userid_anon, cm->userid),
 	      anon_client(clientid_anon, cm->clientid),
-	      cm->audio_frames,
-	      cm->video_frames);
+	      aframes,
+	      vframes);
+out:
+	lock_rel(pf->cml.lock);
+	return err;
+}
+
+int peerflow_add_latency(struct peerflow* pf,
+			 uint32_t csrc,
+			 bool video,
+			 const struct stats_latency *sl)
+{
+	struct conf_member *cm;
+	int err = 0;
+
+	if (!pf || !sl)
+		return EINVAL;
+
+	lock_read_get(pf->cml.lock);
+	cm = conf_member_index_find(pf->cml.idx, csrc, video);
+	if (!cm) {
+		err = ENOENT;
+		goto out;
+	}
+
+	conf_member_add_latency(cm, video, sl);
 out:
 	lock_rel(pf->cml.lock);
 	return err;
 }
 
+static void get_latency_stats(struct peerflow *pf,
+			      struct stats_report *stats)
+{
+	struct le *le;
+
+	stats->nsenders = 0;
+
+	lock_read_get(pf->cml.lock);
+	LIST_FOREACH(&pf->cml.list, le) {
+		struct conf_member *cm = (struct conf_member *)le->data;
+		struct stats_sender_latency *sl;
+
+		if (stats->nsenders >= STATS_LAT_MAX_SENDERS)
+			break;
+
+		if (!cm->active)
+			continue;
+
+		sl = &stats->senders[stats->nsenders];
+		conf_member_get_latency(cm, false, &sl->audio);
+		conf_member_get_latency(cm, true, &sl->video);
+		if (!sl->audio.frames && !sl->video.frames)
+			continue;
+
+		sl->userid[0] = '\0';
+		sl->clientid[0] = '\0';
+		str_ncpy(sl->userid, cm->userid, sizeof(sl->userid));
+		str_ncpy(sl->clientid, cm->clientid, sizeof(sl->clientid));
+		stats->nsenders++;
+	}
+	lock_rel(pf->cml.lock);
+}
+
 int peerflow_get_stats(struct iflow *flow,
 		       struct stats_report *stats)
 {
@@ -3321,10 +3800,50 @@ int peerflow_get_stats(struct iflow *flow,
 	}
 
 	err = stats_get_report(pf->stats, stats);
+	if (!err && g_pf.video.src)
+		g_pf.video.src->GetAdmissionStats(&stats->capture);
+	if (!err)
+		get_latency_stats(pf, stats);
 	
 	return err;
 }
 
+static int debug_hist(struct re_printf *pf, const uint32_t *hist)
+{
+	int err = 0;
+
+	for (int i = 0; i < STATS_LAT_BUCKETS && !err; i++) {
+		if (i < STATS_LAT_BUCKETS - 1)
+			err = re_hprintf(pf, " <%u:%u",
+					 stats_latency_bound(i), hist[i]);
+		else
+			err = re_hprintf(pf, " more:%u", hist[i]);
+	}
+
+	return err;
+}
+
+static int debug_latency(struct re_printf *pf, const char *media,
+			 const struct stats_latency *sl)
+{
+	int err;
+
+	if (!sl->frames)
+		return 0;
+
+	err = re_hprintf(pf, "    %s latency: frames: %u mean: %llu max: %u "
+			 "lost: %u skewed: %u\n      latency ms:",
+			 media, sl->frames,
+			 (unsigned long long)(sl->sum_ms / sl->frames),
+			 sl->max_ms, sl->lost, sl->skewed);
+	err |= debug_hist(pf, sl->latency);
+	err |= re_hprintf(pf, "\n      jitter ms: ");
+	err |= debug_hist(pf, sl->jitter);
+	err |= re_hprintf(pf, "\n");
+
+	return err;
+}
+
 int peerflow_debug(struct re_printf *pf, const struct iflow *flow)
 {
 	struct peerflow *peerflow = (struct peerflow*)flow;
@@ -3337,15 +3856,47 @@ int peerflow_debug(struct re_printf *pf, const struct iflow *flow)
 	if (err)
 		goto out;
 
+	err = re_hprintf(pf, "mq: pushed: %llu dropped: %llu depth_max: %u "
+			 "latency avg: %llu max: %llu us\n",
+			 (unsigned long long)g_pf.mq.stats.pushed.load(),
+			 (unsigned long long)g_pf.mq.stats.dropped.load(),
+			 g_pf.mq.stats.depth_max,
+			 (unsigned long long)(g_pf.mq.stats.drained ?
+			    g_pf.mq.stats.lat_total_us / g_pf.mq.stats.drained : 0),
+			 (unsigned long long)g_pf.mq.stats.lat_max_us);
+	if (err)
+		goto out;
+
+	err = re_hprintf(pf, "dc: msgs: %llu bytes: %llu "
+			 "copied: %llu (%llu per msg)\n",
+			 (unsigned long long)g_pf.mq.stats.dc_msgs.load(),
+			 (unsigned long long)g_pf.mq.stats.dc_bytes.load(),
+			 (unsigned long long)g_pf.mq.stats.dc_copied.load(),
+			 (unsigned long long)(g_pf.mq.stats.dc_msgs.load() ?
+			    g_pf.mq.stats.dc_copied.load()
+			    / g_pf.mq.stats.dc_msgs.load() : 0));
+	if (err)
+		goto out;
+
 	LIST_FOREACH(&peerflow->cml.list, le) {
 		struct conf_member *cm = (struct conf_member *)le->data;
+		struct stats_latency lat;
+		uint32_t aframes, vframes;
 
 		if (cm->active) {
+			conf_member_get_frames(cm, &aframes, &vframes);
 			err = re_hprintf(pf, "stream user: %s.%s ssrca: %u ssrcv: %u aframes: %u vframes: %u\n",
 				anon_id(userid_anon, cm->userid),
 				anon_client(clientid_anon, cm->clientid),
 				cm->ssrca, cm->ssrcv,
-				cm->audio_frames, cm->video_frames);
+				aframes, vframes);
+			if (err)
+				goto out;
+
+			conf_member_get_latency(cm, false, &lat);
+			err = debug_latency(pf, "audio", &lat);
+			conf_member_get_latency(cm, true, &lat);
+			err |= debug_latency(pf, "video", &lat);
 			if (err)
 				goto out;
 		}
@@ -80,6 +80,9 @@ void peerflow_close(struct iflow *iflow);
 int peerflow_dce_send(struct iflow *flow,
 		      const uint8_t *data,
 		      size_t len);
+int peerflow_dce_send_batch(struct iflow *flow,
+			    struct mbuf * const *mbv,
+			    size_t mbc);
 
 bool peerflow_is_dcopen(struct peerflow *pf);
 
@@ -88,6 +91,15 @@ int peerflow_debug(struct re_printf *pf, const struct iflow *flow);
 int peerflow_get_stats(struct iflow *flow,
 		       struct stats_report *stats);
 
+/* Queue events on the main thread as the WebRTC threads would,
+ * for testing the event queue. Declared for the tests in ztest.h.
+ */
+int peerflow_inject_dce_data(struct iflow *iflow,
+			     const uint8_t *data, size_t len);
+int peerflow_inject_close(struct iflow *iflow, int err);
+void peerflow_mq_stats(uint64_t *pushed, uint64_t *dropped,
+		       uint64_t *overflowed);
+
 #ifdef __cplusplus
 }
 #endif
@@ -16,11 +16,15 @@
 * along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <atomic>
+
 #include "video_renderer.h"
 
 
 #define SWAP(a, b, t) {t = a; a = b; b = t;}
 
+static std::atomic<uint32_t> g_render_handle(0);
+
 namespace wire {
 
 VideoRendererSink::VideoRendererSink(struct peerflow *pf,
@@ -40,9 +44,16 @@ VideoRendererSink::VideoRendererSink(struct peerflow *pf,
 	str_dup(&clientid_remote_, clientid_remote);
 	ts_fps_ = tmr_jiffies();
 
-	info("VideoRenderSink(%p): constructor user: %s.%s\n",
+	/* Handle 0 is never used, so apps can use it as "none" */
+	do {
+		handle_ = ++g_render_handle;
+	} while (!handle_);
+
+	info("VideoRenderSink(%p): constructor user: %s.%s handle: %u\n",
 		this, anon_id(uid_anon, userid_remote_),
-		anon_client(cid_anon, clientid_remote_));
+		anon_client(cid_anon, clientid_remote_), handle_);
+
+	iflow_render_streamh(handle_, userid_remote_, clientid_remote_);
 }
 
 VideoRendererSink::~VideoRendererSink()
@@ -53,6 +64,9 @@ VideoRendererSink::~VideoRendererSink()
 	info("VideoRenderSink(%p): destructor user: %s.%s frames: %u\n",
 		this, anon_id(uid_anon, userid_remote_),
 		anon_client(cid_anon, clientid_remote_), frame_count_);
+
+	iflow_render_streamh(handle_, NULL, NULL);
+
 	mem_deref(userid_remote_);
 	mem_deref(clientid_remote_);
 }
@@ -64,7 +78,7 @@ void VideoRendererSink::OnFrame(const webrtc::VideoFrame& frame)
 	uint64_t now = tmr_jiffies();
 	char userid_anon[ANON_ID_LEN];
 	char clientid_anon[ANON_CLIENT_LEN];
-	webrtc::RtpPacketInfos pinfos = frame.packet_infos();
+	const webrtc::RtpPacketInfos& pinfos = frame.packet_infos();
 
 	if (pinfos.size() > 0) {
 		uint32_t sid;
@@ -91,6 +105,10 @@ void VideoRendererSink::OnFrame(const webrtc::VideoFrame& frame)
 					fw, fh);
 				fps_count_ = 0;
 				ts_fps_ = now;
+
+				iflow_render_streamh(handle_,
+						     userid_remote_,
+						     clientid_remote_);
 			}
 			ssrc_ = sid;
 			mem_deref(uid);
@@ -120,7 +138,7 @@ void VideoRendererSink::OnFrame(const webrtc::VideoFrame& frame)
 	}
 
 	struct avs_vidframe avsframe;
-	const webrtc::I420BufferInterface *i420;
+	webrtc::scoped_refptr<webrtc::I420BufferInterface> i420;
 
 	avsframe.type = AVS_VIDFRAME_I420;
 	avsframe.w = fw;
@@ -150,17 +168,51 @@ void VideoRendererSink::OnFrame(const webrtc::VideoFrame& frame)
 		break;
 
 	}
-	i420 = frame.video_frame_buffer()->GetI420();
+	/* No copy for I420 buffers, which is what the decoders produce */
+	i420 = frame.video_frame_buffer()->ToI420();
+	if (!i420)
+		return;
+
 	avsframe.y  = (uint8_t *)i420->DataY();
 	avsframe.u  = (uint8_t *)i420->DataU();
 	avsframe.v  = (uint8_t *)i420->DataV();
 	avsframe.ys = i420->StrideY();
 	avsframe.us = i420->StrideU();
 	avsframe.vs = i420->StrideV();
+	avsframe.ref = i420.get();
+
+	if (iflow_render_stream_enabled())
+		iflow_render_stream_frameh(&avsframe, handle_);
+	else
+		iflow_render_frameh(&avsframe, userid_remote_, clientid_remote_);
+}
 
-	iflow_render_frameh(&avsframe, userid_remote_, clientid_remote_);
-		
 }
 
+extern "C" {
+
+/* Keep a rendered frame beyond the render callback, the reference
+ * may be released from any thread.
+ */
+void *video_renderer_frame_retain(const struct avs_vidframe *frame)
+{
+	webrtc::I420BufferInterface *buf;
+
+	if (!frame || !frame->ref)
+		return NULL;
+
+	buf = (webrtc::I420BufferInterface *)frame->ref;
+	buf->AddRef();
+
+	return buf;
+}
+
+void video_renderer_frame_release(void *ref)
+{
+	webrtc::I420BufferInterface *buf = (webrtc::I420BufferInterface *)ref;
+
+	if (buf)
+		buf->Release();
 }
 
+};
@@ -70,6 +70,7 @@ private:
 	uint32_t fps_count_;
 	uint32_t frame_count_;
 	uint32_t ssrc_;
+	uint32_t handle_;
 };
 
 }
@@ -7,16 +7,16 @@
 // A reference timestamp (9.9.2001) in microseconds
 const double REF_TS_US = 1000000000000000;
 
-static enum stats_proto stats_parse_poto(const char *type)
+static enum stats_proto stats_parse_poto(const struct pl *type)
 {
-	if (type == NULL) {
+	if (!pl_isset(type)) {
 		return STATS_PROTO_UNKNOWN;
 	}
 
-	if (streq(type, "udp")) {
+	if (0 == pl_strcmp(type, "udp")) {
 		return STATS_PROTO_UDP;
 	}
-	else if (streq(type, "tcp")) {
+	else if (0 == pl_strcmp(type, "tcp")) {
 		return STATS_PROTO_TCP;
 	}
 	else { 
@@ -24,22 +24,22 @@ static enum stats_proto stats_parse_poto(const char *type)
 	}
 }
 
-static enum stats_cand stats_parse_cand(const char *cand)
+static enum stats_cand stats_parse_cand(const struct pl *cand)
 {
-	if (cand == NULL) {
+	if (!pl_isset(cand)) {
 		return STATS_CAND_UNKNOWN;
 	}
 
-	if (streq(cand, "host")) {
+	if (0 == pl_strcmp(cand, "host")) {
 		return STATS_CAND_HOST;
 	}
-	else if (streq(cand, "srflx")) {
+	else if (0 == pl_strcmp(cand, "srflx")) {
 		return STATS_CAND_SRFLX;
 	}
-	else if (streq(cand, "prflx")) {
+	else if (0 == pl_strcmp(cand, "prflx")) {
 		return STATS_CAND_PRFLX;
 	}
-	else if (streq(cand, "relay")) {
+	else if (0 == pl_strcmp(cand, "relay")) {
 		return STATS_CAND_RELAY;
 	}
 	else { 
@@ -58,31 +58,31 @@ enum stats_type {
 	STATS_TYPE_TRANSPORT,
 };
 
-static enum stats_type stats_parse_type(const char *type)
+static enum stats_type stats_parse_type(const struct pl *type)
 {
-	if (type == NULL) {
+	if (!pl_isset(type)) {
 		return STATS_TYPE_UNKNOWN;
 	}
 
-	if (streq(type, "inbound-rtp")) {
+	if (0 == pl_strcmp(type, "inbound-rtp")) {
 		return STATS_TYPE_INBOUND_RTP;
 	}
-	else if (streq(type, "outbound-rtp")) {
+	else if (0 == pl_strcmp(type, "outbound-rtp")) {
 		return STATS_TYPE_OUTBOUND_RTP;
 	}
-	else if (streq(type, "remote-inbound-rtp")) {
+	else if (0 == pl_strcmp(type, "remote-inbound-rtp")) {
 		return STATS_TYPE_REMOTE_INBOUND_RTP;
 	}
-	else if (streq(type, "media-source")) {
+	else if (0 == pl_strcmp(type, "media-source")) {
 		return STATS_TYPE_MEDIA_SOURCE;
 	}
-	else if (streq(type, "candidate-pair")) {
+	else if (0 == pl_strcmp(type, "candidate-pair")) {
 		return STATS_TYPE_CANDIDATE_PAIR;
 	}
-	else if (streq(type, "local-candidate")) {
+	else if (0 == pl_strcmp(type, "local-candidate")) {
 		return STATS_TYPE_LOCAL_CANDIDATE;
 	}
-	else if (streq(type, "transport")) {
+	else if (0 == pl_strcmp(type, "transport")) {
 		return STATS_TYPE_TRANSPORT;
 	}
 	else { 
@@ -96,16 +96,16 @@ enum stats_kind {
 	STATS_KIND_VIDEO,
 };
 
-static enum stats_kind stats_parse_kind(const char *kind)
+static enum stats_kind stats_parse_kind(const struct pl *kind)
 {
-	if (kind == NULL) {
+	if (!pl_isset(kind)) {
 		return STATS_KIND_UNKNOWN;
 	}
 
-	if (streq(kind, "audio")) {
+	if (0 == pl_strcmp(kind, "audio")) {
 		return STATS_KIND_AUDIO;
 	}
-	else if (streq(kind, "video")) {
+	else if (0 == pl_strcmp(kind, "video")) {
 		return STATS_KIND_VIDEO;
 	}
 	else { 
@@ -118,13 +118,13 @@ enum stats_state {
 	STATS_STATE_SUCCEEDED,
 };
 
-static enum stats_state stats_parse_state(const char *state)
+static enum stats_state stats_parse_state(const struct pl *state)
 {
-	if (state == NULL) {
+	if (!pl_isset(state)) {
 		return STATS_STATE_UNKNOWN;
 	}
 
-	if (streq(state, "succeeded")) {
+	if (0 == pl_strcmp(state, "succeeded")) {
 		return STATS_STATE_SUCCEEDED;
 	}
 	else {
@@ -132,90 +132,96 @@ static enum stats_state stats_parse_state(const char *state)
 	}
 }
 
-struct stats_inbound_rtp {
+/* ICE entries kept inline while parsing a report, larger reports
+ * move them to the heap.
+ */
+#define STATS_INL_PAIRS       32
+#define STATS_INL_CANDIDATES  32
+
+/*
+ * The fields of one report entry that we care about. Strings point
+ * into the report being parsed.
+ */
+struct stats_item {
+	enum stats_type type;
 	enum stats_kind kind;
+	enum stats_state state;
+	enum stats_proto proto;
+	enum stats_cand cand;
+	bool nominated;
 	int packets_received;
-	int packets_lost;
-	double jitter;
-	double timestamp;
-	struct le le;
-};
-
-struct stats_outbound_rtp {
-	enum stats_kind kind;
 	int packets_sent;
-	double timestamp;
-	struct le le;
-};
-
-struct stats_remote_inbound_rtp {
-	enum stats_kind kind;
 	int packets_lost;
 	double jitter;
 	double timestamp;
 	double rtt;
-	struct le le;
-};
-
-struct stats_audio_source {
-	double level;
-	struct le le;
+	double current_rtt;
+	double audio_level;
+	double total_encode_time;
+	int frames_encoded;
+	struct pl id;
+	struct pl local_candidate_id;
+	struct pl selected_pair_id;
 };
 
 struct stats_candidate_pair {
 	enum stats_state state;
 	bool nominated;
 	double current_rtt;
-	char *id;
-	char *local_candidate_id;
-	struct le le;
+	struct pl id;
+	struct pl local_candidate_id;
 };
 
-static void candidate_pair_destructor(void *arg)
-{
-	struct stats_candidate_pair *item = arg;
-	mem_deref(item->id);
-	mem_deref(item->local_candidate_id);
-}
-
 struct stats_local_candidate {
-	char *id;
+	struct pl id;
 	enum stats_proto proto;
 	enum stats_cand cand;
-	struct le le;
 };
 
-static void local_candidate_destructor(void *arg)
-{
-	struct stats_local_candidate *item = arg;
-	mem_deref(item->id);
-}
+/* Accumulated while streaming through a report, allocating only for
+ * reports with more ICE entries than fit inline.
+ */
+struct stats_obj {
+	struct stats_packet_counts packets;
+	struct stats_rx_tx jitter_audio;
+	struct stats_rx_tx jitter_video;
+	double audio_jitter;
+	int aj_count;
+	double video_jitter;
+	int vj_count;
+	double timestamp;
 
-struct stats_transport {
-	char *selected_pair_id;
-	struct le le;
-};
+	double remote_inbound_rtt;
+	int remote_inbound_rtt_count;
 
-static void transport_destructor(void *arg)
-{
-	struct stats_transport *item = arg;
-	mem_deref(item->selected_pair_id);
-}
+	bool has_audio_level;
+	double audio_level;
 
-struct stats_obj {
-	struct list audio_source;
-	struct list inbound_rtp;
-	struct list outbound_rtp;
-	struct list remote_inbound_rtp;
-	struct list candidate_pair;
-	struct list local_candidate;
-	struct list transport;
+	double total_encode_time;
+	uint32_t frames_encoded;
+
+	bool has_transport;
+	struct pl selected_pair_id;
+
+	struct stats_candidate_pair pair_inl[STATS_INL_PAIRS];
+	struct stats_candidate_pair *pairv;  /* pair_inl or heap */
+	size_t pairc;
+	size_t pairsz;
+	struct stats_local_candidate cand_inl[STATS_INL_CANDIDATES];
+	struct stats_local_candidate *candv; /* cand_inl or heap */
+	size_t candc;
+	size_t candsz;
+
+	size_t pairs_dropped;
+	size_t cands_dropped;
 };
 
 struct avs_stats {
 	struct stats_report report;
 	struct stats_packet_counts last_packets;
 	uint64_t last_timestamp_in_ms;
+	double last_encode_time;
+	uint32_t last_frames_encoded;
 
 	void *arg;
 };
@@ -243,11 +249,10 @@ static uint64_t normalize_timestamp_to_ms(double timestamp) {
 
 static int read_packet_stats_and_jitter(struct avs_stats *stats, const struct stats_obj *stats_obj)
 {
-	struct le *le = NULL;
-	double audio_jitter = 0;
-	int aj_count = 0;
-	double video_jitter = 0;
-	int vj_count = 0;
+	double audio_jitter = stats_obj ? stats_obj->audio_jitter : 0;
+	int aj_count = stats_obj ? stats_obj->aj_count : 0;
+	double video_jitter = stats_obj ? stats_obj->video_jitter : 0;
+	int vj_count = stats_obj ? stats_obj->vj_count : 0;
 	double timestamp = 0;
 
 	if (!stats || !stats_obj) {
@@ -268,57 +273,11 @@ static int read_packet_stats_and_jitter(struct avs_stats *stats, const struct st
 	      report-packets-loss = { loss_tx, loss_rx}
 	*/
 
-	// 1. read json stats into report
-	LIST_FOREACH(&stats_obj->inbound_rtp, le) {
-		const struct stats_inbound_rtp *data = (struct stats_inbound_rtp *)le->data;
-
-		if (data->kind == STATS_KIND_AUDIO) {
-			stats->report.packets.audio.rx += data->packets_received;
-			timestamp = max(timestamp, data->timestamp);
-			if (data->packets_received) {
-				audio_jitter += data->jitter;
-				aj_count++;
-			}
-		}
-		else if (data->kind == STATS_KIND_VIDEO) {
-			stats->report.packets.video.rx += data->packets_received;
-			timestamp = max(timestamp, data->timestamp);
-			if (data->packets_received) {
-				video_jitter += data->jitter;
-				vj_count++;
-			}
-		}
-
-		stats->report.packets.lost.rx += data->packets_lost;
-	}
-
-	LIST_FOREACH(&stats_obj->outbound_rtp, le) {
-		const struct stats_outbound_rtp *data = (struct stats_outbound_rtp *)le->data;
-
-		if (data->kind == STATS_KIND_AUDIO) {
-			stats->report.packets.audio.tx += data->packets_sent;
-			timestamp = max(timestamp, data->timestamp);
-		}
-		else if (data->kind == STATS_KIND_VIDEO) {
-			stats->report.packets.video.tx += data->packets_sent;
-			timestamp = max(timestamp, data->timestamp);
-		}
-	}
-
-	LIST_FOREACH(&stats_obj->remote_inbound_rtp, le) {
-		const struct stats_remote_inbound_rtp *data = (struct stats_remote_inbound_rtp *)le->data;
-
-		if (data->kind == STATS_KIND_AUDIO) {
-			stats->report.jitter.audio.tx = max(stats->report.jitter.audio.tx, (1000 * data->jitter));
-			timestamp = max(timestamp, data->timestamp);
-		}
-		else if (data->kind == STATS_KIND_VIDEO) {
-			stats->report.jitter.video.tx = max(stats->report.jitter.video.tx, (1000 * data->jitter));
-			timestamp = max(timestamp, data->timestamp);
-		}
-
-		stats->report.packets.lost.tx += data->packets_lost;
-	}
+	// 1. read json stats into report, summed up by add_item()
+	stats->report.packets = stats_obj->packets;
+	stats->report.jitter.audio.tx = stats_obj->jitter_audio.tx;
+	stats->report.jitter.video.tx = stats_obj->jitter_video.tx;
+	timestamp = stats_obj->timestamp;
 
 	// 1.1 calcualete rx jitter in ms with taking mean
 	stats->report.jitter.audio.rx = aj_count ? 1000 * (audio_jitter / aj_count) : 0;
@@ -368,54 +327,41 @@ static int read_packet_stats_and_jitter(struct avs_stats *stats, const struct st
 // Helper function to read percieved rtt
 static void read_rtt_rx(struct avs_stats *stats, const struct stats_obj *stats_obj)
 {
-	struct le *le = NULL;
-
 	if (!stats || !stats_obj) {
 		return;
 	}
 
-	// Calculate mean rtt from remote inbound reports
-	double remote_inbound_rtt = 0;
-	int remote_inbound_rtt_count = 0;
-
-	LIST_FOREACH(&stats_obj->remote_inbound_rtp, le) {
-		const struct stats_remote_inbound_rtp *data = (struct stats_remote_inbound_rtp *)le->data;
-
-		if (data->kind == STATS_KIND_AUDIO || data->kind == STATS_KIND_VIDEO) {
-			remote_inbound_rtt += data->rtt;
-			remote_inbound_rtt_count++;
-		}
-	}
+	// Mean rtt from remote inbound reports, summed up by add_item()
+	double remote_inbound_rtt = stats_obj->remote_inbound_rtt;
+	int remote_inbound_rtt_count = stats_obj->remote_inbound_rtt_count;
 
 	stats->report.rtt.rx = remote_inbound_rtt ? 1000 * (remote_inbound_rtt / remote_inbound_rtt_count) : 0;
 }
 
 static int read_rtt_and_connection(struct avs_stats *stats, const struct stats_obj *stats_obj)
 {
-	struct le *le = NULL;
-	const char *connected_local_candidate_id = NULL;
-	const char *selected_pair_id = NULL;
+	const struct pl *connected_local_candidate_id = NULL;
+	const struct pl *selected_pair_id = NULL;
+	size_t i;
 
 	if (!stats || !stats_obj) {
 		return EINVAL;
 	}
 
 	// First check if there is a "transport" report that should have selected pair
-	le = list_head(&stats_obj->transport);
-	if (le) {
-		const struct stats_transport *head = (struct stats_transport*)le->data;
-		selected_pair_id = head->selected_pair_id;
+	if (stats_obj->has_transport) {
+		selected_pair_id = &stats_obj->selected_pair_id;
 	}
 
 	// When we have a "transport" report search selected pair, else
 	// search a connected pair (which is succeeded and nominated)
-	LIST_FOREACH(&stats_obj->candidate_pair, le) {
-		const struct stats_candidate_pair *data = (struct stats_candidate_pair *)le->data;
+	for (i = 0; i < stats_obj->pairc; ++i) {
+		const struct stats_candidate_pair *data = &stats_obj->pairv[i];
 
-		if (selected_pair_id) {
-			if (data->id && streq(selected_pair_id, data->id)) {
+		if (selected_pair_id && pl_isset(selected_pair_id)) {
+			if (pl_isset(&data->id) && 0 == pl_cmp(selected_pair_id, &data->id)) {
 				stats->report.rtt.tx = max(stats->report.rtt.tx, (1000 * data->current_rtt));
-				connected_local_candidate_id = data->local_candidate_id;
+				connected_local_candidate_id = &data->local_candidate_id;
 				break;
 			}
 		}
@@ -423,8 +369,8 @@ static int read_rtt_and_connection(struct avs_stats *stats, const struct stats_o
 			// we will try to find connected pair without "transport" info
 			if (data->nominated && (data->state == STATS_STATE_SUCCEEDED)) {
 				stats->report.rtt.tx = max(stats->report.rtt.tx, (1000 * data->current_rtt));
-				if (data->local_candidate_id) {
-					connected_local_candidate_id = data->local_candidate_id;
+				if (pl_isset(&data->local_candidate_id)) {
+					connected_local_candidate_id = &data->local_candidate_id;
 				}
 			}
 		}
@@ -433,15 +379,15 @@ static int read_rtt_and_connection(struct avs_stats *stats, const struct stats_o
 	// read rtt perceived from peer side
 	read_rtt_rx(stats, stats_obj);
 
-	if (!connected_local_candidate_id) {
+	if (!connected_local_candidate_id || !pl_isset(connected_local_candidate_id)) {
 		// maybe ok that we dont have connection atm
 		return 0;
 	}
 	// use last connected local candidate id to get connection details
-	LIST_FOREACH(&stats_obj->local_candidate, le) {
-		const struct stats_local_candidate *data = (struct stats_local_candidate *)le->data;
+	for (i = 0; i < stats_obj->candc; ++i) {
+		const struct stats_local_candidate *data = &stats_obj->candv[i];
 
-		if (data->id && streq(data->id, connected_local_candidate_id)) {
+		if (pl_isset(&data->id) && 0 == pl_cmp(&data->id, connected_local_candidate_id)) {
 			stats->report.proto = data->proto;
 			stats->report.cand = data->cand;
 			break;
@@ -453,17 +399,46 @@ static int read_rtt_and_connection(struct avs_stats *stats, const struct stats_o
 
 static int read_audio_level(struct avs_stats *stats, const struct stats_obj *stats_obj)
 {
-	struct le *le = NULL;
+	if (!stats || !stats_obj) {
+		return EINVAL;
+	}
+
+	if (stats_obj->has_audio_level) {
+		stats->report.audio_level = (int)(stats_obj->audio_level * 255.0);
+	}
+
+	return 0;
+}
+
+
+/* Mean encode time per video frame since the previous report */
+static int read_encode_time(struct avs_stats *stats, const struct stats_obj *stats_obj)
+{
+	uint32_t frames;
+	double t;
 
 	if (!stats || !stats_obj) {
 		return EINVAL;
 	}
 
-	LIST_FOREACH(&stats_obj->audio_source, le) {
-		const struct stats_audio_source *asp = (struct stats_audio_source *)le->data;
-		stats->report.audio_level = (int)(asp->level * 255.0);
+	frames = stats_obj->frames_encoded - stats->last_frames_encoded;
+	t = stats_obj->total_encode_time - stats->last_encode_time;
+
+	// counters restart with a new sender
+	if (stats_obj->frames_encoded < stats->last_frames_encoded) {
+		frames = stats_obj->frames_encoded;
+		t = stats_obj->total_encode_time;
 	}
 
+	/* Nothing encoded since the last report, no encoder load */
+	if (frames && t > 0)
+		stats->report.encode_time_us = (uint32_t)(1000000.0 * t / frames);
+	else
+		stats->report.encode_time_us = 0;
+
+	stats->last_frames_encoded = stats_obj->frames_encoded;
+	stats->last_encode_time = stats_obj->total_encode_time;
+
 	return 0;
 }
 
@@ -496,289 +471,504 @@ int stats_alloc(struct avs_stats **statsp, void *arg)
 }
 
 
-static struct stats_inbound_rtp *parse_inbound_rtp(struct json_object *jitem)
-{
-	const char *kind_str = NULL;
+/*
+ * Single-pass scanner for the RTCStats JSON report. It only looks at
+ * the fields the read_*() functions need and never builds a tree.
+ */
+struct json_scan {
+	const char *p;
+	const char *end;
+};
 
-	struct stats_inbound_rtp *data;
-	data = mem_zalloc(sizeof(*data), NULL);
-	memset(data, 0, sizeof(*data));
+enum json_tok {
+	JSON_TOK_STRING,
+	JSON_TOK_INT,
+	JSON_TOK_DOUBLE,
+	JSON_TOK_TRUE,
+	JSON_TOK_FALSE,
+	JSON_TOK_OTHER,
+};
 
-	kind_str = jzon_str(jitem, "kind");
-	data->kind = stats_parse_kind(kind_str);
+static void scan_ws(struct json_scan *js)
+{
+	while (js->p < js->end &&
+	       (*js->p == ' ' || *js->p == '\t' ||
+		*js->p == '\n' || *js->p == '\r'))
+		++js->p;
+}
 
-	jzon_int(&data->packets_received, jitem, "packetsReceived");
-	jzon_int(&data->packets_lost, jitem, "packetsLost");
-	jzon_double(&data->jitter, jitem, "jitter");
-	jzon_double(&data->timestamp, jitem, "timestamp");
+static bool scan_char(struct json_scan *js, char c)
+{
+	scan_ws(js);
+	if (js->p < js->end && *js->p == c) {
+		++js->p;
+		return true;
+	}
 
-	return data;
+	return false;
 }
 
-static struct stats_outbound_rtp *parse_outbound_rtp(struct json_object *jitem)
+/* String contents are returned raw, escapes are left as they are */
+static int scan_string(struct json_scan *js, struct pl *pl)
 {
-	const char *kind_str = NULL;
+	const char *start;
 
-	struct stats_outbound_rtp* data;
-	data = mem_zalloc(sizeof(*data), NULL);
-	memset(data, 0, sizeof(*data));
+	if (!scan_char(js, '"'))
+		return EPROTO;
 
-	kind_str = jzon_str(jitem, "kind");
-	data->kind = stats_parse_kind(kind_str);
+	start = js->p;
+	while (js->p < js->end && *js->p != '"') {
+		if (*js->p == '\\')
+			++js->p;
+		++js->p;
+	}
+	if (js->p >= js->end)
+		return EPROTO;
 
-	jzon_int(&data->packets_sent, jitem, "packetsSent");
-	jzon_double(&data->timestamp, jitem, "timestamp");
+	pl->p = start;
+	pl->l = js->p - start;
+	++js->p;
 
-	return data;
+	return 0;
 }
 
-static struct stats_remote_inbound_rtp *parse_remote_inbound_rtp(struct json_object *jitem)
+/* Skip a nested object or array */
+static int scan_skip_nested(struct json_scan *js)
 {
-	const char *kind_str = NULL;
+	int depth = 0;
 
-	struct stats_remote_inbound_rtp *data;
-	data = mem_zalloc(sizeof(*data), NULL);
-	memset(data, 0, sizeof(*data));
+	do {
+		struct pl pl;
 
-	kind_str = jzon_str(jitem, "kind");
-	data->kind = stats_parse_kind(kind_str);
+		if (js->p >= js->end)
+			return EPROTO;
 
-	jzon_int(&data->packets_lost, jitem, "packetsLost");
-	jzon_double(&data->jitter, jitem, "jitter");
-	jzon_double(&data->timestamp, jitem, "timestamp");
-	jzon_double(&data->rtt, jitem, "roundTripTime");
+		switch (*js->p) {
 
-	return data;
-}
+		case '"':
+			if (scan_string(js, &pl))
+				return EPROTO;
+			continue;
 
-static struct stats_audio_source *parse_audio_source(struct json_object *jitem)
-{
-	struct stats_audio_source *data;
-	data = mem_zalloc(sizeof(*data), NULL);
-	memset(data, 0, sizeof(*data));
+		case '{':
+		case '[':
+			++depth;
+			break;
+
+		case '}':
+		case ']':
+			--depth;
+			break;
 
-	jzon_double(&data->level, jitem, "audioLevel");
+		default:
+			break;
+		}
+		++js->p;
+	} while (depth > 0);
 
-	return data;
+	return 0;
 }
 
-static struct stats_candidate_pair *parse_candidate_pair(struct json_object *jitem)
+static int scan_value(struct json_scan *js, enum json_tok *tok, struct pl *pl)
 {
-	const char *state_str = NULL;
-	const char *id_str = NULL;
-	const char *local_candidate_id_str = NULL;
+	const char *start;
+	bool frac = false;
+
+	scan_ws(js);
+	if (js->p >= js->end)
+		return EPROTO;
+
+	switch (*js->p) {
 
-	struct stats_candidate_pair *data;
-	data = mem_zalloc(sizeof(*data), candidate_pair_destructor);
-	memset(data, 0, sizeof(*data));
+	case '"':
+		*tok = JSON_TOK_STRING;
+		return scan_string(js, pl);
 
-	state_str = jzon_str(jitem, "state");
-	data->state = stats_parse_state(state_str);
-	jzon_bool(&data->nominated, jitem, "nominated");
-	jzon_double(&data->current_rtt, jitem, "currentRoundTripTime");
+	case '{':
+	case '[':
+		*tok = JSON_TOK_OTHER;
+		return scan_skip_nested(js);
 
-	id_str = jzon_str(jitem, "id");
-	if (id_str) {
-		str_dup(&data->id, id_str);
+	default:
+		break;
 	}
 
-	local_candidate_id_str = jzon_str(jitem, "localCandidateId");
-	if (local_candidate_id_str) {
-		str_dup(&data->local_candidate_id, local_candidate_id_str);
+	start = js->p;
+	while (js->p < js->end && *js->p != ',' && *js->p != '}' &&
+	       *js->p != ']' && *js->p != ' ' && *js->p != '\n' &&
+	       *js->p != '\r' && *js->p != '\t') {
+		if (*js->p == '.' || *js->p == 'e' || *js->p == 'E')
+			frac = true;
+		++js->p;
 	}
 
-	return data;
+	pl->p = start;
+	pl->l = js->p - start;
+	if (!pl->l)
+		return EPROTO;
+
+	if (0 == pl_strcmp(pl, "true"))
+		*tok = JSON_TOK_TRUE;
+	else if (0 == pl_strcmp(pl, "false"))
+		*tok = JSON_TOK_FALSE;
+	else if (*start == '-' || (*start >= '0' && *start <= '9'))
+		*tok = frac ? JSON_TOK_DOUBLE : JSON_TOK_INT;
+	else
+		*tok = JSON_TOK_OTHER;
+
+	return 0;
 }
 
-static struct stats_local_candidate *parse_local_candidate(struct json_object *jitem)
+/* Same rules as jzon_int(): only integers are accepted */
+static void item_int(int *dst, enum json_tok tok, const struct pl *pl)
 {
-	const char *id_str = NULL;
-	const char *proto_str = NULL;
-	const char *cand_str = NULL;
+	if (tok == JSON_TOK_INT)
+		*dst = (int)strtoll(pl->p, NULL, 10);
+}
 
-	struct stats_local_candidate *data;
-	data = mem_zalloc(sizeof(*data),local_candidate_destructor);
+/* Same rules as jzon_double(): integers and doubles are accepted */
+static void item_double(double *dst, enum json_tok tok, const struct pl *pl)
+{
+	if (tok == JSON_TOK_INT)
+		*dst = (double)strtoll(pl->p, NULL, 10);
+	else if (tok == JSON_TOK_DOUBLE)
+		*dst = strtod(pl->p, NULL);
+}
 
-	proto_str = jzon_str(jitem, "protocol");
-	data->proto = stats_parse_poto(proto_str);
-	cand_str = jzon_str(jitem, "candidateType");
-	data->cand = stats_parse_cand(cand_str);
+static void item_field(struct stats_item *item, const struct pl *key,
+		       enum json_tok tok, const struct pl *val)
+{
+	const bool str = tok == JSON_TOK_STRING;
 
-	id_str = jzon_str(jitem, "id");
-	if (id_str) {
-		str_dup(&data->id, id_str);
+	if (0 == pl_strcmp(key, "type")) {
+		if (str)
+			item->type = stats_parse_type(val);
+	}
+	else if (0 == pl_strcmp(key, "kind")) {
+		if (str)
+			item->kind = stats_parse_kind(val);
+	}
+	else if (0 == pl_strcmp(key, "id")) {
+		if (str)
+			item->id = *val;
+	}
+	else if (0 == pl_strcmp(key, "timestamp")) {
+		item_double(&item->timestamp, tok, val);
+	}
+	else if (0 == pl_strcmp(key, "packetsReceived")) {
+		item_int(&item->packets_received, tok, val);
+	}
+	else if (0 == pl_strcmp(key, "packetsSent")) {
+		item_int(&item->packets_sent, tok, val);
+	}
+	else if (0 == pl_strcmp(key, "packetsLost")) {
+		item_int(&item->packets_lost, tok, val);
+	}
+	else if (0 == pl_strcmp(key, "jitter")) {
+		item_double(&item->jitter, tok, val);
+	}
+	else if (0 == pl_strcmp(key, "roundTripTime")) {
+		item_double(&item->rtt, tok, val);
+	}
+	else if (0 == pl_strcmp(key, "currentRoundTripTime")) {
+		item_double(&item->current_rtt, tok, val);
+	}
+	else if (0 == pl_strcmp(key, "audioLevel")) {
+		item_double(&item->audio_level, tok, val);
+	}
+	else if (0 == pl_strcmp(key, "totalEncodeTime")) {
+		item_double(&item->total_encode_time, tok, val);
+	}
+	else if (0 == pl_strcmp(key, "framesEncoded")) {
+		item_int(&item->frames_encoded, tok, val);
+	}
+	else if (0 == pl_strcmp(key, "state")) {
+		if (str)
+			item->state = stats_parse_state(val);
+	}
+	else if (0 == pl_strcmp(key, "nominated")) {
+		if (tok == JSON_TOK_TRUE || tok == JSON_TOK_FALSE)
+			item->nominated = tok == JSON_TOK_TRUE;
+	}
+	else if (0 == pl_strcmp(key, "protocol")) {
+		if (str)
+			item->proto = stats_parse_poto(val);
+	}
+	else if (0 == pl_strcmp(key, "candidateType")) {
+		if (str)
+			item->cand = stats_parse_cand(val);
+	}
+	else if (0 == pl_strcmp(key, "localCandidateId")) {
+		if (str)
+			item->local_candidate_id = *val;
+	}
+	else if (0 == pl_strcmp(key, "selectedCandidatePairId")) {
+		if (str)
+			item->selected_pair_id = *val;
 	}
-
-	return data;
 }
 
-static struct stats_transport *parse_transport(struct json_object *jitem)
+/* Room for element c of an array that starts out in the inline
+ * storage of inlc elements, and moves to the heap when it is full.
+ */
+static void *obj_room(void **vp, size_t *szp, void *inl, size_t inlc,
+		      size_t c, size_t elemsz)
 {
-	const char *id_str = NULL;
+	size_t sz;
+	void *v;
 
-	struct stats_transport *data;
-	data = mem_zalloc(sizeof(*data),transport_destructor);
+	if (!*vp) {
+		*vp = inl;
+		*szp = inlc;
+	}
+
+	if (c < *szp)
+		return (uint8_t *)*vp + c * elemsz;
 
-	id_str = jzon_str(jitem, "selectedCandidatePairId");
-	if (id_str) {
-		str_dup(&data->selected_pair_id, id_str);
+	sz = *szp * 2;
+	if (*vp == inl) {
+		v = mem_alloc(sz * elemsz, NULL);
+		if (v)
+			memcpy(v, inl, *szp * elemsz);
+	}
+	else {
+		v = mem_realloc(*vp, sz * elemsz);
 	}
+	if (!v)
+		return NULL;
 
-	return data;
+	*vp = v;
+	*szp = sz;
+
+	return (uint8_t *)v + c * elemsz;
 }
 
-static int parse_json(const char *report, struct stats_obj *stats_obj) {
-	const char *type_str = NULL;
-	const char *kind_str = NULL;
-	int err = 0;
+static void obj_reset(struct stats_obj *obj)
+{
+	if (obj->pairv != obj->pair_inl)
+		mem_deref(obj->pairv);
+	if (obj->candv != obj->cand_inl)
+		mem_deref(obj->candv);
 
-	if (!report || !stats_obj) {
-		return EINVAL;
-	}
+	memset(obj, 0, sizeof(*obj));
+}
 
-	struct json_object *jobj;
-	err = jzon_decode(&jobj, report, strlen(report));
-	if (err) {
-		return EPROTO;
-	}
+/* Fold one entry into the totals, as the read_*() functions expect */
+static void add_item(struct stats_obj *obj, const struct stats_item *item)
+{
+	struct stats_candidate_pair *cp;
+	struct stats_local_candidate *lc;
+
+	switch (item->type) {
+
+	case STATS_TYPE_INBOUND_RTP:
+		if (item->kind == STATS_KIND_AUDIO) {
+			obj->packets.audio.rx += item->packets_received;
+			obj->timestamp = max(obj->timestamp, item->timestamp);
+			if (item->packets_received) {
+				obj->audio_jitter += item->jitter;
+				obj->aj_count++;
+			}
+		}
+		else if (item->kind == STATS_KIND_VIDEO) {
+			obj->packets.video.rx += item->packets_received;
+			obj->timestamp = max(obj->timestamp, item->timestamp);
+			if (item->packets_received) {
+				obj->video_jitter += item->jitter;
+				obj->vj_count++;
+			}
+		}
 
-	// jzon_dump(jobj);
+		obj->packets.lost.rx += item->packets_lost;
+		break;
 
-	// we expect json array as root
-	if (!jzon_is_array(jobj)) {
-		err = EINVAL;
-		goto out;
-	}
+	case STATS_TYPE_OUTBOUND_RTP:
+		if (item->kind == STATS_KIND_AUDIO) {
+			obj->packets.audio.tx += item->packets_sent;
+			obj->timestamp = max(obj->timestamp, item->timestamp);
+		}
+		else if (item->kind == STATS_KIND_VIDEO) {
+			obj->packets.video.tx += item->packets_sent;
+			obj->timestamp = max(obj->timestamp, item->timestamp);
+			obj->total_encode_time += item->total_encode_time;
+			obj->frames_encoded += item->frames_encoded;
+		}
+		break;
 
-	int items = json_object_array_length(jobj);
-	for (int i = 0; i < items; ++i) {
-		struct json_object *jitem;
+	case STATS_TYPE_REMOTE_INBOUND_RTP:
+		if (item->kind == STATS_KIND_AUDIO) {
+			obj->jitter_audio.tx = max(obj->jitter_audio.tx, (1000 * item->jitter));
+			obj->timestamp = max(obj->timestamp, item->timestamp);
+		}
+		else if (item->kind == STATS_KIND_VIDEO) {
+			obj->jitter_video.tx = max(obj->jitter_video.tx, (1000 * item->jitter));
+			obj->timestamp = max(obj->timestamp, item->timestamp);
+		}
 
-		jitem = json_object_array_get_idx(jobj, i);
-		if (!jitem) {
-			// probably ok to skip unread items
-			continue;
+		if (item->kind == STATS_KIND_AUDIO || item->kind == STATS_KIND_VIDEO) {
+			obj->remote_inbound_rtt += item->rtt;
+			obj->remote_inbound_rtt_count++;
 		}
 
-		// jzon_dump(jitem);
+		obj->packets.lost.tx += item->packets_lost;
+		break;
 
-		type_str = jzon_str(jitem, "type");
-		enum stats_type type = stats_parse_type(type_str);
+	case STATS_TYPE_MEDIA_SOURCE:
+		if (item->kind == STATS_KIND_AUDIO) {
+			obj->has_audio_level = true;
+			obj->audio_level = item->audio_level;
+		}
+		break;
+
+	case STATS_TYPE_CANDIDATE_PAIR:
+		cp = obj_room((void **)&obj->pairv, &obj->pairsz,
+			      obj->pair_inl, STATS_INL_PAIRS,
+			      obj->pairc, sizeof(*cp));
+		if (!cp) {
+			++obj->pairs_dropped;
+			break;
+		}
 
-		switch (type) {
-			case STATS_TYPE_INBOUND_RTP: {
-				struct stats_inbound_rtp *irp = NULL;
-				irp = parse_inbound_rtp(jitem);
-				if (irp) {
-					list_append(&stats_obj->inbound_rtp, &irp->le, irp);
-				}
-			}
-				break;
+		++obj->pairc;
+		cp->state = item->state;
+		cp->nominated = item->nominated;
+		cp->current_rtt = item->current_rtt;
+		cp->id = item->id;
+		cp->local_candidate_id = item->local_candidate_id;
+		break;
+
+	case STATS_TYPE_LOCAL_CANDIDATE:
+		lc = obj_room((void **)&obj->candv, &obj->candsz,
+			      obj->cand_inl, STATS_INL_CANDIDATES,
+			      obj->candc, sizeof(*lc));
+		if (!lc) {
+			++obj->cands_dropped;
+			break;
+		}
 
-			case STATS_TYPE_OUTBOUND_RTP: {
-				struct stats_outbound_rtp *orp = NULL;
-				orp = parse_outbound_rtp(jitem);
-				if (orp) {
-					list_append(&stats_obj->outbound_rtp, &orp->le, orp);
-				}
-			}
-				break;
+		++obj->candc;
+		lc->id = item->id;
+		lc->proto = item->proto;
+		lc->cand = item->cand;
+		break;
+
+	case STATS_TYPE_TRANSPORT:
+		// only the first transport is used
+		if (!obj->has_transport) {
+			obj->has_transport = true;
+			obj->selected_pair_id = item->selected_pair_id;
+		}
+		break;
 
-			case STATS_TYPE_REMOTE_INBOUND_RTP: {
-				struct stats_remote_inbound_rtp *rirp = NULL;
-				rirp = parse_remote_inbound_rtp(jitem);
-				if (rirp) {
-					list_append(&stats_obj->remote_inbound_rtp, &rirp->le, rirp);
-				}
-			}
-				break;
+	default:
+		break;
+	}
+}
 
-			case STATS_TYPE_MEDIA_SOURCE: {
-				kind_str = NULL;
-				kind_str = jzon_str(jitem, "kind");
-				enum stats_kind kind = stats_parse_kind(kind_str);
-
-				if (kind == STATS_KIND_AUDIO) {
-					struct stats_audio_source *asp = NULL;
-					asp = parse_audio_source(jitem);
-					if (asp) {
-						list_append(&stats_obj->audio_source, &asp->le, asp);
-					}
-				}
-			}
-				break;
+static int scan_item(struct json_scan *js, struct stats_obj *stats_obj)
+{
+	struct stats_item item;
 
-			case STATS_TYPE_CANDIDATE_PAIR: {
-				struct stats_candidate_pair *cp = NULL;
-				cp = parse_candidate_pair(jitem);
-				if (cp) {
-					list_append(&stats_obj->candidate_pair, &cp->le, cp);
-				}
-			}
-				break;
+	memset(&item, 0, sizeof(item));
 
-			case STATS_TYPE_LOCAL_CANDIDATE: {
-				struct stats_local_candidate *lc = NULL;
-				lc = parse_local_candidate(jitem);
-				if (lc) {
-					list_append(&stats_obj->local_candidate, &lc->le, lc);
-				}
-			}
-				break;
+	if (!scan_char(js, '{'))
+		return EPROTO;
 
-			case STATS_TYPE_TRANSPORT: {
-				struct stats_transport *tr = NULL;
-				tr = parse_transport(jitem);
-				if (tr) {
-					list_append(&stats_obj->transport, &tr->le, tr);
-				}
-			}
-				break;
+	if (scan_char(js, '}'))
+		goto out;
 
-			default:
-				break;
-		}
+	do {
+		struct pl key, val;
+		enum json_tok tok;
+		int err;
+
+		err = scan_string(js, &key);
+		if (err)
+			return err;
+
+		if (!scan_char(js, ':'))
+			return EPROTO;
+
+		err = scan_value(js, &tok, &val);
+		if (err)
+			return err;
+
+		item_field(&item, &key, tok, &val);
+	} while (scan_char(js, ','));
+
+	if (!scan_char(js, '}'))
+		return EPROTO;
+
+ out:
+	add_item(stats_obj, &item);
+
+	return 0;
+}
+
+static int parse_json(const char *report, struct stats_obj *stats_obj)
+{
+	struct json_scan js;
+	int err = 0;
+
+	if (!report || !stats_obj) {
+		return EINVAL;
+	}
+
+	js.p = report;
+	js.end = report + strlen(report);
 
-		mem_deref(jitem);
+	// we expect json array as root
+	if (!scan_char(&js, '[')) {
+		scan_ws(&js);
+		err = (js.p < js.end && *js.p == '{') ? EINVAL : EPROTO;
+		goto out;
 	}
 
-out:
-	mem_deref(jobj);
+	if (scan_char(&js, ']'))
+		goto out;
+
+	do {
+		err = scan_item(&js, stats_obj);
+		if (err)
+			goto out;
+	} while (scan_char(&js, ','));
+
+	if (!scan_char(&js, ']'))
+		err = EPROTO;
+
+ out:
+	// like a failed decode, a broken report contributes nothing
+	if (err)
+		obj_reset(stats_obj);
 
 	return err;
 }
 
 int stats_update(struct avs_stats *stats, const char *report_json)
 {
+	struct stats_obj stats_obj;
 	int err = 0;
 	
 	if (!stats || !report_json)
 		return EINVAL;
 
 	memset(&stats->report, 0, sizeof(stats->report));
-
-	struct stats_obj stats_obj = {.audio_source = LIST_INIT,
-							.inbound_rtp = LIST_INIT,
-							.outbound_rtp = LIST_INIT,
-							.remote_inbound_rtp = LIST_INIT,
-							.candidate_pair = LIST_INIT,
-							.local_candidate = LIST_INIT,
-							.transport = LIST_INIT,
-						};
+	memset(&stats_obj, 0, sizeof(stats_obj));
 
 	err |= parse_json(report_json, &stats_obj);
 
+	if (stats_obj.pairs_dropped || stats_obj.cands_dropped) {
+		warning("stats: out of memory, dropped %zu candidate pairs"
+			" and %zu local candidates\n",
+			stats_obj.pairs_dropped, stats_obj.cands_dropped);
+	}
+
 	err |= read_packet_stats_and_jitter(stats, &stats_obj);
 	err |= read_rtt_and_connection(stats, &stats_obj);
 	err |= read_audio_level(stats, &stats_obj);
+	err |= read_encode_time(stats, &stats_obj);
 
-	list_flush(&stats_obj.audio_source);
-	list_flush(&stats_obj.inbound_rtp);
-	list_flush(&stats_obj.outbound_rtp);
-	list_flush(&stats_obj.remote_inbound_rtp);
-	list_flush(&stats_obj.candidate_pair);
-	list_flush(&stats_obj.local_candidate);
-	list_flush(&stats_obj.transport);
+	obj_reset(&stats_obj);
 
 	return err;
 }
@@ -832,3 +1022,45 @@ char *stats_cand_name(enum stats_cand cand)
 		return "???";
 	}
 }
+
+/* 5, 10, 20 ... 1280 ms */
+uint32_t stats_latency_bound(int bucket)
+{
+	if (bucket < 0 || bucket >= STATS_LAT_BUCKETS - 1)
+		return UINT32_MAX;
+
+	return 5u << bucket;
+}
+
+static int latency_bucket(uint32_t ms)
+{
+	int b = 0;
+
+	while (b < STATS_LAT_BUCKETS - 1 && ms >= stats_latency_bound(b))
+		b++;
+
+	return b;
+}
+
+/* Add one frame, jitter_ms is negative if the previous frame
+ * of the sender is unknown.
+ */
+void stats_latency_add(struct stats_latency *sl, int32_t latency_ms,
+		       int32_t jitter_ms)
+{
+	if (!sl)
+		return;
+
+	if (latency_ms < 0) {
+		sl->skewed++;
+		latency_ms = 0;
+	}
+
+	sl->frames++;
+	sl->sum_ms += latency_ms;
+	sl->max_ms = MAX(sl->max_ms, (uint32_t)latency_ms);
+	sl->latency[latency_bucket(latency_ms)]++;
+
+	if (jitter_ms >= 0)
+		sl->jitter[latency_bucket(jitter_ms)]++;
+}
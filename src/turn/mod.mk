@@ -1,5 +1,6 @@
 
 
 AVS_SRCS += \
+	turn/tcpbuf.c \
 	turn/turnconn.c \
 	turn/uri.c
@@ -0,0 +1,268 @@
+/*
+* Wire
+* Copyright (C) 2026 Wire Swiss GmbH
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <re.h>
+#include "avs_turn.h"
+
+
+enum {
+	FRAME_HDR_SIZE = 4,
+	STAGE_INITSZ   = 2048,
+};
+
+
+struct turn_tcpbuf {
+	struct mbuf *stage;  /* start of a frame split across segments */
+	size_t need;         /* length of the staged frame, 0 if unknown */
+	size_t skip;         /* padding of the last frame still to come */
+	struct turn_tcpbuf_stats stats;
+};
+
+
+static void destructor(void *arg)
+{
+	struct turn_tcpbuf *tb = arg;
+
+	mem_deref(tb->stage);
+}
+
+
+/* Frame length from the first 4 bytes: STUN messages have a 20 byte
+ * header, ChannelData a 4 byte header and is padded to 4 bytes on TCP.
+ */
+static int frame_len(const uint8_t *p, size_t *lenp)
+{
+	uint16_t typ = p[0] << 8 | p[1];
+	size_t len = p[2] << 8 | p[3];
+
+	if (typ < 0x4000)
+		len += STUN_HEADER_SIZE;
+	else if (typ < 0x8000)
+		len += 4;
+	else
+		return EBADMSG;
+
+	*lenp = len;
+
+	return 0;
+}
+
+
+static size_t pad_len(size_t len)
+{
+	return (4 - (len & 0x03)) & 0x03;
+}
+
+
+/* Drop padding of the previous frame from the start of [pos, end) */
+static size_t consume_skip(struct turn_tcpbuf *tb, size_t pos, size_t end)
+{
+	size_t n = MIN(tb->skip, end - pos);
+
+	tb->skip -= n;
+
+	return pos + n;
+}
+
+
+static int stage(struct turn_tcpbuf *tb, const uint8_t *p, size_t n)
+{
+	int err;
+
+	err = mbuf_write_mem(tb->stage, p, n);
+	if (err)
+		return err;
+
+	tb->stats.copied += n;
+	tb->stats.size_max = MAX(tb->stats.size_max, tb->stage->size);
+
+	return 0;
+}
+
+
+/* Complete the staged frame from the start of [pos, end), returns the
+ * new position or sets *done to false if the segment ran out first.
+ */
+static int stage_complete(struct turn_tcpbuf *tb, struct mbuf *mb,
+			  size_t *posp, size_t end, bool *done,
+			  turn_tcpbuf_frame_h *frameh, void *arg)
+{
+	size_t pos = *posp;
+	size_t n;
+	int err;
+
+	*done = false;
+
+	if (!tb->need) {
+		n = MIN(FRAME_HDR_SIZE - tb->stage->end, end - pos);
+		err = stage(tb, mb->buf + pos, n);
+		if (err)
+			return err;
+		pos += n;
+
+		if (tb->stage->end < FRAME_HDR_SIZE)
+			goto out;
+
+		err = frame_len(tb->stage->buf, &tb->need);
+		if (err)
+			return err;
+	}
+
+	n = MIN(tb->need - tb->stage->end, end - pos);
+	err = stage(tb, mb->buf + pos, n);
+	if (err)
+		return err;
+	pos += n;
+
+	if (tb->stage->end < tb->need)
+		goto out;
+
+	tb->stage->pos = 0;
+	tb->stats.frames++;
+	tb->stats.staged++;
+	err = frameh(tb->stage, arg);
+
+	tb->skip = pad_len(tb->need);
+	tb->need = 0;
+	mbuf_rewind(tb->stage);
+	if (err)
+		return err;
+
+	*done = true;
+
+ out:
+	*posp = pos;
+	return 0;
+}
+
+
+int turn_tcpbuf_alloc(struct turn_tcpbuf **tbp)
+{
+	struct turn_tcpbuf *tb;
+
+	if (!tbp)
+		return EINVAL;
+
+	tb = mem_zalloc(sizeof(*tb), destructor);
+	if (!tb)
+		return ENOMEM;
+
+	tb->stage = mbuf_alloc(STAGE_INITSZ);
+	if (!tb->stage) {
+		mem_deref(tb);
+		return ENOMEM;
+	}
+
+	*tbp = tb;
+
+	return 0;
+}
+
+
+int turn_tcpbuf_recv(struct turn_tcpbuf *tb, struct mbuf *mb,
+		     turn_tcpbuf_frame_h *frameh, void *arg)
+{
+	size_t pos, end, len;
+	bool done;
+	int err = 0;
+
+	if (!tb || !mb || !frameh)
+		return EINVAL;
+
+	/* The frame handler may close the connection owning us */
+	mem_ref(tb);
+
+	pos = mb->pos;
+	end = mb->end;
+
+	pos = consume_skip(tb, pos, end);
+
+	if (tb->stage->end) {
+		err = stage_complete(tb, mb, &pos, end, &done, frameh, arg);
+		if (err || !done)
+			goto out;
+
+		pos = consume_skip(tb, pos, end);
+	}
+
+	/* Frames that are complete in this segment are passed in place */
+	while (end - pos >= FRAME_HDR_SIZE) {
+
+		err = frame_len(mb->buf + pos, &len);
+		if (err)
+			goto out;
+
+		if (end - pos < len)
+			break;
+
+		mb->pos = pos;
+		mb->end = pos + len;
+
+		tb->stats.frames++;
+		err = frameh(mb, arg);
+
+		mb->end = end;
+		if (err)
+			goto out;
+
+		tb->skip = pad_len(len);
+		pos = consume_skip(tb, pos + len, end);
+	}
+
+	if (pos < end) {
+		err = stage(tb, mb->buf + pos, end - pos);
+		if (err)
+			goto out;
+
+		if (tb->stage->end >= FRAME_HDR_SIZE) {
+			err = frame_len(tb->stage->buf, &tb->need);
+			if (err)
+				goto out;
+		}
+		pos = end;
+	}
+
+ out:
+	mb->pos = pos;
+	mb->end = end;
+	mem_deref(tb);
+
+	return err;
+}
+
+
+void turn_tcpbuf_reset(struct turn_tcpbuf *tb)
+{
+	if (!tb)
+		return;
+
+	mbuf_rewind(tb->stage);
+	tb->need = 0;
+	tb->skip = 0;
+}
+
+
+void turn_tcpbuf_get_stats(const struct turn_tcpbuf *tb,
+			   struct turn_tcpbuf_stats *stats)
+{
+	if (!tb || !stats)
+		return;
+
+	*stats = tb->stats;
+}
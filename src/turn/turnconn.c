@@ -186,7 +186,7 @@ static void tcp_estab(void *arg)
 		     tls_cipher_name(tl->tlsc));
 	}
 
-	tl->mb = (struct mbuf *)mem_deref(tl->mb);
+	turn_tcpbuf_reset(tl->tcpbuf);
 
 	err = turnc_alloc(&tl->turnc, NULL, IPPROTO_TCP,
 			  tl->tc, tl->layer_turn,
@@ -198,83 +198,31 @@ static void tcp_estab(void *arg)
 }
 
 
-static void tcp_recv(struct mbuf *mb, void *arg)
+static int tcp_frame_handler(struct mbuf *mb, void *arg)
 {
 	struct turn_conn *tl = arg;
-	int err = 0;
-
-	if (tl->mb) {
-		size_t pos;
-
-		pos = tl->mb->pos;
-
-		tl->mb->pos = tl->mb->end;
-
-		err = mbuf_write_mem(tl->mb, mbuf_buf(mb),
-				     mbuf_get_left(mb));
-		if (err)
-			goto out;
-
-		tl->mb->pos = pos;
-	}
-	else {
-		tl->mb = mem_ref(mb);
-	}
-
-	for (;;) {
-
-		size_t len, pos, end;
-		struct sa src;
-		uint16_t typ;
-
-		if (mbuf_get_left(tl->mb) < 4)
-			break;
-
-		typ = ntohs(mbuf_read_u16(tl->mb));
-		len = ntohs(mbuf_read_u16(tl->mb));
-
-		if (typ < 0x4000)
-			len += STUN_HEADER_SIZE;
-		else if (typ < 0x8000)
-			len += 4;
-		else {
-			err = EBADMSG;
-			goto out;
-		}
-
-		tl->mb->pos -= 4;
-
-		if (mbuf_get_left(tl->mb) < len)
-			break;
-
-		pos = tl->mb->pos;
-		end = tl->mb->end;
-
-		tl->mb->end = pos + len;
+	struct sa src;
+	int err;
 
-		err = turnc_recv(tl->turnc, &src, tl->mb);
-		if (err)
-			goto out;
+	err = turnc_recv(tl->turnc, &src, mb);
+	if (err)
+		return err;
 
-		if (mbuf_get_left(tl->mb))
-			turntcp_recv_data(tl, &src, tl->mb);
+	if (mbuf_get_left(mb))
+		turntcp_recv_data(tl, &src, mb);
 
-		/* 4 byte alignment */
-		while (len & 0x03)
-			++len;
+	return 0;
+}
 
-		tl->mb->pos = pos + len;
-		tl->mb->end = end;
 
-		if (tl->mb->pos >= tl->mb->end) {
-			tl->mb = mem_deref(tl->mb);
-			break;
-		}
-	}
+static void tcp_recv(struct mbuf *mb, void *arg)
+{
+	struct turn_conn *tl = arg;
+	int err;
 
- out:
+	err = turn_tcpbuf_recv(tl->tcpbuf, mb, tcp_frame_handler, tl);
 	if (err) {
-		warning("turnconn: turn tcp_recv error (%m)\n");
+		warning("turnconn: turn tcp_recv error (%m)\n", err);
 		mem_deref(tl);
 	}
 }
@@ -311,7 +259,7 @@ static void turnconn_destructor(void *data)
 	mem_deref(tc->tlsc);
 	mem_deref(tc->tc);
 	mem_deref(tc->tls);
-	mem_deref(tc->mb);
+	mem_deref(tc->tcpbuf);
 	mem_deref(tc->username);
 	mem_deref(tc->password);
 }
@@ -424,6 +372,10 @@ int turnconn_alloc(struct turn_conn **connp, struct list *connl,
 		break;
 
 	case IPPROTO_TCP:
+		err = turn_tcpbuf_alloc(&tc->tcpbuf);
+		if (err)
+			goto out;
+
 		err = tcp_connect(&tc->tc, turn_srv, tcp_estab,
 				  tcp_recv, tcp_close, tc);
 		if (err) {
@@ -640,6 +592,18 @@ int turnconn_debug(struct re_printf *pf, const struct turn_conn *conn)
 			  conn->turnc,
 			  alloc_time);
 
+	if (conn->tcpbuf) {
+		struct turn_tcpbuf_stats st;
+
+		turn_tcpbuf_get_stats(conn->tcpbuf, &st);
+		err |= re_hprintf(pf, "......tcp frames=%llu staged=%llu"
+				  " copied=%llu bytes bufsz=%zu\n",
+				  (unsigned long long)st.frames,
+				  (unsigned long long)st.staged,
+				  (unsigned long long)st.copied,
+				  st.size_max);
+	}
+
 #if 0
 	if (conn->turnc) {
 
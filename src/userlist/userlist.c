@@ -23,12 +23,20 @@
 #include "avs_audio_level.h"
 
 #define LIST_POS_NONE 0xFFFFFFFF
+#define USERS_HASH_SIZE 128
+
+struct find_arg {
+	const char *userid;
+	const char *clientid;
+};
 
 static void userinfo_destructor(void *arg)
 {
 	struct userinfo *ui = arg;
 
 	list_unlink(&ui->le);
+	hash_unlink(&ui->hle);
+	hash_unlink(&ui->rle);
 	ui->userid_real = mem_deref(ui->userid_real);
 	ui->userid_hash = mem_deref(ui->userid_hash);
 	ui->clientid_real = mem_deref(ui->clientid_real);
@@ -65,7 +73,40 @@ static void userlist_destructor(void *arg)
 
 	list_flush(&list->users);
 	mem_deref(list->self);
+	mem_deref(list->hashh);
+	mem_deref(list->realh);
+}
 
+static uint32_t ids_key(const char *userid, const char *clientid)
+{
+	return hash_joaat_str_ci(userid) ^
+		(hash_joaat_str_ci(clientid) * 31);
+}
+
+/* Update the hash indexes after a user has been added to the list
+ * or any of its ids have changed.
+ */
+static void userinfo_index(struct userlist *list, struct userinfo *u)
+{
+	hash_unlink(&u->hle);
+	hash_unlink(&u->rle);
+
+	if (u->userid_hash && u->clientid_hash) {
+		hash_append(list->hashh,
+			    ids_key(u->userid_hash, u->clientid_hash),
+			    &u->hle, u);
+	}
+	if (u->userid_real && u->clientid_real) {
+		hash_append(list->realh,
+			    ids_key(u->userid_real, u->clientid_real),
+			    &u->rle, u);
+	}
+}
+
+static void userlist_add(struct userlist *list, struct userinfo *u)
+{
+	list_append(&list->users, &u->le, u);
+	userinfo_index(list, u);
 }
 
 int userlist_alloc(struct userlist **listp,
@@ -87,6 +128,14 @@ int userlist_alloc(struct userlist **listp,
 		goto out;
 	}
 
+	err = hash_alloc(&lp->hashh, USERS_HASH_SIZE);
+	if (err)
+		goto out;
+
+	err = hash_alloc(&lp->realh, USERS_HASH_SIZE);
+	if (err)
+		goto out;
+
 	err = userinfo_alloc(&lp->self,
 			     userid_self,
 			     clientid_self,
@@ -135,50 +184,62 @@ const struct userinfo *userlist_get_self(const struct userlist *list)
 	return list->self;
 }
 
+static bool find_real_handler(struct le *le, void *arg)
+{
+	struct find_arg *fa = arg;
+	struct userinfo *u = le->data;
+
+	return u && strcaseeq(u->userid_real, fa->userid) &&
+		strcaseeq(u->clientid_real, fa->clientid);
+}
+
+static bool find_hash_handler(struct le *le, void *arg)
+{
+	struct find_arg *fa = arg;
+	struct userinfo *u = le->data;
+
+	return u && strcaseeq(u->userid_hash, fa->userid) &&
+		strcaseeq(u->clientid_hash, fa->clientid);
+}
+
 struct userinfo *userlist_find_by_real(const struct userlist *list,
 				       const char *userid_real,
 				       const char *clientid_real)
 {
+	struct find_arg fa;
 	struct le *le;
 
 	if (!list || !userid_real || !clientid_real) {
 		return NULL;
 	}
 
-	LIST_FOREACH(&list->users, le) {
-		struct userinfo *u = le->data;
+	fa.userid = userid_real;
+	fa.clientid = clientid_real;
+	le = hash_lookup(list->realh,
+			 ids_key(userid_real, clientid_real),
+			 find_real_handler, &fa);
 
-		if (u && u->userid_real && u->clientid_real) {
-			if (strcaseeq(u->userid_real, userid_real) &&
-			    strcaseeq(u->clientid_real, clientid_real)) {
-				return u;
-			}
-		}
-	}
-	return NULL;
+	return le ? le->data : NULL;
 }
 
 struct userinfo *userlist_find_by_hash(const struct userlist *list,
 				       const char *userid_hash,
 				       const char *clientid_hash)
 {
+	struct find_arg fa;
 	struct le *le;
 
 	if (!list || !userid_hash || !clientid_hash) {
 		return NULL;
 	}
 
-	LIST_FOREACH(&list->users, le) {
-		struct userinfo *u = le->data;
+	fa.userid = userid_hash;
+	fa.clientid = clientid_hash;
+	le = hash_lookup(list->hashh,
+			 ids_key(userid_hash, clientid_hash),
+			 find_hash_handler, &fa);
 
-		if (u && u->userid_hash && u->clientid_hash) {
-			if (strcaseeq(u->userid_hash, userid_hash) &&
-			    strcaseeq(u->clientid_hash, clientid_hash)) {
-				return u;
-			}
-		}
-	}
-	return NULL;
+	return le ? le->data : NULL;
 }
 
 
@@ -234,6 +295,7 @@ int userlist_set_secret(struct userlist *list,
 	LIST_FOREACH(&list->users, le) {
 		struct userinfo *u = le->data;
 		hash_userinfo(u, secret, secret_len);
+		userinfo_index(list, u);
 	}
 
 	return err;
@@ -421,7 +483,7 @@ int userlist_update_from_sftlist(struct userlist *list,
 			u->ssrcv = p->ssrcv;
 			u->incall_now = true;
 			u->latest_epoch = 0;
-			list_append(&list->users, &u->le, u);
+			userlist_add(list, u);
 			missing = true;
 			u->listpos = listpos;
 			listpos++;
@@ -441,6 +503,8 @@ int userlist_update_from_sftlist(struct userlist *list,
 				}
 				u->force_decoder = false;
 				u->needs_key = true;
+				u->ciphers = 0;
+				++list->joins;
 				list_changed = true;
 				info("userlist(%p): update_from_sftlist %s.%s joined the call\n",
 				     list,
@@ -525,6 +589,7 @@ void userlist_update_from_selist(struct userlist* list,
 		user = userlist_find_by_real(list, cli->userid, cli->clientid);
 		if (user) {
 			hash_userinfo(user, secret, secret_len);
+			userinfo_index(list, user);
 			info("userlist(%p): update_from_selist updating found client %s.%s\n",
 			     list,
 			     anon_id(userid_anon, cli->userid),
@@ -550,6 +615,7 @@ void userlist_update_from_selist(struct userlist* list,
 				user->clientid_real = mem_deref(user->clientid_real);
 				str_dup(&user->userid_real, cli->userid);
 				str_dup(&user->clientid_real, cli->clientid);
+				userinfo_index(list, user);
 				user->first_epoch = epoch;
 				list_changed = true;
 
@@ -579,7 +645,7 @@ void userlist_update_from_selist(struct userlist* list,
 				     anon_id(userid_anon, cli->userid),
 				     anon_client(clientid_anon, cli->clientid));
 				user = u;
-				list_append(&list->users, &u->le, u);
+				userlist_add(list, u);
 				list_changed = true;
 			}
 
@@ -735,6 +801,24 @@ uint32_t userlist_incall_count(struct userlist *list)
 	return incall;
 }
 
+uint32_t userlist_get_ciphers(const struct userlist *list)
+{
+	struct le *le;
+	uint32_t ciphers = ~0u;
+
+	if (!list)
+		return 0;
+
+	LIST_FOREACH(&list->users, le) {
+		const struct userinfo *u = le->data;
+
+		if (u && u->incall_now)
+			ciphers &= u->ciphers;
+	}
+
+	return ciphers;
+}
+
 int userlist_get_key_targets(struct userlist *list,
 			     struct list *targets,
 			     bool send_to_all)
@@ -53,6 +53,7 @@ extern void ios_log (const char *fmt, ...);
 
 
 #define EVENT_AGE_VALID 60 /* max event age in seconds */
+#define EVENT_HASH_SIZE 256
 
 enum call_event_state {
 	CALL_EVENT_STATE_IDLE     = 0,
@@ -75,6 +76,7 @@ struct call_event_instance {
 	void *arg;
 	
 	struct list eventl;
+	struct hash *convh;  /* call_event by convid */
 
 	struct le le;
 };
@@ -90,6 +92,7 @@ struct call_event {
 	int reason;
 
 	struct le le;
+	struct le hle;
 };
 
 static struct {
@@ -126,8 +129,60 @@ static void event_destructor(void *arg)
 	mem_deref(ev->clientid);
 
 	list_unlink(&ev->le);
+	hash_unlink(&ev->hle);
 }
 
+struct find_arg {
+	const char *convid;
+	const char *userid;
+	const char *clientid;
+	enum call_event_state state;  /* IDLE matches any state */
+};
+
+static bool find_handler(struct le *le, void *arg)
+{
+	struct call_event *ev = le->data;
+	struct find_arg *fa = arg;
+
+	if (fa->state != CALL_EVENT_STATE_IDLE && ev->state != fa->state)
+		return false;
+	if (!streq(ev->convid, fa->convid))
+		return false;
+	if (fa->userid && !streq(ev->userid, fa->userid))
+		return false;
+	if (fa->clientid && !streq(ev->clientid, fa->clientid))
+		return false;
+
+	return true;
+}
+
+static struct call_event *queue_find(struct call_event_instance *inst,
+				     const char *convid,
+				     const char *userid,
+				     const char *clientid,
+				     enum call_event_state state)
+{
+	struct find_arg fa;
+	struct le *le;
+
+	if (!inst || !convid)
+		return NULL;
+
+	fa.convid = convid;
+	fa.userid = userid;
+	fa.clientid = clientid;
+	fa.state = state;
+
+	le = hash_lookup(inst->convh, hash_joaat_str(convid),
+			 find_handler, &fa);
+
+	return le ? le->data : NULL;
+}
+
+/* When coalescing, a conversation keeps at most one event: a new
+ * event supersedes the pending one and moves it to the end of the
+ * queue, so only the final state is reported.
+ */
 static void queue_event(struct call_event_instance *inst,
 			const char *convid,
 			const char *userid,
@@ -135,18 +190,34 @@ static void queue_event(struct call_event_instance *inst,
 			uint32_t msg_time,
 			int conv_type,
 			enum call_event_state state,
-			int reason)
+			int reason,
+			bool coalesce)
 {
-	struct call_event *ev;
+	struct call_event *ev = NULL;
 	
 	if (!inst)
 		return;
 
-	ev = mem_zalloc(sizeof(*ev), event_destructor);
-	if (!ev)
-		return;
+	if (coalesce) {
+		ev = queue_find(inst, convid, NULL, NULL,
+				CALL_EVENT_STATE_IDLE);
+	}
+
+	if (ev) {
+		list_unlink(&ev->le);
+		ev->userid = mem_deref(ev->userid);
+		ev->clientid = mem_deref(ev->clientid);
+	}
+	else {
+		ev = mem_zalloc(sizeof(*ev), event_destructor);
+		if (!ev)
+			return;
+
+		str_dup(&ev->convid, convid);
+		hash_append(inst->convh, hash_joaat_str(convid),
+			    &ev->hle, ev);
+	}
 
-	str_dup(&ev->convid, convid);
 	str_dup(&ev->userid, userid);
 	str_dup(&ev->clientid, clientid);	
 	ev->state = state;
@@ -157,38 +228,13 @@ static void queue_event(struct call_event_instance *inst,
 	list_append(&inst->eventl, &ev->le, ev);
 }
 
-static struct call_event *queue_find(struct call_event_instance *inst,
-				     const char *convid,
-				     const char *userid,
-				     const char *clientid,
-				     enum call_event_state state)
-{
-	bool found = false;
-	struct call_event *ev;
-	struct le *le;
-
-	if (!inst)
-		return false;
-
-	for (le = inst->eventl.head; le != NULL && !found; le = le->next) {
-		ev = le->data;
-		found = ev->state == state && streq(ev->convid, convid);
-		if (userid)
-			found = found && streq(ev->userid, userid);
-		if (clientid)
-			found = found && streq(ev->clientid, clientid);
-		if (!found)
-			le = le->next;
-	}
-
-	return found ? ev : NULL;
-}
-
 
 static void inst_destructor(void *arg)
 {
 	struct call_event_instance *inst = arg;
 
+	list_flush(&inst->eventl);
+	mem_deref(inst->convh);
 	mem_deref(inst->userid);
 	mem_deref(inst->clientid);
 }
@@ -221,6 +267,7 @@ WUSER_HANDLE wcall_event_create(const char *userid,
 
 		found = streq(inst->userid, userid)
 		     && streq(inst->clientid, clientid);
+		le = le->next;
 	}
 	if (found)
 		return inst ? inst->wuser : WUSER_INVALID_HANDLE;
@@ -230,6 +277,11 @@ WUSER_HANDLE wcall_event_create(const char *userid,
 		error("event: cannot create instance\n");
 		return WUSER_INVALID_HANDLE;
 	}
+	if (hash_alloc(&inst->convh, EVENT_HASH_SIZE)) {
+		error("event: cannot create event index\n");
+		mem_deref(inst);
+		return WUSER_INVALID_HANDLE;
+	}
 	inst->wuser = wcall_create_wuser(&calling_event.wuser_index);
 
 	str_dup(&inst->userid, userid);
@@ -261,62 +313,23 @@ void wcall_event_start(WUSER_HANDLE wuser)
 	inst->processing = true;
 }
 
-AVS_EXPORT
-int  wcall_event_process(WUSER_HANDLE wuser, 
-			 const uint8_t *buf,
-			 size_t len,
-			 uint32_t curr_time, /* timestamp in seconds */
-			 uint32_t msg_time,  /* timestamp in seconds */
-			 const char *convid,
-			 const char *userid,
-			 const char *clientid,
-			 int conv_type)
+static int event_apply(struct call_event_instance *inst,
+		       const struct econn_message *msg,
+		       const char *convid,
+		       const char *userid,
+		       const char *clientid,
+		       int conv_type,
+		       bool coalesce)
 {
-	struct call_event_instance *inst;
-	struct econn_message *msg;
 	struct call_event *ev;
-	int err = 0;
-	char userid_anon[ANON_ID_LEN];
-	char clientid_anon[ANON_CLIENT_LEN];
-
-	if (!buf || len == 0 || !convid || !userid || !clientid)
-		return EINVAL;
-
-	inst = wuser2evinst(wuser);
-	info("event(%p): process for wuser=%p from=%s.%s\n",
-	     inst, wuser,
-	     anon_id(userid_anon, userid),
-	     anon_client(clientid_anon, clientid));
-
-	if (!inst) {
-		error("event: process: cannot find wuser=%p\n", wuser);
-		return ENOENT;
-	}
-
-	if (!inst->processing) {
-		warning("event(%p): process: not processing events\n", inst);
-		return EAGAIN;
-	}
-
-	err = econn_message_decode(&msg, curr_time, msg_time,
-				   (const char *)buf, len);
-	if (err == EPROTONOSUPPORT) {
-		warning("event(%p): process: uknown message type\n", inst);
-		return WCALL_ERROR_UNKNOWN_PROTOCOL;
-	}
-	else if (err) {
-		warning("event(%p): process: failed to decode: %m\n", inst, err);
-		return err;
-	}
-
-	info("event(%p): msg=%H\n", inst, econn_message_brief, msg);
 
 	switch(msg->msg_type) {
 	case ECONN_SETUP:
 	case ECONN_GROUP_START:
 	case ECONN_CONF_START:
 		if (msg->age > EVENT_AGE_VALID) {
-			warning("event(%p): message is too old. age=%d\n", inst, msg->age);
+			debug("event(%p): message is too old. age=%d\n",
+			      inst, msg->age);
 			return ETIMEDOUT;
 		}
 		
@@ -326,7 +339,8 @@ int  wcall_event_process(WUSER_HANDLE wuser,
 				    msg->time,
 				    conv_type,
 				    CALL_EVENT_STATE_INCOMING,
-				    WCALL_REASON_NORMAL);
+				    WCALL_REASON_NORMAL,
+				    coalesce);
 		}
 		else {
 			if (streq(inst->userid, userid)
@@ -336,11 +350,23 @@ int  wcall_event_process(WUSER_HANDLE wuser,
 					    msg->time,
 					    conv_type,
 					    CALL_EVENT_STATE_CLOSED,
-					    WCALL_REASON_ANSWERED_ELSEWHERE);
+					    WCALL_REASON_ANSWERED_ELSEWHERE,
+					    coalesce);
 			}
 		}
 		break;
 
+	case ECONN_CANCEL:
+		/* caller gave up before we answered */
+		ev = queue_find(inst, convid,
+				userid, NULL,
+				CALL_EVENT_STATE_INCOMING);
+		if (ev) {
+			ev->state = CALL_EVENT_STATE_MISSED;
+			ev->reason = WCALL_REASON_NORMAL;
+		}
+		break;
+
 	case ECONN_CONF_END:
 		if (econn_message_isrequest(msg)) {
 			ev = queue_find(inst, convid,
@@ -361,7 +387,8 @@ int  wcall_event_process(WUSER_HANDLE wuser,
 					    msg->time,
 					    conv_type,
 					    CALL_EVENT_STATE_CLOSED,
-					    WCALL_REASON_NORMAL);
+					    WCALL_REASON_NORMAL,
+					    coalesce);
 			}
 		}
 		break;
@@ -375,7 +402,8 @@ int  wcall_event_process(WUSER_HANDLE wuser,
 				    msg->time,
 				    conv_type,
 				    CALL_EVENT_STATE_CLOSED,
-				    WCALL_REASON_REJECTED);
+				    WCALL_REASON_REJECTED,
+				    coalesce);
 		}
 		break;
 
@@ -387,6 +415,139 @@ int  wcall_event_process(WUSER_HANDLE wuser,
 	return 0;
 }
 
+AVS_EXPORT
+int  wcall_event_process(WUSER_HANDLE wuser, 
+			 const uint8_t *buf,
+			 size_t len,
+			 uint32_t curr_time, /* timestamp in seconds */
+			 uint32_t msg_time,  /* timestamp in seconds */
+			 const char *convid,
+			 const char *userid,
+			 const char *clientid,
+			 int conv_type)
+{
+	struct call_event_instance *inst;
+	struct econn_message *msg;
+	int err = 0;
+	char userid_anon[ANON_ID_LEN];
+	char clientid_anon[ANON_CLIENT_LEN];
+
+	if (!buf || len == 0 || !convid || !userid || !clientid)
+		return EINVAL;
+
+	inst = wuser2evinst(wuser);
+	info("event(%p): process for wuser=%p from=%s.%s\n",
+	     inst, wuser,
+	     anon_id(userid_anon, userid),
+	     anon_client(clientid_anon, clientid));
+
+	if (!inst) {
+		error("event: process: cannot find wuser=%p\n", wuser);
+		return ENOENT;
+	}
+
+	if (!inst->processing) {
+		warning("event(%p): process: not processing events\n", inst);
+		return EAGAIN;
+	}
+
+	err = econn_message_decode(&msg, curr_time, msg_time,
+				   (const char *)buf, len);
+	if (err == EPROTONOSUPPORT) {
+		warning("event(%p): process: uknown message type\n", inst);
+		return WCALL_ERROR_UNKNOWN_PROTOCOL;
+	}
+	else if (err) {
+		warning("event(%p): process: failed to decode: %m\n", inst, err);
+		return err;
+	}
+
+	info("event(%p): msg=%H\n", inst, econn_message_brief, msg);
+
+	err = event_apply(inst, msg, convid, userid, clientid,
+			  conv_type, false);
+	if (err == ETIMEDOUT) {
+		warning("event(%p): message is too old. age=%d\n",
+			inst, msg->age);
+	}
+
+	mem_deref(msg);
+
+	return err;
+}
+
+AVS_EXPORT
+int wcall_event_process_batch(WUSER_HANDLE wuser,
+			      const struct wcall_event_msg *msgv,
+			      size_t msgc)
+{
+	struct call_event_instance *inst;
+	size_t i, nproc = 0, nfail = 0;
+	int ferr = 0;
+
+	if (!msgv && msgc > 0)
+		return EINVAL;
+
+	inst = wuser2evinst(wuser);
+	info("event(%p): process batch of %zu for wuser=%p\n",
+	     inst, msgc, wuser);
+
+	if (!inst) {
+		error("event: process_batch: cannot find wuser=%p\n", wuser);
+		return ENOENT;
+	}
+
+	if (!inst->processing) {
+		warning("event(%p): process_batch: not processing events\n",
+			inst);
+		return EAGAIN;
+	}
+
+	for (i = 0; i < msgc; ++i) {
+		const struct wcall_event_msg *em = &msgv[i];
+		struct econn_message *msg;
+		int err;
+
+		if (!em->buf || em->len == 0 || !em->convid
+		    || !em->userid || !em->clientid) {
+			if (!ferr)
+				ferr = EINVAL;
+			++nfail;
+			continue;
+		}
+
+		err = econn_message_decode(&msg, em->curr_time, em->msg_time,
+					   (const char *)em->buf, em->len);
+		if (err) {
+			warning("event(%p): process_batch: failed to decode"
+				" message %zu: %m\n", inst, i, err);
+			if (!ferr) {
+				ferr = err == EPROTONOSUPPORT
+				     ? WCALL_ERROR_UNKNOWN_PROTOCOL : err;
+			}
+			++nfail;
+			continue;
+		}
+
+		debug("event(%p): batch[%zu] msg=%H\n",
+		      inst, i, econn_message_brief, msg);
+
+		if (0 == event_apply(inst, msg, em->convid,
+				     em->userid, em->clientid,
+				     em->conv_type, true)) {
+			++nproc;
+		}
+
+		mem_deref(msg);
+	}
+
+	info("event(%p): process batch: %zu applied, %zu failed, "
+	     "%u events pending\n",
+	     inst, nproc, nfail, list_count(&inst->eventl));
+
+	return ferr;
+}
+
 AVS_EXPORT
 void wcall_event_end(WUSER_HANDLE wuser)
 {
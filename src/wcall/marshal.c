@@ -16,6 +16,7 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdatomic.h>
 #include <re.h>
 
 #include <avs.h>
@@ -26,10 +27,61 @@
 #include <emscripten.h>
 #endif
 
+#define MQ_RING_SIZE        512  /* must be a power of 2 */
+#define MQ_RING_MASK   (MQ_RING_SIZE - 1)
+#define MQ_CONV_HASH_SIZE    32
+#define MQ_CONV_MAX         256  /* interned ids kept without events */
+
+/* mqueue ids */
+#define MQ_ID_WAKE      0
+#define MQ_ID_OVERFLOW  1
+
+struct mq_slot;
+
 struct wcall_marshal {
 	struct mqueue *mq;
-	struct list mdl;
-	struct lock *lock;
+	struct list mdl;      /* events that did not fit in the ring */
+	struct lock *lock;    /* protects mdl and convh */
+
+	/* Bounded MPSC ring: API calls on any thread claim a slot
+	 * lock-free, the re thread drains it.
+	 */
+	struct mq_slot *ring;
+	atomic_uint tail;
+	uint32_t head;
+	atomic_bool wake;
+	atomic_uint overflow; /* events pending in mdl */
+	bool destroyed;       /* a DESTROY event has run */
+
+	struct hash *convh;   /* interned conversation ids */
+	uint32_t convc;       /* entries in convh */
+	atomic_uint_fast64_t conv_clock;
+
+	struct {
+		atomic_uint_fast64_t pushed;
+		atomic_uint_fast64_t overflowed;
+		uint64_t drained;
+		uint64_t lookups;
+		uint64_t lookups_cached;
+	} stats;
+};
+
+/* An interned conversation id, shared by the queued events of a
+ * conversation instead of each copying the id. refs counts those events
+ * plus one for convh, so the entry and its cached wcall stay around
+ * between events. Once more than MQ_CONV_MAX entries are interned, the
+ * least recently used one without events is dropped from convh.
+ */
+struct mq_conv {
+	struct le le;         /* member of convh */
+	struct wcall_marshal *wm; /* NULL once the marshal is gone */
+	atomic_uint refs;     /* protected by wm->lock when dropping */
+	atomic_uint_fast64_t used; /* wm->conv_clock when last interned */
+	char *convid;
+
+	/* Resolved on the re thread, see wcall_lookup_cached() */
+	struct wcall *wcall;
+	uint32_t gen;
 };
 
 
@@ -62,9 +114,8 @@ enum mq_event {
 struct mq_data {
 	enum mq_event event;
 	struct calling_instance *inst;
-	char *convid;
-	struct le le; /* member of marshaling list */
-	struct le ready_le; /* member of pending ready list */
+	struct mq_conv *conv;
+	const char *convid;   /* conv->convid */
 	
 	union {
 		struct {
@@ -168,28 +219,27 @@ struct mq_data {
 	} u;
 };
 
-static struct list g_ready_pendingl = LIST_INIT;
-
-static void md_destructor(void *arg)
-{
-	struct wcall_marshal *wm = NULL;
-	struct mq_data *md = arg;
+struct mq_slot {
+	atomic_uint seq;
+	uint32_t pos;
+	struct mq_data md;
+};
 
-	wm = wcall_get_marshal(md->inst);
-	if (!wm)
-		return;
+/* Heap copy of an event, for events that have to wait */
+struct mq_held {
+	struct le le; /* member of wm->mdl or g_ready_pendingl */
+	struct wcall_marshal *wm;
+	struct mq_data md;
+};
 
-	lock_write_get(wm->lock);
-	list_unlink(&md->le);
-	lock_rel(wm->lock);
-	
-	switch (md->event) {
-	case WCALL_MEV_ANSWER:
-		break;
+static struct list g_ready_pendingl = LIST_INIT;
 
-	case WCALL_MEV_START:
-		break;
+static void conv_release(struct mq_conv *conv);
 
+/* Release whatever an event owns */
+static void md_reset(struct mq_data *md)
+{
+	switch (md->event) {
 	case WCALL_MEV_RECV_MSG:
 		mem_deref(md->u.recv_msg.msg);
 		mem_deref(md->u.recv_msg.userid);
@@ -234,37 +284,222 @@ static void md_destructor(void *arg)
 		break;
 	}
 
-	md->convid = mem_deref(md->convid);
+	memset(&md->u, 0, sizeof(md->u));
+
+	conv_release(md->conv);
+	md->conv = NULL;
+	md->convid = NULL;
 }
 
 
-static struct mq_data *md_new(struct calling_instance *inst,
-			      const char *convid,
-			      enum mq_event event)
+static void held_destructor(void *arg)
 {
-	struct mq_data *md = NULL;
-	int err = 0;
+	struct mq_held *mh = arg;
+
+	if (mh->wm) {
+		lock_write_get(mh->wm->lock);
+		list_unlink(&mh->le);
+		lock_rel(mh->wm->lock);
+	}
+	else {
+		list_unlink(&mh->le);
+	}
 
-	md = mem_zalloc(sizeof(*md), md_destructor);
-	if (!md)
+	md_reset(&mh->md);
+}
+
+
+/* Takes over what md owns */
+static struct mq_held *md_hold(const struct mq_data *md)
+{
+	struct mq_held *mh;
+
+	mh = mem_zalloc(sizeof(*mh), held_destructor);
+	if (!mh)
 		return NULL;
 
+	mh->md = *md;
+
+	return mh;
+}
+
+
+static void conv_destructor(void *arg)
+{
+	struct mq_conv *conv = arg;
+
+	hash_unlink(&conv->le);
+	mem_deref(conv->convid);
+}
+
+
+static bool conv_cmp_handler(struct le *le, void *arg)
+{
+	struct mq_conv *conv = le->data;
+
+	return streq(conv->convid, (const char *)arg);
+}
+
+
+static bool conv_lru_handler(struct le *le, void *arg)
+{
+	struct mq_conv *conv = le->data;
+	struct mq_conv **lrup = arg;
+
+	if (atomic_load(&conv->refs) > 1)
+		return false;
+
+	if (!*lrup || atomic_load(&conv->used) < atomic_load(&(*lrup)->used))
+		*lrup = conv;
+
+	return false;
+}
+
+
+/* Called with the write lock held */
+static void conv_evict(struct wcall_marshal *wm)
+{
+	struct mq_conv *lru = NULL;
+
+	if (wm->convc <= MQ_CONV_MAX)
+		return;
+
+	hash_apply(wm->convh, conv_lru_handler, &lru);
+	if (!lru)
+		return;
+
+	hash_unlink(&lru->le);
+	--wm->convc;
+
+	if (atomic_fetch_sub(&lru->refs, 1) == 1)
+		mem_deref(lru);
+}
+
+
+static void conv_use(struct wcall_marshal *wm, struct mq_conv *conv)
+{
+	atomic_fetch_add(&conv->refs, 1);
+	atomic_store(&conv->used, atomic_fetch_add(&wm->conv_clock, 1));
+}
+
+
+static struct mq_conv *conv_intern(struct wcall_marshal *wm,
+				   const char *convid)
+{
+	struct mq_conv *conv = NULL;
+	uint32_t key = hash_joaat_str(convid);
+	struct le *le;
+
+	/* Dropping the last reference takes the write lock, so taking
+	 * one under the read lock cannot race with the entry going away.
+	 */
+	lock_read_get(wm->lock);
+	le = hash_lookup(wm->convh, key, conv_cmp_handler, (void *)convid);
+	if (le) {
+		conv = le->data;
+		conv_use(wm, conv);
+	}
+	lock_rel(wm->lock);
+	if (conv)
+		return conv;
+
+	lock_write_get(wm->lock);
+	le = hash_lookup(wm->convh, key, conv_cmp_handler, (void *)convid);
+	if (le) {
+		conv = le->data;
+		conv_use(wm, conv);
+		goto out;
+	}
+
+	conv = mem_zalloc(sizeof(*conv), conv_destructor);
+	if (!conv)
+		goto out;
+
+	if (str_dup(&conv->convid, convid)) {
+		conv = mem_deref(conv);
+		goto out;
+	}
+
+	conv->wm = wm;
+	atomic_init(&conv->refs, 1);
+	atomic_init(&conv->used, 0);
+	conv_use(wm, conv);
+	hash_append(wm->convh, key, &conv->le, conv);
+	++wm->convc;
+
+	conv_evict(wm);
+
+ out:
+	lock_rel(wm->lock);
+
+	return conv;
+}
+
+
+static void conv_release(struct mq_conv *conv)
+{
+	struct wcall_marshal *wm;
+
+	if (!conv)
+		return;
+
+	wm = conv->wm;
+	if (wm)
+		lock_write_get(wm->lock);
+
+	if (atomic_fetch_sub(&conv->refs, 1) == 1)
+		mem_deref(conv);
+
+	if (wm)
+		lock_rel(wm->lock);
+}
+
+
+/* Drops the reference of convh, entries still used by held events
+ * outlive the marshal
+ */
+static bool conv_orphan_handler(struct le *le, void *arg)
+{
+	struct mq_conv *conv = le->data;
+
+	(void)arg;
+
+	conv->wm = NULL;
+	hash_unlink(&conv->le);
+
+	if (atomic_fetch_sub(&conv->refs, 1) == 1)
+		mem_deref(conv);
+
+	return false;
+}
+
+
+static int md_init(struct mq_data *md,
+		   struct calling_instance *inst,
+		   const char *convid,
+		   enum mq_event event)
+{
+	struct wcall_marshal *wm;
+
+	memset(md, 0, sizeof(*md));
+
+	wm = wcall_get_marshal(inst);
+	if (!wm)
+		return ENOSYS;
+
 	if (convid) {
-		err = str_dup(&md->convid, convid);
-		if (err) {
-			warning("marshall: unable to copy convid\n");
-			goto out;
+		md->conv = conv_intern(wm, convid);
+		if (!md->conv) {
+			warning("marshall: unable to intern convid\n");
+			return ENOMEM;
 		}
+		md->convid = md->conv->convid;
 	}
 
 	md->inst = inst;
 	md->event = event;
 
-out:
-	if (err)
-		md = mem_deref(md);
-
-	return md;
+	return 0;
 }
 
 static char *mev_name(int id)
@@ -317,16 +552,44 @@ static char *mev_name(int id)
 	}
 }
 
-static void mqueue_handler(int id, void *data, void *arg)
+/* The held copy takes over what md owns */
+static void md_defer_until_ready(struct mq_data *md)
 {
-	struct mq_data *md = data;
+	struct mq_held *mh;
+
+	mh = md_hold(md);
+	if (!mh) {
+		md_reset(md);
+		return;
+	}
+
+	list_append(&g_ready_pendingl, &mh->le, mh);
+
+	memset(&md->u, 0, sizeof(md->u));
+	md->conv = NULL;
+	md->convid = NULL;
+}
+
+
+/* Run an event on the re thread. Consumes what md owns. */
+static void md_handle(struct mq_data *md)
+{
+	struct wcall_marshal *wm = wcall_get_marshal(md->inst);
 	struct wcall *wcall = NULL;
+	int id = md->event;
 	int err = 0;
 
-	(void)arg;
+	if (md->conv) {
+		uint32_t gen = md->conv->gen;
 
-	if (md->convid)
-		wcall = wcall_lookup(md->inst, md->convid);
+		wcall = wcall_lookup_cached(md->inst, md->convid,
+					    &md->conv->wcall, &md->conv->gen);
+		if (wm) {
+			++wm->stats.lookups;
+			if (gen == md->conv->gen)
+				++wm->stats.lookups_cached;
+		}
+	}
 
 	switch (id) {
 
@@ -366,10 +629,8 @@ static void mqueue_handler(int id, void *data, void *arg)
 	        if (!wcall_is_ready(md->inst, md->u.start.conv_type)) {
 		        warning("wcall(%p): AVS not ready queueing start\n",
 				md->inst);
-		        list_append(&g_ready_pendingl,
-				    &md->ready_le,
-				    mem_ref(md));
-			break;
+			md_defer_until_ready(md);
+			return;
 		}
 		if (!wcall) {
 			if (!md->convid) {
@@ -408,10 +669,8 @@ static void mqueue_handler(int id, void *data, void *arg)
 	        if (!wcall_is_ready(md->inst, md->u.start.conv_type)) {
 		        warning("wcall(%p): AVS not ready queueing answer\n",
 				md->inst);
-		        list_append(&g_ready_pendingl,
-				    &md->ready_le,
-				    mem_ref(md));
-			break;
+			md_defer_until_ready(md);
+			return;
 		}
 		if (!wcall) {
 			err = ENOENT;
@@ -492,6 +751,9 @@ static void mqueue_handler(int id, void *data, void *arg)
 		break;
 
 	case WCALL_MEV_DESTROY:
+		/* May free the instance and release the marshal */
+		if (wm)
+			wm->destroyed = true;
 		wcall_i_destroy(md->inst);
 		break;
 
@@ -549,7 +811,68 @@ out:
 			md->convid ? anon_id(convid_anon, md->convid) : "???");
 	}
 
-	mem_deref(md);
+	md_reset(md);
+}
+
+
+/* Drain the ring. Slots are released before their event runs, so
+ * handlers may queue new events.
+ */
+static void mq_drain(struct wcall_marshal *wm)
+{
+	atomic_store(&wm->wake, false);
+
+	while (!wm->destroyed) {
+		uint32_t pos = wm->head;
+		struct mq_slot *slot = &wm->ring[pos & MQ_RING_MASK];
+		struct mq_data md;
+
+		if (atomic_load_explicit(&slot->seq,
+					 memory_order_acquire) != pos + 1)
+			break;
+
+		md = slot->md;
+		atomic_store_explicit(&slot->seq, pos + MQ_RING_SIZE,
+				      memory_order_release);
+		wm->head = pos + 1;
+		++wm->stats.drained;
+
+		md_handle(&md);
+	}
+}
+
+
+static void mqueue_handler(int id, void *data, void *arg)
+{
+	struct wcall_marshal *wm = arg;
+	struct mq_held *mh = data;
+
+	/* A DESTROY event may release the marshal while it is handled,
+	 * events behind it refer to the freed instance and are dropped.
+	 */
+	mem_ref(wm);
+
+	switch (id) {
+
+	case MQ_ID_WAKE:
+		mq_drain(wm);
+		break;
+
+	case MQ_ID_OVERFLOW:
+		/* Everything in the ring was queued before this */
+		mq_drain(wm);
+
+		if (!wm->destroyed)
+			md_handle(&mh->md);
+		mem_deref(mh);
+		atomic_fetch_sub(&wm->overflow, 1);
+		break;
+
+	default:
+		break;
+	}
+
+	mem_deref(wm);
 }
 
 void wcall_invoke_ready(struct calling_instance *inst)
@@ -560,14 +883,15 @@ void wcall_invoke_ready(struct calling_instance *inst)
 	     inst, list_count(&g_ready_pendingl));
 
 	while(le) {
-	        struct mq_data *md = le->data;
+	        struct mq_held *mh = le->data;
 
 		le = le->next;
 		info("wcall_invoke_ready(%p): for inst=%p\n",
-		     inst, md->inst);
-		if (md && md->inst == inst) {
-		       list_unlink(&md->ready_le);
-		       mqueue_handler(md->event, md, NULL);
+		     inst, mh->md.inst);
+		if (mh && mh->md.inst == inst) {
+		       list_unlink(&mh->le);
+		       md_handle(&mh->md);
+		       mem_deref(mh);
 		}
 	}
 }
@@ -584,9 +908,38 @@ static void wm_destructor(void *arg)
 	count = list_count(&wmarsh->mdl);
 	lock_rel(wmarsh->lock);
 
-	info("wcall: marshal(%p): flush pending events: %u\n",
-	      wmarsh, count);
+	if (wmarsh->ring) {
+		uint32_t pos;
+
+		for (pos = wmarsh->head; ; ++pos) {
+			struct mq_slot *slot;
+
+			slot = &wmarsh->ring[pos & MQ_RING_MASK];
+			if (atomic_load(&slot->seq) != pos + 1)
+				break;
+
+			md_reset(&slot->md);
+			++count;
+		}
+	}
+
+	info("wcall: marshal(%p): flush pending events: %u "
+	     "(pushed=%llu overflowed=%llu lookups=%llu cached=%llu)\n",
+	     wmarsh, count,
+	     (unsigned long long)atomic_load(&wmarsh->stats.pushed),
+	     (unsigned long long)atomic_load(&wmarsh->stats.overflowed),
+	     (unsigned long long)wmarsh->stats.lookups,
+	     (unsigned long long)wmarsh->stats.lookups_cached);
+
 	list_flush(&wmarsh->mdl);
+	mem_deref(wmarsh->ring);
+
+	if (wmarsh->convh) {
+		lock_write_get(wmarsh->lock);
+		hash_apply(wmarsh->convh, conv_orphan_handler, NULL);
+		lock_rel(wmarsh->lock);
+		mem_deref(wmarsh->convh);
+	}
 
 	wmarsh->lock = mem_deref(wmarsh->lock);
 }
@@ -595,13 +948,14 @@ static void wm_destructor(void *arg)
 int wcall_marshal_alloc(struct wcall_marshal **wmp)
 {
 	struct wcall_marshal *wmarsh;
+	uint32_t i;
 	int err;
 
 	wmarsh = mem_zalloc(sizeof(*wmarsh), wm_destructor);
 	if (!wmarsh)
 		return ENOMEM;
 
-	err = mqueue_alloc(&wmarsh->mq, mqueue_handler, NULL);
+	err = mqueue_alloc(&wmarsh->mq, mqueue_handler, wmarsh);
 	if (err)
 		goto out;
 
@@ -611,6 +965,24 @@ int wcall_marshal_alloc(struct wcall_marshal **wmp)
 	if (err)
 		goto out;
 
+	err = hash_alloc(&wmarsh->convh, MQ_CONV_HASH_SIZE);
+	if (err)
+		goto out;
+
+	wmarsh->ring = mem_zalloc(MQ_RING_SIZE * sizeof(*wmarsh->ring),
+				  NULL);
+	if (!wmarsh->ring) {
+		err = ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < MQ_RING_SIZE; ++i)
+		atomic_init(&wmarsh->ring[i].seq, i);
+
+	atomic_init(&wmarsh->tail, 0);
+	atomic_init(&wmarsh->wake, false);
+	atomic_init(&wmarsh->overflow, 0);
+	atomic_init(&wmarsh->conv_clock, 0);
+
  out:
 	if (err)
 		mem_deref(wmarsh);
@@ -621,34 +993,108 @@ int wcall_marshal_alloc(struct wcall_marshal **wmp)
 }
 
 
-static int md_enqueue(struct mq_data *md)
+/* Claim a ring slot, NULL if the ring is full */
+static struct mq_slot *mq_claim(struct wcall_marshal *wm)
 {
-	struct wcall_marshal *wm = NULL;
-	int err = 0;
-
-	wm = wcall_get_marshal(md->inst);
-	if (wm == NULL) {
-		err = ENOSYS;
-		goto out;
+	struct mq_slot *slot;
+	unsigned int pos, seq;
+	int32_t dif;
+
+	pos = atomic_load_explicit(&wm->tail, memory_order_relaxed);
+	for (;;) {
+		slot = &wm->ring[pos & MQ_RING_MASK];
+		seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		dif = (int32_t)(seq - pos);
+
+		if (dif == 0) {
+			if (atomic_compare_exchange_weak_explicit(
+				    &wm->tail, &pos, pos + 1,
+				    memory_order_relaxed,
+				    memory_order_relaxed))
+				break;
+		}
+		else if (dif < 0) {
+			return NULL;
+		}
+		else {
+			pos = atomic_load_explicit(&wm->tail,
+						   memory_order_relaxed);
+		}
 	}
 
+	slot->pos = pos;
+
+	return slot;
+}
+
+
+/* A full ring spills into mdl and goes through the mqueue pipe.
+ * While anything is spilled, later events follow it there so that
+ * each producer's events stay in order.
+ */
+static int md_overflow(struct wcall_marshal *wm, const struct mq_data *md)
+{
+	struct mq_held *mh;
+	int err;
+
+	mh = md_hold(md);
+	if (!mh)
+		return ENOMEM;
+
+	mh->wm = wm;
+	atomic_fetch_add(&wm->overflow, 1);
+	atomic_fetch_add(&wm->stats.overflowed, 1);
+
 	lock_write_get(wm->lock);
-	list_append(&wm->mdl, &md->le, md);
+	list_append(&wm->mdl, &mh->le, mh);
 	lock_rel(wm->lock);
 
-	if (WCALL_MODE_MARSHAL == wcall_get_mode()) {
-		err = mqueue_push(wm->mq, md->event, md);
-		if (err)
-			goto out;
-	}
-	else {
-		mqueue_handler(md->event, md, NULL);
+	err = mqueue_push(wm->mq, MQ_ID_OVERFLOW, mh);
+	if (err) {
+		/* md still owns its data */
+		memset(&mh->md.u, 0, sizeof(mh->md.u));
+		mh->md.conv = NULL;
+		mem_deref(mh);
+		atomic_fetch_sub(&wm->overflow, 1);
 	}
 
- out:
 	return err;
-	
-	
+}
+
+
+/* On success the queue takes over what md owns */
+static int md_enqueue(struct mq_data *md)
+{
+	struct wcall_marshal *wm = NULL;
+	struct mq_slot *slot = NULL;
+
+	wm = wcall_get_marshal(md->inst);
+	if (wm == NULL)
+		return ENOSYS;
+
+	if (WCALL_MODE_MARSHAL != wcall_get_mode()) {
+		md_handle(md);
+		return 0;
+	}
+
+	if (atomic_load(&wm->overflow) == 0)
+		slot = mq_claim(wm);
+	if (!slot)
+		return md_overflow(wm, md);
+
+	slot->md = *md;
+	atomic_store_explicit(&slot->seq, slot->pos + 1,
+			      memory_order_release);
+	atomic_fetch_add_explicit(&wm->stats.pushed, 1,
+				  memory_order_relaxed);
+
+	/* Only wake the re thread if it is not already due to drain */
+	if (!atomic_exchange(&wm->wake, true)) {
+		if (mqueue_push(wm->mq, MQ_ID_WAKE, NULL))
+			atomic_store(&wm->wake, false);
+	}
+
+	return 0;
 }
 
 
@@ -664,7 +1110,7 @@ int  wcall_recv_msg(WUSER_HANDLE wuser, const uint8_t *buf, size_t len,
 {
 	struct calling_instance *inst;
 	struct econn_message *msg = NULL;
-	struct mq_data *md = NULL;
+	struct mq_data md;
 	int err = 0;
 
 	if (!buf || len == 0 || !convid || !userid || !clientid)
@@ -687,31 +1133,31 @@ int  wcall_recv_msg(WUSER_HANDLE wuser, const uint8_t *buf, size_t len,
 		return EINVAL;
 	}		
 
-	md = md_new(inst, convid, WCALL_MEV_RECV_MSG);
-	if (!md) {
+	err = md_init(&md, inst, convid, WCALL_MEV_RECV_MSG);
+	if (err) {
 		mem_deref(msg);
-		return ENOMEM;
+		return err;
 	}
 
-	md->u.recv_msg.msg = msg;
-	md->u.recv_msg.curr_time = curr_time;
-	md->u.recv_msg.msg_time = msg_time;
-	md->u.recv_msg.conv_type = conv_type;
-	md->u.recv_msg.meeting = meeting == 1;
-	err = str_dup(&md->u.recv_msg.userid, userid);
-	err |= str_dup(&md->u.recv_msg.clientid, clientid);
+	md.u.recv_msg.msg = msg;
+	md.u.recv_msg.curr_time = curr_time;
+	md.u.recv_msg.msg_time = msg_time;
+	md.u.recv_msg.conv_type = conv_type;
+	md.u.recv_msg.meeting = meeting == 1;
+	err = str_dup(&md.u.recv_msg.userid, userid);
+	err |= str_dup(&md.u.recv_msg.clientid, clientid);
 
 	if (err)
 		goto out;
 
-	err = md_enqueue(md);
+	err = md_enqueue(&md);
 	if (err)
 		goto out;
 			    
 
  out:
 	if (err)
-		mem_deref(md);
+		md_reset(&md);
 
 	return err;
 }
@@ -720,7 +1166,7 @@ AVS_EXPORT
 void wcall_config_update(WUSER_HANDLE wuser, int err, const char *json_str)
 {
 	struct calling_instance *inst;
-	struct mq_data *md = NULL;
+	struct mq_data md;
 
 	info("wcall(%p): config_update: err=%d json=%zu bytes\n",
 	     wuser, err, str_len(json_str));
@@ -732,14 +1178,14 @@ void wcall_config_update(WUSER_HANDLE wuser, int err, const char *json_str)
 		return;
 	}
 	
-	md = md_new(inst, NULL, WCALL_MEV_CONFIG_UPDATE); 
-	if (!md)
+	if (md_init(&md, inst, NULL, WCALL_MEV_CONFIG_UPDATE))
 		return;
 
-	str_dup(&md->u.config_update.json_str, json_str);
-	md->u.config_update.err = err;
+	str_dup(&md.u.config_update.json_str, json_str);
+	md.u.config_update.err = err;
 
-	md_enqueue(md);
+	if (md_enqueue(&md))
+		md_reset(&md);
 }
 
 
@@ -747,7 +1193,7 @@ AVS_EXPORT
 void wcall_resp(WUSER_HANDLE wuser, int status, const char *reason, void *arg)
 {
 	struct calling_instance *inst;
-	struct mq_data *md = NULL;
+	struct mq_data md;
 	int err = 0;
 
 	inst = wuser2inst(wuser);
@@ -757,21 +1203,21 @@ void wcall_resp(WUSER_HANDLE wuser, int status, const char *reason, void *arg)
 		return;
 	}
 	
-	md = md_new(inst, NULL, WCALL_MEV_RESP);
-	if (!md) {
+	err = md_init(&md, inst, NULL, WCALL_MEV_RESP);
+	if (err) {
 		warning("wcall: resp: failed to alloc md\n");
 		return;
 	}
 
-	md->u.resp.arg = arg;
-	md->u.resp.status = status;
-	err = str_dup(&md->u.resp.reason, reason);
+	md.u.resp.arg = arg;
+	md.u.resp.status = status;
+	err = str_dup(&md.u.resp.reason, reason);
 	if (err)
-		md->u.resp.reason = NULL;
+		md.u.resp.reason = NULL;
 
-	err = md_enqueue(md);
+	err = md_enqueue(&md);
 	if (err)
-		mem_deref(md);
+		md_reset(&md);
 }
 
 
@@ -781,7 +1227,7 @@ void wcall_sft_resp(WUSER_HANDLE wuser,
 {
 	struct calling_instance *inst;
 	struct econn_message *msg = NULL;
-	struct mq_data *md = NULL;
+	struct mq_data md;
 	int err = 0;
 
 	inst = wuser2inst(wuser);
@@ -802,23 +1248,25 @@ void wcall_sft_resp(WUSER_HANDLE wuser,
 		}
 	}
 
-	md = md_new(inst, NULL, WCALL_MEV_SFT_RESP);
-	if (!md)
+	err = md_init(&md, inst, NULL, WCALL_MEV_SFT_RESP);
+	if (err) {
+		mem_deref(msg);
 		return;
+	}
 
-	md->u.sft_resp.err = perr;
-	md->u.sft_resp.msg = msg;
-	md->u.sft_resp.ctx = ctx;
+	md.u.sft_resp.err = perr;
+	md.u.sft_resp.msg = msg;
+	md.u.sft_resp.ctx = ctx;
 
 	if (err)
 		goto out;
 
-	err = md_enqueue(md);
+	err = md_enqueue(&md);
 	if (err)
 		goto out;
  out:
 	if (err)
-		mem_deref(md);
+		md_reset(&md);
 }
 
 
@@ -831,7 +1279,7 @@ int wcall_start(WUSER_HANDLE wuser,
 		int meeting /*bool */)
 {
 	struct calling_instance *inst;
-	struct mq_data *md = NULL;
+	struct mq_data md;
 	int err = 0;
 
 	if (!convid)
@@ -844,20 +1292,18 @@ int wcall_start(WUSER_HANDLE wuser,
 		return EINVAL;
 	}
 
-	md = md_new(inst, convid, WCALL_MEV_START);
-	if (!md) {
-		err = ENOMEM;
+	err = md_init(&md, inst, convid, WCALL_MEV_START);
+	if (err)
 		goto out;
-	}
 
-	md->u.start.call_type = call_type;
-	md->u.start.conv_type = conv_type;
-	md->u.start.audio_cbr = (bool)audio_cbr;
-	md->u.start.meeting = meeting == 1;
+	md.u.start.call_type = call_type;
+	md.u.start.conv_type = conv_type;
+	md.u.start.audio_cbr = (bool)audio_cbr;
+	md.u.start.meeting = meeting == 1;
 
-	err = md_enqueue(md);
+	err = md_enqueue(&md);
 	if (err)
-		mem_deref(md);
+		md_reset(&md);
 
  out:
 	return err;
@@ -871,7 +1317,7 @@ int wcall_answer(WUSER_HANDLE wuser,
 		 int audio_cbr/* bool */)
 {
 	struct calling_instance *inst;
-	struct mq_data *md = NULL;
+	struct mq_data md;
 	int err = 0;
 
 	if (!convid)
@@ -884,11 +1330,14 @@ int wcall_answer(WUSER_HANDLE wuser,
 		return EINVAL;
 	}
 
-	md = md_new(inst, convid, WCALL_MEV_ANSWER);
-	md->u.answer.call_type = call_type;
-	md->u.answer.audio_cbr = audio_cbr;
+	err = md_init(&md, inst, convid, WCALL_MEV_ANSWER);
+	if (err)
+		return err;
+
+	md.u.answer.call_type = call_type;
+	md.u.answer.audio_cbr = audio_cbr;
 
-	err = md_enqueue(md);
+	err = md_enqueue(&md);
 	if (err) {
 		goto out;
 	}
@@ -896,7 +1345,7 @@ int wcall_answer(WUSER_HANDLE wuser,
 
 out:
 	if (err)
-		mem_deref(md);
+		md_reset(&md);
 
 	return err;
 }
@@ -906,7 +1355,7 @@ AVS_EXPORT
 void wcall_end(WUSER_HANDLE wuser, const char *convid)
 {
 	struct calling_instance *inst;
-	struct mq_data *md = NULL;
+	struct mq_data md;
 	int err = 0;
 
 	if (!convid) {
@@ -921,15 +1370,13 @@ void wcall_end(WUSER_HANDLE wuser, const char *convid)
 		return;
 	}
 
-	md = md_new(inst, convid, WCALL_MEV_END);
-	if (!md) {
-		err = ENOMEM;
+	err = md_init(&md, inst, convid, WCALL_MEV_END);
+	if (err)
 		goto out;
-	}
 
-	err = md_enqueue(md);
+	err = md_enqueue(&md);
 	if (err)
-		mem_deref(md);
+		md_reset(&md);
 
  out:
 	if (err)
@@ -941,7 +1388,7 @@ AVS_EXPORT
 int wcall_reject(WUSER_HANDLE wuser, const char *convid)
 {
 	struct calling_instance *inst;
-	struct mq_data *md = NULL;
+	struct mq_data md;
 	int err = 0;
 
 	if (!convid)
@@ -954,15 +1401,13 @@ int wcall_reject(WUSER_HANDLE wuser, const char *convid)
 		return EINVAL;
 	}
 
-	md = md_new(inst, convid, WCALL_MEV_REJECT);
-	if (!md) {
-		err = ENOMEM;
+	err = md_init(&md, inst, convid, WCALL_MEV_REJECT);
+	if (err)
 		goto out;
-	}
 
-	err = md_enqueue(md);
+	err = md_enqueue(&md);
 	if (err)
-		mem_deref(md);
+		md_reset(&md);
 
  out:
 	if (err)
@@ -977,7 +1422,7 @@ void wcall_set_video_send_state(WUSER_HANDLE wuser,
 				const char *convid, int state)
 {
 	struct calling_instance *inst;
-	struct mq_data *md = NULL;
+	struct mq_data md;
 	int err = 0;
 	
 	if (!convid)
@@ -991,15 +1436,15 @@ void wcall_set_video_send_state(WUSER_HANDLE wuser,
 		return;
 	}
 
-	md = md_new(inst, convid, WCALL_MEV_VIDEO_SET_STATE);
-	if (!md)
+	err = md_init(&md, inst, convid, WCALL_MEV_VIDEO_SET_STATE);
+	if (err)
 		return;
 
-	md->u.video_set_state.state = state;
+	md.u.video_set_state.state = state;
 
-	err = md_enqueue(md);
+	err = md_enqueue(&md);
 	if (err)
-		mem_deref(md);	
+		md_reset(&md);	
 }
 
 
@@ -1007,7 +1452,7 @@ AVS_EXPORT
 void wcall_dce_send(WUSER_HANDLE wuser, const char *convid, struct mbuf *mb)
 {
 	struct calling_instance *inst;
-	struct mq_data *md = NULL;
+	struct mq_data md;
 	int err = 0;
 
 	if (!convid)
@@ -1020,62 +1465,62 @@ void wcall_dce_send(WUSER_HANDLE wuser, const char *convid, struct mbuf *mb)
 		return;
 	}
 
-	md = md_new(inst, convid, WCALL_MEV_DCE_SEND);
-	if (!md)
+	err = md_init(&md, inst, convid, WCALL_MEV_DCE_SEND);
+	if (err)
 		return;
 
-	md->u.dce_send.mb = mem_ref(mb);
+	md.u.dce_send.mb = mem_ref(mb);
 
-	err = md_enqueue(md);
+	err = md_enqueue(&md);
 	if (err)
-		mem_deref(md);
+		md_reset(&md);
 }
 
 void wcall_mcat_changed(struct calling_instance *inst,
 			enum mediamgr_state state)
 {
 	
-	struct mq_data *md = NULL;
+	struct mq_data md;
 	int err = 0;
 
 	if (!inst)
 		return;
 	
-	md = md_new(inst, NULL, WCALL_MEV_MCAT_CHANGED);
-	if (!md)
+	err = md_init(&md, inst, NULL, WCALL_MEV_MCAT_CHANGED);
+	if (err)
 		return;
     
-	md->u.mcat_changed.state = state;
+	md.u.mcat_changed.state = state;
 
 	info("wcall_mcat_changed: inst=%p state=%d\n", inst, (int)state);
 	
-	err = md_enqueue(md);
+	err = md_enqueue(&md);
 	if (err)
-		mem_deref(md);
+		md_reset(&md);
 }
 
 void wcall_audio_route_changed(	struct calling_instance *inst,
 			       enum mediamgr_auplay new_route)
 {
-	struct mq_data *md = NULL;
+	struct mq_data md;
 	int err = 0;
 
-	md = md_new(inst, NULL, WCALL_MEV_AUDIO_ROUTE_CHANGED);
-	if (!md)
+	err = md_init(&md, inst, NULL, WCALL_MEV_AUDIO_ROUTE_CHANGED);
+	if (err)
 		return;
 
-	md->u.route_changed.new_route = new_route;
+	md.u.route_changed.new_route = new_route;
 
-	err = md_enqueue(md);
+	err = md_enqueue(&md);
 	if (err)
-		mem_deref(md);
+		md_reset(&md);
 }
 
 
 AVS_EXPORT
 void wcall_network_changed(void)
 {
-	struct mq_data *md = NULL;
+	struct mq_data md;
 	struct calling_instance *inst = wcall_get_instance();
 	int err = 0;
 
@@ -1084,13 +1529,13 @@ void wcall_network_changed(void)
 		return;
 	}
 	
-	md = md_new(inst, NULL, WCALL_MEV_NETWORK_CHANGED);
-	if (!md)
+	err = md_init(&md, inst, NULL, WCALL_MEV_NETWORK_CHANGED);
+	if (err)
 		return;
 
-	err = md_enqueue(md);
+	err = md_enqueue(&md);
 	if (err)
-		mem_deref(md);	
+		md_reset(&md);	
 }
 
 
@@ -1105,33 +1550,33 @@ void wcall_invoke_incoming_handler(const char *convid,
 			           void *arg)
 {
 	struct calling_instance *inst = arg;
-	struct mq_data *md = NULL;
+	struct mq_data md;
 	int err = 0;
 
 	if (!inst || !convid || !userid)
 		return;
 
-	md = md_new(inst, convid, WCALL_MEV_INCOMING);
-	if (!md)
+	err = md_init(&md, inst, convid, WCALL_MEV_INCOMING);
+	if (err)
 		return;
 
-	md->u.incoming.msg_time = msg_time;
-	md->u.incoming.video_call = video_call;
-	md->u.incoming.should_ring = should_ring;
-	md->u.incoming.conv_type = conv_type;
-	err = str_dup(&md->u.incoming.userid, userid);
-	err |= str_dup(&md->u.incoming.clientid, clientid);
+	md.u.incoming.msg_time = msg_time;
+	md.u.incoming.video_call = video_call;
+	md.u.incoming.should_ring = should_ring;
+	md.u.incoming.conv_type = conv_type;
+	err = str_dup(&md.u.incoming.userid, userid);
+	err |= str_dup(&md.u.incoming.clientid, clientid);
 
 	if (err)
 		goto out;
 
-	err = md_enqueue(md);
+	err = md_enqueue(&md);
 	if (err)
 		goto out;
 
  out:
 	if (err)
-		mem_deref(md);
+		md_reset(&md);
 }
 
 
@@ -1141,7 +1586,7 @@ int wcall_set_clients_for_conv(WUSER_HANDLE wuser,
 			       const char *json)
 {
 	struct calling_instance *inst;
-	struct mq_data *md = NULL;
+	struct mq_data md;
 	int err = 0;
 
 	if (!convid) {
@@ -1163,21 +1608,21 @@ int wcall_set_clients_for_conv(WUSER_HANDLE wuser,
 		return EINVAL;
 	}
 
-	md = md_new(inst, convid, WCALL_MEV_SET_CLIENTS);
-	if (!md)
-		return ENOMEM;
+	err = md_init(&md, inst, convid, WCALL_MEV_SET_CLIENTS);
+	if (err)
+		return err;
 
-	err = str_dup(&md->u.set_clients.json, json);
+	err = str_dup(&md.u.set_clients.json, json);
 	if (err)
 		goto out;
 
-	err = md_enqueue(md);
+	err = md_enqueue(&md);
 	if (err)
 		goto out;
 
  out:
 	if (err)
-		mem_deref(md);
+		md_reset(&md);
 
 	return err;
 }
@@ -1187,7 +1632,7 @@ AVS_EXPORT
 void wcall_set_mute(WUSER_HANDLE wuser, int muted)
 {
 	struct calling_instance *inst;
-	struct mq_data *md = NULL;
+	struct mq_data md;
 	int err = 0;
 
 	inst = wuser2inst(wuser);
@@ -1198,17 +1643,17 @@ void wcall_set_mute(WUSER_HANDLE wuser, int muted)
 		return;
 	}
 	
-	md = md_new(inst, NULL, WCALL_MEV_SET_MUTE);
-	if (!md)
+	err = md_init(&md, inst, NULL, WCALL_MEV_SET_MUTE);
+	if (err)
 		return;
     
-	md->u.set_mute.muted = muted;
+	md.u.set_mute.muted = muted;
 
 	info("wcall_set_mute: inst=%p muted=%d\n", inst, muted);
 	
-	err = md_enqueue(md);
+	err = md_enqueue(&md);
 	if (err)
-		mem_deref(md);
+		md_reset(&md);
 }
 
 
@@ -1219,7 +1664,7 @@ int wcall_request_video_streams(WUSER_HANDLE wuser,
 				const char *json)
 {
 	struct calling_instance *inst;
-	struct mq_data *md = NULL;
+	struct mq_data md;
 	int err = 0;
 
 	if (!convid) {
@@ -1240,23 +1685,23 @@ int wcall_request_video_streams(WUSER_HANDLE wuser,
 		return EINVAL;
 	}
 
-	md = md_new(inst, convid, WCALL_MEV_REQ_VSTREAMS);
-	if (!md)
-		return ENOMEM;
+	err = md_init(&md, inst, convid, WCALL_MEV_REQ_VSTREAMS);
+	if (err)
+		return err;
 
-	err = str_dup(&md->u.req_vstreams.json, json);
+	err = str_dup(&md.u.req_vstreams.json, json);
 	if (err)
 		goto out;
 
-	md->u.req_vstreams.mode = mode;
+	md.u.req_vstreams.mode = mode;
 
-	err = md_enqueue(md);
+	err = md_enqueue(&md);
 	if (err)
 		goto out;
 
  out:
 	if (err)
-		mem_deref(md);
+		md_reset(&md);
 
 	return err;
 }
@@ -1270,7 +1715,7 @@ int wcall_set_epoch_info(WUSER_HANDLE wuser,
 			 const char *key_base64)
 {
 	struct calling_instance *inst;
-	struct mq_data *md = NULL;
+	struct mq_data md;
 	size_t key_size = 0;
 	size_t b64_size = 0;
 	int err = 0;
@@ -1299,20 +1744,20 @@ int wcall_set_epoch_info(WUSER_HANDLE wuser,
 		return EINVAL;
 	}
 
-	md = md_new(inst, convid, WCALL_MEV_SET_EPOCH_INFO);
-	if (!md)
-		return ENOMEM;
+	err = md_init(&md, inst, convid, WCALL_MEV_SET_EPOCH_INFO);
+	if (err)
+		return err;
 
 	key_size = b64_size;
-	md->u.set_epoch_info.key_data = mem_zalloc(key_size, NULL);
-	if (!md->u.set_epoch_info.key_data) {
+	md.u.set_epoch_info.key_data = mem_zalloc(key_size, NULL);
+	if (!md.u.set_epoch_info.key_data) {
 		err = ENOMEM;
 		goto out;
 	}
 
 	err = base64_decode(key_base64,
 			    b64_size,
-			    md->u.set_epoch_info.key_data,
+			    md.u.set_epoch_info.key_data,
 			    &key_size);
 	
 	if (err) {
@@ -1327,20 +1772,20 @@ int wcall_set_epoch_info(WUSER_HANDLE wuser,
 		goto out;
 	}
 
-	err = str_dup(&md->u.set_epoch_info.clients_json, clients_json);
+	err = str_dup(&md.u.set_epoch_info.clients_json, clients_json);
 	if (err) 
 		goto out;
 
-	md->u.set_epoch_info.epochid = epochid;
-	md->u.set_epoch_info.key_size = key_size;
+	md.u.set_epoch_info.epochid = epochid;
+	md.u.set_epoch_info.key_size = key_size;
 
-	err = md_enqueue(md);
+	err = md_enqueue(&md);
 	if (err)
 		goto out;
 
  out:
 	if (err)
-		mem_deref(md);
+		md_reset(&md);
 
 	return err;
 }
@@ -1349,7 +1794,7 @@ AVS_EXPORT
 void wcall_set_duration(WUSER_HANDLE wuser, const char *convid, int duration)
 {
 	struct calling_instance *inst;
-	struct mq_data *md = NULL;
+	struct mq_data md;
 	int err = 0;
 
 	inst = wuser2inst(wuser);
@@ -1364,17 +1809,17 @@ void wcall_set_duration(WUSER_HANDLE wuser, const char *convid, int duration)
 		return;
 	}
 
-	md = md_new(inst, convid, WCALL_MEV_SET_DURATION);
-	if (!md)
+	err = md_init(&md, inst, convid, WCALL_MEV_SET_DURATION);
+	if (err)
 		return;
 
-	md->u.set_duration.duration = duration;
+	md.u.set_duration.duration = duration;
 
 	info("wcall_set_duration: inst=%p duration=%d\n", inst, duration);
 
-	err = md_enqueue(md);
+	err = md_enqueue(&md);
 	if (err)
-		mem_deref(md);
+		md_reset(&md);
 }
 
 
@@ -1383,7 +1828,7 @@ AVS_EXPORT
 int wcall_process_notifications(WUSER_HANDLE wuser, int processing)
 {
 	struct calling_instance *inst;
-	struct mq_data *md = NULL;
+	struct mq_data md;
 	int err = 0;
 
 	inst = wuser2inst(wuser);
@@ -1392,15 +1837,15 @@ int wcall_process_notifications(WUSER_HANDLE wuser, int processing)
 		return EINVAL;
 	}
 
-	md = md_new(inst, NULL, WCALL_MEV_PROCESS_NOTIFICATIONS);
-	if (!md)
-		return ENOMEM;
+	err = md_init(&md, inst, NULL, WCALL_MEV_PROCESS_NOTIFICATIONS);
+	if (err)
+		return err;
 
-	md->u.process_notifications.processing = (bool)processing;
+	md.u.process_notifications.processing = (bool)processing;
 
-	err = md_enqueue(md);
+	err = md_enqueue(&md);
 	if (err)
-		mem_deref(md);
+		md_reset(&md);
 
 	return err;
 }
@@ -1408,17 +1853,32 @@ int wcall_process_notifications(WUSER_HANDLE wuser, int processing)
 
 void wcall_marshal_destroy(struct calling_instance *inst)
 {
-	struct mq_data *md = NULL;
+	struct mq_data md;
 	int err = 0;
 
-	md = md_new(inst, NULL, WCALL_MEV_DESTROY);
-	if (!md)
+	err = md_init(&md, inst, NULL, WCALL_MEV_DESTROY);
+	if (err)
 		return;
 
-	err = md_enqueue(md);
+	err = md_enqueue(&md);
 	if (err)
 		goto out;
 
  out:
 	return;
 }
+
+
+void wcall_marshal_lookup_stats(WUSER_HANDLE wuser,
+				uint64_t *lookups, uint64_t *lookups_cached)
+{
+	struct calling_instance *inst = wuser2inst(wuser);
+	struct wcall_marshal *wm;
+
+	wm = inst ? wcall_get_marshal(inst) : NULL;
+
+	if (lookups)
+		*lookups = wm ? wm->stats.lookups : 0;
+	if (lookups_cached)
+		*lookups_cached = wm ? wm->stats.lookups_cached : 0;
+}
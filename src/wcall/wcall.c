@@ -43,6 +43,7 @@
 #endif
 
 #define AUDIO_CBR_STATE_UNSET (-1)
+#define WCALL_HASH_SIZE 64
 
 #define APITAG "WAPI "
 
@@ -118,6 +119,7 @@ struct calling_instance {
 
 	struct list ecalls;
 	struct list wcalls;
+	struct hash *wcallh;   /* wcall by convid */
 	struct list ctxl;
 
 	pthread_t tid;
@@ -157,6 +159,13 @@ struct calling_instance {
 		wcall_mute_h *h;
 		void *arg;
 	} mute;
+
+	struct {
+		bool enabled;
+		uint32_t gen; /* bumped when delta mode is (re)enabled */
+	} delta;
+
+	int cipher_suite;
 	
 	void *arg;
 
@@ -177,9 +186,11 @@ struct calling_instance {
 	struct sa *media_laddr;
 
 	uint32_t wuser;
+	uint32_t wcall_gen; /* bumped when wcalls changes */
 
 	bool processing_notifications;
 	struct list pending_eventl;
+	struct hash *pendingh; /* incoming_event by convid */
         struct list durationl;
 	struct list config_updatel;
 };
@@ -204,8 +215,16 @@ struct wcall {
 
 	int state; /* wcall state */
 	bool disable_audio;
+
+	/* Last state reported in delta mode */
+	struct {
+		uint32_t gen;
+		struct wcall_members *members;
+		struct list levell;
+	} delta;
 	
 	struct le le;
+	struct le hle; /* member of inst->wcallh */
 };
 
 
@@ -228,6 +247,7 @@ struct incoming_event {
 	void *arg;
 
 	struct le le;
+	struct le hle; /* member of inst->pendingh */
 };
 
 struct config_update_entry {
@@ -249,7 +269,9 @@ static bool wcall_has_calls(void);
 
 static void call_group_change_json(struct calling_instance *inst,
 				   struct wcall *wcall);
-static struct incoming_event *find_pending_event(struct list *eventl, const char *convid);
+static struct incoming_event *find_pending_event(
+				struct calling_instance *inst,
+				const char *convid);
 
 
 
@@ -447,28 +469,72 @@ static void set_state(struct wcall *wcall, int st)
 }
 
 
+static bool wcall_convid_handler(struct le *le, void *arg)
+{
+	struct wcall *wcall = le->data;
+
+	return streq(wcall->convid, (const char *)arg);
+}
+
+
+/* Caller must hold inst->lock */
+static struct wcall *wcall_find(struct calling_instance *inst,
+				const char *convid)
+{
+	struct le *le;
+
+	le = hash_lookup(inst->wcallh, hash_joaat_str(convid),
+			 wcall_convid_handler, (void *)convid);
+
+	return le ? le->data : NULL;
+}
+
+
 struct wcall *wcall_lookup(struct calling_instance *inst, const char *convid)
 {
 	struct wcall *wcall;
-	bool found = false;
-	struct le *le;
 
 	if (!inst || !convid)
 		return NULL;
 	
-	lock_write_get(inst->lock);
-	for (le = inst->wcalls.head;
-	     le != NULL && !found;
-	     le = le->next) { 
-		wcall = le->data;
-
-		if (streq(convid, wcall->convid)) {
-			found = true;
-		}
-	}
+	lock_read_get(inst->lock);
+	wcall = wcall_find(inst, convid);
 	lock_rel(inst->lock);
 	
-	return found ? wcall : NULL;
+	return wcall;
+}
+
+
+/* Like wcall_lookup(), but reuses the result cached in *wcallp as long
+ * as no call has been added or removed since *genp was taken. A zeroed
+ * cache is valid for an instance that never had a call.
+ */
+struct wcall *wcall_lookup_cached(struct calling_instance *inst,
+				  const char *convid,
+				  struct wcall **wcallp, uint32_t *genp)
+{
+	struct wcall *wcall = NULL;
+	bool hit;
+
+	if (!inst || !convid || !wcallp || !genp)
+		return NULL;
+
+	lock_read_get(inst->lock);
+	hit = *genp == inst->wcall_gen;
+	if (hit)
+		wcall = *wcallp;
+	lock_rel(inst->lock);
+
+	if (hit)
+		return wcall;
+
+	lock_write_get(inst->lock);
+	wcall = wcall_find(inst, convid);
+	*wcallp = wcall;
+	*genp = inst->wcall_gen;
+	lock_rel(inst->lock);
+
+	return wcall;
 }
 
 static void cuent_destructor(void *arg)
@@ -492,6 +558,7 @@ static void ie_destructor(void *arg)
 	mem_deref(ie->clientid);
 
 	list_unlink(&ie->le);
+	hash_unlink(&ie->hle);
 }
 
 void wcall_i_invoke_incoming_handler(const char *convid,
@@ -610,10 +677,10 @@ static void icall_start_handler(struct icall *icall,
 			return;
 		}
 
-		prev_ie = find_pending_event(&inst->pending_eventl,
-					     userid_sender);
+		prev_ie = find_pending_event(inst, userid_sender);
 		if (prev_ie) {
 			list_unlink(&prev_ie->le);
+			hash_unlink(&prev_ie->hle);
 		}
 
 		str_dup(&ie->convid, wcall->convid);
@@ -630,6 +697,8 @@ static void icall_start_handler(struct icall *icall,
 		ie->arg = inst;
 
 		list_append(&inst->pending_eventl, &ie->le, ie);
+		hash_append(inst->pendingh, hash_joaat_str(ie->convid),
+			    &ie->hle, ie);
 
 		if (prev_ie) {
 			mem_deref(prev_ie);
@@ -857,6 +926,201 @@ static int members_json(struct wcall *wcall, char **mjson, char **anon_str)
 	return err;
 }
 
+/* Drop the last reported state if delta mode was re-enabled since */
+static void delta_sync(struct wcall *wcall)
+{
+	struct calling_instance *inst = wcall->inst;
+
+	if (wcall->delta.gen == inst->delta.gen)
+		return;
+
+	wcall->delta.members = mem_deref(wcall->delta.members);
+	list_flush(&wcall->delta.levell);
+	wcall->delta.gen = inst->delta.gen;
+}
+
+
+static int member_json_print(struct mbuf *mb,
+			     const struct wcall_member *memb,
+			     const char *change)
+{
+	return mbuf_printf(mb, "{\"userid\":\"%H\",\"clientid\":\"%H\""
+			   ",\"aestab\":%d,\"vrecv\":%d,\"muted\":%d"
+			   ",\"change\":\"%s\"}",
+			   utf8_encode, memb->userid,
+			   utf8_encode, memb->clientid,
+			   memb->audio_state, memb->video_recv, memb->muted,
+			   change);
+}
+
+
+static bool member_eq(const struct wcall_member *a,
+		      const struct wcall_member *b)
+{
+	return streq(a->userid, b->userid) && streq(a->clientid, b->clientid);
+}
+
+
+/*
+ * Write the members that joined, left or changed in members compared
+ * to last, which may be NULL. If nothing changed, *mjson is set to NULL.
+ */
+int wcall_members_delta_json(const struct wcall_members *last,
+			     const struct wcall_members *members,
+			     const char *convid,
+			     char **mjson, char **anon_str)
+{
+	struct mbuf *mb = NULL;
+	uint8_t *seen = NULL;
+	size_t njoined = 0, nchanged = 0, nleft = 0;
+	size_t i, j = 0;
+	int err = 0;
+
+	if (!members || !convid || !mjson)
+		return EINVAL;
+
+	if (last && last->membc) {
+		seen = mem_zalloc(last->membc, NULL);
+		if (!seen)
+			return ENOMEM;
+	}
+
+	mb = mbuf_alloc(256);
+	if (!mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err |= mbuf_printf(mb, "{\"convid\":\"%H\",\"delta\":true"
+			   ",\"members\":[",
+			   utf8_encode, convid);
+
+	for (i = 0; i < members->membc; ++i) {
+		const struct wcall_member *memb = &members->membv[i];
+		const struct wcall_member *prev = NULL;
+		const char *change;
+
+		/* Members keep their order between updates,
+		 * so try the same slot before scanning
+		 */
+		if (last && i < last->membc && !seen[i]
+		    && member_eq(memb, &last->membv[i])) {
+			j = i;
+			prev = &last->membv[j];
+		}
+		else if (last) {
+			for (j = 0; j < last->membc; ++j) {
+				if (!seen[j]
+				    && member_eq(memb, &last->membv[j])) {
+					prev = &last->membv[j];
+					break;
+				}
+			}
+		}
+
+		if (prev) {
+			seen[j] = 1;
+			if (prev->audio_state == memb->audio_state
+			    && prev->video_recv == memb->video_recv
+			    && prev->muted == memb->muted)
+				continue;
+
+			change = "changed";
+			++nchanged;
+		}
+		else {
+			change = "joined";
+			++njoined;
+		}
+
+		if (njoined + nchanged > 1)
+			err |= mbuf_write_u8(mb, ',');
+		err |= member_json_print(mb, memb, change);
+	}
+
+	for (j = 0; last && j < last->membc; ++j) {
+		const struct wcall_member *prev = &last->membv[j];
+
+		if (seen[j])
+			continue;
+
+		if (njoined + nchanged + nleft++ > 0)
+			err |= mbuf_write_u8(mb, ',');
+		err |= mbuf_printf(mb, "{\"userid\":\"%H\""
+				   ",\"clientid\":\"%H\""
+				   ",\"change\":\"left\"}",
+				   utf8_encode, prev->userid,
+				   utf8_encode, prev->clientid);
+	}
+
+	err |= mbuf_printf(mb, "]}");
+	if (err)
+		goto out;
+
+	if (anon_str) {
+		err = re_sdprintf(anon_str, "%zu members: %zu joined "
+				  "%zu changed %zu left",
+				  members->membc, njoined, nchanged, nleft);
+		if (err)
+			goto out;
+	}
+
+	if (njoined || nchanged || nleft) {
+		mb->pos = 0;
+		err = mbuf_strdup(mb, mjson, mb->end);
+	}
+	else {
+		*mjson = NULL;
+	}
+
+ out:
+	mem_deref(seen);
+	mem_deref(mb);
+
+	return err;
+}
+
+
+/*
+ * Like members_json, but only writes the members that joined, left or
+ * changed since the last call. If nothing changed, *mjson is set to NULL.
+ */
+static int members_delta_json(struct wcall *wcall,
+			      char **mjson, char **anon_str)
+{
+	struct wcall_members *members = NULL;
+	int err = 0;
+
+	if (!mjson)
+		return EINVAL;
+
+	delta_sync(wcall);
+
+	err = ICALL_CALLE(wcall->icall, get_members, &members);
+	if (err)
+		return EBADF;
+
+	if (!members) {
+		warning("wcall(%p): members_delta_json: members is NULL\n",
+			wcall);
+		return ENOSYS;
+	}
+
+	err = wcall_members_delta_json(wcall->delta.members, members,
+				       wcall->convid, mjson, anon_str);
+	if (err)
+		goto out;
+
+	mem_deref(wcall->delta.members);
+	wcall->delta.members = mem_ref(members);
+
+ out:
+	mem_deref(members);
+
+	return err;
+}
+
+
 static void call_group_change_json(struct calling_instance *inst,
 				   struct wcall *wcall)
 {
@@ -864,11 +1128,18 @@ static void call_group_change_json(struct calling_instance *inst,
 	char *anon_json = NULL;
 	int err;
 
-	err = members_json(wcall, &mjson, &anon_json);
+	if (inst->delta.enabled)
+		err = members_delta_json(wcall, &mjson, &anon_json);
+	else
+		err = members_json(wcall, &mjson, &anon_json);
 	if (err) {
 		warning("wcall(%p): members_json failed: %m\n",
 			wcall, err);
 	}
+	else if (!mjson) {
+		/* nothing changed since the last delta */
+		mem_deref(anon_json);
+	}
 	else if (inst->group.json.chgh) {
 		uint64_t now;
 
@@ -1217,7 +1488,7 @@ static void icall_close_handler(struct icall *icall, int err,
 	}
 	set_state(wcall, WCALL_STATE_NONE);
 	if (inst->processing_notifications) {
-		if (find_pending_event(&inst->pending_eventl, wcall->convid))
+		if (find_pending_event(inst, wcall->convid))
 			ignore_close = true;
 	}
 	if (!ignore_close && inst->closeh) {
@@ -1309,8 +1580,7 @@ static void icall_leave_handler(struct icall* icall, int reason, uint32_t msg_ti
 	if (inst->processing_notifications) {
 		struct incoming_event *ie;
 
-		ie = find_pending_event(&inst->pending_eventl,
-					wcall->convid);
+		ie = find_pending_event(inst, wcall->convid);
 		if (ie) {
 			info("wcall(%p): icall_leave_handler: ignoring close while prcessing notifications\n",
 			     wcall);
@@ -1624,6 +1894,8 @@ static void destructor(void *arg)
 	
 	lock_write_get(inst->lock);
 	list_unlink(&wcall->le);
+	hash_unlink(&wcall->hle);
+	++inst->wcall_gen;
 	has_calls = wcall_has_calls();
 	lock_rel(inst->lock);
 
@@ -1639,6 +1911,8 @@ static void destructor(void *arg)
 
 	mem_deref(wcall->icall);
 	mem_deref(wcall->convid);
+	mem_deref(wcall->delta.members);
+	list_flush(&wcall->delta.levell);
 
 	info("wcall(%p): dtor -- done\n", wcall);
 }
@@ -1870,11 +2144,25 @@ static void icall_aulevel_handler(struct icall *icall, struct list *levell, void
 	if (!inst->active_speakerh)
 		return;
 	
-	err = audio_level_json(levell,
-			       inst->userid, inst->clientid,
-			       &json_str, &info_str);
+	if (inst->delta.enabled) {
+		delta_sync(wcall);
+		err = audio_level_delta_json(&wcall->delta.levell, levell,
+					     inst->userid, inst->clientid,
+					     &json_str, &info_str);
+	}
+	else {
+		err = audio_level_json(levell,
+				       inst->userid, inst->clientid,
+				       &json_str, &info_str);
+	}
 	if (err) {
 		warning("icall_aulevel_handler(%p): could not create json\n", wcall);
+		mem_deref(info_str);
+		return;
+	}
+	if (!json_str) {
+		/* no level changed since the last delta */
+		mem_deref(info_str);
 		return;
 	}
 		
@@ -1917,6 +2205,23 @@ static void icall_req_new_epoch_handler(struct icall *icall, void *arg)
 }
 
 
+static enum frame_cipher_suite frame_suite(int suite)
+{
+	switch (suite) {
+
+	case WCALL_CIPHER_CHACHA20_POLY1305:
+		return FRAME_CIPHER_CHACHA20_POLY1305;
+
+	case WCALL_CIPHER_AUTO:
+		return frame_cipher_suite_preferred();
+
+	case WCALL_CIPHER_AES_256_GCM:
+	default:
+		return FRAME_CIPHER_AES_256_GCM;
+	}
+}
+
+
 int wcall_add(struct calling_instance *inst,
 	      struct wcall **wcallp,
 	      const char *convid,
@@ -2096,6 +2401,8 @@ int wcall_add(struct calling_instance *inst,
 				    wcall);
 
 		ccall_set_config(ccall, inst->cfg);
+		ccall_set_cipher_suite(ccall,
+				       frame_suite(inst->cipher_suite));
 
 		}
 		break;
@@ -2139,6 +2446,9 @@ int wcall_add(struct calling_instance *inst,
 	wcall->audio.cbr_state = AUDIO_CBR_STATE_UNSET;
 
 	list_append(&inst->wcalls, &wcall->le, wcall);
+	hash_append(inst->wcallh, hash_joaat_str(wcall->convid),
+		    &wcall->hle, wcall);
+	++inst->wcall_gen;
 
  out:
 	lock_rel(inst->lock);
@@ -2184,20 +2494,26 @@ void wcall_set_media_laddr(WUSER_HANDLE wuser, struct sa *laddr)
 	inst->media_laddr = maddr;
 }
 
-static struct incoming_event *find_pending_event(struct list *eventl,
-						 const char *convid)
+static bool ie_convid_handler(struct le *le, void *arg)
+{
+	struct incoming_event *ie = le->data;
+
+	return streq(ie->convid, (const char *)arg);
+}
+
+static struct incoming_event *find_pending_event(
+				struct calling_instance *inst,
+				const char *convid)
 {
-	bool found = false;
-	struct incoming_event *ie;
 	struct le *le;
 
-	for(le = eventl->head; !found && le; le = le->next) {
-		ie = le->data;
+	if (!convid)
+		return NULL;
 
-		found = streq(convid, ie->convid);
-	}
+	le = hash_lookup(inst->pendingh, hash_joaat_str(convid),
+			 ie_convid_handler, (void *)convid);
 
-	return found ? ie : NULL;
+	return le ? le->data : NULL;
 }
 
 static void handle_pending_events(struct list *eventl)
@@ -2761,6 +3077,7 @@ static void instance_destroy(struct calling_instance *inst)
 		}
 	}
 	list_flush(&inst->ctxl);
+	list_flush(&inst->pending_eventl);
 
 	lock_write_get(inst->lock);
 	list_unlink(&inst->le);
@@ -2787,6 +3104,8 @@ static void instance_destroy(struct calling_instance *inst)
 
 	inst->lock = mem_deref(inst->lock);
 	inst->netprobe = mem_deref(inst->netprobe);
+	inst->wcallh = mem_deref(inst->wcallh);
+	inst->pendingh = mem_deref(inst->pendingh);
 
 	{
 		struct inst_dtor_entry *ide;
@@ -2968,6 +3287,14 @@ WUSER_HANDLE wcall_create_ex(const char *userid,
 	if (err)
 		goto out;
 
+	err = hash_alloc(&inst->wcallh, WCALL_HASH_SIZE);
+	if (err)
+		goto out;
+
+	err = hash_alloc(&inst->pendingh, WCALL_HASH_SIZE);
+	if (err)
+		goto out;
+
 	uintptr_t vuser = inst->wuser;
 	err = msystem_get(&inst->msys, msys_name, NULL,
 			  msys_mute_handler, (void*)vuser);
@@ -3686,6 +4013,11 @@ void wcall_i_network_changed(void)
 {
 	struct le *le;
 
+#ifndef __EMSCRIPTEN__
+	/* Addresses resolved on the old network may not be valid */
+	dns_cache_flush();
+#endif
+
 	LIST_FOREACH(&calling.instances, le) {
 		struct calling_instance *inst = le->data;
 
@@ -3862,6 +4194,14 @@ int  wcall_stats(struct re_printf *pf, WUSER_HANDLE wuser)
 }
 
 
+AVS_EXPORT
+void wcall_set_latency_probe(int enable)
+{
+	info("wcall: set_latency_probe: %d\n", enable);
+	msystem_set_latency_probe(enable != 0);
+}
+
+
 AVS_EXPORT
 void wcall_set_trace(WUSER_HANDLE wuser, int trace)
 {
@@ -4281,6 +4621,40 @@ void wcall_set_video_handlers(wcall_render_frame_h *render_frame_h,
 }
 
 
+AVS_EXPORT
+void wcall_set_render_stream_handlers(wcall_render_stream_h *stream_h,
+				      wcall_render_stream_frame_h *frame_h,
+				      void *arg)
+{
+	info(APITAG "wcall: set_render_stream_handlers s=%p f=%p\n",
+	     stream_h, frame_h);
+	iflow_set_render_stream_handlers(stream_h, frame_h, arg);
+}
+
+
+AVS_EXPORT
+void *wcall_render_frame_retain(const struct avs_vidframe *frame)
+{
+#if ENABLE_PEERFLOW
+	return video_renderer_frame_retain(frame);
+#else
+	(void)frame;
+	return NULL;
+#endif
+}
+
+
+AVS_EXPORT
+void wcall_render_frame_release(void *ref)
+{
+#if ENABLE_PEERFLOW
+	video_renderer_frame_release(ref);
+#else
+	(void)ref;
+#endif
+}
+
+
 AVS_EXPORT
 int wcall_i_dce_send(struct wcall *wcall, struct mbuf *mb)
 {
@@ -4358,6 +4732,63 @@ void wcall_set_active_speaker_handler(WUSER_HANDLE wuser,
 }
 
 
+AVS_EXPORT
+void wcall_set_delta_notifications(WUSER_HANDLE wuser, int enabled)
+{
+	struct calling_instance *inst;
+
+	inst = wuser2inst(wuser);
+	if (!inst) {
+		warning("wcall: set_delta_notifications: "
+			"invalid wuser=0x%08X\n",
+			wuser);
+		return;
+	}
+
+	info(APITAG "wcall: set_delta_notifications enabled=%d inst=%p\n",
+	     enabled, inst);
+
+	/* The next notification of every call reports the full state */
+	if (enabled && !inst->delta.enabled)
+		++inst->delta.gen;
+
+	inst->delta.enabled = enabled != 0;
+}
+
+
+AVS_EXPORT
+int wcall_set_cipher_suite(WUSER_HANDLE wuser, int suite)
+{
+	struct calling_instance *inst;
+
+	inst = wuser2inst(wuser);
+	if (!inst) {
+		warning("wcall: set_cipher_suite: invalid wuser=0x%08X\n",
+			wuser);
+		return EINVAL;
+	}
+
+	switch (suite) {
+
+	case WCALL_CIPHER_AES_256_GCM:
+	case WCALL_CIPHER_CHACHA20_POLY1305:
+	case WCALL_CIPHER_AUTO:
+		break;
+
+	default:
+		warning("wcall: set_cipher_suite: invalid suite %d\n", suite);
+		return EINVAL;
+	}
+
+	info(APITAG "wcall: set_cipher_suite suite=%d inst=%p\n",
+	     suite, inst);
+
+	inst->cipher_suite = suite;
+
+	return 0;
+}
+
+
 static void wcall_set_clients_for_epoch(struct wcall *wcall,
 					const char *json,
 					uint32_t epoch)
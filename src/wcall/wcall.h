@@ -26,6 +26,9 @@ int wcall_marshal_alloc(struct wcall_marshal **wmp);
 struct wcall_marshal *wcall_get_marshal(struct calling_instance *inst);
 
 struct wcall *wcall_lookup(struct calling_instance *inst, const char *convid);
+struct wcall *wcall_lookup_cached(struct calling_instance *inst,
+				  const char *convid,
+				  struct wcall **wcallp, uint32_t *genp);
 int  wcall_add(struct calling_instance *inst,
 	       struct wcall **wcallp, const char *convid,
 	       int conv_type, bool meeting);
@@ -106,6 +109,8 @@ void wcall_i_process_notifications(struct calling_instance *inst,
 void wcall_i_set_duration(struct wcall *wcall, int duration);
 
 void wcall_marshal_destroy(struct calling_instance *inst);
+void wcall_marshal_lookup_stats(WUSER_HANDLE wuser,
+				uint64_t *lookups, uint64_t *lookups_cached);
 int wcall_duration_add(struct calling_instance *inst,
 		       const char *convid,
 		       int duration);
@@ -65,7 +65,8 @@ int zapi_iceservers_decode(struct json_object *jarr,
 			   struct zapi_ice_server **srvvp, size_t *srvc)
 {
 	struct zapi_ice_server *srvv;
-	int i, n;
+	struct json_object *jice;
+	int i = 0, n;
 	int err = 0;
 
 	if (!jarr || !srvvp || !srvc)
@@ -79,24 +80,16 @@ int zapi_iceservers_decode(struct json_object *jarr,
 	n = json_object_array_length(jarr);
 	srvv = mem_zalloc(n * sizeof(*srvv), NULL);
 
-	for (i = 0; i < n; ++i) {
-		struct json_object *jice;
+	JZON_ARRAY_FOREACH(jarr, jice) {
 		struct zapi_ice_server *srv = &srvv[i];
 		const char *url, *username, *credential;
 		struct json_object *urls_arr;
 
-		jice = json_object_array_get_idx(jarr, i);
-		if (!jice) {
-			warning("zapi: ice_servers[%d] is missing\n", i);
-			err = ENOENT;
-			goto out;
-		}
-
 		if (0 == jzon_array(&urls_arr, jice, "urls")) {
 
 			struct json_object *jurl;
 			/* NOTE: we use only first server */
-			jurl = json_object_array_get_idx(urls_arr, 0);
+			jurl = jzon_array_first(urls_arr);
 			url = json_object_get_string(jurl);
 		}
 		else {
@@ -118,6 +111,7 @@ int zapi_iceservers_decode(struct json_object *jarr,
 		str_ncpy(srv->url, url, sizeof(srv->url));
 		str_ncpy(srv->username, username, sizeof(srv->username));
 		str_ncpy(srv->credential, credential, sizeof(srv->credential));
+		++i;
 	}
 
  out:
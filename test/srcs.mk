@@ -10,8 +10,10 @@ TEST_SRCS	+= util.cpp
 TEST_SRCS	+= test_version.cpp
 
 # Testcases in alphabetical order
+TEST_SRCS	+= test_audio_level.cpp
 TEST_SRCS	+= test_cert.cpp
 TEST_SRCS	+= test_chunk.cpp
+TEST_SRCS	+= test_conf_member.cpp
 TEST_SRCS	+= test_confpos.cpp
 TEST_SRCS	+= test_cookie.cpp
 TEST_SRCS	+= test_dict.cpp
@@ -19,11 +21,13 @@ TEST_SRCS	+= test_dict.cpp
 TEST_SRCS	+= test_econn.cpp
 TEST_SRCS	+= test_econn_fmt.cpp
 TEST_SRCS	+= test_engine.cpp
+TEST_SRCS	+= test_frame_enc.cpp
 TEST_SRCS	+= test_frame_hdr.cpp
 TEST_SRCS	+= test_http.cpp
 TEST_SRCS	+= test_jzon.cpp
 TEST_SRCS	+= test_keystore.cpp
 TEST_SRCS	+= test_libre.cpp
+TEST_SRCS	+= test_log.cpp
 TEST_SRCS	+= test_login.cpp
 TEST_SRCS	+= test_msystem.cpp
 TEST_SRCS	+= test_network.cpp
@@ -32,9 +36,12 @@ TEST_SRCS	+= test_resampler.cpp
 TEST_SRCS	+= test_rest.cpp
 #TEST_SRCS	+= test_sdp.cpp
 TEST_SRCS	+= test_string.cpp
+TEST_SRCS	+= test_turn_tcp.cpp
 TEST_SRCS	+= test_uuid.cpp
 TEST_SRCS	+= test_userlist.cpp
 #TEST_SRCS	+= test_wcall.cpp
+TEST_SRCS	+= test_wcall_event.cpp
+TEST_SRCS	+= test_wcall_marshal.cpp
 TEST_SRCS	+= test_zapi.cpp
 TEST_SRCS	+= test_ztime.cpp
 TEST_SRCS	+= test_stats.cpp
@@ -48,6 +55,7 @@ TEST_SLOW_SRCS  += test_network_quality_handler.cpp
 ifeq ($(AVS_OS),android)
 TEST_SRCS	+= test_android.cpp
 else
+TEST_SRCS	+= test_dns.cpp
 TEST_SRCS	+= test_mediamgr.cpp
 endif
 
@@ -57,6 +65,10 @@ endif
 ifneq ($(HAVE_CRYPTOBOX),)
 TEST_SRCS	+= test_cryptobox.cpp
 endif
+ifeq ($(HAVE_WEBRTC),1)
+TEST_SRCS	+= test_capture_source.cpp
+TEST_SRCS	+= test_peerflow.cpp
+endif
 
 
 # Fakes/mocks in alphabetical order
@@ -0,0 +1,305 @@
+/*
+* Wire
+* Copyright (C) 2020 Wire Swiss GmbH
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <sys/time.h>
+#include <re.h>
+#include <avs.h>
+#include <avs_wcall.h>
+extern "C" {
+#include "avs_audio_level.h"
+};
+#include <gtest/gtest.h>
+
+
+static void make_levels(struct list *levell, int n, uint8_t level)
+{
+	for (int i = 0; i < n; ++i) {
+		struct audio_level *a;
+		char userid[64], clientid[32];
+
+		re_snprintf(userid, sizeof(userid), "user-%d", i);
+		re_snprintf(clientid, sizeof(clientid), "client-%d", i);
+
+		ASSERT_EQ(0, audio_level_alloc(&a, levell, false,
+					       userid, clientid,
+					       level, level));
+	}
+}
+
+
+static struct audio_level *level_at(struct list *levell, int idx)
+{
+	struct le *le = list_head(levell);
+
+	while (le && idx--)
+		le = le->next;
+
+	return le ? (struct audio_level *)le->data : NULL;
+}
+
+
+static struct json_object *arr(struct json_object *jobj, const char *key)
+{
+	struct json_object *jarr = NULL;
+
+	jzon_array(&jarr, jobj, key);
+
+	return jarr;
+}
+
+
+TEST(audio_level, delta_first_is_full)
+{
+	struct list levell = LIST_INIT;
+	struct list lastl = LIST_INIT;
+	struct json_object *jobj;
+	struct json_object *jarr;
+	char *json = NULL;
+
+	make_levels(&levell, 3, 10);
+
+	ASSERT_EQ(0, audio_level_delta_json(&lastl, &levell, NULL, NULL,
+					    &json, NULL));
+	ASSERT_TRUE(json != NULL);
+	ASSERT_EQ(0, jzon_decode(&jobj, json, strlen(json)));
+
+	ASSERT_TRUE(jzon_bool_opt(jobj, "delta", false));
+	jarr = arr(jobj, "audio_levels");
+	ASSERT_TRUE(jarr != NULL);
+	ASSERT_EQ(3, json_object_array_length(jarr));
+	jarr = arr(jobj, "removed");
+	ASSERT_TRUE(jarr != NULL);
+	ASSERT_EQ(0, json_object_array_length(jarr));
+	ASSERT_EQ((uint32_t)3, list_count(&lastl));
+
+	mem_deref(jobj);
+	mem_deref(json);
+	list_flush(&levell);
+	list_flush(&lastl);
+}
+
+
+TEST(audio_level, delta_reports_changes_only)
+{
+	struct list levell = LIST_INIT;
+	struct list lastl = LIST_INIT;
+	struct json_object *jobj, *jarr, *jitem;
+	char *json = NULL;
+	char *anon = NULL;
+
+	make_levels(&levell, 4, 10);
+
+	ASSERT_EQ(0, audio_level_delta_json(&lastl, &levell, NULL, NULL,
+					    &json, NULL));
+	json = (char *)mem_deref(json);
+
+	/* Nothing changed */
+	ASSERT_EQ(0, audio_level_delta_json(&lastl, &levell, NULL, NULL,
+					    &json, &anon));
+	ASSERT_TRUE(json == NULL);
+	ASSERT_TRUE(anon != NULL);
+	anon = (char *)mem_deref(anon);
+
+	/* One level changes, one client leaves */
+	list_flush(&levell);
+	make_levels(&levell, 3, 10);
+	audio_level_set(level_at(&levell, 1), 20, 15);
+
+	ASSERT_EQ(0, audio_level_delta_json(&lastl, &levell, NULL, NULL,
+					    &json, NULL));
+	ASSERT_TRUE(json != NULL);
+	ASSERT_EQ(0, jzon_decode(&jobj, json, strlen(json)));
+
+	jarr = arr(jobj, "audio_levels");
+	ASSERT_EQ(1, json_object_array_length(jarr));
+	jitem = json_object_array_get_idx(jarr, 0);
+	ASSERT_STREQ("user-1", jzon_str(jitem, "userid"));
+	ASSERT_STREQ("client-1", jzon_str(jitem, "clientid"));
+
+	jarr = arr(jobj, "removed");
+	ASSERT_EQ(1, json_object_array_length(jarr));
+	jitem = json_object_array_get_idx(jarr, 0);
+	ASSERT_STREQ("user-3", jzon_str(jitem, "userid"));
+	ASSERT_EQ((uint32_t)3, list_count(&lastl));
+
+	mem_deref(jobj);
+	mem_deref(json);
+	list_flush(&levell);
+	list_flush(&lastl);
+}
+
+
+TEST(audio_level, delta_self_ids)
+{
+	struct list levell = LIST_INIT;
+	struct list lastl = LIST_INIT;
+	struct audio_level *a;
+	struct json_object *jobj, *jitem;
+	char *json = NULL;
+
+	ASSERT_EQ(0, audio_level_alloc(&a, &levell, true, "self", "self",
+				       5, 5));
+
+	ASSERT_EQ(0, audio_level_delta_json(&lastl, &levell, "me", "dev",
+					    &json, NULL));
+	ASSERT_EQ(0, jzon_decode(&jobj, json, strlen(json)));
+	jitem = json_object_array_get_idx(arr(jobj, "audio_levels"), 0);
+	ASSERT_STREQ("me", jzon_str(jitem, "userid"));
+	ASSERT_STREQ("dev", jzon_str(jitem, "clientid"));
+
+	mem_deref(jobj);
+	mem_deref(json);
+	list_flush(&levell);
+	list_flush(&lastl);
+}
+
+
+static void set_member(struct wcall_member *memb, const char *userid,
+		       int audio_state, int muted)
+{
+	memset(memb, 0, sizeof(*memb));
+	memb->userid = (char *)userid;
+	memb->clientid = (char *)"client";
+	memb->audio_state = audio_state;
+	memb->muted = muted;
+}
+
+
+TEST(audio_level, members_delta)
+{
+	struct wcall_member lastv[3], membv[3];
+	struct wcall_members last = {lastv, 3};
+	struct wcall_members members = {membv, 3};
+	struct json_object *jobj, *jarr, *jitem;
+	char *json = NULL;
+	char *anon = NULL;
+	int muted = 0;
+
+	set_member(&lastv[0], "user-0", 1, 0);
+	set_member(&lastv[1], "user-1", 1, 0);
+	set_member(&lastv[2], "user-2", 1, 0);
+
+	/* Without a previous state everyone joined */
+	ASSERT_EQ(0, wcall_members_delta_json(NULL, &last, "conv",
+					      &json, NULL));
+	ASSERT_TRUE(json != NULL);
+	ASSERT_EQ(0, jzon_decode(&jobj, json, strlen(json)));
+	ASSERT_TRUE(jzon_bool_opt(jobj, "delta", false));
+	ASSERT_STREQ("conv", jzon_str(jobj, "convid"));
+	jarr = arr(jobj, "members");
+	ASSERT_EQ(3, json_object_array_length(jarr));
+	jitem = json_object_array_get_idx(jarr, 2);
+	ASSERT_STREQ("joined", jzon_str(jitem, "change"));
+	jobj = (struct json_object *)mem_deref(jobj);
+	json = (char *)mem_deref(json);
+
+	/* Nothing changed */
+	ASSERT_EQ(0, wcall_members_delta_json(&last, &last, "conv",
+					      &json, &anon));
+	ASSERT_TRUE(json == NULL);
+	ASSERT_STREQ("3 members: 0 joined 0 changed 0 left", anon);
+	anon = (char *)mem_deref(anon);
+
+	/* user-2 mutes and moves up, user-1 leaves, user-3 joins */
+	set_member(&membv[0], "user-0", 1, 0);
+	set_member(&membv[1], "user-2", 1, 1);
+	set_member(&membv[2], "user-3", 0, 0);
+
+	ASSERT_EQ(0, wcall_members_delta_json(&last, &members, "conv",
+					      &json, &anon));
+	ASSERT_TRUE(json != NULL);
+	ASSERT_STREQ("3 members: 1 joined 1 changed 1 left", anon);
+	ASSERT_EQ(0, jzon_decode(&jobj, json, strlen(json)));
+
+	jarr = arr(jobj, "members");
+	ASSERT_EQ(3, json_object_array_length(jarr));
+
+	jitem = json_object_array_get_idx(jarr, 0);
+	ASSERT_STREQ("user-2", jzon_str(jitem, "userid"));
+	ASSERT_STREQ("changed", jzon_str(jitem, "change"));
+	ASSERT_EQ(0, jzon_int(&muted, jitem, "muted"));
+	ASSERT_EQ(1, muted);
+
+	jitem = json_object_array_get_idx(jarr, 1);
+	ASSERT_STREQ("user-3", jzon_str(jitem, "userid"));
+	ASSERT_STREQ("joined", jzon_str(jitem, "change"));
+
+	jitem = json_object_array_get_idx(jarr, 2);
+	ASSERT_STREQ("user-1", jzon_str(jitem, "userid"));
+	ASSERT_STREQ("client", jzon_str(jitem, "clientid"));
+	ASSERT_STREQ("left", jzon_str(jitem, "change"));
+
+	mem_deref(jobj);
+	mem_deref(json);
+	mem_deref(anon);
+}
+
+
+static float elapsed_us(const struct timeval *start)
+{
+	struct timeval now, res;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, start, &res);
+
+	return (float)res.tv_sec * 1000000.0f + res.tv_usec;
+}
+
+
+/* 100 clients, one of which is speaking.
+ * Benchmark, run with --gtest_also_run_disabled_tests
+ */
+TEST(audio_level, DISABLED_delta_speed)
+{
+	struct list levell = LIST_INIT;
+	struct list lastl = LIST_INIT;
+	struct timeval start;
+	const int rounds = 100;
+	float t_full, t_delta;
+	char *json, *anon;
+
+	make_levels(&levell, 100, 0);
+
+	gettimeofday(&start, NULL);
+	for (int r = 0; r < rounds; ++r) {
+		audio_level_set(level_at(&levell, 0), r % 30, r % 30);
+		ASSERT_EQ(0, audio_level_json(&levell, NULL, NULL,
+					      &json, &anon));
+		mem_deref(json);
+		mem_deref(anon);
+	}
+	t_full = elapsed_us(&start) / rounds;
+
+	gettimeofday(&start, NULL);
+	for (int r = 0; r < rounds; ++r) {
+		json = NULL;
+		anon = NULL;
+		audio_level_set(level_at(&levell, 0), r % 30, r % 30);
+		ASSERT_EQ(0, audio_level_delta_json(&lastl, &levell,
+						    NULL, NULL,
+						    &json, &anon));
+		mem_deref(json);
+		mem_deref(anon);
+	}
+	t_delta = elapsed_us(&start) / rounds;
+
+	printf("audio_level: 100 levels full: %.1f us delta: %.1f us\n",
+	       t_full, t_delta);
+
+	list_flush(&levell);
+	list_flush(&lastl);
+}
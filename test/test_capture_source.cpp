@@ -0,0 +1,545 @@
+/*
+* Wire
+* Copyright (C) 2020 Wire Swiss GmbH
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <re.h>
+#include <avs.h>
+#include <gtest/gtest.h>
+
+
+/* Synthetic capture clock, so a second of frames takes no time.
+ * It only moves forward, as admission control keeps its cadence
+ * between the tests.
+ */
+static uint64_t capture_ts_us;
+
+static uint64_t capture_clock(uint64_t step_us)
+{
+	if (!capture_ts_us)
+		capture_ts_us = tmr_jiffies() * 1000;
+
+	capture_ts_us += step_us;
+
+	return capture_ts_us;
+}
+
+
+/* Feed one second of 30fps synthetic frames */
+static void feed_frames(enum avs_vidframe_type type, int w, int h)
+{
+	struct avs_vidframe frame;
+	uint64_t frames0 = 0, allocs0 = 0;
+	uint64_t frames1 = 0, allocs1 = 0;
+	const int nframes = 30;
+	uint8_t *buf;
+
+	/* Y plane plus the chroma planes, 1.5 bytes per pixel */
+	buf = (uint8_t *)mem_alloc(w * h * 3 / 2, NULL);
+	ASSERT_TRUE(buf != NULL);
+	memset(buf, 0x80, w * h * 3 / 2);
+
+	memset(&frame, 0, sizeof(frame));
+	frame.type = type;
+	frame.w = w;
+	frame.h = h;
+	frame.y = buf;
+	frame.ys = w;
+	frame.u = buf + w * h;
+	if (type == AVS_VIDFRAME_I420) {
+		frame.us = w / 2;
+		frame.v = frame.u + (w / 2) * (h / 2);
+		frame.vs = w / 2;
+	}
+	else {
+		frame.us = w;
+	}
+
+	capture_source_stats(&frames0, &allocs0);
+
+	/* Time the frames like a camera would, so admission control
+	 * sees a real frame rate.
+	 */
+	for (int i = 0; i < nframes; ++i) {
+		frame.ts = i * 33;
+		capture_source_handle_frame_at(&frame, capture_clock(33333));
+	}
+
+	capture_source_stats(&frames1, &allocs1);
+
+	/* Frames above the target rate are dropped, but not all */
+	ASSERT_GT(frames1 - frames0, (uint64_t)0);
+
+	/* With the pool, only the first frame of a size allocates */
+	ASSERT_LE(allocs1 - allocs0, (uint64_t)2);
+
+	mem_deref(buf);
+}
+
+
+TEST(capture_source, frame_buffers_pooled)
+{
+	static const enum avs_vidframe_type typev[] = {
+		AVS_VIDFRAME_NV12,
+		AVS_VIDFRAME_NV21,
+		AVS_VIDFRAME_I420,
+	};
+	int err;
+
+	err = peerflow_init();
+	ASSERT_TRUE(err == 0 || err == EALREADY);
+
+	for (size_t i = 0; i < sizeof(typev) / sizeof(typev[0]); ++i) {
+		feed_frames(typev[i], 1280, 720);
+		feed_frames(typev[i], 1920, 1080);
+	}
+}
+
+
+/* Count the frames passed on from one second at 30fps */
+static uint64_t admitted_per_second(struct avs_vidframe *frame)
+{
+	uint64_t frames0 = 0, frames1 = 0;
+
+	capture_source_stats(&frames0, NULL);
+	for (int i = 0; i < 30; ++i)
+		capture_source_handle_frame_at(frame, capture_clock(33333));
+	capture_source_stats(&frames1, NULL);
+
+	return frames1 - frames0;
+}
+
+
+TEST(capture_source, load_decays_when_idle)
+{
+	struct avs_vidframe frame;
+	const int w = 640, h = 360;
+	uint64_t idle, loaded, decayed;
+	uint8_t *buf;
+	int err;
+
+	err = peerflow_init();
+	ASSERT_TRUE(err == 0 || err == EALREADY);
+
+	buf = (uint8_t *)mem_alloc(w * h * 3 / 2, NULL);
+	ASSERT_TRUE(buf != NULL);
+	memset(buf, 0x80, w * h * 3 / 2);
+
+	memset(&frame, 0, sizeof(frame));
+	frame.type = AVS_VIDFRAME_I420;
+	frame.w = w;
+	frame.h = h;
+	frame.y = buf;
+	frame.ys = w;
+	frame.u = buf + w * h;
+	frame.us = w / 2;
+	frame.v = frame.u + (w / 2) * (h / 2);
+	frame.vs = w / 2;
+
+	idle = admitted_per_second(&frame);
+
+	/* An encoder taking a second per frame raises the load to max */
+	capture_source_set_encode_time(1000000);
+	capture_source_set_encode_time(1000000);
+	loaded = admitted_per_second(&frame);
+	ASSERT_LT(loaded, idle);
+
+	/* Reports with nothing encoded bring it back down */
+	capture_source_set_encode_time(0);
+	capture_source_set_encode_time(0);
+	decayed = admitted_per_second(&frame);
+	ASSERT_GT(decayed, loaded);
+
+	mem_deref(buf);
+}
+
+
+/* Distinct values per plane and position, so a misplaced sample
+ * shows up in the output.
+ */
+static uint8_t pix_y(int x, int y)
+{
+	return (x * 7 + y * 13) & 0xff;
+}
+
+static uint8_t pix_u(int x, int y)
+{
+	return (x * 5 + y * 11 + 64) & 0xff;
+}
+
+static uint8_t pix_v(int x, int y)
+{
+	return (x * 3 + y * 17 + 128) & 0xff;
+}
+
+/* Source position of a destination sample, for a clockwise rotation */
+static void rotate_src(int rotation, int w, int h, int dx, int dy,
+		       int *sx, int *sy)
+{
+	switch (rotation) {
+	case 90:
+		*sx = dy;
+		*sy = h - 1 - dx;
+		break;
+
+	case 180:
+		*sx = w - 1 - dx;
+		*sy = h - 1 - dy;
+		break;
+
+	case 270:
+		*sx = w - 1 - dy;
+		*sy = dx;
+		break;
+
+	default:
+		*sx = dx;
+		*sy = dy;
+		break;
+	}
+}
+
+struct frame_check {
+	int w;
+	int h;
+	int rotation;
+
+	int frames;
+	int ow;
+	int oh;
+	int orotation;
+	int mismatches;
+};
+
+static int check_plane(const uint8_t *p, size_t stride, int ow, int oh,
+		       const struct frame_check *fc, int sw, int sh,
+		       uint8_t (*pix)(int x, int y))
+{
+	int mismatches = 0;
+
+	for (int dy = 0; dy < oh; ++dy) {
+		for (int dx = 0; dx < ow; ++dx) {
+			int sx, sy;
+
+			rotate_src(fc->rotation, sw, sh, dx, dy, &sx, &sy);
+			if (p[dy * stride + dx] != pix(sx, sy))
+				++mismatches;
+		}
+	}
+
+	return mismatches;
+}
+
+static void check_frame_handler(const struct avs_vidframe *frame, void *arg)
+{
+	struct frame_check *fc = (struct frame_check *)arg;
+
+	++fc->frames;
+	fc->ow = frame->w;
+	fc->oh = frame->h;
+	fc->orotation = frame->rotation;
+
+	if (frame->w != (fc->rotation % 180 ? fc->h : fc->w) ||
+	    frame->h != (fc->rotation % 180 ? fc->w : fc->h))
+		return;
+
+	fc->mismatches += check_plane(frame->y, frame->ys,
+				      frame->w, frame->h,
+				      fc, fc->w, fc->h, pix_y);
+	fc->mismatches += check_plane(frame->u, frame->us,
+				      frame->w / 2, frame->h / 2,
+				      fc, fc->w / 2, fc->h / 2, pix_u);
+	fc->mismatches += check_plane(frame->v, frame->vs,
+				      frame->w / 2, frame->h / 2,
+				      fc, fc->w / 2, fc->h / 2, pix_v);
+}
+
+/* Fill a frame of the given type with the test pattern */
+static uint8_t *pattern_frame(struct avs_vidframe *frame,
+			      enum avs_vidframe_type type, int w, int h)
+{
+	uint8_t *buf;
+
+	buf = (uint8_t *)mem_alloc(w * h * 3 / 2, NULL);
+	if (!buf)
+		return NULL;
+
+	memset(frame, 0, sizeof(*frame));
+	frame->type = type;
+	frame->w = w;
+	frame->h = h;
+	frame->y = buf;
+	frame->ys = w;
+	frame->u = buf + w * h;
+
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x)
+			frame->y[y * w + x] = pix_y(x, y);
+	}
+
+	if (type == AVS_VIDFRAME_I420) {
+		frame->us = w / 2;
+		frame->v = frame->u + (w / 2) * (h / 2);
+		frame->vs = w / 2;
+
+		for (int y = 0; y < h / 2; ++y) {
+			for (int x = 0; x < w / 2; ++x) {
+				frame->u[y * frame->us + x] = pix_u(x, y);
+				frame->v[y * frame->vs + x] = pix_v(x, y);
+			}
+		}
+	}
+	else {
+		bool nv21 = type == AVS_VIDFRAME_NV21;
+
+		/* Interleaved chroma, VU order for NV21 */
+		frame->us = w;
+		for (int y = 0; y < h / 2; ++y) {
+			for (int x = 0; x < w / 2; ++x) {
+				uint8_t *uv = frame->u + y * frame->us + 2 * x;
+
+				uv[nv21 ? 1 : 0] = pix_u(x, y);
+				uv[nv21 ? 0 : 1] = pix_v(x, y);
+			}
+		}
+	}
+
+	return buf;
+}
+
+
+/* The fused convert and rotate must place every sample where a
+ * separate rotation would, for all capture formats.
+ */
+TEST(capture_source, convert_rotate_pixels)
+{
+	static const enum avs_vidframe_type typev[] = {
+		AVS_VIDFRAME_NV12,
+		AVS_VIDFRAME_NV21,
+		AVS_VIDFRAME_I420,
+	};
+	static const int rotationv[] = {0, 90, 180, 270};
+	/* A size on the scaling ladder, so the frame is not scaled */
+	const int w = 320, h = 180;
+	int err;
+
+	err = peerflow_init();
+	ASSERT_TRUE(err == 0 || err == EALREADY);
+
+	/* Start from no load, whatever earlier tests fed back */
+	capture_source_set_encode_time(0);
+	capture_source_set_encode_time(0);
+
+	for (size_t t = 0; t < sizeof(typev) / sizeof(typev[0]); ++t) {
+		for (size_t r = 0; r < sizeof(rotationv) / sizeof(int); ++r) {
+			struct avs_vidframe frame;
+			struct frame_check fc;
+			uint8_t *buf;
+
+			buf = pattern_frame(&frame, typev[t], w, h);
+			ASSERT_TRUE(buf != NULL);
+			frame.rotation = rotationv[r];
+
+			memset(&fc, 0, sizeof(fc));
+			fc.w = w;
+			fc.h = h;
+			fc.rotation = rotationv[r];
+
+			ASSERT_EQ(0, capture_source_set_frame_handler(
+					     check_frame_handler, &fc));
+
+			/* A second apart, so admission passes it */
+			capture_source_handle_frame_at(&frame,
+						       capture_clock(1000000));
+
+			ASSERT_EQ(0, capture_source_set_frame_handler(NULL,
+								      NULL));
+			mem_deref(buf);
+
+			ASSERT_EQ(1, fc.frames)
+				<< "type " << typev[t] << " rot " << fc.rotation;
+			ASSERT_EQ(fc.rotation % 180 ? h : w, fc.ow);
+			ASSERT_EQ(fc.rotation % 180 ? w : h, fc.oh);
+			ASSERT_EQ(0, fc.orotation);
+			ASSERT_EQ(0, fc.mismatches)
+				<< "type " << typev[t] << " rot " << fc.rotation;
+		}
+	}
+}
+
+
+#define FLAT_Y 0x50
+#define FLAT_U 0x40
+#define FLAT_V 0xc0
+
+struct flat_check {
+	int frames;
+	int ow;
+	int oh;
+	int mismatches;
+};
+
+static int flat_plane(const uint8_t *p, size_t stride, int w, int h,
+		      uint8_t val)
+{
+	int mismatches = 0;
+
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x)
+			mismatches += p[y * stride + x] != val;
+	}
+
+	return mismatches;
+}
+
+static void flat_frame_handler(const struct avs_vidframe *frame, void *arg)
+{
+	struct flat_check *fc = (struct flat_check *)arg;
+
+	++fc->frames;
+	fc->ow = frame->w;
+	fc->oh = frame->h;
+
+	fc->mismatches += flat_plane(frame->y, frame->ys,
+				     frame->w, frame->h, FLAT_Y);
+	fc->mismatches += flat_plane(frame->u, frame->us,
+				     frame->w / 2, frame->h / 2, FLAT_U);
+	fc->mismatches += flat_plane(frame->v, frame->vs,
+				     frame->w / 2, frame->h / 2, FLAT_V);
+}
+
+
+/* NV12 and NV21 frames off the scaling ladder are scaled before they
+ * are converted, and come out at the target size with the chroma in
+ * place.
+ */
+TEST(capture_source, scale_nv_before_convert)
+{
+	static const enum avs_vidframe_type typev[] = {
+		AVS_VIDFRAME_NV12,
+		AVS_VIDFRAME_NV21,
+	};
+	static const int rotationv[] = {0, 90};
+	const int w = 960, h = 540;
+	int err;
+
+	err = peerflow_init();
+	ASSERT_TRUE(err == 0 || err == EALREADY);
+
+	capture_source_set_encode_time(0);
+	capture_source_set_encode_time(0);
+
+	for (size_t t = 0; t < sizeof(typev) / sizeof(typev[0]); ++t) {
+		for (size_t r = 0; r < sizeof(rotationv) / sizeof(int); ++r) {
+			bool nv21 = typev[t] == AVS_VIDFRAME_NV21;
+			struct avs_vidframe frame;
+			struct flat_check fc;
+			uint8_t *buf;
+
+			buf = (uint8_t *)mem_alloc(w * h * 3 / 2, NULL);
+			ASSERT_TRUE(buf != NULL);
+			memset(buf, FLAT_Y, w * h);
+			for (int i = 0; i < w * h / 2; i += 2) {
+				buf[w * h + i] = nv21 ? FLAT_V : FLAT_U;
+				buf[w * h + i + 1] = nv21 ? FLAT_U : FLAT_V;
+			}
+
+			memset(&frame, 0, sizeof(frame));
+			frame.type = typev[t];
+			frame.w = w;
+			frame.h = h;
+			frame.y = buf;
+			frame.ys = w;
+			frame.u = buf + w * h;
+			frame.us = w;
+			frame.rotation = rotationv[r];
+
+			memset(&fc, 0, sizeof(fc));
+			ASSERT_EQ(0, capture_source_set_frame_handler(
+					     flat_frame_handler, &fc));
+
+			capture_source_handle_frame_at(&frame,
+						       capture_clock(1000000));
+
+			ASSERT_EQ(0, capture_source_set_frame_handler(NULL,
+								      NULL));
+			mem_deref(buf);
+
+			ASSERT_EQ(1, fc.frames);
+			ASSERT_EQ(640, fc.ow);
+			ASSERT_EQ(360, fc.oh);
+			ASSERT_EQ(0, fc.mismatches)
+				<< "type " << typev[t] << " rot " << rotationv[r];
+		}
+	}
+}
+
+
+/* Pass the encode time of a stats report on to admission control,
+ * as peerflow does on its stats timer.
+ */
+static void report_encode_time(struct avs_stats *stats,
+			       int frames, double total)
+{
+	struct stats_report report;
+	char json[256];
+
+	snprintf(json, sizeof(json),
+		 "[{\"id\":\"OTvideo1V1\",\"type\":\"outbound-rtp\","
+		 "\"kind\":\"video\",\"packetsSent\":10,"
+		 "\"framesEncoded\":%d,\"totalEncodeTime\":%f}]",
+		 frames, total);
+
+	ASSERT_EQ(0, stats_update(stats, json));
+	ASSERT_EQ(0, stats_get_report(stats, &report));
+	capture_source_set_encode_time(report.encode_time_us);
+}
+
+
+TEST(capture_source, load_follows_stats_report)
+{
+	struct avs_stats *stats = NULL;
+	struct avs_vidframe frame;
+	uint64_t idle, loaded, decayed;
+	uint8_t *buf;
+	int err;
+
+	err = peerflow_init();
+	ASSERT_TRUE(err == 0 || err == EALREADY);
+
+	ASSERT_EQ(0, stats_alloc(&stats, NULL));
+
+	buf = pattern_frame(&frame, AVS_VIDFRAME_I420, 640, 360);
+	ASSERT_TRUE(buf != NULL);
+
+	capture_source_set_encode_time(0);
+	capture_source_set_encode_time(0);
+	idle = admitted_per_second(&frame);
+
+	/* 30 frames a second, each taking a second to encode */
+	report_encode_time(stats, 30, 30.0);
+	report_encode_time(stats, 60, 60.0);
+	loaded = admitted_per_second(&frame);
+	ASSERT_LT(loaded, idle);
+
+	/* The encoder stopped, the counters stay where they were */
+	report_encode_time(stats, 60, 60.0);
+	report_encode_time(stats, 60, 60.0);
+	decayed = admitted_per_second(&frame);
+	ASSERT_GT(decayed, loaded);
+
+	mem_deref(buf);
+	mem_deref(stats);
+}
@@ -0,0 +1,219 @@
+/*
+* Wire
+* Copyright (C) 2020 Wire Swiss GmbH
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <sys/time.h>
+#include <pthread.h>
+#include <re.h>
+#include <avs.h>
+#include <gtest/gtest.h>
+
+#define NUM_THREADS 4
+#define NUM_INCS    100000
+
+
+class ConfMemberTest : public ::testing::Test {
+
+public:
+
+	virtual void SetUp() override
+	{
+		list_init(&membl);
+		ASSERT_EQ(0, conf_member_index_alloc(&idx));
+	}
+
+	virtual void TearDown() override
+	{
+		list_flush(&membl);
+		mem_deref(idx);
+	}
+
+	struct conf_member *add_member(int i, uint32_t ssrca, uint32_t ssrcv)
+	{
+		struct conf_member *cm = NULL;
+		char userid[32];
+
+		re_snprintf(userid, sizeof(userid), "user_%d", i);
+		EXPECT_EQ(0, conf_member_alloc(&cm, &membl, NULL,
+					       userid, "client", userid,
+					       ssrca, ssrcv, userid));
+		EXPECT_EQ(0, conf_member_index_add(idx, cm));
+
+		return cm;
+	}
+
+protected:
+	struct list membl;
+	struct conf_member_index *idx = NULL;
+};
+
+
+static float elapsed_us(const struct timeval *start)
+{
+	struct timeval now, res;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, start, &res);
+
+	return (float)res.tv_sec * 1000000.0f + res.tv_usec;
+}
+
+
+TEST_F(ConfMemberTest, index_find)
+{
+	struct conf_member *a, *b;
+
+	a = add_member(0, 1000, 2000);
+	b = add_member(1, 1001, 0);
+
+	ASSERT_EQ(a, conf_member_index_find(idx, 1000, false));
+	ASSERT_EQ(a, conf_member_index_find(idx, 2000, true));
+	ASSERT_EQ(b, conf_member_index_find(idx, 1001, false));
+
+	/* audio and video tables are separate */
+	ASSERT_EQ(NULL, conf_member_index_find(idx, 1000, true));
+	ASSERT_EQ(NULL, conf_member_index_find(idx, 2000, false));
+	ASSERT_EQ(NULL, conf_member_index_find(idx, 0, true));
+	ASSERT_EQ(NULL, conf_member_index_find(idx, 4242, false));
+}
+
+
+TEST_F(ConfMemberTest, index_deactivate)
+{
+	struct conf_member *a, *b;
+
+	a = add_member(0, 1000, 2000);
+	b = add_member(1, 1001, 2001);
+
+	conf_member_deactivate(a);
+	ASSERT_FALSE(a->active);
+	ASSERT_EQ(NULL, conf_member_index_find(idx, 1000, false));
+	ASSERT_EQ(NULL, conf_member_index_find(idx, 2000, true));
+	ASSERT_EQ(b, conf_member_index_find(idx, 1001, false));
+
+	/* re-added user with the same SSRCs */
+	a = add_member(0, 1000, 2000);
+	ASSERT_EQ(a, conf_member_index_find(idx, 1000, false));
+	ASSERT_EQ(conf_member_find_by_ssrca(&membl, 1000),
+		  conf_member_index_find(idx, 1000, false));
+
+	/* freeing a member drops it from the index */
+	mem_deref(b);
+	ASSERT_EQ(NULL, conf_member_index_find(idx, 1001, false));
+	ASSERT_EQ(NULL, conf_member_index_find(idx, 2001, true));
+}
+
+
+TEST_F(ConfMemberTest, index_grow_and_remove)
+{
+	struct conf_member *cms[500];
+	int n = 500;
+
+	for (int i = 0; i < n; i++)
+		cms[i] = add_member(i, 0x10000 + i * 2, 0x10001 + i * 2);
+
+	/* drop every third member, the rest must still be found */
+	for (int i = 0; i < n; i += 3)
+		conf_member_deactivate(cms[i]);
+
+	for (int i = 0; i < n; i++) {
+		struct conf_member *exp = (i % 3) ? cms[i] : NULL;
+
+		ASSERT_EQ(exp, conf_member_index_find(idx, 0x10000 + i * 2,
+						      false));
+		ASSERT_EQ(exp, conf_member_index_find(idx, 0x10001 + i * 2,
+						      true));
+		ASSERT_EQ(exp, conf_member_find_by_ssrca(&membl,
+							 0x10000 + i * 2));
+	}
+}
+
+
+static void *inc_thread(void *arg)
+{
+	struct conf_member *cm = (struct conf_member *)arg;
+
+	for (int i = 0; i < NUM_INCS; i++) {
+		conf_member_inc_frames(cm, false, 1);
+		conf_member_inc_frames(cm, true, 2);
+	}
+
+	return NULL;
+}
+
+
+TEST_F(ConfMemberTest, concurrent_frame_count)
+{
+	pthread_t tids[NUM_THREADS];
+	struct conf_member *cm;
+	uint32_t aframes = 0, vframes = 0;
+
+	cm = add_member(0, 1000, 2000);
+
+	for (int i = 0; i < NUM_THREADS; i++)
+		pthread_create(&tids[i], NULL, inc_thread, cm);
+	for (int i = 0; i < NUM_THREADS; i++)
+		pthread_join(tids[i], NULL);
+
+	conf_member_get_frames(cm, &aframes, &vframes);
+	ASSERT_EQ(NUM_THREADS * NUM_INCS, aframes);
+	ASSERT_EQ(NUM_THREADS * NUM_INCS * 2, vframes);
+}
+
+
+/* Benchmark, run with --gtest_also_run_disabled_tests */
+TEST_F(ConfMemberTest, DISABLED_lookup_perf)
+{
+	const size_t sizes[] = {10, 100, 500};
+	int added = 0;
+	int rounds = 100;
+
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		size_t n = sizes[s];
+		struct timeval start;
+		float t_list, t_index;
+		size_t hits = 0;
+
+		for (; added < (int)n; added++)
+			add_member(added, 0x20000 + added, 0x30000 + added);
+
+		gettimeofday(&start, NULL);
+		for (int r = 0; r < rounds; r++) {
+			for (size_t i = 0; i < n; i++) {
+				if (conf_member_find_by_ssrca(&membl,
+							      0x20000 + i))
+					hits++;
+			}
+		}
+		t_list = elapsed_us(&start) / (rounds * n);
+
+		gettimeofday(&start, NULL);
+		for (int r = 0; r < rounds; r++) {
+			for (size_t i = 0; i < n; i++) {
+				if (conf_member_index_find(idx, 0x20000 + i,
+							   false))
+					hits++;
+			}
+		}
+		t_index = elapsed_us(&start) / (rounds * n);
+
+		ASSERT_EQ(2 * rounds * n, hits);
+
+		printf("conf_member: %3zu members: list %.3f us "
+		       "index %.3f us per lookup\n",
+		       n, t_list, t_index);
+	}
+}
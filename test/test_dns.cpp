@@ -0,0 +1,256 @@
+/*
+* Wire
+* Copyright (C) 2026 Wire Swiss GmbH
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <unistd.h>
+#include <atomic>
+#include <re.h>
+#include <avs.h>
+#include <gtest/gtest.h>
+#include "ztest.h"
+
+
+#define STUB_DELAY_MS  50
+#define STUB_NXHOST    "nx.example.com"
+
+
+/* Platform resolver taking a fixed time per lookup */
+static std::atomic<int> stub_calls;
+static std::atomic<int> stub_running;
+static std::atomic<int> stub_running_max;
+
+static int stub_resolver(const char *host, struct sa *srv)
+{
+	int running = ++stub_running;
+	int peak = stub_running_max;
+
+	while (running > peak &&
+	       !stub_running_max.compare_exchange_weak(peak, running))
+		;
+
+	++stub_calls;
+	usleep(STUB_DELAY_MS * 1000);
+	--stub_running;
+
+	if (streq(host, STUB_NXHOST))
+		return ENOENT;
+
+	return sa_set_str(srv, "10.0.0.1", 3478);
+}
+
+
+struct lookup_wait {
+	int expected;
+	int done;
+	int err;
+	struct sa srv;
+};
+
+static void lookup_handler(int err, const struct sa *srv, void *arg)
+{
+	struct lookup_wait *lw = (struct lookup_wait *)arg;
+
+	lw->err = err;
+	lw->srv = *srv;
+
+	if (++lw->done >= lw->expected)
+		re_cancel();
+}
+
+
+static void cancel_handler(void *arg)
+{
+	(void)arg;
+
+	re_cancel();
+}
+
+
+class Dns : public ::testing::Test {
+
+public:
+	virtual void SetUp() override
+	{
+		stub_calls = 0;
+		stub_running = 0;
+		stub_running_max = 0;
+
+		dns_platform_set_stub(stub_resolver);
+		ASSERT_EQ(0, dns_init((void *)NULL));
+	}
+
+	virtual void TearDown() override
+	{
+		dns_close();
+		dns_platform_set_stub(NULL);
+	}
+
+	int lookup(const char *host, struct lookup_wait *lw, int n = 1)
+	{
+		int err;
+
+		memset(lw, 0, sizeof(*lw));
+		lw->expected = n;
+
+		for (int i = 0; i < n; ++i) {
+			err = dns_lookup(host, lookup_handler, lw);
+			if (err)
+				return err;
+		}
+
+		err = re_main_wait(5000);
+		if (err)
+			return err;
+
+		return lw->done == n ? 0 : EPROTO;
+	}
+
+	/* Run the main loop for a while, as a call setup would */
+	void run_for(uint32_t ms)
+	{
+		struct tmr tmr;
+
+		tmr_init(&tmr);
+		tmr_start(&tmr, ms, cancel_handler, NULL);
+		re_main_wait(ms + 5000);
+		tmr_cancel(&tmr);
+	}
+};
+
+
+TEST_F(Dns, cache_hit)
+{
+	struct lookup_wait lw;
+	struct dns_stats stats;
+	struct sa addr;
+
+	sa_set_str(&addr, "10.0.0.1", 3478);
+
+	ASSERT_EQ(0, lookup("sft.example.com", &lw));
+	ASSERT_EQ(0, lw.err);
+	ASSERT_TRUE(sa_cmp(&addr, &lw.srv, SA_ALL));
+	ASSERT_EQ(1, stub_calls.load());
+
+	ASSERT_EQ(0, lookup("SFT.example.com", &lw));
+	ASSERT_EQ(0, lw.err);
+	ASSERT_TRUE(sa_cmp(&addr, &lw.srv, SA_ALL));
+	ASSERT_EQ(1, stub_calls.load());
+
+	ASSERT_EQ(0, dns_get_stats(&stats));
+	ASSERT_EQ(1u, stats.misses);
+	ASSERT_EQ(1u, stats.hits);
+	ASSERT_EQ(1u, stats.lookups);
+}
+
+
+TEST_F(Dns, negative_cache)
+{
+	struct lookup_wait lw;
+	struct dns_stats stats;
+
+	ASSERT_EQ(0, lookup(STUB_NXHOST, &lw));
+	ASSERT_EQ(ENOENT, lw.err);
+
+	ASSERT_EQ(0, lookup(STUB_NXHOST, &lw));
+	ASSERT_EQ(ENOENT, lw.err);
+	ASSERT_EQ(1, stub_calls.load());
+
+	ASSERT_EQ(0, dns_get_stats(&stats));
+	ASSERT_EQ(1u, stats.neg_hits);
+	ASSERT_EQ(0u, stats.hits);
+}
+
+
+TEST_F(Dns, coalesce_running_lookup)
+{
+	struct lookup_wait lw;
+	struct dns_stats stats;
+
+	ASSERT_EQ(0, lookup("turn.example.com", &lw, 3));
+	ASSERT_EQ(0, lw.err);
+	ASSERT_EQ(1, stub_calls.load());
+
+	ASSERT_EQ(0, dns_get_stats(&stats));
+	ASSERT_EQ(1u, stats.misses);
+	ASSERT_EQ(2u, stats.coalesced);
+}
+
+
+TEST_F(Dns, cache_flush)
+{
+	struct lookup_wait lw;
+
+	ASSERT_EQ(0, lookup("sft.example.com", &lw));
+	dns_cache_flush();
+	ASSERT_EQ(0, lookup("sft.example.com", &lw));
+
+	ASSERT_EQ(2, stub_calls.load());
+}
+
+
+TEST_F(Dns, bounded_workers)
+{
+	const int nhosts = 12;
+	struct lookup_wait lw;
+	char host[64];
+
+	memset(&lw, 0, sizeof(lw));
+	lw.expected = nhosts;
+
+	for (int i = 0; i < nhosts; ++i) {
+		re_snprintf(host, sizeof(host), "host%d.example.com", i);
+		ASSERT_EQ(0, dns_lookup(host, lookup_handler, &lw));
+	}
+
+	ASSERT_EQ(0, re_main_wait(10000));
+	ASSERT_EQ(nhosts, lw.done);
+	ASSERT_EQ(nhosts, stub_calls.load());
+	ASSERT_LE(stub_running_max.load(), 4);
+	ASSERT_GT(stub_running_max.load(), 1);
+}
+
+
+/* Compare the lookup latency with a cold cache, to the one after
+ * the host has been prefetched.
+ */
+TEST_F(Dns, prefetch_latency)
+{
+	struct lookup_wait lw;
+	struct dns_stats stats;
+	uint64_t t0;
+	uint64_t cold_ms;
+	uint64_t warm_ms;
+
+	t0 = tmr_jiffies();
+	ASSERT_EQ(0, lookup("cold.example.com", &lw));
+	cold_ms = tmr_jiffies() - t0;
+
+	ASSERT_EQ(0, dns_prefetch("warm.example.com"));
+	ASSERT_EQ(0, dns_prefetch("warm.example.com"));
+	run_for(2 * STUB_DELAY_MS);
+
+	t0 = tmr_jiffies();
+	ASSERT_EQ(0, lookup("warm.example.com", &lw));
+	warm_ms = tmr_jiffies() - t0;
+
+	ASSERT_EQ(2, stub_calls.load());
+	ASSERT_EQ(0, dns_get_stats(&stats));
+	ASSERT_EQ(1u, stats.prefetches);
+	ASSERT_EQ(1u, stats.hits);
+
+	ASSERT_GE(cold_ms, (uint64_t)STUB_DELAY_MS);
+	ASSERT_LT(warm_ms, cold_ms);
+}
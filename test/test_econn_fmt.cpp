@@ -25,6 +25,8 @@
 #include <re.h>
 #include <avs.h>
 #include <gtest/gtest.h>
+#include <random>
+#include <sys/time.h>
 
 #define TIME_MSG 12340
 #define TIME_NOW 12345
@@ -637,10 +639,12 @@ TEST(econn_fmt, econn_confkey)
 	ASSERT_TRUE(smsg != NULL);
 
 	init_keylist(&smsg->u.confkey.keyl);
+	smsg->u.confkey.ciphers = 3;
 
 	encode_decode(smsg, &dmsg);
 
 	check_keylist(&smsg->u.confkey.keyl, &dmsg->u.confkey.keyl);
+	ASSERT_EQ(smsg->u.confkey.ciphers, dmsg->u.confkey.ciphers);
 
 	mem_deref(smsg);
 	mem_deref(dmsg);
@@ -665,3 +669,733 @@ TEST(econn_fmt, econn_confstreams)
 	mem_deref(dmsg);
 }
 
+
+
+// ----------------------------------------- Binary format ------------------------------------------
+
+static void encode_decode_bin(struct econn_message *smsg,
+			      struct econn_message **pdmsg)
+{
+	struct mbuf *mb = NULL;
+
+	ASSERT_EQ(econn_message_encode_bin(&mb, smsg), 0);
+	ASSERT_TRUE(mb != NULL);
+	ASSERT_TRUE(econn_message_is_bin(mbuf_buf(mb), mbuf_get_left(mb)));
+
+	ASSERT_EQ(econn_message_decode_bin(pdmsg, TIME_NOW, TIME_MSG,
+					   mbuf_buf(mb), mbuf_get_left(mb)), 0);
+	ASSERT_TRUE(*pdmsg != NULL);
+
+	check_message(smsg, *pdmsg);
+
+	mem_deref(mb);
+}
+
+TEST(econn_fmt, bin_confpart)
+{
+	struct econn_message *smsg = NULL;
+	struct econn_message *dmsg = NULL;
+	const char *entropy = "ENTROPY";
+
+	smsg = init_message(ECONN_CONF_PART);
+	ASSERT_TRUE(smsg != NULL);
+
+	smsg->u.confpart.timestamp = 12345;
+	smsg->u.confpart.seqno = 24680;
+	smsg->u.confpart.should_start = true;
+	ASSERT_EQ(str_dup((char**)(&smsg->u.confpart.entropy), entropy), 0);
+	smsg->u.confpart.entropylen = strlen(entropy)+1;
+	init_stringlist(&smsg->u.confpart.sftl);
+	init_partlist(&smsg->u.confpart.partl);
+
+	encode_decode_bin(smsg, &dmsg);
+
+	ASSERT_EQ(smsg->u.confpart.timestamp, dmsg->u.confpart.timestamp);
+	ASSERT_EQ(smsg->u.confpart.seqno, dmsg->u.confpart.seqno);
+	ASSERT_EQ(smsg->u.confpart.should_start, dmsg->u.confpart.should_start);
+	ASSERT_EQ(smsg->u.confpart.entropylen, dmsg->u.confpart.entropylen);
+	ASSERT_EQ(memcmp(smsg->u.confpart.entropy,
+			 dmsg->u.confpart.entropy,
+			 smsg->u.confpart.entropylen), 0);
+	check_stringlist(&smsg->u.confpart.sftl, &dmsg->u.confpart.sftl);
+	check_partlist(&smsg->u.confpart.partl, &dmsg->u.confpart.partl);
+
+	mem_deref(smsg);
+	mem_deref(dmsg);
+}
+
+TEST(econn_fmt, bin_version_mismatch)
+{
+	struct econn_message *smsg = NULL;
+	struct econn_message *dmsg = NULL;
+	struct mbuf *mb = NULL;
+
+	smsg = init_message(ECONN_PING);
+	ASSERT_TRUE(smsg != NULL);
+
+	ASSERT_EQ(econn_message_encode_bin(&mb, smsg), 0);
+	mb->buf[1] = ECONN_BIN_VERSION + 1;
+
+	ASSERT_EQ(econn_message_decode_bin(&dmsg, TIME_NOW, TIME_MSG,
+					   mbuf_buf(mb), mbuf_get_left(mb)),
+		  EPROTO);
+	ASSERT_TRUE(dmsg == NULL);
+
+	/* JSON is never mistaken for the binary format */
+	ASSERT_FALSE(econn_message_is_bin((const uint8_t *)"{}", 2));
+
+	mem_deref(mb);
+	mem_deref(smsg);
+}
+
+
+static void check_dce_encoding(const char *bin_ver, bool expect_bin)
+{
+	struct econn_message *smsg = NULL;
+	struct econn_message *dmsg = NULL;
+	struct econn_props *props = NULL;
+	struct mbuf *mb = NULL;
+	int err;
+
+	smsg = init_message(ECONN_PING);
+	ASSERT_TRUE(smsg != NULL);
+
+	ASSERT_EQ(econn_props_alloc(&props, NULL), 0);
+	if (bin_ver) {
+		ASSERT_EQ(econn_props_add(props, ECONN_PROP_BIN, bin_ver), 0);
+	}
+
+	ASSERT_EQ(econn_message_encode_dce(&mb, smsg, props), 0);
+	ASSERT_TRUE(mb != NULL);
+	ASSERT_EQ(expect_bin,
+		  econn_message_is_bin(mbuf_buf(mb), mbuf_get_left(mb)));
+
+	if (expect_bin) {
+		err = econn_message_decode_bin(&dmsg, TIME_NOW, TIME_MSG,
+					       mbuf_buf(mb),
+					       mbuf_get_left(mb));
+	}
+	else {
+		ASSERT_EQ('{', mbuf_buf(mb)[0]);
+		err = econn_message_decode(&dmsg, TIME_NOW, TIME_MSG,
+					   (const char *)mbuf_buf(mb),
+					   mbuf_get_left(mb));
+	}
+	ASSERT_EQ(0, err);
+	ASSERT_EQ(ECONN_PING, dmsg->msg_type);
+
+	mem_deref(dmsg);
+	mem_deref(mb);
+	mem_deref(props);
+	mem_deref(smsg);
+}
+
+TEST(econn_fmt, dce_json_without_bin_prop)
+{
+	check_dce_encoding(NULL, false);
+}
+
+TEST(econn_fmt, dce_json_with_other_bin_version)
+{
+	check_dce_encoding("2", false);
+}
+
+TEST(econn_fmt, dce_bin_with_bin_prop)
+{
+	check_dce_encoding(ECONN_BIN_VERSION_STR, true);
+}
+
+
+static std::mt19937 fuzz_rng(0xec0);
+
+static uint32_t fuzz_u32(uint32_t max)
+{
+	return std::uniform_int_distribution<uint32_t>(0, max)(fuzz_rng);
+}
+
+static void fuzz_str(char *buf, size_t sz)
+{
+	size_t len = 1 + fuzz_u32(sz - 2);
+	size_t i;
+
+	/* printable ASCII, including quotes and backslashes */
+	for (i = 0; i < len; i++)
+		buf[i] = (char)(0x20 + fuzz_u32(0x5e));
+	buf[len] = '\0';
+}
+
+static char *fuzz_strdup(bool optional)
+{
+	char buf[64];
+	char *str = NULL;
+
+	if (optional && fuzz_u32(3) == 0)
+		return NULL;
+
+	fuzz_str(buf, 40);
+	str_dup(&str, buf);
+
+	return str;
+}
+
+static uint8_t *fuzz_data(uint32_t *lenp)
+{
+	uint32_t len = 8 + fuzz_u32(24);
+	uint8_t *data;
+	uint32_t i;
+
+	data = (uint8_t *)mem_alloc(len, NULL);
+	for (i = 0; i < len; i++)
+		data[i] = (uint8_t)fuzz_u32(255);
+
+	*lenp = len;
+
+	return data;
+}
+
+static struct econn_props *fuzz_props(bool optional)
+{
+	struct econn_props *props = NULL;
+	char val[64];
+
+	if (optional && fuzz_u32(3) == 0)
+		return NULL;
+
+	econn_props_alloc(&props, NULL);
+	fuzz_str(val, sizeof(val));
+	econn_props_add(props, "prop1", val);
+	fuzz_str(val, sizeof(val));
+	econn_props_add(props, "prop2", val);
+
+	return props;
+}
+
+static void fuzz_turns(struct zapi_ice_server **pturnv, size_t *pturnc,
+		       size_t min)
+{
+	size_t i, n = min + fuzz_u32(3);
+
+	*pturnv = NULL;
+	*pturnc = 0;
+	if (!n)
+		return;
+
+	*pturnv = (struct zapi_ice_server *)
+		mem_zalloc(n * sizeof(struct zapi_ice_server), NULL);
+	for (i = 0; i < n; i++) {
+		fuzz_str((*pturnv)[i].url, 64);
+		fuzz_str((*pturnv)[i].username, 64);
+		fuzz_str((*pturnv)[i].credential, 64);
+	}
+	*pturnc = n;
+}
+
+static void fuzz_stringlist(struct list *l)
+{
+	uint32_t i, n = fuzz_u32(3);
+	char buf[64];
+
+	for (i = 0; i < n; i++) {
+		fuzz_str(buf, sizeof(buf));
+		stringlist_append(l, buf);
+	}
+}
+
+static void fuzz_partlist(struct list *l, uint32_t n)
+{
+	const enum group_part_muted_state states[] = {
+		MUTED_STATE_UNKNOWN, MUTED_STATE_MUTED, MUTED_STATE_UNMUTED
+	};
+	char uid[64], cid[64];
+	uint32_t i;
+
+	for (i = 0; i < n; i++) {
+		struct econn_group_part *part;
+
+		fuzz_str(uid, sizeof(uid));
+		fuzz_str(cid, sizeof(cid));
+		part = econn_part_alloc(uid, cid);
+		part->authorized = fuzz_u32(1);
+		part->muted_state = states[fuzz_u32(2)];
+		part->ssrca = fuzz_u32(UINT32_MAX);
+		part->ssrcv = fuzz_u32(UINT32_MAX);
+		/* JSON carries the timestamp as int32 */
+		part->ts = fuzz_u32(INT32_MAX);
+
+		list_append(l, &part->le, part);
+	}
+}
+
+static void fuzz_keylist(struct list *l)
+{
+	uint32_t i, n = 1 + fuzz_u32(3);
+
+	for (i = 0; i < n; i++) {
+		struct econn_key_info *kinfo;
+		uint32_t len;
+		uint8_t *data = fuzz_data(&len);
+
+		kinfo = econn_key_info_alloc(len);
+		memcpy(kinfo->data, data, len);
+		kinfo->idx = fuzz_u32(1000);
+		list_append(l, &kinfo->le, kinfo);
+
+		mem_deref(data);
+	}
+}
+
+static void fuzz_streamlist(struct list *l)
+{
+	uint32_t i, n = fuzz_u32(4);
+	char uid[64];
+
+	for (i = 0; i < n; i++) {
+		struct econn_stream_info *sinfo;
+
+		fuzz_str(uid, sizeof(uid));
+		sinfo = econn_stream_info_alloc(uid, fuzz_u32(3));
+		sinfo->ssrcv.hi = fuzz_u32(1) ? fuzz_u32(INT32_MAX) : 0;
+		sinfo->ssrcv.lo = fuzz_u32(1) ? fuzz_u32(INT32_MAX) : 0;
+		if (fuzz_u32(1))
+			fuzz_str(sinfo->ssrcv.clientid, 64);
+		list_append(l, &sinfo->le, sinfo);
+	}
+}
+
+static struct econn_message *fuzz_message(enum econn_msg type)
+{
+	struct econn_message *msg;
+
+	msg = econn_message_alloc();
+	econn_message_init(msg, type, "");
+	fuzz_str(msg->sessid_sender, 64);
+	fuzz_str(msg->src_userid, 64);
+	fuzz_str(msg->src_clientid, 64);
+	fuzz_str(msg->dest_userid, 64);
+	fuzz_str(msg->dest_clientid, 64);
+	msg->resp = fuzz_u32(1);
+
+	switch (type) {
+
+	case ECONN_SETUP:
+		msg->u.setup.url = fuzz_strdup(true);
+		msg->u.setup.sft_tuple = fuzz_strdup(true);
+		/* fall through */
+	case ECONN_GROUP_SETUP:
+	case ECONN_UPDATE:
+		msg->u.setup.sdp_msg = fuzz_strdup(false);
+		msg->u.setup.props = fuzz_props(false);
+		break;
+
+	case ECONN_PROPSYNC:
+		msg->u.propsync.props = fuzz_props(false);
+		break;
+
+	case ECONN_GROUP_START:
+		msg->u.groupstart.props = fuzz_props(true);
+		break;
+
+	case ECONN_CONF_CONN:
+		fuzz_turns(&msg->u.confconn.turnv, &msg->u.confconn.turnc, 0);
+		msg->u.confconn.update = fuzz_u32(1);
+		msg->u.confconn.tool = fuzz_strdup(false);
+		msg->u.confconn.toolver = fuzz_strdup(false);
+		msg->u.confconn.env = (int)fuzz_u32(20) - 10;
+		msg->u.confconn.status =
+			(enum econn_confconn_status)fuzz_u32(5);
+		msg->u.confconn.selective_audio = fuzz_u32(1);
+		msg->u.confconn.selective_video = fuzz_u32(1);
+		msg->u.confconn.vstreams = fuzz_u32(32);
+		msg->u.confconn.sft_url = fuzz_strdup(true);
+		msg->u.confconn.sft_tuple = fuzz_strdup(true);
+		msg->u.confconn.sft_username = fuzz_strdup(true);
+		msg->u.confconn.sft_credential = fuzz_strdup(true);
+		break;
+
+	case ECONN_CONF_START:
+		msg->u.confstart.props = fuzz_props(true);
+		msg->u.confstart.sft_url = fuzz_strdup(false);
+		msg->u.confstart.sft_tuple = fuzz_strdup(true);
+		msg->u.confstart.secret =
+			fuzz_data(&msg->u.confstart.secretlen);
+		msg->u.confstart.timestamp = fuzz_u32(UINT32_MAX) * 1000ULL;
+		msg->u.confstart.seqno = fuzz_u32(UINT32_MAX);
+		fuzz_stringlist(&msg->u.confstart.sftl);
+		break;
+
+	case ECONN_CONF_CHECK:
+		msg->u.confcheck.sft_url = fuzz_strdup(false);
+		msg->u.confcheck.sft_tuple = fuzz_strdup(true);
+		msg->u.confcheck.secret =
+			fuzz_data(&msg->u.confcheck.secretlen);
+		msg->u.confcheck.timestamp = fuzz_u32(UINT32_MAX) * 1000ULL;
+		msg->u.confcheck.seqno = fuzz_u32(UINT32_MAX);
+		fuzz_stringlist(&msg->u.confcheck.sftl);
+		break;
+
+	case ECONN_CONF_PART:
+		msg->u.confpart.should_start = fuzz_u32(1);
+		msg->u.confpart.timestamp = fuzz_u32(UINT32_MAX) * 1000ULL;
+		msg->u.confpart.seqno = fuzz_u32(UINT32_MAX);
+		msg->u.confpart.entropy =
+			fuzz_data(&msg->u.confpart.entropylen);
+		fuzz_partlist(&msg->u.confpart.partl, fuzz_u32(5));
+		fuzz_stringlist(&msg->u.confpart.sftl);
+		break;
+
+	case ECONN_CONF_KEY:
+		fuzz_keylist(&msg->u.confkey.keyl);
+		msg->u.confkey.ciphers = fuzz_u32(3);
+		break;
+
+	case ECONN_CONF_STREAMS:
+		msg->u.confstreams.mode = fuzz_strdup(false);
+		fuzz_streamlist(&msg->u.confstreams.streaml);
+		break;
+
+	case ECONN_DEVPAIR_PUBLISH:
+		fuzz_turns(&msg->u.devpair_publish.turnv,
+			   &msg->u.devpair_publish.turnc, 1);
+		msg->u.devpair_publish.sdp = fuzz_strdup(false);
+		msg->u.devpair_publish.username = fuzz_strdup(false);
+		break;
+
+	case ECONN_DEVPAIR_ACCEPT:
+		msg->u.devpair_accept.sdp = fuzz_strdup(false);
+		break;
+
+	case ECONN_ALERT:
+		msg->u.alert.level = 1 + fuzz_u32(1);
+		msg->u.alert.descr = fuzz_strdup(false);
+		break;
+
+	default:
+		break;
+	}
+
+	return msg;
+}
+
+/* The JSON and binary decodings of the same message must agree */
+static void check_same(struct econn_message *a, struct econn_message *b)
+{
+	ASSERT_EQ(a->msg_type, b->msg_type);
+	ASSERT_STREQ(a->sessid_sender, b->sessid_sender);
+	ASSERT_STREQ(a->src_userid, b->src_userid);
+	ASSERT_STREQ(a->src_clientid, b->src_clientid);
+	ASSERT_STREQ(a->dest_userid, b->dest_userid);
+	ASSERT_STREQ(a->dest_clientid, b->dest_clientid);
+	ASSERT_EQ(a->resp, b->resp);
+	ASSERT_EQ(a->time, b->time);
+	ASSERT_EQ(a->age, b->age);
+
+	switch (a->msg_type) {
+
+	case ECONN_SETUP:
+	case ECONN_GROUP_SETUP:
+	case ECONN_UPDATE:
+		ASSERT_STREQ(a->u.setup.sdp_msg, b->u.setup.sdp_msg);
+		ASSERT_STREQ(a->u.setup.url, b->u.setup.url);
+		ASSERT_STREQ(a->u.setup.sft_tuple, b->u.setup.sft_tuple);
+		check_props(a->u.setup.props, b->u.setup.props);
+		break;
+
+	case ECONN_PROPSYNC:
+		check_props(a->u.propsync.props, b->u.propsync.props);
+		break;
+
+	case ECONN_GROUP_START:
+		ASSERT_EQ(a->u.groupstart.props == NULL,
+			  b->u.groupstart.props == NULL);
+		check_props(a->u.groupstart.props, b->u.groupstart.props);
+		break;
+
+	case ECONN_CONF_CONN:
+		ASSERT_EQ(a->u.confconn.turnc, b->u.confconn.turnc);
+		check_ice_serverlist(a->u.confconn.turnv, b->u.confconn.turnv,
+				     a->u.confconn.turnc);
+		ASSERT_EQ(a->u.confconn.update, b->u.confconn.update);
+		ASSERT_STREQ(a->u.confconn.tool, b->u.confconn.tool);
+		ASSERT_STREQ(a->u.confconn.toolver, b->u.confconn.toolver);
+		ASSERT_EQ(a->u.confconn.env, b->u.confconn.env);
+		ASSERT_EQ(a->u.confconn.status, b->u.confconn.status);
+		ASSERT_EQ(a->u.confconn.selective_audio,
+			  b->u.confconn.selective_audio);
+		ASSERT_EQ(a->u.confconn.selective_video,
+			  b->u.confconn.selective_video);
+		ASSERT_EQ(a->u.confconn.vstreams, b->u.confconn.vstreams);
+		ASSERT_STREQ(a->u.confconn.sft_url, b->u.confconn.sft_url);
+		ASSERT_STREQ(a->u.confconn.sft_tuple, b->u.confconn.sft_tuple);
+		ASSERT_STREQ(a->u.confconn.sft_username,
+			     b->u.confconn.sft_username);
+		ASSERT_STREQ(a->u.confconn.sft_credential,
+			     b->u.confconn.sft_credential);
+		break;
+
+	case ECONN_CONF_START:
+		ASSERT_EQ(a->u.confstart.props == NULL,
+			  b->u.confstart.props == NULL);
+		check_props(a->u.confstart.props, b->u.confstart.props);
+		ASSERT_STREQ(a->u.confstart.sft_url, b->u.confstart.sft_url);
+		ASSERT_STREQ(a->u.confstart.sft_tuple, b->u.confstart.sft_tuple);
+		ASSERT_EQ(a->u.confstart.secretlen, b->u.confstart.secretlen);
+		ASSERT_EQ(memcmp(a->u.confstart.secret, b->u.confstart.secret,
+				 a->u.confstart.secretlen), 0);
+		ASSERT_EQ(a->u.confstart.timestamp, b->u.confstart.timestamp);
+		ASSERT_EQ(a->u.confstart.seqno, b->u.confstart.seqno);
+		check_stringlist(&a->u.confstart.sftl, &b->u.confstart.sftl);
+		break;
+
+	case ECONN_CONF_CHECK:
+		ASSERT_STREQ(a->u.confcheck.sft_url, b->u.confcheck.sft_url);
+		ASSERT_STREQ(a->u.confcheck.sft_tuple, b->u.confcheck.sft_tuple);
+		ASSERT_EQ(a->u.confcheck.secretlen, b->u.confcheck.secretlen);
+		ASSERT_EQ(memcmp(a->u.confcheck.secret, b->u.confcheck.secret,
+				 a->u.confcheck.secretlen), 0);
+		ASSERT_EQ(a->u.confcheck.timestamp, b->u.confcheck.timestamp);
+		ASSERT_EQ(a->u.confcheck.seqno, b->u.confcheck.seqno);
+		check_stringlist(&a->u.confcheck.sftl, &b->u.confcheck.sftl);
+		break;
+
+	case ECONN_CONF_PART:
+		ASSERT_EQ(a->u.confpart.should_start,
+			  b->u.confpart.should_start);
+		ASSERT_EQ(a->u.confpart.timestamp, b->u.confpart.timestamp);
+		ASSERT_EQ(a->u.confpart.seqno, b->u.confpart.seqno);
+		ASSERT_EQ(a->u.confpart.entropylen, b->u.confpart.entropylen);
+		ASSERT_EQ(memcmp(a->u.confpart.entropy, b->u.confpart.entropy,
+				 a->u.confpart.entropylen), 0);
+		check_partlist(&a->u.confpart.partl, &b->u.confpart.partl);
+		check_stringlist(&a->u.confpart.sftl, &b->u.confpart.sftl);
+		break;
+
+	case ECONN_CONF_KEY:
+		check_keylist(&a->u.confkey.keyl, &b->u.confkey.keyl);
+		ASSERT_EQ(a->u.confkey.ciphers, b->u.confkey.ciphers);
+		break;
+
+	case ECONN_CONF_STREAMS: {
+		struct le *ale, *ble;
+
+		ASSERT_STREQ(a->u.confstreams.mode, b->u.confstreams.mode);
+		check_streamlist(&a->u.confstreams.streaml,
+				 &b->u.confstreams.streaml);
+
+		ale = a->u.confstreams.streaml.head;
+		ble = b->u.confstreams.streaml.head;
+		while (ale && ble) {
+			struct econn_stream_info *ainfo =
+				(struct econn_stream_info*)ale->data;
+			struct econn_stream_info *binfo =
+				(struct econn_stream_info*)ble->data;
+
+			ASSERT_EQ(ainfo->ssrcv.hi, binfo->ssrcv.hi);
+			ASSERT_EQ(ainfo->ssrcv.lo, binfo->ssrcv.lo);
+			ASSERT_STREQ(ainfo->ssrcv.clientid,
+				     binfo->ssrcv.clientid);
+			ale = ale->next;
+			ble = ble->next;
+		}
+	}
+		break;
+
+	case ECONN_DEVPAIR_PUBLISH:
+		ASSERT_EQ(a->u.devpair_publish.turnc,
+			  b->u.devpair_publish.turnc);
+		check_ice_serverlist(a->u.devpair_publish.turnv,
+				     b->u.devpair_publish.turnv,
+				     a->u.devpair_publish.turnc);
+		ASSERT_STREQ(a->u.devpair_publish.sdp,
+			     b->u.devpair_publish.sdp);
+		ASSERT_STREQ(a->u.devpair_publish.username,
+			     b->u.devpair_publish.username);
+		break;
+
+	case ECONN_DEVPAIR_ACCEPT:
+		ASSERT_STREQ(a->u.devpair_accept.sdp, b->u.devpair_accept.sdp);
+		break;
+
+	case ECONN_ALERT:
+		ASSERT_EQ(a->u.alert.level, b->u.alert.level);
+		ASSERT_STREQ(a->u.alert.descr, b->u.alert.descr);
+		break;
+
+	default:
+		break;
+	}
+}
+
+static const enum econn_msg fuzz_types[] = {
+	ECONN_SETUP, ECONN_CANCEL, ECONN_HANGUP, ECONN_PROPSYNC,
+	ECONN_GROUP_START, ECONN_GROUP_LEAVE, ECONN_GROUP_CHECK,
+	ECONN_GROUP_SETUP, ECONN_CONF_CONN, ECONN_CONF_START,
+	ECONN_CONF_END, ECONN_CONF_PART, ECONN_CONF_KEY, ECONN_CONF_CHECK,
+	ECONN_CONF_STREAMS, ECONN_UPDATE, ECONN_REJECT, ECONN_ALERT,
+	ECONN_PING, ECONN_DEVPAIR_PUBLISH, ECONN_DEVPAIR_ACCEPT,
+};
+
+TEST(econn_fmt, bin_fuzz_against_json)
+{
+	const int rounds = 50;
+
+	for (int r = 0; r < rounds; r++) {
+		for (size_t t = 0; t < ARRAY_SIZE(fuzz_types); t++) {
+			struct econn_message *smsg, *jmsg = NULL, *bmsg = NULL;
+			struct mbuf *mb = NULL;
+			char *str = NULL;
+
+			smsg = fuzz_message(fuzz_types[t]);
+
+			ASSERT_EQ(econn_message_encode(&str, smsg), 0);
+			ASSERT_EQ(econn_message_decode(&jmsg, TIME_NOW,
+						       TIME_MSG, str,
+						       strlen(str)), 0);
+
+			ASSERT_EQ(econn_message_encode_bin(&mb, smsg), 0);
+			ASSERT_EQ(econn_message_decode_bin(&bmsg, TIME_NOW,
+							   TIME_MSG,
+							   mbuf_buf(mb),
+							   mbuf_get_left(mb)),
+				  0);
+
+			check_same(jmsg, bmsg);
+
+			mem_deref(bmsg);
+			mem_deref(jmsg);
+			mem_deref(str);
+			mem_deref(mb);
+			mem_deref(smsg);
+		}
+	}
+}
+
+TEST(econn_fmt, bin_fuzz_malformed)
+{
+	for (size_t t = 0; t < ARRAY_SIZE(fuzz_types); t++) {
+		struct econn_message *smsg, *dmsg;
+		struct mbuf *mb = NULL;
+		uint8_t *buf;
+		size_t len, i;
+
+		smsg = fuzz_message(fuzz_types[t]);
+		ASSERT_EQ(econn_message_encode_bin(&mb, smsg), 0);
+		len = mbuf_get_left(mb);
+
+		/* Every field is mandatory, so any truncation must fail */
+		for (i = 0; i < len; i++) {
+			dmsg = NULL;
+			buf = (uint8_t *)mem_alloc(i ? i : 1, NULL);
+			memcpy(buf, mbuf_buf(mb), i);
+			ASSERT_NE(econn_message_decode_bin(&dmsg, TIME_NOW,
+							   TIME_MSG, buf, i),
+				  0);
+			ASSERT_TRUE(dmsg == NULL);
+			mem_deref(buf);
+		}
+
+		/* Corrupted bytes may decode or fail, but never crash */
+		for (i = 0; i < 200; i++) {
+			buf = (uint8_t *)mem_alloc(len, NULL);
+			memcpy(buf, mbuf_buf(mb), len);
+			buf[2 + fuzz_u32(len - 3)] = (uint8_t)fuzz_u32(255);
+			buf[2 + fuzz_u32(len - 3)] = (uint8_t)fuzz_u32(255);
+
+			dmsg = NULL;
+			econn_message_decode_bin(&dmsg, TIME_NOW, TIME_MSG,
+						 buf, len);
+			mem_deref(dmsg);
+			mem_deref(buf);
+		}
+
+		mem_deref(mb);
+		mem_deref(smsg);
+	}
+}
+
+
+static float elapsed_us(const struct timeval *start)
+{
+	struct timeval now, res;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, start, &res);
+
+	return (float)res.tv_sec * 1000000.0f + res.tv_usec;
+}
+
+/* Benchmark, run with --gtest_also_run_disabled_tests */
+TEST(econn_fmt, DISABLED_bin_confpart_100_speed)
+{
+	struct econn_message *smsg;
+	struct timeval start;
+	const int rounds = 200;
+	size_t json_len, bin_len;
+	float t_json_enc, t_json_dec, t_bin_enc, t_bin_dec;
+	struct mbuf *mb = NULL;
+	char *str = NULL;
+
+	smsg = init_message(ECONN_CONF_PART);
+	ASSERT_TRUE(smsg != NULL);
+
+	smsg->u.confpart.timestamp = 1772636175216ULL;
+	smsg->u.confpart.seqno = 24680;
+	smsg->u.confpart.entropy =
+		fuzz_data(&smsg->u.confpart.entropylen);
+	init_stringlist(&smsg->u.confpart.sftl);
+	fuzz_partlist(&smsg->u.confpart.partl, 100);
+
+	ASSERT_EQ(econn_message_encode(&str, smsg), 0);
+	ASSERT_EQ(econn_message_encode_bin(&mb, smsg), 0);
+	json_len = strlen(str);
+	bin_len = mbuf_get_left(mb);
+
+	gettimeofday(&start, NULL);
+	for (int r = 0; r < rounds; r++) {
+		char *s = NULL;
+
+		ASSERT_EQ(econn_message_encode(&s, smsg), 0);
+		mem_deref(s);
+	}
+	t_json_enc = elapsed_us(&start) / rounds;
+
+	gettimeofday(&start, NULL);
+	for (int r = 0; r < rounds; r++) {
+		struct econn_message *dmsg = NULL;
+
+		ASSERT_EQ(econn_message_decode(&dmsg, TIME_NOW, TIME_MSG,
+					       str, json_len), 0);
+		mem_deref(dmsg);
+	}
+	t_json_dec = elapsed_us(&start) / rounds;
+
+	gettimeofday(&start, NULL);
+	for (int r = 0; r < rounds; r++) {
+		struct mbuf *m = NULL;
+
+		ASSERT_EQ(econn_message_encode_bin(&m, smsg), 0);
+		mem_deref(m);
+	}
+	t_bin_enc = elapsed_us(&start) / rounds;
+
+	gettimeofday(&start, NULL);
+	for (int r = 0; r < rounds; r++) {
+		struct econn_message *dmsg = NULL;
+
+		ASSERT_EQ(econn_message_decode_bin(&dmsg, TIME_NOW, TIME_MSG,
+						   mbuf_buf(mb), bin_len), 0);
+		mem_deref(dmsg);
+	}
+	t_bin_dec = elapsed_us(&start) / rounds;
+
+	printf("econn_fmt: CONFPART 100 parts: "
+	       "json %zu bytes enc %.1f us dec %.1f us, "
+	       "bin %zu bytes enc %.1f us dec %.1f us\n",
+	       json_len, t_json_enc, t_json_dec,
+	       bin_len, t_bin_enc, t_bin_dec);
+
+	EXPECT_LT(bin_len, json_len);
+
+	mem_deref(mb);
+	mem_deref(str);
+	mem_deref(smsg);
+}
@@ -0,0 +1,476 @@
+/*
+* Wire
+* Copyright (C) 2020 Wire Swiss GmbH
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <sys/time.h>
+#include <re.h>
+#include <avs.h>
+#include <gtest/gtest.h>
+
+#define KEYSZ (32)
+#define MAX_SENDERS (32)
+#define FRAMESZ (160)
+#define BUFSZ (1024)
+#define ARENASZ (65536)
+
+class FrameEncTest : public ::testing::Test {
+
+public:
+
+	virtual void SetUp() override
+	{
+		const uint8_t callid[] = "CALL_ID";
+		uint8_t key[KEYSZ];
+
+		memset(key, 0xAA, KEYSZ);
+		keystore_alloc(&ks, true);
+		keystore_set_salt(ks, callid, 7);
+		keystore_set_session_key(ks, 0, key, KEYSZ);
+
+		memset(encs, 0, sizeof(encs));
+		for (size_t i = 0; i < FRAMESZ; i++)
+			frame[i] = (uint8_t)i;
+	}
+
+	virtual void TearDown() override
+	{
+		for (int i = 0; i < MAX_SENDERS; i++)
+			mem_deref(encs[i]);
+		mem_deref(dec);
+		mem_deref(ks);
+	}
+
+	void add_senders(int n)
+	{
+		char uid[32];
+
+		ASSERT_EQ(frame_decryptor_alloc(&dec, FRAME_MEDIA_AUDIO), 0);
+		ASSERT_EQ(frame_decryptor_set_keystore(dec, ks), 0);
+
+		for (int i = 0; i < n; i++) {
+			re_snprintf(uid, sizeof(uid), "user_%d", i);
+			ASSERT_EQ(frame_encryptor_alloc(&encs[i], uid,
+							FRAME_MEDIA_AUDIO), 0);
+			ASSERT_EQ(frame_encryptor_set_keystore(encs[i], ks), 0);
+			ASSERT_EQ(frame_decryptor_set_uid_for_csrc(dec, i + 1, uid), 0);
+		}
+	}
+
+	/* Returns the average decrypt time per frame in us */
+	float interleave(int n, int frames, bool reseed)
+	{
+		struct timeval start, now, res, tot;
+		char uid[32];
+		size_t esz, dsz;
+
+		timerclear(&tot);
+		for (int f = 0; f < frames; f++) {
+			int s = f % n;
+
+			frame_encryptor_encrypt(encs[s], s + 1,
+						frame, FRAMESZ,
+						ebuf, &esz);
+
+			/* Emulate a decryptor that only keeps one sender */
+			if (reseed) {
+				re_snprintf(uid, sizeof(uid), "user_%d", s);
+				frame_decryptor_set_uid_for_csrc(dec, s + 1, uid);
+			}
+
+			gettimeofday(&start, NULL);
+			EXPECT_EQ(frame_decryptor_decrypt(dec, 0, ebuf, esz,
+							  dbuf, &dsz), 0);
+			gettimeofday(&now, NULL);
+			timersub(&now, &start, &res);
+			timeradd(&res, &tot, &tot);
+
+			EXPECT_EQ(dsz, FRAMESZ);
+		}
+
+		return ((float)tot.tv_sec * 1000000.0f + tot.tv_usec) / frames;
+	}
+
+protected:
+	struct keystore *ks = NULL;
+	struct frame_encryptor *encs[MAX_SENDERS];
+	struct frame_decryptor *dec = NULL;
+	uint8_t frame[FRAMESZ];
+	uint8_t ebuf[BUFSZ];
+	uint8_t dbuf[BUFSZ];
+};
+
+TEST_F(FrameEncTest, encrypt_decrypt)
+{
+	size_t esz, dsz;
+
+	ASSERT_EQ(frame_encryptor_alloc(&encs[0], "user_0",
+					FRAME_MEDIA_AUDIO), 0);
+	ASSERT_EQ(frame_encryptor_set_keystore(encs[0], ks), 0);
+	ASSERT_EQ(frame_decryptor_alloc(&dec, FRAME_MEDIA_AUDIO), 0);
+	ASSERT_EQ(frame_decryptor_set_keystore(dec, ks), 0);
+	ASSERT_EQ(frame_decryptor_set_uid(dec, "user_0"), 0);
+
+	for (int i = 0; i < 10; i++) {
+		ASSERT_EQ(frame_encryptor_encrypt(encs[0], 0, frame, FRAMESZ,
+						  ebuf, &esz), 0);
+		ASSERT_EQ(frame_decryptor_decrypt(dec, 0, ebuf, esz,
+						  dbuf, &dsz), 0);
+		ASSERT_EQ(dsz, FRAMESZ);
+		ASSERT_TRUE(memcmp(frame, dbuf, FRAMESZ) == 0);
+	}
+}
+
+TEST_F(FrameEncTest, wrong_uid_fails)
+{
+	size_t esz, dsz;
+
+	ASSERT_EQ(frame_encryptor_alloc(&encs[0], "user_0",
+					FRAME_MEDIA_AUDIO), 0);
+	ASSERT_EQ(frame_encryptor_set_keystore(encs[0], ks), 0);
+	ASSERT_EQ(frame_decryptor_alloc(&dec, FRAME_MEDIA_AUDIO), 0);
+	ASSERT_EQ(frame_decryptor_set_keystore(dec, ks), 0);
+	ASSERT_EQ(frame_decryptor_set_uid_for_csrc(dec, 1, "user_1"), 0);
+
+	ASSERT_EQ(frame_encryptor_encrypt(encs[0], 1, frame, FRAMESZ,
+					  ebuf, &esz), 0);
+	ASSERT_NE(frame_decryptor_decrypt(dec, 0, ebuf, esz,
+					  dbuf, &dsz), 0);
+}
+
+TEST_F(FrameEncTest, interleaved_senders)
+{
+	uint32_t hits, misses, evictions;
+
+	add_senders(8);
+	interleave(8, 800, false);
+
+	frame_decryptor_get_cache_stats(dec, &hits, &misses, &evictions);
+	ASSERT_EQ(hits, 800);
+	ASSERT_EQ(misses, 0);
+	ASSERT_EQ(evictions, 0);
+}
+
+TEST_F(FrameEncTest, cache_eviction)
+{
+	uint32_t hits, misses, evictions;
+	size_t esz, dsz;
+
+	add_senders(MAX_SENDERS);
+
+	frame_decryptor_get_cache_stats(dec, &hits, &misses, &evictions);
+	ASSERT_EQ(evictions, MAX_SENDERS - 16);
+
+	/* Most recently added sender is still cached */
+	ASSERT_EQ(frame_encryptor_encrypt(encs[MAX_SENDERS - 1], MAX_SENDERS,
+					  frame, FRAMESZ, ebuf, &esz), 0);
+	ASSERT_EQ(frame_decryptor_decrypt(dec, 0, ebuf, esz,
+					  dbuf, &dsz), 0);
+
+	/* First sender was evicted and can't be resolved without a peerflow */
+	ASSERT_EQ(frame_encryptor_encrypt(encs[0], 1,
+					  frame, FRAMESZ, ebuf, &esz), 0);
+	ASSERT_NE(frame_decryptor_decrypt(dec, 0, ebuf, esz,
+					  dbuf, &dsz), 0);
+}
+
+/* Benchmark, run with --gtest_also_run_disabled_tests */
+TEST_F(FrameEncTest, DISABLED_interleaved_senders_perf)
+{
+	const int nsenders[] = {2, 4, 8, 16};
+	const int frames = 20000;
+
+	add_senders(16);
+
+	for (size_t i = 0; i < ARRAY_SIZE(nsenders); i++) {
+		int n = nsenders[i];
+		float cold, warm;
+
+		cold = interleave(n, frames, true);
+		warm = interleave(n, frames, false);
+
+		printf("frame_dec: %2d senders: setup per frame: %.2f us "
+		       "cached: %.2f us\n", n, cold, warm);
+	}
+}
+
+TEST_F(FrameEncTest, encrypt_batch)
+{
+	struct frame_batch frames[3];
+	uint8_t *arena;
+	size_t used, dsz;
+
+	ASSERT_EQ(frame_encryptor_alloc(&encs[0], "user_0",
+					FRAME_MEDIA_VIDEO), 0);
+	ASSERT_EQ(frame_encryptor_set_keystore(encs[0], ks), 0);
+	ASSERT_EQ(frame_decryptor_alloc(&dec, FRAME_MEDIA_VIDEO), 0);
+	ASSERT_EQ(frame_decryptor_set_keystore(dec, ks), 0);
+	ASSERT_EQ(frame_decryptor_set_uid(dec, "user_0"), 0);
+
+	arena = (uint8_t *)mem_zalloc(ARENASZ, NULL);
+	ASSERT_TRUE(arena != NULL);
+
+	for (int i = 0; i < 3; i++) {
+		frames[i].src = frame;
+		frames[i].srcsz = FRAMESZ - i * 10;
+		frames[i].ssrc = 0;
+	}
+
+	ASSERT_EQ(frame_encryptor_encrypt_batch(encs[0], frames, 3,
+						arena, ARENASZ, &used), 0);
+
+	for (int i = 0; i < 3; i++) {
+		ASSERT_TRUE(frames[i].dst >= arena);
+		ASSERT_TRUE(frames[i].dst + frames[i].dstsz <= arena + used);
+		ASSERT_EQ(frame_decryptor_decrypt(dec, 0,
+						  frames[i].dst,
+						  frames[i].dstsz,
+						  dbuf, &dsz), 0);
+		ASSERT_EQ(dsz, frames[i].srcsz);
+		ASSERT_TRUE(memcmp(frame, dbuf, dsz) == 0);
+	}
+
+	/* Arena too small for the last frame */
+	ASSERT_EQ(frame_encryptor_encrypt_batch(encs[0], frames, 3,
+						arena, used, &used), ENOMEM);
+
+	mem_deref(arena);
+}
+
+static float elapsed_us(const struct timeval *start)
+{
+	struct timeval now, res;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, start, &res);
+
+	return (float)res.tv_sec * 1000000.0f + res.tv_usec;
+}
+
+static void batch_perf(struct frame_encryptor *enc,
+		       const char *name,
+		       const size_t *sizes,
+		       size_t count)
+{
+	struct frame_batch frames[8];
+	struct timeval start;
+	uint8_t *src, *arena;
+	const int rounds = 5000;
+	size_t total = 0, used, esz;
+	float single, batch;
+
+	src = (uint8_t *)mem_zalloc(ARENASZ, NULL);
+	arena = (uint8_t *)mem_zalloc(ARENASZ, NULL);
+
+	for (size_t i = 0; i < count; i++) {
+		frames[i].src = src;
+		frames[i].srcsz = sizes[i];
+		frames[i].ssrc = 0;
+		total += sizes[i];
+	}
+
+	gettimeofday(&start, NULL);
+	for (int r = 0; r < rounds; r++) {
+		size_t pos = 0;
+
+		for (size_t i = 0; i < count; i++) {
+			frame_encryptor_encrypt(enc, 0, src, sizes[i],
+						arena + pos, &esz);
+			pos += esz;
+		}
+	}
+	single = elapsed_us(&start);
+
+	gettimeofday(&start, NULL);
+	for (int r = 0; r < rounds; r++) {
+		frame_encryptor_encrypt_batch(enc, frames, count,
+					      arena, ARENASZ, &used);
+	}
+	batch = elapsed_us(&start);
+
+	printf("frame_enc: %s %zu frames %zu bytes per tick: "
+	       "per-frame %.2f us (%.1f MB/s) batched %.2f us (%.1f MB/s)\n",
+	       name, count, total,
+	       single / rounds, (float)total * rounds / single,
+	       batch / rounds, (float)total * rounds / batch);
+
+	mem_deref(src);
+	mem_deref(arena);
+}
+
+/* Benchmark, run with --gtest_also_run_disabled_tests */
+TEST_F(FrameEncTest, DISABLED_encrypt_batch_perf)
+{
+	/* Opus 20 ms packet with two redundancy packets */
+	const size_t audio[] = {80, 80, 80};
+	/* Three simulcast layers of a video frame */
+	const size_t video[] = {600, 2400, 9600};
+
+	ASSERT_EQ(frame_encryptor_alloc(&encs[0], "user_0",
+					FRAME_MEDIA_AUDIO), 0);
+	ASSERT_EQ(frame_encryptor_set_keystore(encs[0], ks), 0);
+	ASSERT_EQ(frame_encryptor_alloc(&encs[1], "user_0",
+					FRAME_MEDIA_VIDEO), 0);
+	ASSERT_EQ(frame_encryptor_set_keystore(encs[1], ks), 0);
+
+	batch_perf(encs[0], "audio", audio, ARRAY_SIZE(audio));
+	batch_perf(encs[1], "video", video, ARRAY_SIZE(video));
+}
+
+TEST_F(FrameEncTest, encrypt_decrypt_chacha)
+{
+	size_t esz, dsz;
+
+	ASSERT_EQ(frame_encryptor_alloc(&encs[0], "user_0",
+					FRAME_MEDIA_AUDIO), 0);
+	ASSERT_EQ(frame_encryptor_set_keystore(encs[0], ks), 0);
+	ASSERT_EQ(frame_decryptor_alloc(&dec, FRAME_MEDIA_AUDIO), 0);
+	ASSERT_EQ(frame_decryptor_set_keystore(dec, ks), 0);
+	ASSERT_EQ(frame_decryptor_set_uid(dec, "user_0"), 0);
+
+	/* The decryptor follows the suite of each frame */
+	for (int i = 0; i < 10; i++) {
+		ASSERT_EQ(keystore_set_cipher_suite(ks, i & 1 ?
+			FRAME_CIPHER_CHACHA20_POLY1305 :
+			FRAME_CIPHER_AES_256_GCM), 0);
+		ASSERT_EQ(frame_encryptor_encrypt(encs[0], 0, frame, FRAMESZ,
+						  ebuf, &esz), 0);
+		ASSERT_EQ(frame_decryptor_decrypt(dec, 0, ebuf, esz,
+						  dbuf, &dsz), 0);
+		ASSERT_EQ(dsz, FRAMESZ);
+		ASSERT_TRUE(memcmp(frame, dbuf, FRAMESZ) == 0);
+	}
+
+	/* Tampered header is rejected */
+	ASSERT_EQ(frame_encryptor_encrypt(encs[0], 0, frame, FRAMESZ,
+					  ebuf, &esz), 0);
+	ebuf[2] ^= 1;
+	ASSERT_EQ(frame_decryptor_decrypt(dec, 0, ebuf, esz,
+					  dbuf, &dsz), EIO);
+}
+
+static void suite_perf(struct keystore *ks,
+		       enum frame_cipher_suite suite,
+		       size_t framesz)
+{
+	struct frame_encryptor *enc = NULL;
+	struct frame_decryptor *dec = NULL;
+	struct timeval start;
+	uint8_t *src, *ebuf, *dbuf;
+	const size_t total = 32 * 1024 * 1024;
+	const int rounds = total / framesz;
+	size_t esz = 0, dsz;
+	float tenc, tdec;
+
+	src = (uint8_t *)mem_zalloc(framesz, NULL);
+	ebuf = (uint8_t *)mem_zalloc(framesz + BUFSZ, NULL);
+	dbuf = (uint8_t *)mem_zalloc(framesz + BUFSZ, NULL);
+
+	keystore_set_cipher_suite(ks, suite);
+	frame_encryptor_alloc(&enc, "user_0", FRAME_MEDIA_VIDEO);
+	frame_encryptor_set_keystore(enc, ks);
+	frame_decryptor_alloc(&dec, FRAME_MEDIA_VIDEO);
+	frame_decryptor_set_keystore(dec, ks);
+	frame_decryptor_set_uid(dec, "user_0");
+
+	gettimeofday(&start, NULL);
+	for (int r = 0; r < rounds; r++)
+		frame_encryptor_encrypt(enc, 0, src, framesz, ebuf, &esz);
+	tenc = elapsed_us(&start);
+
+	/* Decrypting the same frame repeatedly is fine for timing */
+	gettimeofday(&start, NULL);
+	for (int r = 0; r < rounds; r++)
+		frame_decryptor_decrypt(dec, 0, ebuf, esz, dbuf, &dsz);
+	tdec = elapsed_us(&start);
+
+	ASSERT_EQ(dsz, framesz);
+
+	printf("frame_enc: %-17s %5zu bytes: "
+	       "encrypt %.2f us (%.1f MB/s) decrypt %.2f us (%.1f MB/s)\n",
+	       frame_cipher_suite_name(suite), framesz,
+	       tenc / rounds, (float)framesz * rounds / tenc,
+	       tdec / rounds, (float)framesz * rounds / tdec);
+
+	mem_deref(enc);
+	mem_deref(dec);
+	mem_deref(src);
+	mem_deref(ebuf);
+	mem_deref(dbuf);
+}
+
+/* Benchmark, run with --gtest_also_run_disabled_tests
+ * On x86 the AES numbers without AES-NI can be had by running with
+ * OPENSSL_ia32cap=~0x200000200000000
+ */
+TEST_F(FrameEncTest, DISABLED_cipher_suite_perf)
+{
+	/* Opus packet, video packet and a full video frame */
+	const size_t sizes[] = {160, 1200, 12000};
+
+	printf("frame_enc: preferred suite: %s\n",
+	       frame_cipher_suite_name(frame_cipher_suite_preferred()));
+
+	for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+		suite_perf(ks, FRAME_CIPHER_AES_256_GCM, sizes[i]);
+		suite_perf(ks, FRAME_CIPHER_CHACHA20_POLY1305, sizes[i]);
+	}
+}
+
+TEST_F(FrameEncTest, latency_probe)
+{
+	struct stats_latency sl;
+	size_t esz, dsz;
+
+	ASSERT_EQ(frame_encryptor_alloc(&encs[0], "user_0",
+					FRAME_MEDIA_AUDIO), 0);
+	ASSERT_EQ(frame_encryptor_set_keystore(encs[0], ks), 0);
+	ASSERT_EQ(frame_decryptor_alloc(&dec, FRAME_MEDIA_AUDIO), 0);
+	ASSERT_EQ(frame_decryptor_set_keystore(dec, ks), 0);
+	ASSERT_EQ(frame_decryptor_set_uid(dec, "user_0"), 0);
+
+	/* Disabled by default */
+	ASSERT_EQ(frame_encryptor_encrypt(encs[0], 0, frame, FRAMESZ,
+					  ebuf, &esz), 0);
+	ASSERT_EQ(frame_decryptor_decrypt(dec, 0, ebuf, esz,
+					  dbuf, &dsz), 0);
+	ASSERT_EQ(frame_decryptor_get_latency(dec, 0, &sl), 0);
+	ASSERT_EQ(sl.frames, 0u);
+
+	frame_encryptor_set_latency_probe(encs[0], true);
+
+	for (int i = 0; i < 10; i++) {
+		ASSERT_EQ(frame_encryptor_encrypt(encs[0], 0, frame, FRAMESZ,
+						  ebuf, &esz), 0);
+		/* Drop every fifth frame */
+		if (i % 5 == 4)
+			continue;
+		ASSERT_EQ(frame_decryptor_decrypt(dec, 0, ebuf, esz,
+						  dbuf, &dsz), 0);
+		ASSERT_EQ(dsz, FRAMESZ);
+		ASSERT_TRUE(memcmp(frame, dbuf, FRAMESZ) == 0);
+	}
+
+	ASSERT_EQ(frame_decryptor_get_latency(dec, 0, &sl), 0);
+	ASSERT_EQ(sl.frames, 8u);
+	ASSERT_EQ(sl.lost, 1u);
+	ASSERT_EQ(sl.skewed, 0u);
+	ASSERT_LT(sl.max_ms, 1000u);
+	/* Jitter only between consecutive frames */
+	uint32_t jitter = 0;
+	for (int i = 0; i < STATS_LAT_BUCKETS; i++)
+		jitter += sl.jitter[i];
+	ASSERT_EQ(jitter, 6u);
+}
@@ -177,3 +177,110 @@ TEST_F(FrameHdrTest, write_read_csrc)
 	ASSERT_EQ(c, 0x12345678);
 }
 
+
+TEST_F(FrameHdrTest, write_read_suite)
+{
+	size_t bw, br;
+	uint64_t f, k;
+	uint32_t c = 0;
+	uint8_t s;
+	int err;
+
+	bw = frame_hdr_write_suite(buffer, BUFSZ, 0x11, 0x22, 0, 1);
+	ASSERT_EQ(bw, 6);
+
+	err = frame_hdr_read_suite(buffer, BUFSZ, &f, &k, &c, &s, &br);
+
+	ASSERT_EQ(err, 0);
+	ASSERT_EQ(br, bw);
+	ASSERT_EQ(k, 0x22);
+	ASSERT_EQ(f, 0x11);
+	ASSERT_EQ(c, 0);
+	ASSERT_EQ(s, 1);
+}
+
+TEST_F(FrameHdrTest, write_read_csrc_suite)
+{
+	size_t bw, br;
+	uint64_t f, k;
+	uint32_t c;
+	uint8_t s;
+	int err;
+
+	bw = frame_hdr_write_suite(buffer, BUFSZ, 0x11, 0x22, 0x12345678, 1);
+	ASSERT_EQ(bw, 11);
+
+	err = frame_hdr_read_suite(buffer, BUFSZ, &f, &k, &c, &s, &br);
+
+	ASSERT_EQ(err, 0);
+	ASSERT_EQ(br, bw);
+	ASSERT_EQ(k, 0x22);
+	ASSERT_EQ(f, 0x11);
+	ASSERT_EQ(c, 0x12345678);
+	ASSERT_EQ(s, 1);
+
+	/* Old readers skip the suite and still find the CSRC */
+	err = frame_hdr_read(buffer, BUFSZ, &f, &k, &c, &br);
+	ASSERT_EQ(err, 0);
+	ASSERT_EQ(br, bw);
+	ASSERT_EQ(c, 0x12345678);
+}
+
+TEST_F(FrameHdrTest, default_suite_unchanged)
+{
+	uint8_t old[BUFSZ];
+	size_t bo, bw, br;
+	uint64_t f, k;
+	uint32_t c;
+	uint8_t s = 0xff;
+	int err;
+
+	bo = frame_hdr_write(old, BUFSZ, 0x11, 0x22, 0x12345678);
+	bw = frame_hdr_write_suite(buffer, BUFSZ, 0x11, 0x22, 0x12345678, 0);
+	ASSERT_EQ(bo, bw);
+	ASSERT_EQ(memcmp(old, buffer, bw), 0);
+
+	err = frame_hdr_read_suite(buffer, BUFSZ, &f, &k, &c, &s, &br);
+	ASSERT_EQ(err, 0);
+	ASSERT_EQ(s, 0);
+}
+
+TEST_F(FrameHdrTest, write_read_timestamp)
+{
+	struct frame_hdr_ext ext, rext;
+	size_t bw, br;
+	uint64_t f, k;
+	uint32_t c;
+	int err;
+
+	memset(&ext, 0, sizeof(ext));
+	ext.suite = 1;
+	ext.has_ts = true;
+	ext.ts = 0xdeadbeef;
+	ext.seq = 0x1234;
+
+	bw = frame_hdr_write_ext(buffer, BUFSZ, 0x11, 0x22, 0x12345678, &ext);
+	ASSERT_EQ(bw, 18);
+
+	err = frame_hdr_read_ext(buffer, BUFSZ, &f, &k, &c, &rext, &br);
+
+	ASSERT_EQ(err, 0);
+	ASSERT_EQ(br, bw);
+	ASSERT_EQ(c, 0x12345678);
+	ASSERT_EQ(rext.suite, 1);
+	ASSERT_TRUE(rext.has_ts);
+	ASSERT_EQ(rext.ts, 0xdeadbeef);
+	ASSERT_EQ(rext.seq, 0x1234);
+
+	/* Timestamp alone */
+	ext.suite = 0;
+	bw = frame_hdr_write_ext(buffer, BUFSZ, 0x11, 0x22, 0, &ext);
+	ASSERT_EQ(bw, 11);
+
+	err = frame_hdr_read_ext(buffer, BUFSZ, &f, &k, &c, &rext, &br);
+	ASSERT_EQ(err, 0);
+	ASSERT_EQ(br, bw);
+	ASSERT_EQ(rext.suite, 0);
+	ASSERT_TRUE(rext.has_ts);
+	ASSERT_EQ(rext.seq, 0x1234);
+}
@@ -19,6 +19,7 @@
 #include <re.h>
 #include <avs.h>
 #include <gtest/gtest.h>
+#include <sys/time.h>
 
 
 TEST(jzon, invalid_arguments)
@@ -381,3 +382,173 @@ TEST(jzon, add_base64)
 
 	mem_deref(jobj);
 }
+
+
+static struct json_object *make_array(int n)
+{
+	struct json_object *jarr;
+
+	jarr = json_object_new_array();
+
+	for (int i = 0; i < n; ++i) {
+		struct json_object *jitem = json_object_new_object();
+
+		jzon_add_int(jitem, "idx", i);
+		json_object_array_add(jarr, jitem);
+	}
+
+	return jarr;
+}
+
+
+TEST(jzon, array_foreach)
+{
+	struct json_object *jarr, *jitem;
+	int i = 0;
+
+	jarr = make_array(20);
+	ASSERT_TRUE(jarr != NULL);
+
+	JZON_ARRAY_FOREACH(jarr, jitem) {
+		int32_t v;
+
+		ASSERT_TRUE(jitem == json_object_array_get_idx(jarr, i));
+		ASSERT_EQ(0, jzon_int(&v, jitem, "idx"));
+		ASSERT_EQ(i, v);
+		++i;
+	}
+	ASSERT_EQ(20, i);
+
+	mem_deref(jarr);
+}
+
+
+TEST(jzon, array_foreach_empty)
+{
+	struct json_object *jarr, *jobj;
+
+	jarr = json_object_new_array();
+	jobj = json_object_new_object();
+	jzon_add_int(jobj, "idx", 0);
+
+	ASSERT_TRUE(jzon_array_first(jarr) == NULL);
+	ASSERT_TRUE(jzon_array_first(jobj) == NULL);
+	ASSERT_TRUE(jzon_array_first(NULL) == NULL);
+	ASSERT_TRUE(jzon_array_next(NULL) == NULL);
+
+	mem_deref(jobj);
+	mem_deref(jarr);
+}
+
+
+TEST(jzon, array_vector)
+{
+	struct json_object *jarr, *jobj;
+	struct json_object **vec = NULL;
+	size_t n = 0;
+
+	jarr = make_array(7);
+
+	ASSERT_EQ(0, jzon_array_vector(&vec, &n, jarr));
+	ASSERT_EQ((size_t)7, n);
+
+	for (size_t i = 0; i < n; ++i) {
+		int32_t v;
+
+		ASSERT_EQ(0, jzon_int(&v, vec[i], "idx"));
+		ASSERT_EQ((int32_t)i, v);
+	}
+	mem_deref(vec);
+
+	jobj = json_object_new_object();
+	ASSERT_EQ(EINVAL, jzon_array_vector(&vec, &n, jobj));
+	ASSERT_EQ(EINVAL, jzon_array_vector(NULL, &n, jarr));
+
+	mem_deref(jobj);
+	mem_deref(jarr);
+}
+
+
+TEST(jzon, array_decoded_order)
+{
+	static const char *json = "[\"a\",\"b\",\"c\",\"d\"]";
+	struct json_object *jarr, *jitem;
+	const char *expv[] = {"a", "b", "c", "d"};
+	int i = 0;
+
+	ASSERT_EQ(0, jzon_decode(&jarr, json, strlen(json)));
+
+	JZON_ARRAY_FOREACH(jarr, jitem) {
+		ASSERT_STREQ(expv[i], json_object_get_string(jitem));
+		++i;
+	}
+	ASSERT_EQ(4, i);
+
+	mem_deref(jarr);
+}
+
+
+static float elapsed_us(const struct timeval *start)
+{
+	struct timeval now, res;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, start, &res);
+
+	return (float)res.tv_sec * 1000000.0f + res.tv_usec;
+}
+
+
+/* Benchmark, run with --gtest_also_run_disabled_tests */
+TEST(jzon, DISABLED_array_iterate_speed)
+{
+	static const int sizev[] = {10, 100, 1000};
+	const int rounds = 100;
+
+	for (size_t s = 0; s < sizeof(sizev) / sizeof(sizev[0]); ++s) {
+		struct json_object *jarr, *jitem;
+		struct json_object **vec;
+		struct timeval start;
+		float t_idx, t_each, t_vec;
+		size_t n;
+		int sum = 0;
+
+		jarr = make_array(sizev[s]);
+
+		gettimeofday(&start, NULL);
+		for (int r = 0; r < rounds; ++r) {
+			int len = json_object_array_length(jarr);
+
+			for (int i = 0; i < len; ++i) {
+				jitem = json_object_array_get_idx(jarr, i);
+				sum += jitem != NULL;
+			}
+		}
+		t_idx = elapsed_us(&start) / rounds;
+
+		gettimeofday(&start, NULL);
+		for (int r = 0; r < rounds; ++r) {
+			JZON_ARRAY_FOREACH(jarr, jitem) {
+				sum += jitem != NULL;
+			}
+		}
+		t_each = elapsed_us(&start) / rounds;
+
+		gettimeofday(&start, NULL);
+		for (int r = 0; r < rounds; ++r) {
+			ASSERT_EQ(0, jzon_array_vector(&vec, &n, jarr));
+			for (size_t i = 0; i < n; ++i)
+				sum += vec[i] != NULL;
+			mem_deref(vec);
+		}
+		t_vec = elapsed_us(&start) / rounds;
+
+		ASSERT_EQ(3 * rounds * sizev[s], sum);
+
+		printf("array of %4d: get_idx %8.1fus foreach %6.1fus"
+		       " vector %6.1fus\n",
+		       sizev[s], t_idx, t_each, t_vec);
+
+		mem_deref(jarr);
+	}
+}
@@ -15,11 +15,15 @@
 * You should have received a copy of the GNU General Public License
 * along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
+#include <pthread.h>
+#include <unistd.h>
+#include <atomic>
 #include <re.h>
 #include <avs.h>
 #include <gtest/gtest.h>
 
 #define KEYSZ (32)
+#define NUM_DECODERS (4)
 
 class KeystoreTest : public ::testing::Test {
 
@@ -355,6 +359,32 @@ TEST_F(KeystoreTest, delete_old_keys)
 	ASSERT_EQ(keystore_get_media_key(ks, 2, b4, KEYSZ), 0);
 }
 
+TEST_F(KeystoreTest, evict_oldest_key)
+{
+	uint8_t b1[KEYSZ];
+	uint8_t b2[KEYSZ];
+	uint32_t idx;
+	uint32_t i;
+
+	memset(b1, 0xAA, KEYSZ);
+	ASSERT_EQ(keystore_set_session_key(ks3, 0, b1, KEYSZ), 0);
+
+	/* More keys than slots, the oldest ones make room */
+	for (i = 1; i <= 64; i++) {
+		memset(b2, (uint8_t)i, KEYSZ);
+		ASSERT_EQ(keystore_set_session_key(ks3, i, b2, KEYSZ), 0);
+	}
+	ASSERT_EQ(keystore_get_max_key(ks3), 64u);
+
+	/* The current key is kept */
+	ASSERT_EQ(keystore_get_current_session_key(ks3, &idx, b2, KEYSZ), 0);
+	ASSERT_EQ(idx, 0u);
+	ASSERT_TRUE(memcmp(b1, b2, KEYSZ) == 0);
+
+	ASSERT_EQ(keystore_get_media_key(ks3, 1, b2, KEYSZ), ENOENT);
+	ASSERT_EQ(keystore_get_media_key(ks3, 64, b2, KEYSZ), 0);
+}
+
 TEST_F(KeystoreTest, no_hash_mode)
 {
 	uint8_t b1[KEYSZ];
@@ -476,3 +506,201 @@ TEST_F(KeystoreTest, rotate_by_time)
 	ASSERT_TRUE(memcmp(b3, b4, KEYSZ) == 0);
 }
 
+
+static bool wait_lookahead(struct keystore *ks, uint64_t derived)
+{
+	struct keystore_stats stats;
+
+	for (int i = 0; i < 1000; i++) {
+		keystore_get_stats(ks, &stats);
+		if (stats.derived >= derived)
+			return true;
+		usleep(1000);
+	}
+
+	return false;
+}
+
+TEST_F(KeystoreTest, lookahead)
+{
+	struct keystore_stats stats;
+	uint8_t b1[KEYSZ];
+	uint8_t b2[KEYSZ];
+	uint8_t b3[KEYSZ];
+	uint8_t m2[KEYSZ];
+	uint8_t m3[KEYSZ];
+	uint32_t idx1, idx2;
+	uint64_t derived;
+	size_t i;
+
+	memset(b1, 0xAA, KEYSZ);
+
+	ASSERT_EQ(keystore_set_lookahead(ks3, 4), ENOTSUP);
+	ASSERT_EQ(keystore_set_lookahead(ks, 4), 0);
+
+	ASSERT_EQ(keystore_set_session_key(ks, 0, b1, KEYSZ), 0);
+	ASSERT_EQ(keystore_set_session_key(ks2, 0, b1, KEYSZ), 0);
+	ASSERT_TRUE(wait_lookahead(ks, 4));
+
+	/* Rotations hit keys hashed ahead, and match a plain keystore */
+	for (i = 1; i < 10; i++) {
+		keystore_get_stats(ks, &stats);
+		derived = stats.derived;
+
+		ASSERT_EQ(keystore_rotate(ks), 0);
+		ASSERT_EQ(keystore_rotate(ks2), 0);
+		ASSERT_EQ(keystore_get_current_session_key(ks, &idx1, b2, KEYSZ), 0);
+		ASSERT_EQ(keystore_get_current_session_key(ks2, &idx2, b3, KEYSZ), 0);
+		ASSERT_EQ(idx1, i);
+		ASSERT_EQ(idx2, i);
+		ASSERT_TRUE(memcmp(b2, b3, KEYSZ) == 0);
+
+		ASSERT_EQ(keystore_get_media_key(ks, idx1, m2, KEYSZ), 0);
+		ASSERT_EQ(keystore_get_media_key(ks2, idx2, m3, KEYSZ), 0);
+		ASSERT_TRUE(memcmp(m2, m3, KEYSZ) == 0);
+
+		ASSERT_TRUE(wait_lookahead(ks, derived + 1));
+	}
+
+	/* A frame with a future key is a hit as well */
+	ASSERT_EQ(keystore_get_media_key(ks, 13, m2, KEYSZ), 0);
+	ASSERT_EQ(keystore_get_media_key(ks2, 13, m3, KEYSZ), 0);
+	ASSERT_TRUE(memcmp(m2, m3, KEYSZ) == 0);
+
+	keystore_get_stats(ks, &stats);
+
+	ASSERT_EQ(stats.lookahead_hits, 13u);
+	ASSERT_EQ(stats.lookahead_misses, 0u);
+
+	/* A new era drops the keys hashed from the old one */
+	memset(b1, 0xBB, KEYSZ);
+	ASSERT_EQ(keystore_set_session_key(ks, 20, b1, KEYSZ), 0);
+	ASSERT_EQ(keystore_set_session_key(ks2, 20, b1, KEYSZ), 0);
+	ASSERT_EQ(keystore_get_media_key(ks, 21, m2, KEYSZ), 0);
+	ASSERT_EQ(keystore_get_media_key(ks2, 21, m3, KEYSZ), 0);
+	ASSERT_TRUE(memcmp(m2, m3, KEYSZ) == 0);
+}
+
+struct contention_ctx {
+	struct keystore *ks;
+	std::atomic<bool> run;
+	bool locked;
+	std::atomic<uint64_t> ops[NUM_DECODERS + 1];
+	std::atomic<uint64_t> misses;
+	std::atomic<uint32_t> rotations;
+};
+
+struct contention_thread {
+	struct contention_ctx *ctx;
+	int id;
+};
+
+static void *media_thread(void *arg)
+{
+	struct contention_thread *t = (struct contention_thread *)arg;
+	struct contention_ctx *ctx = t->ctx;
+	uint8_t mkey[KEYSZ];
+	uint64_t ts;
+	uint32_t idx;
+
+	while (ctx->run) {
+		/* The baseline reads the key under the keystore lock,
+		 * as every media key lookup used to.
+		 */
+		if (ctx->locked) {
+			if (keystore_get_current_session_key(ctx->ks, &idx,
+							     mkey, KEYSZ) != 0)
+				ctx->misses++;
+		}
+		else {
+			if (keystore_get_current(ctx->ks, &idx, &ts) != 0)
+				continue;
+
+			if (keystore_get_media_key(ctx->ks, idx,
+						   mkey, KEYSZ) != 0)
+				ctx->misses++;
+		}
+
+		ctx->ops[t->id]++;
+	}
+
+	return NULL;
+}
+
+static void *rotate_thread(void *arg)
+{
+	struct contention_ctx *ctx = (struct contention_ctx *)arg;
+
+	while (ctx->run) {
+		keystore_rotate(ctx->ks);
+		ctx->rotations++;
+		usleep(1000);
+	}
+
+	return NULL;
+}
+
+static double run_contention(struct keystore *ks, bool locked, int run_ms)
+{
+	struct contention_ctx ctx;
+	struct contention_thread threads[NUM_DECODERS + 1];
+	pthread_t tids[NUM_DECODERS + 1];
+	pthread_t rtid;
+	uint64_t total = 0;
+
+	ctx.ks = ks;
+	ctx.run = true;
+	ctx.locked = locked;
+	ctx.misses = 0;
+	ctx.rotations = 0;
+
+	/* Thread 0 is the encoder, the rest are decoders */
+	for (int i = 0; i <= NUM_DECODERS; i++) {
+		ctx.ops[i] = 0;
+		threads[i].ctx = &ctx;
+		threads[i].id = i;
+		pthread_create(&tids[i], NULL, media_thread, &threads[i]);
+	}
+	pthread_create(&rtid, NULL, rotate_thread, &ctx);
+
+	usleep(run_ms * 1000);
+	ctx.run = false;
+
+	for (int i = 0; i <= NUM_DECODERS; i++) {
+		pthread_join(tids[i], NULL);
+		total += ctx.ops[i];
+	}
+	pthread_join(rtid, NULL);
+
+	printf("keystore: %s: %d media threads, %u rotations: "
+	       "%.0f lookups/s (encoder %.0f/s) misses: %llu\n",
+	       locked ? "locked" : "snapshot",
+	       NUM_DECODERS + 1,
+	       ctx.rotations.load(),
+	       (double)total * 1000.0 / run_ms,
+	       (double)ctx.ops[0] * 1000.0 / run_ms,
+	       (unsigned long long)ctx.misses.load());
+
+	EXPECT_GT(ctx.rotations.load(), 0u);
+	EXPECT_GT(ctx.ops[0].load(), 0u);
+
+	return (double)total * 1000.0 / run_ms;
+}
+
+/* Benchmark, run with --gtest_also_run_disabled_tests */
+TEST_F(KeystoreTest, DISABLED_contention_perf)
+{
+	uint8_t b1[KEYSZ];
+	double locked, snapshot;
+	const int run_ms = 500;
+
+	memset(b1, 0xAA, KEYSZ);
+	ASSERT_EQ(keystore_set_session_key(ks, 0, b1, KEYSZ), 0);
+	ASSERT_EQ(keystore_set_session_key(ks2, 0, b1, KEYSZ), 0);
+
+	locked = run_contention(ks2, true, run_ms);
+	snapshot = run_contention(ks, false, run_ms);
+
+	printf("keystore: snapshot reads %.1fx the locked baseline\n",
+	       locked > 0 ? snapshot / locked : 0.0);
+}
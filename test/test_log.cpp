@@ -0,0 +1,278 @@
+/*
+* Wire
+* Copyright (C) 2020 Wire Swiss GmbH
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <re.h>
+#include <avs.h>
+#include <gtest/gtest.h>
+
+#define NUM_THREADS  4
+#define NUM_MSGS   500
+
+
+class LogTest : public ::testing::Test {
+
+public:
+
+	virtual void SetUp() override
+	{
+		level = log_get_min_level();
+		log_set_min_level(LOG_LEVEL_DEBUG);
+		log_enable_stderr(false);
+
+		memset(&lg, 0, sizeof(lg));
+		lg.h = log_handler;
+		lg.arg = this;
+		log_register_handler(&lg);
+	}
+
+	virtual void TearDown() override
+	{
+		log_async_stop();
+		log_unregister_handler(&lg);
+		log_set_min_level(level);
+		log_enable_stderr(true);
+	}
+
+	static void log_handler(uint32_t lvl, const char *msg, void *arg)
+	{
+		LogTest *t = (LogTest *)arg;
+
+		if (t->block) {
+			while (t->block)
+				usleep(1000);
+		}
+
+		t->msgs.push_back(msg);
+	}
+
+	void log_all(void);
+
+protected:
+	struct log lg;
+	enum log_level level;
+	std::vector<std::string> msgs;
+	std::atomic<bool> block{false};
+};
+
+
+static int print_handler(struct re_printf *pf, void *arg)
+{
+	return re_hprintf(pf, "<%s>", (const char *)arg);
+}
+
+
+void LogTest::log_all(void)
+{
+	std::string big(1000, 'x');
+	char userid_anon[ANON_ID_LEN];
+	const char *null_str = NULL;
+
+	info("plain message\n");
+	info("str: %s int: %d uint: %u\n", "hello", -42, 42u);
+	info("ptr: %p hex: %x %08x %X\n", (void *)0x1234, 255, 255, 0xbeefu);
+	info("64: %llu %lld size: %zu long: %lu\n",
+	     (unsigned long long)1 << 40, -(1LL << 40),
+	     (size_t)123456, (unsigned long)99);
+	info("pad: [%-8s] [%5d] [%05u] [%c] %%\n", "ab", 7, 9u, 'z');
+	info("double: %f\n", 3.25);
+	info("null: %s\n", null_str);
+	info("user: %s\n", anon_id(userid_anon, "3c2a5a8b-d4a1-4ae5-9d3e"));
+	info("handler: %H\n", print_handler, (void *)"x");
+	info("long: %s\n", big.c_str());
+	warning("warn: %d\n", 1);
+	debug("debug: %d\n", 2);
+	loglv(LOG_LEVEL_INFO, "loglv: %s %d\n", "a", 3);
+}
+
+
+TEST_F(LogTest, async_matches_sync)
+{
+	std::vector<std::string> sync_msgs;
+	struct log_async_stats st;
+
+	log_all();
+	sync_msgs = msgs;
+	msgs.clear();
+
+	ASSERT_EQ(0, log_async_start(0));
+	ASSERT_TRUE(log_async_active());
+	log_all();
+	log_async_flush();
+	log_async_stop();
+	ASSERT_FALSE(log_async_active());
+
+	ASSERT_EQ(sync_msgs.size(), msgs.size());
+	for (size_t i = 0; i < msgs.size(); i++)
+		ASSERT_EQ(sync_msgs[i], msgs[i]);
+
+	log_async_get_stats(&st);
+	ASSERT_EQ(st.queued, st.dispatched);
+	ASSERT_GT(st.deferred, 0u);
+	ASSERT_GT(st.oversized, 0u);
+}
+
+
+static void *log_thread(void *arg)
+{
+	int id = *(int *)arg;
+
+	for (int i = 0; i < NUM_MSGS; i++)
+		info("thread %d msg %d\n", id, i);
+
+	return NULL;
+}
+
+
+TEST_F(LogTest, threads_keep_order)
+{
+	pthread_t tids[NUM_THREADS];
+	int ids[NUM_THREADS];
+	int next[NUM_THREADS] = {0};
+
+	ASSERT_EQ(0, log_async_start(1024));
+
+	for (int i = 0; i < NUM_THREADS; i++) {
+		ids[i] = i;
+		pthread_create(&tids[i], NULL, log_thread, &ids[i]);
+	}
+	for (int i = 0; i < NUM_THREADS; i++)
+		pthread_join(tids[i], NULL);
+
+	log_async_flush();
+	log_async_stop();
+
+	ASSERT_EQ((size_t)NUM_THREADS * NUM_MSGS, msgs.size());
+	for (size_t i = 0; i < msgs.size(); i++) {
+		int id, n;
+
+		ASSERT_EQ(2, sscanf(msgs[i].c_str(),
+				    "thread %d msg %d", &id, &n));
+		ASSERT_EQ(next[id], n);
+		next[id]++;
+	}
+}
+
+
+TEST_F(LogTest, full_ring_drops)
+{
+	struct log_async_stats st;
+	bool reported = false;
+
+	ASSERT_EQ(0, log_async_start(4));
+
+	/* stall the log thread inside the handler */
+	block = true;
+	info("first\n");
+	usleep(20000);
+
+	for (int i = 0; i < 20; i++)
+		info("info %d\n", i);
+
+	log_async_get_stats(&st);
+	ASSERT_GT(st.dropped[LOG_LEVEL_INFO], 0u);
+	ASSERT_EQ(0u, st.dropped[LOG_LEVEL_WARN]);
+
+	block = false;
+	log_async_flush();
+	log_async_stop();
+
+	for (size_t i = 0; i < msgs.size(); i++) {
+		if (msgs[i].find("log: dropped") == 0)
+			reported = true;
+	}
+	ASSERT_TRUE(reported);
+}
+
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static void log_sftlist_member(int i)
+{
+	char userid_anon[ANON_ID_LEN];
+	char clientid_anon[ANON_CLIENT_LEN];
+	char userid[64];
+
+	re_snprintf(userid, sizeof(userid),
+		    "a8c1e6c4-4bd5-4a34-8f1b-%012d@wire.com", i);
+
+	info("userlist(%p): update_from_sftlist found user %s.%s %s"
+	     "ssrca: %u ssrcv:%u incall_prev: %s\n",
+	     (void *)userid,
+	     anon_id(userid_anon, userid),
+	     anon_client(clientid_anon, "c5e7bd1f8a2d"),
+	     "7f8a3b2c1d0e9f8a7b6c5d4e3f2a1b0c",
+	     1000 + i, 2000 + i, "yes");
+}
+
+
+/* Per call latency, as seen by e.g. userlist_update_from_sftlist() */
+static void time_calls(int n, std::vector<uint64_t> &lat)
+{
+	lat.clear();
+	for (int i = 0; i < n; i++) {
+		uint64_t t = now_ns();
+
+		log_sftlist_member(i);
+		lat.push_back(now_ns() - t);
+	}
+	std::sort(lat.begin(), lat.end());
+}
+
+
+/* Benchmark, run with --gtest_also_run_disabled_tests */
+TEST_F(LogTest, DISABLED_caller_latency_perf)
+{
+	const int n = 2000;
+	struct log_async_stats st;
+	std::vector<uint64_t> lsync, lasync;
+
+	time_calls(n, lsync);
+	msgs.clear();
+
+	ASSERT_EQ(0, log_async_start(4096));
+	time_calls(n, lasync);
+
+	log_async_flush();
+	log_async_get_stats(&st);
+	log_async_stop();
+
+	ASSERT_EQ((size_t)n, msgs.size());
+
+	printf("log: info() caller latency: "
+	       "sync p50 %llu ns p99 %llu ns, "
+	       "async p50 %llu ns p99 %llu ns (max delay %u ms)\n",
+	       (unsigned long long)lsync[n / 2],
+	       (unsigned long long)lsync[n * 99 / 100],
+	       (unsigned long long)lasync[n / 2],
+	       (unsigned long long)lasync[n * 99 / 100],
+	       st.max_delay);
+}
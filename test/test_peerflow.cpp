@@ -0,0 +1,348 @@
+/*
+* Wire
+* Copyright (C) 2026 Wire Swiss GmbH
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <chrono>
+#include <re.h>
+#include <avs.h>
+#include <gtest/gtest.h>
+#include "ztest.h"
+
+
+struct mq_wait {
+	int data;
+	int data_at_close;
+	int closed;
+};
+
+static void close_handler(struct iflow *flow, int err, void *arg)
+{
+	struct mq_wait *mw = (struct mq_wait *)arg;
+
+	(void)flow;
+	(void)err;
+
+	mw->data_at_close = mw->data;
+	++mw->closed;
+	re_cancel();
+}
+
+static void dce_recv_handler(struct iflow *flow,
+			     const uint8_t *data, size_t len, void *arg)
+{
+	struct mq_wait *mw = (struct mq_wait *)arg;
+
+	(void)flow;
+	(void)data;
+	(void)len;
+
+	++mw->data;
+}
+
+
+static void cancel_handler(void *arg)
+{
+	(void)arg;
+
+	re_cancel();
+}
+
+
+class Peerflow : public ::testing::Test {
+
+public:
+	virtual void SetUp() override
+	{
+		int err;
+
+		err = peerflow_init();
+		ASSERT_TRUE(err == 0 || err == EALREADY);
+
+		memset(&mw, 0, sizeof(mw));
+		ASSERT_EQ(0, peerflow_alloc(&flow, "convid", "user", "client",
+					    ICALL_CONV_TYPE_ONEONONE,
+					    ICALL_CALL_TYPE_NORMAL,
+					    ICALL_VIDEO_STATE_STOPPED,
+					    NULL));
+		iflow_set_callbacks(flow,
+				    NULL,
+				    close_handler,
+				    NULL,
+				    NULL,
+				    NULL,
+				    NULL,
+				    NULL,
+				    dce_recv_handler,
+				    NULL,
+				    NULL,
+				    NULL,
+				    &mw);
+	}
+
+	virtual void TearDown() override
+	{
+		mem_deref(flow);
+	}
+
+protected:
+	struct iflow *flow = NULL;
+	struct mq_wait mw;
+};
+
+
+/* Data events are dropped when the main thread falls behind,
+ * a close queued after them must still arrive, after the data.
+ */
+TEST_F(Peerflow, mq_full_keeps_close)
+{
+	uint8_t data[64];
+	uint64_t overflowed0, overflowed1;
+	int queued = 0;
+	int dropped = 0;
+
+	memset(data, 0x2a, sizeof(data));
+	peerflow_mq_stats(NULL, NULL, &overflowed0);
+
+	/* The main loop is not running, nothing drains the ring */
+	for (int i = 0; i < 4096; ++i) {
+		int err = peerflow_inject_dce_data(flow, data, sizeof(data));
+
+		if (err == EOVERFLOW)
+			++dropped;
+		else if (!err)
+			++queued;
+	}
+	ASSERT_GT(dropped, 0);
+
+	ASSERT_EQ(0, peerflow_inject_close(flow, EPIPE));
+	peerflow_mq_stats(NULL, NULL, &overflowed1);
+	ASSERT_EQ(overflowed0 + 1, overflowed1);
+
+	ASSERT_EQ(0, re_main_wait(5000));
+	ASSERT_EQ(1, mw.closed);
+	ASSERT_EQ(queued, mw.data_at_close);
+}
+
+
+/* Events for a flow that is destroyed are never dispatched */
+TEST_F(Peerflow, mq_discard_on_destroy)
+{
+	uint8_t data[16];
+	struct tmr tmr;
+
+	memset(data, 0, sizeof(data));
+	for (int i = 0; i < 8; ++i)
+		ASSERT_EQ(0, peerflow_inject_dce_data(flow, data,
+						      sizeof(data)));
+	ASSERT_EQ(0, peerflow_inject_close(flow, EPIPE));
+
+	flow = (struct iflow *)mem_deref(flow);
+
+	tmr_init(&tmr);
+	tmr_start(&tmr, 100, cancel_handler, NULL);
+	re_main_wait(1000);
+	tmr_cancel(&tmr);
+
+	ASSERT_EQ(0, mw.data);
+	ASSERT_EQ(0, mw.closed);
+}
+
+
+#define LOOPBACK_MSGS     512  /* below the event ring size */
+#define LOOPBACK_BATCH     16
+#define LOOPBACK_MSG_LEN   64
+
+struct loopback {
+	struct iflow *flow;
+	int gathered;
+	int estab;
+
+	int recv;
+	int expected;
+};
+
+static uint64_t now_us(void)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void lb_gather_handler(struct iflow *flow, void *arg)
+{
+	struct loopback *lb = (struct loopback *)arg;
+
+	(void)flow;
+
+	++lb->gathered;
+	re_cancel();
+}
+
+static void lb_dce_estab_handler(struct iflow *flow, void *arg)
+{
+	struct loopback *lb = (struct loopback *)arg;
+
+	(void)flow;
+
+	++lb->estab;
+	re_cancel();
+}
+
+static void lb_dce_recv_handler(struct iflow *flow,
+				const uint8_t *data, size_t len, void *arg)
+{
+	struct loopback *lb = (struct loopback *)arg;
+
+	(void)flow;
+	(void)data;
+
+	if (len != LOOPBACK_MSG_LEN)
+		return;
+
+	if (++lb->recv >= lb->expected)
+		re_cancel();
+}
+
+static bool lb_wait(const int *counter, int n, uint32_t ms)
+{
+	uint64_t end = tmr_jiffies() + ms;
+
+	while (*counter < n) {
+		uint64_t now = tmr_jiffies();
+
+		if (now >= end)
+			break;
+		re_main_wait((uint32_t)(end - now));
+	}
+
+	return *counter >= n;
+}
+
+static int lb_alloc(struct loopback *lb, const char *userid)
+{
+	int err;
+
+	memset(lb, 0, sizeof(*lb));
+
+	err = peerflow_alloc(&lb->flow, "loopback", userid, "client",
+			     ICALL_CONV_TYPE_ONEONONE,
+			     ICALL_CALL_TYPE_FORCED_AUDIO,
+			     ICALL_VIDEO_STATE_STOPPED,
+			     NULL);
+	if (err)
+		return err;
+
+	iflow_set_callbacks(lb->flow,
+			    NULL,
+			    NULL,
+			    NULL,
+			    NULL,
+			    NULL,
+			    lb_gather_handler,
+			    lb_dce_estab_handler,
+			    lb_dce_recv_handler,
+			    NULL,
+			    NULL,
+			    NULL,
+			    lb);
+
+	return 0;
+}
+
+static void lb_write(struct mbuf *mb)
+{
+	uint8_t pad[LOOPBACK_MSG_LEN - sizeof(uint64_t)];
+	uint64_t ts = now_us();
+
+	memset(pad, 0x2a, sizeof(pad));
+	mb->pos = 0;
+	mb->end = 0;
+	mbuf_write_mem(mb, (const uint8_t *)&ts, sizeof(ts));
+	mbuf_write_mem(mb, pad, sizeof(pad));
+	mb->pos = 0;
+}
+
+/* Send LOOPBACK_MSGS from a to b, batch at a time, and wait
+ * for b to get all of them.
+ */
+static void lb_run(struct loopback *a, struct loopback *b, size_t batch)
+{
+	struct mbuf *mbv[LOOPBACK_BATCH];
+	size_t i;
+	int sent = 0;
+
+	b->recv = 0;
+	b->expected = LOOPBACK_MSGS;
+
+	for (i = 0; i < batch; ++i) {
+		mbv[i] = mbuf_alloc(LOOPBACK_MSG_LEN);
+		ASSERT_TRUE(mbv[i] != NULL);
+	}
+
+	while (sent < LOOPBACK_MSGS) {
+		for (i = 0; i < batch; ++i)
+			lb_write(mbv[i]);
+
+		if (batch == 1) {
+			ASSERT_EQ(0, a->flow->dce_send(a->flow,
+						       mbuf_buf(mbv[0]),
+						       mbuf_get_left(mbv[0])));
+		}
+		else {
+			ASSERT_EQ(0, iflow_dce_send_batch(a->flow,
+							  mbv, batch));
+		}
+		sent += batch;
+	}
+
+	ASSERT_TRUE(lb_wait(&b->recv, LOOPBACK_MSGS, 10000));
+
+	for (i = 0; i < batch; ++i)
+		mem_deref(mbv[i]);
+
+}
+
+
+/* Two flows connected back to back in process, over host candidates */
+TEST(PeerflowLoopback, dce_send_batch)
+{
+	struct loopback a, b;
+	char sdp[16384];
+	int err;
+
+	err = peerflow_init();
+	ASSERT_TRUE(err == 0 || err == EALREADY);
+
+	ASSERT_EQ(0, lb_alloc(&a, "user_a"));
+	ASSERT_EQ(0, lb_alloc(&b, "user_b"));
+
+	ASSERT_EQ(0, a.flow->gather_all_turn(a.flow, true));
+	ASSERT_TRUE(lb_wait(&a.gathered, 1, 10000));
+	ASSERT_EQ(0, a.flow->generate_offer(a.flow, sdp, sizeof(sdp)));
+
+	ASSERT_EQ(0, b.flow->handle_offer(b.flow, sdp));
+	ASSERT_EQ(0, b.flow->gather_all_turn(b.flow, false));
+	ASSERT_TRUE(lb_wait(&b.gathered, 1, 10000));
+	ASSERT_EQ(0, b.flow->generate_answer(b.flow, sdp, sizeof(sdp)));
+
+	ASSERT_EQ(0, a.flow->handle_answer(a.flow, sdp));
+	ASSERT_TRUE(lb_wait(&a.estab, 1, 10000));
+
+	lb_run(&a, &b, 1);
+	lb_run(&a, &b, LOOPBACK_BATCH);
+
+	a.flow->close(a.flow);
+	b.flow->close(b.flow);
+}
@@ -18,11 +18,14 @@
 
 #include "re.h"
 #include "avs_stats.h"
+#include "avs_jzon.h"
 #include "api/stats/rtc_stats_collector_callback.h"
 #include "api/stats/rtcstats_objects.h"
 
 #include <gtest/gtest.h>
 #include <fstream>
+#include <sstream>
+#include <sys/time.h>
 
 using namespace webrtc;
 
@@ -48,7 +51,8 @@ bool operator==(const stats_report& lhs, const stats_report& rhs) {
 			lhs.rtt == rhs.rtt &&
 			lhs.jitter == rhs.jitter &&
 			lhs.packets == rhs.packets &&
-			lhs.packets_per_sec == rhs.packets_per_sec;
+			lhs.packets_per_sec == rhs.packets_per_sec &&
+			lhs.encode_time_us == rhs.encode_time_us;
 }
 
 const auto zero_report = stats_report {};
@@ -646,3 +650,241 @@ TEST(StatsSamples, single_item_from_web)
 	expected_report.packets.audio.tx = 16;
 	EXPECT_EQ(sr,expected_report);
 }
+
+
+static std::string video_encode_json(int frames, double total)
+{
+	char buf[256];
+
+	snprintf(buf, sizeof(buf),
+		 "[{\"id\":\"OTvideo1V1\",\"type\":\"outbound-rtp\","
+		 "\"kind\":\"video\",\"packetsSent\":10,"
+		 "\"framesEncoded\":%d,\"totalEncodeTime\":%f}]",
+		 frames, total);
+
+	return std::string(buf);
+}
+
+TEST(StatsSamples, encode_time_per_interval)
+{
+	avs_stats *stats;
+	stats_report sr;
+
+	stats_alloc(&stats, NULL);
+
+	// 100 frames in 0.5s: 5ms each
+	stats_update(stats, video_encode_json(100, 0.5).c_str());
+	stats_get_report(stats, &sr);
+	EXPECT_EQ(sr.encode_time_us, (uint32_t)5000);
+
+	// next 50 frames took 1s more: 20ms each
+	stats_update(stats, video_encode_json(150, 1.5).c_str());
+	stats_get_report(stats, &sr);
+	EXPECT_EQ(sr.encode_time_us, (uint32_t)20000);
+
+	// nothing encoded since
+	stats_update(stats, video_encode_json(150, 1.5).c_str());
+	stats_get_report(stats, &sr);
+	EXPECT_EQ(sr.encode_time_us, (uint32_t)0);
+
+	mem_deref(stats);
+}
+
+
+/* More ICE entries than are kept inline, the selected pair last */
+static std::string many_pairs_json(int n)
+{
+	std::string json = "[{\"id\":\"T1\",\"type\":\"transport\","
+		"\"selectedCandidatePairId\":\"P" + std::to_string(n - 1) + "\"}";
+
+	for (int i = 0; i < n; ++i) {
+		bool last = i == n - 1;
+		std::string id = std::to_string(i);
+
+		json += ",{\"id\":\"L" + id + "\",\"type\":\"local-candidate\","
+			"\"protocol\":\"" + (last ? "tcp" : "udp") + "\","
+			"\"candidateType\":\"" + (last ? "relay" : "host") + "\"}";
+		json += ",{\"id\":\"P" + id + "\",\"type\":\"candidate-pair\","
+			"\"localCandidateId\":\"L" + id + "\","
+			"\"state\":\"succeeded\","
+			"\"nominated\":" + (last ? "true" : "false") + ","
+			"\"currentRoundTripTime\":" + (last ? "0.05" : "0.5") + "}";
+	}
+	json += "]";
+
+	return json;
+}
+
+TEST(StatsSamples, many_candidate_pairs)
+{
+	avs_stats *stats;
+	stats_report sr;
+
+	stats_alloc(&stats, NULL);
+
+	ASSERT_EQ(0, stats_update(stats, many_pairs_json(100).c_str()));
+	stats_get_report(stats, &sr);
+
+	EXPECT_EQ(50u, sr.rtt.tx);
+	EXPECT_EQ(STATS_PROTO_TCP, sr.proto);
+	EXPECT_EQ(STATS_CAND_RELAY, sr.cand);
+
+	mem_deref(stats);
+}
+
+
+// ----------------------------------------- Recorded reports ---------------------------------------
+
+static std::string load_report(const char *path)
+{
+	std::ifstream in(path);
+	std::stringstream ss;
+
+	ss << in.rdbuf();
+
+	return ss.str();
+}
+
+/* Repeat the entries of a recorded report, as seen in group calls */
+static std::string repeat_report(const std::string &report, int n)
+{
+	std::string body = report.substr(1, report.rfind(']') - 1);
+	std::string out = "[";
+
+	for (int i = 0; i < n; ++i) {
+		if (i)
+			out.append(",");
+		out.append(body);
+	}
+	out.append("]");
+
+	return out;
+}
+
+static float elapsed_us(const struct timeval *start)
+{
+	struct timeval now, res;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, start, &res);
+
+	return (float)res.tv_sec * 1000000.0f + res.tv_usec;
+}
+
+/* What stats_update() used to do before reading a single field */
+static void decode_tree(const std::string &report)
+{
+	struct json_object *jobj;
+
+	if (jzon_decode(&jobj, report.c_str(), report.size()))
+		return;
+
+	int items = json_object_array_length(jobj);
+	for (int i = 0; i < items; ++i) {
+		struct json_object *jitem;
+
+		jitem = json_object_array_get_idx(jobj, i);
+		if (!jitem)
+			continue;
+
+		jzon_str(jitem, "type");
+	}
+
+	mem_deref(jobj);
+}
+
+TEST(StatsSamples, recorded_report)
+{
+	std::string report = load_report("./test/data/sample_webrtc_report.json");
+	avs_stats *stats;
+	stats_report sr;
+
+	ASSERT_FALSE(report.empty());
+
+	stats_alloc(&stats, NULL);
+
+	ASSERT_EQ(0, stats_update(stats, report.c_str()));
+	stats_get_report(stats, &sr);
+
+	mem_deref(stats);
+
+	EXPECT_EQ(STATS_PROTO_UDP, sr.proto);
+	EXPECT_EQ(STATS_CAND_PRFLX, sr.cand);
+	EXPECT_EQ(440u, sr.packets.audio.rx);
+	EXPECT_EQ(461u, sr.packets.audio.tx);
+	EXPECT_EQ(3151u, sr.packets.video.rx);
+	EXPECT_EQ(3519u, sr.packets.video.tx);
+	EXPECT_EQ(1u, sr.packets.lost.rx);
+	EXPECT_EQ(0u, sr.packets.lost.tx);
+	EXPECT_EQ(6u, sr.jitter.audio.rx);
+	EXPECT_EQ(4u, sr.jitter.audio.tx);
+	EXPECT_EQ(14u, sr.jitter.video.rx);
+	EXPECT_EQ(12u, sr.jitter.video.tx);
+	EXPECT_EQ(26u, sr.rtt.rx);
+	EXPECT_EQ(24u, sr.rtt.tx);
+	EXPECT_EQ(0, sr.audio_level);
+}
+
+/* Benchmark, run with --gtest_also_run_disabled_tests */
+TEST(StatsSamples, DISABLED_update_speed)
+{
+	std::string recorded = load_report("./test/data/sample_webrtc_report.json");
+	const int sizes[] = {1, 4, 16};
+	const int rounds = 200;
+
+	ASSERT_FALSE(recorded.empty());
+
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+		std::string report = repeat_report(recorded, sizes[s]);
+		avs_stats *stats;
+		struct timeval start;
+		float t_tree, t_update;
+
+		stats_alloc(&stats, NULL);
+
+		gettimeofday(&start, NULL);
+		for (int r = 0; r < rounds; ++r)
+			decode_tree(report);
+		t_tree = elapsed_us(&start) / rounds;
+
+		gettimeofday(&start, NULL);
+		for (int r = 0; r < rounds; ++r)
+			ASSERT_EQ(0, stats_update(stats, report.c_str()));
+		t_update = elapsed_us(&start) / rounds;
+
+		printf("stats: %6zu bytes: jzon tree %.1f us stats_update %.1f us\n",
+		       report.size(), t_tree, t_update);
+
+		mem_deref(stats);
+	}
+}
+
+TEST(StatsLatency, buckets)
+{
+	struct stats_latency sl = {};
+
+	ASSERT_EQ(stats_latency_bound(0), 5u);
+	ASSERT_EQ(stats_latency_bound(STATS_LAT_BUCKETS - 2), 1280u);
+	ASSERT_EQ(stats_latency_bound(STATS_LAT_BUCKETS - 1), UINT32_MAX);
+
+	stats_latency_add(&sl, 0, -1);
+	stats_latency_add(&sl, 4, 0);
+	stats_latency_add(&sl, 5, 1);
+	stats_latency_add(&sl, 100, 95);
+	stats_latency_add(&sl, 5000, 4900);
+	stats_latency_add(&sl, -20, -1);
+
+	ASSERT_EQ(sl.frames, 6u);
+	ASSERT_EQ(sl.skewed, 1u);
+	ASSERT_EQ(sl.max_ms, 5000u);
+	ASSERT_EQ(sl.sum_ms, 5109u);
+
+	ASSERT_EQ(sl.latency[0], 3u);
+	ASSERT_EQ(sl.latency[1], 1u);
+	ASSERT_EQ(sl.latency[5], 1u); /* 80..160 */
+	ASSERT_EQ(sl.latency[STATS_LAT_BUCKETS - 1], 1u);
+
+	ASSERT_EQ(sl.jitter[0], 2u);
+	ASSERT_EQ(sl.jitter[5], 1u);
+	ASSERT_EQ(sl.jitter[STATS_LAT_BUCKETS - 1], 1u);
+}
@@ -0,0 +1,341 @@
+/*
+* Wire
+* Copyright (C) 2026 Wire Swiss GmbH
+*
+* This program is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <sys/time.h>
+#include <re.h>
+#include <avs.h>
+#include <gtest/gtest.h>
+
+
+/* A synthetic TURN-TCP byte stream of mostly ChannelData with
+ * some STUN messages, as seen when relaying media.
+ */
+struct tcp_stream {
+	struct mbuf *mb;
+	size_t nframes;
+	size_t payload;
+};
+
+static void stream_build(struct tcp_stream *ts, size_t bytes)
+{
+	uint8_t body[1500];
+
+	ts->mb = mbuf_alloc(bytes + 2048);
+	ts->nframes = 0;
+	ts->payload = 0;
+
+	while (ts->mb->end < bytes) {
+		size_t len;
+
+		if (rand_u32() % 50 == 0) {
+			/* STUN, Send indication sized */
+			len = 4 * (1 + rand_u32() % 64);
+			mbuf_write_u16(ts->mb, htons(0x0016));
+			mbuf_write_u16(ts->mb, htons(len));
+			mbuf_write_u32(ts->mb, htonl(STUN_MAGIC_COOKIE));
+			mbuf_fill(ts->mb, (uint8_t)ts->nframes, 12);
+			ts->payload += STUN_HEADER_SIZE + len;
+		}
+		else {
+			/* ChannelData, audio to video packet sized */
+			len = 50 + rand_u32() % 1150;
+			mbuf_write_u16(ts->mb, htons(0x4000));
+			mbuf_write_u16(ts->mb, htons(len));
+			ts->payload += 4 + len;
+		}
+
+		memset(body, (uint8_t)ts->nframes, len);
+		mbuf_write_mem(ts->mb, body, len);
+		while (ts->mb->end & 3)
+			mbuf_write_u8(ts->mb, 0);
+
+		ts->nframes++;
+	}
+
+	ts->mb->pos = 0;
+}
+
+struct frame_check {
+	size_t frames;
+	size_t bytes;
+	bool ok;
+};
+
+static int frame_handler(struct mbuf *mb, void *arg)
+{
+	struct frame_check *fc = (struct frame_check *)arg;
+	const uint8_t *p = mbuf_buf(mb);
+	uint16_t typ = p[0] << 8 | p[1];
+	size_t hdr = typ < 0x4000 ? 8 : 4;
+	uint8_t fill = (uint8_t)fc->frames;
+
+	/* Every frame is filled with its index after the type/length */
+	for (size_t i = hdr; i < mbuf_get_left(mb); i++) {
+		if (p[i] != fill) {
+			fc->ok = false;
+			break;
+		}
+	}
+
+	fc->frames++;
+	fc->bytes += mbuf_get_left(mb);
+
+	return 0;
+}
+
+/* Feed the stream in segments of 1 to maxseg bytes */
+static int stream_push(struct turn_tcpbuf *tb, const struct tcp_stream *ts,
+		       size_t maxseg, turn_tcpbuf_frame_h *frameh, void *arg)
+{
+	size_t pos = 0;
+	int err = 0;
+
+	while (pos < ts->mb->end && !err) {
+		size_t n = 1 + rand_u32() % maxseg;
+		struct mbuf *seg;
+
+		n = MIN(n, ts->mb->end - pos);
+		seg = mbuf_alloc(n);
+		mbuf_write_mem(seg, ts->mb->buf + pos, n);
+		seg->pos = 0;
+
+		err = turn_tcpbuf_recv(tb, seg, frameh, arg);
+
+		mem_deref(seg);
+		pos += n;
+	}
+
+	return err;
+}
+
+TEST(turn_tcp, single_bytes)
+{
+	struct turn_tcpbuf *tb = NULL;
+	struct frame_check fc = {0, 0, true};
+	struct tcp_stream ts;
+
+	stream_build(&ts, 20000);
+	ASSERT_EQ(0, turn_tcpbuf_alloc(&tb));
+
+	ASSERT_EQ(0, stream_push(tb, &ts, 1, frame_handler, &fc));
+	ASSERT_TRUE(fc.ok);
+	ASSERT_EQ(fc.frames, ts.nframes);
+	ASSERT_EQ(fc.bytes, ts.payload);
+
+	mem_deref(tb);
+	mem_deref(ts.mb);
+}
+
+TEST(turn_tcp, random_segments)
+{
+	struct turn_tcpbuf *tb = NULL;
+	struct turn_tcpbuf_stats st;
+	struct frame_check fc = {0, 0, true};
+	struct tcp_stream ts;
+
+	stream_build(&ts, 1000000);
+	ASSERT_EQ(0, turn_tcpbuf_alloc(&tb));
+
+	ASSERT_EQ(0, stream_push(tb, &ts, 4000, frame_handler, &fc));
+	ASSERT_TRUE(fc.ok);
+	ASSERT_EQ(fc.frames, ts.nframes);
+	ASSERT_EQ(fc.bytes, ts.payload);
+
+	/* Only frames split across segments are staged */
+	turn_tcpbuf_get_stats(tb, &st);
+	ASSERT_EQ(st.frames, ts.nframes);
+	ASSERT_LT(st.staged, ts.nframes);
+	ASSERT_LT(st.copied, ts.mb->end / 2);
+	ASSERT_LE(st.size_max, 4096u);
+
+	mem_deref(tb);
+	mem_deref(ts.mb);
+}
+
+TEST(turn_tcp, bad_message)
+{
+	struct turn_tcpbuf *tb = NULL;
+	struct frame_check fc = {0, 0, true};
+	struct mbuf *mb;
+
+	ASSERT_EQ(0, turn_tcpbuf_alloc(&tb));
+
+	mb = mbuf_alloc(8);
+	mbuf_write_u32(mb, htonl(0x80000004));
+	mbuf_write_u32(mb, 0);
+	mb->pos = 0;
+
+	ASSERT_EQ(EBADMSG, turn_tcpbuf_recv(tb, mb, frame_handler, &fc));
+	ASSERT_EQ(fc.frames, 0u);
+
+	mem_deref(mb);
+	mem_deref(tb);
+}
+
+
+/* The previous approach, appending every segment to one buffer and
+ * framing from there, for comparison.
+ */
+struct append_buf {
+	struct mbuf *mb;
+	size_t copied;
+};
+
+static int append_recv(struct append_buf *ab, struct mbuf *mb,
+		       turn_tcpbuf_frame_h *frameh, void *arg)
+{
+	if (ab->mb) {
+		size_t pos = ab->mb->pos;
+
+		ab->mb->pos = ab->mb->end;
+		mbuf_write_mem(ab->mb, mbuf_buf(mb), mbuf_get_left(mb));
+		ab->copied += mbuf_get_left(mb);
+		ab->mb->pos = pos;
+	}
+	else {
+		ab->mb = (struct mbuf *)mem_ref(mb);
+	}
+
+	for (;;) {
+		size_t len, pos, end;
+		uint16_t typ;
+
+		if (mbuf_get_left(ab->mb) < 4)
+			break;
+
+		typ = ntohs(mbuf_read_u16(ab->mb));
+		len = ntohs(mbuf_read_u16(ab->mb));
+		len += typ < 0x4000 ? STUN_HEADER_SIZE : 4;
+		ab->mb->pos -= 4;
+
+		if (mbuf_get_left(ab->mb) < len)
+			break;
+
+		pos = ab->mb->pos;
+		end = ab->mb->end;
+		ab->mb->end = pos + len;
+		frameh(ab->mb, arg);
+
+		while (len & 0x03)
+			++len;
+
+		ab->mb->pos = pos + len;
+		ab->mb->end = end;
+
+		if (ab->mb->pos >= ab->mb->end) {
+			ab->mb = (struct mbuf *)mem_deref(ab->mb);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static int count_handler(struct mbuf *mb, void *arg)
+{
+	size_t *bytes = (size_t *)arg;
+
+	*bytes += mbuf_get_left(mb);
+
+	return 0;
+}
+
+static float elapsed_ms(const struct timeval *start)
+{
+	struct timeval now, res;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, start, &res);
+
+	return (float)res.tv_sec * 1000.0f + res.tv_usec / 1000.0f;
+}
+
+/* Benchmark, run with --gtest_also_run_disabled_tests */
+TEST(turn_tcp, DISABLED_reassembly_perf)
+{
+	/* Segment sizes of a slow link, a typical MSS and coalesced reads */
+	const size_t maxsegs[] = {500, 1400, 16000};
+	struct tcp_stream ts;
+	struct timeval start;
+
+	stream_build(&ts, 32 * 1024 * 1024);
+
+	for (size_t i = 0; i < ARRAY_SIZE(maxsegs); i++) {
+		struct turn_tcpbuf *tb = NULL;
+		struct turn_tcpbuf_stats st;
+		struct append_buf ab = {NULL, 0};
+		size_t pos = 0, bytes = 0, abytes = 0;
+		size_t abuf_max = 0;
+		float t, ta;
+
+		ASSERT_EQ(0, turn_tcpbuf_alloc(&tb));
+
+		/* Same segment boundaries for both */
+		gettimeofday(&start, NULL);
+		srand(1);
+		while (pos < ts.mb->end) {
+			size_t n = MIN(1 + (size_t)rand() % maxsegs[i],
+				       ts.mb->end - pos);
+			struct mbuf *seg = mbuf_alloc(n);
+
+			mbuf_write_mem(seg, ts.mb->buf + pos, n);
+			seg->pos = 0;
+			turn_tcpbuf_recv(tb, seg, count_handler, &bytes);
+			mem_deref(seg);
+			pos += n;
+		}
+		t = elapsed_ms(&start);
+
+		pos = 0;
+		gettimeofday(&start, NULL);
+		srand(1);
+		while (pos < ts.mb->end) {
+			size_t n = MIN(1 + (size_t)rand() % maxsegs[i],
+				       ts.mb->end - pos);
+			struct mbuf *seg = mbuf_alloc(n);
+
+			mbuf_write_mem(seg, ts.mb->buf + pos, n);
+			seg->pos = 0;
+			append_recv(&ab, seg, count_handler, &abytes);
+			if (ab.mb)
+				abuf_max = MAX(abuf_max, ab.mb->size);
+			mem_deref(seg);
+			pos += n;
+		}
+		ta = elapsed_ms(&start);
+		mem_deref(ab.mb);
+
+		ASSERT_EQ(bytes, ts.payload);
+		ASSERT_EQ(abytes, ts.payload);
+
+		turn_tcpbuf_get_stats(tb, &st);
+		printf("turn_tcp: segments <= %5zu: tcpbuf %.1f MB/s "
+		       "copied %.1f%% buf %zu, append %.1f MB/s "
+		       "copied %.1f%% buf %zu\n",
+		       maxsegs[i],
+		       ts.mb->end / 1000.0f / t,
+		       100.0f * st.copied / ts.mb->end,
+		       st.size_max,
+		       ts.mb->end / 1000.0f / ta,
+		       100.0f * ab.copied / ts.mb->end,
+		       abuf_max);
+
+		mem_deref(tb);
+	}
+
+	mem_deref(ts.mb);
+}
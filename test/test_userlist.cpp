@@ -15,6 +15,7 @@
 * You should have received a copy of the GNU General Public License
 * along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
+#include <sys/time.h>
 #include <re.h>
 #include <avs.h>
 #include "avs_wcall.h"
@@ -573,6 +574,52 @@ TEST_F(UserlistTest, kg_change)
 	users_synced = false;
 }
 
+TEST_F(UserlistTest, ciphers)
+{
+	uint8_t secret1[32] = "secret1                        ";
+	struct userinfo *u;
+	bool changed = false;
+	bool self_changed = false;
+	bool missing = false;
+	bool removed = false;
+	uint32_t joins;
+
+	InitSftList(&sftlist2, 1, 2, secret1, sizeof(secret1));
+	InitSftList(&sftlist3, 0, 3, secret1, sizeof(secret1));
+	userlist_set_secret(list, secret1, sizeof(secret1));
+
+	userlist_update_from_selist(list, &selist3, 0, secret1, sizeof(secret1), &changed, &removed);
+
+	/* sftlist: [user_00001,user_00002] */
+	userlist_update_from_sftlist(list, &sftlist2, &changed, &self_changed, &missing);
+	ASSERT_EQ(list->joins, 2u);
+	ASSERT_EQ(userlist_get_ciphers(list), 0u);
+
+	u = userlist_find_by_real(list, "user_00001", "client_00001");
+	ASSERT_TRUE(u != NULL);
+	u->ciphers = 3;
+	ASSERT_EQ(userlist_get_ciphers(list), 0u);
+
+	u = userlist_find_by_real(list, "user_00002", "client_00002");
+	ASSERT_TRUE(u != NULL);
+	u->ciphers = 1;
+	ASSERT_EQ(userlist_get_ciphers(list), 1u);
+	u->ciphers = 3;
+	ASSERT_EQ(userlist_get_ciphers(list), 3u);
+
+	/* user_00000 joins without announcing */
+	joins = list->joins;
+	userlist_update_from_sftlist(list, &sftlist3, &changed, &self_changed, &missing);
+	ASSERT_EQ(list->joins, joins + 1);
+	ASSERT_EQ(userlist_get_ciphers(list), 0u);
+
+	/* and leaves again */
+	joins = list->joins;
+	userlist_update_from_sftlist(list, &sftlist2, &changed, &self_changed, &missing);
+	ASSERT_EQ(list->joins, joins);
+	ASSERT_EQ(userlist_get_ciphers(list), 3u);
+}
+
 TEST_F(UserlistTest, epoch_breakout)
 {
 	uint8_t secret1[32] = "secret1                        ";
@@ -929,3 +976,84 @@ TEST_F(UserlistTest, get_partlist)
 	mem_deref(userid_hash);
 }
 
+
+static float elapsed_us(const struct timeval *start)
+{
+	struct timeval now, res;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, start, &res);
+
+	return (float)res.tv_sec * 1000000.0f + res.tv_usec;
+}
+
+/* Benchmark, run with --gtest_also_run_disabled_tests */
+TEST_F(UserlistTest, DISABLED_update_scaling)
+{
+	uint8_t secret1[32] = "secret1                        ";
+	const size_t counts[] = {10, 100, 500};
+	const int rounds = 50;
+
+	for (size_t c = 0; c < ARRAY_SIZE(counts); c++) {
+		struct userlist *ul = NULL;
+		struct list clientl = LIST_INIT;
+		struct list sftl = LIST_INIT;
+		struct list levell = LIST_INIT;
+		struct timeval start;
+		size_t n = counts[c];
+		bool changed, self_changed, missing, removed;
+		float t_sft, t_level;
+
+		ASSERT_EQ(userlist_alloc(&ul,
+					 "userid_self",
+					 "clientid_self",
+					 NULL, NULL, NULL, NULL, NULL,
+					 NULL), 0);
+
+		for (size_t i = 0; i < n; i++) {
+			char userid[ECONN_ID_LEN];
+			char clientid[ECONN_ID_LEN];
+			struct icall_client *cli;
+
+			snprintf(userid, ECONN_ID_LEN-1, "user_%05zu", i);
+			snprintf(clientid, ECONN_ID_LEN-1, "client_%05zu", i);
+			cli = icall_client_alloc(userid, clientid);
+			cli->in_subconv = true;
+			list_append(&clientl, &cli->le, cli);
+		}
+
+		InitSftList(&sftl, 0, n, secret1, sizeof(secret1));
+		InitAudioLevelList(&levell, 0, n, n / 10);
+
+		userlist_set_secret(ul, secret1, sizeof(secret1));
+		userlist_update_from_selist(ul, &clientl, 1,
+					    secret1, sizeof(secret1),
+					    &changed, &removed);
+		ASSERT_EQ(userlist_get_count(ul), n);
+
+		gettimeofday(&start, NULL);
+		for (int r = 0; r < rounds; r++) {
+			ASSERT_EQ(userlist_update_from_sftlist(ul, &sftl,
+							       &changed,
+							       &self_changed,
+							       &missing), 0);
+			ASSERT_FALSE(missing);
+		}
+		t_sft = elapsed_us(&start) / rounds;
+
+		gettimeofday(&start, NULL);
+		for (int r = 0; r < rounds; r++)
+			userlist_update_audio_level(ul, &levell, &changed);
+		t_level = elapsed_us(&start) / rounds;
+
+		ASSERT_EQ(userlist_incall_count(ul), n);
+
+		printf("userlist: %3zu participants: update_from_sftlist %.1f us "
+		       "update_audio_level %.1f us\n", n, t_sft, t_level);
+
+		list_flush(&levell);
+		list_flush(&sftl);
+		list_flush(&clientl);
+		mem_deref(ul);
+	}
+}
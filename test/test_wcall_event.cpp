@@ -0,0 +1,289 @@
+/*
+ * Wire
+ * Copyright (C) 2025 Wire Swiss GmbH
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <re.h>
+#include <avs.h>
+#include <avs_wcall.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+
+#define TIME_NOW 100000
+
+struct event_counts {
+	int incoming;
+	int missed;
+	int closed;
+	int last_reason;
+};
+
+static void incoming_handler(const char *convid, uint32_t msg_time,
+			     const char *userid, const char *clientid,
+			     int video_call, int should_ring, int conv_type,
+			     void *arg)
+{
+	struct event_counts *ec = (struct event_counts *)arg;
+
+	++ec->incoming;
+}
+
+static void missed_handler(const char *convid, uint32_t msg_time,
+			   const char *userid, const char *clientid,
+			   int video_call, void *arg)
+{
+	struct event_counts *ec = (struct event_counts *)arg;
+
+	++ec->missed;
+}
+
+static void close_handler(int reason, const char *convid, uint32_t msg_time,
+			  const char *userid, const char *clientid, void *arg)
+{
+	struct event_counts *ec = (struct event_counts *)arg;
+
+	++ec->closed;
+	ec->last_reason = reason;
+}
+
+static std::string encode_message(enum econn_msg type, bool resp)
+{
+	struct econn_message *msg;
+	std::string res;
+	char *str = NULL;
+
+	msg = econn_message_alloc();
+	econn_message_init(msg, type, "sessid");
+	msg->resp = resp;
+
+	if (type == ECONN_SETUP) {
+		str_dup(&msg->u.setup.sdp_msg, "v=0");
+		econn_props_alloc(&msg->u.setup.props, NULL);
+		econn_props_add(msg->u.setup.props, "videosend", "false");
+	}
+
+	if (0 == econn_message_encode(&str, msg))
+		res = str;
+
+	mem_deref(str);
+	mem_deref(msg);
+
+	return res;
+}
+
+static struct wcall_event_msg make_msg(const std::string &payload,
+				       uint32_t msg_time,
+				       const char *convid,
+				       const char *userid)
+{
+	struct wcall_event_msg em;
+
+	memset(&em, 0, sizeof(em));
+	em.buf = (const uint8_t *)payload.c_str();
+	em.len = payload.size();
+	em.curr_time = TIME_NOW;
+	em.msg_time = msg_time;
+	em.convid = convid;
+	em.userid = userid;
+	em.clientid = "caller_client";
+	em.conv_type = WCALL_CONV_TYPE_ONEONONE;
+
+	return em;
+}
+
+static WUSER_HANDLE event_user(const char *userid, struct event_counts *ec)
+{
+	memset(ec, 0, sizeof(*ec));
+
+	return wcall_event_create(userid, "self_client",
+				  incoming_handler,
+				  missed_handler,
+				  close_handler,
+				  ec);
+}
+
+
+TEST(wcall_event, batch_coalesces_per_conversation)
+{
+	std::string setup = encode_message(ECONN_SETUP, false);
+	std::string cancel = encode_message(ECONN_CANCEL, false);
+	std::vector<struct wcall_event_msg> msgv;
+	struct event_counts ec;
+	WUSER_HANDLE wuser;
+
+	ASSERT_FALSE(setup.empty());
+	ASSERT_FALSE(cancel.empty());
+
+	wuser = event_user("batch_self", &ec);
+	ASSERT_NE(WUSER_INVALID_HANDLE, wuser);
+
+	/* rang and was cancelled: missed */
+	msgv.push_back(make_msg(setup, TIME_NOW - 5, "conv_a", "user_a"));
+	msgv.push_back(make_msg(cancel, TIME_NOW - 4, "conv_a", "user_a"));
+
+	/* rang twice: a single incoming */
+	msgv.push_back(make_msg(setup, TIME_NOW - 5, "conv_b", "user_b"));
+	msgv.push_back(make_msg(setup, TIME_NOW - 2, "conv_b", "user_b"));
+
+	/* cancelled, then rang again: still ringing */
+	msgv.push_back(make_msg(setup, TIME_NOW - 9, "conv_c", "user_c"));
+	msgv.push_back(make_msg(cancel, TIME_NOW - 8, "conv_c", "user_c"));
+	msgv.push_back(make_msg(setup, TIME_NOW - 1, "conv_c", "user_c"));
+
+	/* too old to ring */
+	msgv.push_back(make_msg(setup, TIME_NOW - 600, "conv_d", "user_d"));
+
+	wcall_event_start(wuser);
+	ASSERT_EQ(0, wcall_event_process_batch(wuser, &msgv[0], msgv.size()));
+	wcall_event_end(wuser);
+
+	ASSERT_EQ(2, ec.incoming);
+	ASSERT_EQ(1, ec.missed);
+	ASSERT_EQ(0, ec.closed);
+}
+
+
+TEST(wcall_event, single_keeps_every_event)
+{
+	std::string setup = encode_message(ECONN_SETUP, false);
+	std::string cancel = encode_message(ECONN_CANCEL, false);
+	struct wcall_event_msg em[3];
+	struct event_counts ec;
+	WUSER_HANDLE wuser;
+
+	wuser = event_user("single_self", &ec);
+	ASSERT_NE(WUSER_INVALID_HANDLE, wuser);
+
+	em[0] = make_msg(setup, TIME_NOW - 5, "conv_a", "user_a");
+	em[1] = make_msg(setup, TIME_NOW - 3, "conv_a", "user_a");
+	em[2] = make_msg(cancel, TIME_NOW - 2, "conv_a", "user_a");
+
+	ASSERT_EQ(EAGAIN, wcall_event_process_batch(wuser, em, 3));
+
+	wcall_event_start(wuser);
+	for (int i = 0; i < 3; ++i) {
+		ASSERT_EQ(0, wcall_event_process(wuser, em[i].buf, em[i].len,
+						 em[i].curr_time,
+						 em[i].msg_time,
+						 em[i].convid,
+						 em[i].userid,
+						 em[i].clientid,
+						 em[i].conv_type));
+	}
+	wcall_event_end(wuser);
+
+	/* the cancel only ends the first pending ring */
+	ASSERT_EQ(1, ec.incoming);
+	ASSERT_EQ(1, ec.missed);
+}
+
+
+TEST(wcall_event, batch_reports_malformed_message)
+{
+	std::string setup = encode_message(ECONN_SETUP, false);
+	std::string garbage = "{\"version\":";
+	std::vector<struct wcall_event_msg> msgv;
+	struct event_counts ec;
+	WUSER_HANDLE wuser;
+
+	wuser = event_user("malformed_self", &ec);
+	ASSERT_NE(WUSER_INVALID_HANDLE, wuser);
+
+	msgv.push_back(make_msg(setup, TIME_NOW - 5, "conv_a", "user_a"));
+	msgv.push_back(make_msg(garbage, TIME_NOW - 4, "conv_b", "user_b"));
+	msgv.push_back(make_msg(setup, TIME_NOW - 3, "conv_c", "user_c"));
+
+	wcall_event_start(wuser);
+	ASSERT_NE(0, wcall_event_process_batch(wuser, &msgv[0], msgv.size()));
+	wcall_event_end(wuser);
+
+	/* the rest of the batch is still processed */
+	ASSERT_EQ(2, ec.incoming);
+
+	/* a batch where nothing can be decoded fails as well */
+	msgv.clear();
+	msgv.push_back(make_msg(garbage, TIME_NOW - 2, "conv_d", "user_d"));
+	msgv.push_back(make_msg(garbage, TIME_NOW - 1, "conv_e", "user_e"));
+
+	wcall_event_start(wuser);
+	ASSERT_NE(0, wcall_event_process_batch(wuser, &msgv[0], msgv.size()));
+	wcall_event_end(wuser);
+
+	ASSERT_EQ(2, ec.incoming);
+}
+
+
+TEST(wcall_event, replay_10k_backlog)
+{
+	const int nconvs = 1000;
+	const int nmsgs = 10000;
+	std::string setup = encode_message(ECONN_SETUP, false);
+	std::string cancel = encode_message(ECONN_CANCEL, false);
+	std::vector<std::string> convv;
+	std::vector<struct wcall_event_msg> msgv;
+	struct event_counts ec_single, ec_batch;
+	WUSER_HANDLE wu_single, wu_batch;
+	int log_level = log_get_min_level();
+
+	for (int c = 0; c < nconvs; ++c)
+		convv.push_back("conv_" + std::to_string(c));
+
+	/* Each conversation rings and is cancelled a few times; every
+	 * tenth one is left ringing.
+	 */
+	for (int i = 0; i < nmsgs; ++i) {
+		int c = i % nconvs;
+		int round = i / nconvs;
+		bool last = round == nmsgs / nconvs - 1;
+		const std::string &payload =
+			(round % 2 == 0 || (last && c % 10 == 0))
+			? setup : cancel;
+
+		msgv.push_back(make_msg(payload, TIME_NOW - 30 + round,
+					convv[c].c_str(), "caller"));
+	}
+
+	wu_single = event_user("replay_single", &ec_single);
+	wu_batch = event_user("replay_batch", &ec_batch);
+
+	log_set_min_level(LOG_LEVEL_WARN);
+
+	wcall_event_start(wu_single);
+	for (size_t i = 0; i < msgv.size(); ++i) {
+		const struct wcall_event_msg *em = &msgv[i];
+
+		wcall_event_process(wu_single, em->buf, em->len,
+				    em->curr_time, em->msg_time,
+				    em->convid, em->userid, em->clientid,
+				    em->conv_type);
+	}
+	wcall_event_end(wu_single);
+
+	wcall_event_start(wu_batch);
+	ASSERT_EQ(0, wcall_event_process_batch(wu_batch,
+					       &msgv[0], msgv.size()));
+	wcall_event_end(wu_batch);
+
+	log_set_min_level((enum log_level)log_level);
+
+	ASSERT_EQ(nconvs / 10, ec_batch.incoming);
+	ASSERT_EQ(nconvs - nconvs / 10, ec_batch.missed);
+	ASSERT_GT(ec_single.incoming + ec_single.missed,
+		  ec_batch.incoming + ec_batch.missed);
+
+}
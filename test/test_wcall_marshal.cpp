@@ -0,0 +1,307 @@
+/*
+ * Wire
+ * Copyright (C) 2026 Wire Swiss GmbH
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <sys/time.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <re.h>
+#include <avs.h>
+#include <avs_wcall.h>
+#include <gtest/gtest.h>
+#include "ztest.h"
+
+
+#define HAMMER_THREADS 4
+#define HAMMER_CALLS   50000
+#define HAMMER_CONVS   8
+
+static const char *convv[HAMMER_CONVS] = {
+	"conv-0", "conv-1", "conv-2", "conv-3",
+	"conv-4", "conv-5", "conv-6", "conv-7",
+};
+
+struct hammer {
+	pthread_t tid;
+	WUSER_HANDLE wuser;
+	int calls;
+};
+
+static std::atomic<int> hammer_handled;
+
+/* Without a call, each handled event logs an ENOENT warning naming it */
+static void hammer_log_handler(uint32_t level, const char *msg, void *arg)
+{
+	(void)level;
+	(void)arg;
+
+	if (strstr(msg, "VIDEO_SET_STATE"))
+		++hammer_handled;
+}
+
+static void *hammer_thread(void *arg)
+{
+	struct hammer *h = (struct hammer *)arg;
+
+	for (int i = 0; i < h->calls; ++i) {
+		wcall_set_video_send_state(h->wuser,
+					   convv[i % HAMMER_CONVS],
+					   WCALL_VIDEO_STATE_STOPPED);
+	}
+
+	return NULL;
+}
+
+static void hammer_tmr_handler(void *arg)
+{
+	struct tmr *tmr = (struct tmr *)arg;
+
+	if (hammer_handled >= HAMMER_THREADS * HAMMER_CALLS)
+		re_cancel();
+	else
+		tmr_start(tmr, 1, hammer_tmr_handler, tmr);
+}
+
+struct wait_handled {
+	struct tmr tmr;
+	int target;
+};
+
+static void wait_tmr_handler(void *arg)
+{
+	struct wait_handled *wh = (struct wait_handled *)arg;
+
+	if (hammer_handled >= wh->target)
+		re_cancel();
+	else
+		tmr_start(&wh->tmr, 1, wait_tmr_handler, wh);
+}
+
+static float elapsed_us(const struct timeval *start)
+{
+	struct timeval now, res;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, start, &res);
+
+	return (float)res.tv_sec * 1000000.0f + res.tv_usec;
+}
+
+
+class WcallMarshal : public ::testing::Test {
+
+public:
+	virtual void SetUp() override
+	{
+		ASSERT_EQ(0, wcall_init(0));
+
+		wuser = wcall_create("abc", "123", NULL, NULL, NULL,
+				     NULL, NULL, NULL, NULL, NULL,
+				     NULL, NULL, NULL, NULL, NULL);
+		ASSERT_NE(WUSER_INVALID_HANDLE, wuser);
+
+		hammer_handled = 0;
+		memset(&lg, 0, sizeof(lg));
+		lg.h = hammer_log_handler;
+		log_register_handler(&lg);
+	}
+
+	virtual void TearDown() override
+	{
+		log_unregister_handler(&lg);
+		wcall_set_mode(WCALL_MODE_MARSHAL);
+
+		if (wuser != WUSER_INVALID_HANDLE)
+			wcall_destroy(wuser);
+		wcall_close();
+	}
+
+protected:
+	WUSER_HANDLE wuser = WUSER_INVALID_HANDLE;
+	struct log lg;
+};
+
+
+/* Benchmark, run with --gtest_also_run_disabled_tests */
+TEST_F(WcallMarshal, DISABLED_throughput)
+{
+	struct hammer hv[HAMMER_THREADS];
+	struct tmr tmr;
+	struct timeval start;
+	float t_total;
+	int total = HAMMER_THREADS * HAMMER_CALLS;
+	int err;
+
+	tmr_init(&tmr);
+	tmr_start(&tmr, 1, hammer_tmr_handler, &tmr);
+
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < HAMMER_THREADS; ++i) {
+		hv[i].wuser = wuser;
+		hv[i].calls = HAMMER_CALLS;
+		pthread_create(&hv[i].tid, NULL, hammer_thread, &hv[i]);
+	}
+
+	/* The app threads run while this thread drains */
+	err = re_main(NULL);
+	ASSERT_EQ(0, err);
+	t_total = elapsed_us(&start);
+
+	for (int i = 0; i < HAMMER_THREADS; ++i)
+		pthread_join(hv[i].tid, NULL);
+
+	tmr_cancel(&tmr);
+
+	ASSERT_EQ(total, (int)hammer_handled);
+
+	printf("marshal: %d threads x %d calls: %.1fms, %.0f calls/s\n",
+	       HAMMER_THREADS, HAMMER_CALLS, t_total / 1000.0,
+	       total / (t_total / 1000000.0));
+}
+
+
+static void shutdown_handler(WUSER_HANDLE wuser, void *arg)
+{
+	int *shutdowns = (int *)arg;
+
+	(void)wuser;
+
+	++*shutdowns;
+	re_cancel();
+}
+
+
+/* Events queued behind a destroy refer to the freed instance, they
+ * are dropped and released with the marshal.
+ */
+TEST_F(WcallMarshal, destroy_with_backlog)
+{
+	const int before = 100;
+	const int after = 100;
+	int shutdowns = 0;
+
+	wcall_set_shutdown_handler(wuser, shutdown_handler, &shutdowns);
+
+	for (int i = 0; i < before; ++i) {
+		wcall_set_video_send_state(wuser, convv[i % HAMMER_CONVS],
+					   WCALL_VIDEO_STATE_STOPPED);
+	}
+
+	/* With a shutdown handler the destroy goes through the queue */
+	wcall_destroy(wuser);
+
+	for (int i = 0; i < after; ++i) {
+		wcall_set_video_send_state(wuser, convv[i % HAMMER_CONVS],
+					   WCALL_VIDEO_STATE_STOPPED);
+	}
+	wuser = WUSER_INVALID_HANDLE;
+
+	ASSERT_EQ(0, re_main_wait(5000));
+	ASSERT_EQ(1, shutdowns);
+	ASSERT_EQ(before, (int)hammer_handled);
+}
+
+
+/* Events of a conversation share its interned id and cached call
+ * lookup, also when the queue drains in between.
+ */
+TEST_F(WcallMarshal, conversation_cached_between_events)
+{
+	const int events = 10;
+	struct wait_handled wh;
+	uint64_t lookups0, cached0, lookups, cached;
+	int err = 0;
+
+	/* Adding a call moves the lookup generation on from its
+	 * initial value, so a fresh entry cannot be a hit.
+	 */
+	wcall_set_mode(WCALL_MODE_DIRECT);
+	ASSERT_EQ(0, wcall_start(wuser, "conv-call",
+				 WCALL_CALL_TYPE_NORMAL,
+				 WCALL_CONV_TYPE_GROUP, 0, 0));
+	wcall_set_mode(WCALL_MODE_MARSHAL);
+
+	wcall_marshal_lookup_stats(wuser, &lookups0, &cached0);
+
+	tmr_init(&wh.tmr);
+	for (int i = 0; i < events && !err; ++i) {
+		wcall_set_video_send_state(wuser, convv[0],
+					   WCALL_VIDEO_STATE_STOPPED);
+
+		wh.target = i + 1;
+		tmr_start(&wh.tmr, 1, wait_tmr_handler, &wh);
+		err = re_main_wait(5000);
+	}
+	tmr_cancel(&wh.tmr);
+	ASSERT_EQ(0, err);
+
+	wcall_marshal_lookup_stats(wuser, &lookups, &cached);
+	ASSERT_EQ((uint64_t)events, lookups - lookups0);
+	ASSERT_EQ((uint64_t)events - 1, cached - cached0);
+
+	wcall_set_mode(WCALL_MODE_DIRECT);
+	wcall_end(wuser, "conv-call");
+}
+
+
+/* Lookups by convid with many calls, as done for every incoming
+ * message and most API calls.
+ */
+TEST_F(WcallMarshal, lookup_many_conversations)
+{
+	const int nconvs = 2000;
+	const int rounds = 20;
+	std::vector<std::string> convs, misses;
+	int active = 0;
+	int err;
+
+	/* Run the API calls inline, so the calls exist when we look */
+	wcall_set_mode(WCALL_MODE_DIRECT);
+
+	for (int c = 0; c < nconvs; ++c) {
+		convs.push_back("conv-" + std::to_string(c));
+		misses.push_back("none-" + std::to_string(c));
+
+		err = wcall_start(wuser, convs[c].c_str(),
+				  WCALL_CALL_TYPE_NORMAL,
+				  WCALL_CONV_TYPE_GROUP, 0, 0);
+		ASSERT_EQ(0, err);
+	}
+
+	for (int r = 0; r < rounds; ++r) {
+		for (int c = 0; c < nconvs; ++c) {
+			int state = wcall_get_state(wuser, convs[c].c_str());
+
+			active += state != WCALL_STATE_UNKNOWN;
+		}
+	}
+
+	for (int r = 0; r < rounds; ++r) {
+		for (int c = 0; c < nconvs; ++c) {
+			int state = wcall_get_state(wuser, misses[c].c_str());
+
+			ASSERT_EQ(WCALL_STATE_UNKNOWN, state);
+		}
+	}
+
+	ASSERT_EQ(rounds * nconvs, active);
+
+	for (int c = 0; c < nconvs; ++c)
+		wcall_end(wuser, convs[c].c_str());
+}
@@ -22,3 +22,19 @@ int re_main_wait(uint32_t timeout_ms);
 int dns_init(struct dnsc **dnscp);
 int create_dtls_srtp_context(struct tls **dtlsp, enum tls_keytype cert_type);
 int ztest_set_ulimit(unsigned num);
+
+
+/* Test hooks in the library, kept out of the public headers */
+extern "C" {
+
+int peerflow_inject_dce_data(struct iflow *iflow,
+			     const uint8_t *data, size_t len);
+int peerflow_inject_close(struct iflow *iflow, int err);
+void peerflow_mq_stats(uint64_t *pushed, uint64_t *dropped,
+		       uint64_t *overflowed);
+void wcall_marshal_lookup_stats(uint32_t wuser,
+				uint64_t *lookups, uint64_t *lookups_cached);
+typedef int (dns_platform_stub_h)(const char *host, struct sa *srv);
+void dns_platform_set_stub(dns_platform_stub_h *stubh);
+
+}
@@ -2,12 +2,17 @@
 #include <getopt.h>
 #include <stdlib.h>
 #include <time.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <re.h>
 #include <avs.h>
 
+static bool quiet = false;
+
 static void progress_handler(int progress, void *arg)
 {
-	printf("Progress=%d\n", progress);
+	if (!quiet)
+		printf("Progress=%d\n", progress);
 }
 
 
@@ -19,28 +24,154 @@ static void log_handler(uint32_t level, const char *msg, void *arg)
 
 struct log log_def = {
 	.h = log_handler
-}; 
+};
+
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options] in out\n"
+		"options:\n"
+		"\t-e <effect>   audio effect number (default none)\n"
+		"\t-n            reduce noise\n"
+		"\t-p <rate>     input is raw PCM at this sample rate\n"
+		"\t-t <threads>  max threads, 0 for one per CPU\n"
+		"\t-b <runs>     benchmark serial against parallel\n",
+		name);
+}
+
+
+static double elapsed_ms(const struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	return (now.tv_sec - start->tv_sec) * 1000.0
+		+ (now.tv_usec - start->tv_usec) / 1000.0;
+}
+
+
+static int run(const char *in, const char *out, enum audio_effect effect,
+	       bool reduce_noise, int rate)
+{
+	if (rate)
+		return apply_effect_to_pcm(in, out, rate, effect,
+					   reduce_noise,
+					   progress_handler, NULL);
+	else
+		return apply_effect_to_wav(in, out, effect, reduce_noise,
+					   progress_handler, NULL);
+}
+
+
+/* Time a number of runs with the given thread limit, and print the
+ * throughput in input samples per second.
+ */
+static int bench(const char *in, const char *out, enum audio_effect effect,
+		 bool reduce_noise, int rate, int threads, int runs)
+{
+	struct timeval start;
+	struct stat st;
+	double ms;
+	double nsamps;
+	int err = 0;
+
+	if (stat(in, &st) != 0)
+		return errno;
+
+	nsamps = st.st_size / 2.0;
+
+	apply_effect_set_max_threads(threads);
+
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < runs && !err; ++i)
+		err = run(in, out, effect, reduce_noise, rate);
+	ms = elapsed_ms(&start) / runs;
+
+	printf("threads=%d: %.1f ms/run %.2f Msamples/s", threads, ms,
+	       nsamps / ms / 1000.0);
+	if (rate)
+		printf(" %.1fx realtime", nsamps / rate * 1000.0 / ms);
+	printf("\n");
+
+	return err;
+}
+
 
 int main(int argc, char *argv[])
 {
+	enum audio_effect effect = AUDIO_EFFECT_NONE;
+	bool reduce_noise = false;
+	int rate = 0;
+	int threads = 0;
+	int runs = 0;
 	char *wavin;
 	char *wavout;
 	int err;
 
 	log_set_min_level(LOG_LEVEL_DEBUG);
 	//log_register_handler(&log_def);
-	
-	if (argc != 3) {
-		fprintf(stderr, "Usage: %s wavin wavout\n", argv[0]);
+
+	for (;;) {
+		const int c = getopt(argc, argv, "b:e:np:t:");
+		if (c < 0)
+			break;
+
+		switch (c) {
+
+		case 'b':
+			runs = atoi(optarg);
+			break;
+
+		case 'e':
+			effect = (enum audio_effect)atoi(optarg);
+			break;
+
+		case 'n':
+			reduce_noise = true;
+			break;
+
+		case 'p':
+			rate = atoi(optarg);
+			break;
+
+		case 't':
+			threads = atoi(optarg);
+			break;
+
+		default:
+			usage(argv[0]);
+			return 22;
+		}
+	}
+
+	if (argc - optind != 2) {
+		usage(argv[0]);
 		return 22;
 	}
 
-	wavin = argv[1];
-	wavout = argv[2];
+	wavin = argv[optind];
+	wavout = argv[optind + 1];
+
+	if (runs > 0) {
+		quiet = true;
+		log_set_min_level(LOG_LEVEL_WARN);
+
+		err = bench(wavin, wavout, effect, reduce_noise, rate,
+			    1, runs);
+		if (!err)
+			err = bench(wavin, wavout, effect, reduce_noise, rate,
+				    threads, runs);
+		printf("Benchmark completed with err=%d\n", err);
+
+		return 0;
+	}
+
+	apply_effect_set_max_threads(threads);
 
-	err = apply_effect_to_wav(wavin, wavout, AUDIO_EFFECT_NONE, false,
-				  progress_handler, NULL);
-	printf("WAV completed with err=%d\n", err);
+	err = run(wavin, wavout, effect, reduce_noise, rate);
+	printf("%s completed with err=%d\n", rate ? "PCM" : "WAV", err);
 
 	return 0;
 }